@@ -0,0 +1,214 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+
+/**
+ * Measures the latency of fetching a URL, first with a new curl handle
+ * per request as zxdbfs used to, then through getURLViacURL(), which
+ * keeps each thread's connections open and shares DNS and TLS sessions.
+ * Finally all the requests are submitted to a fetcher at once, as a burst
+ * of lookups would be, and the time for the lot is reported. That is done
+ * with one request per connection and again multiplexed over HTTP/2,
+ * which needs the server to speak HTTP/2 to make a difference.
+ * Point it at a local HTTPS stand-in server to leave network jitter out.
+ *
+ * Usage: zxdbfs_fetch_bench <host> <path> [requests]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <curl/curl.h>
+
+#include "zxdbfs_fetcher.h"
+#include "zxdbfs_http.h"
+
+#define DEFAULT_REQUESTS 100
+
+static double _now() {
+
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t _discard( void *contents, size_t size, size_t nmemb, void *userp ) {
+
+    (void) contents;
+    (void) userp;
+
+    return size * nmemb;
+}
+
+/**
+ * One fetch on a handle of its own, paying for DNS, TCP and TLS each time
+ */
+static int _fetchFresh( const char *url ) {
+
+    CURL *curl = curl_easy_init();
+    if ( curl == NULL ) {
+        return 1;
+    }
+
+    curl_easy_setopt( curl, CURLOPT_URL, url );
+    curl_easy_setopt( curl, CURLOPT_FOLLOWLOCATION, 1L );
+    curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, _discard );
+    curl_easy_setopt( curl, CURLOPT_NOSIGNAL, 1 );
+    curl_easy_setopt( curl, CURLOPT_TIMEOUT, 30L );
+    curl_easy_setopt( curl, CURLOPT_SSL_VERIFYPEER, 1L );
+    curl_easy_setopt( curl, CURLOPT_SSL_VERIFYHOST, 2L );
+
+    CURLcode res = curl_easy_perform( curl );
+    curl_easy_cleanup( curl );
+
+    return res == CURLE_OK ? 0 : 1;
+}
+
+static int _fetchPooled( const char *host, const char *path ) {
+
+    struct MemoryStruct *chunk = getURLViacURL( host, path, NULL );
+    if ( chunk == NULL ) {
+        return 1;
+    }
+
+    free( chunk->memory );
+    free( chunk );
+
+    return 0;
+}
+
+/**
+ * Every request in flight on the fetcher's event loop at once
+ */
+static int _fetchBurst( const char *url, int requests, long maxstreams,
+                        unsigned long *nconnects ) {
+
+    Fetcher_t *fetcher = Fetcher_create( 0, maxstreams );
+    Fetch_t **fetches = (Fetch_t **)calloc( requests, sizeof( Fetch_t * ) );
+    if ( fetcher == NULL || fetches == NULL ) {
+        return 1;
+    }
+
+    int rv = 0;
+    for ( int i = 0 ; i < requests ; i++ ) {
+        fetches[i] = Fetcher_submit( fetcher, url, NULL, NULL, 0 );
+    }
+    for ( int i = 0 ; i < requests ; i++ ) {
+        struct MemoryStruct *chunk = Fetch_wait( fetches[i], NULL, NULL );
+        if ( chunk == NULL ) {
+            rv = 1;
+            continue;
+        }
+        free( chunk->memory );
+        free( chunk );
+    }
+
+    free( fetches );
+    *nconnects = fetcher->nconnects;
+    Fetcher_free( fetcher );
+
+    return rv;
+}
+
+static int _compare( const void *a, const void *b ) {
+
+    double da = *(const double *)a;
+    double db = *(const double *)b;
+
+    return da < db ? -1 : da > db;
+}
+
+static void _report( const char *name, double *latencies, int n ) {
+
+    qsort( latencies, n, sizeof( double ), _compare );
+    printf( "%-10s p50 %9.3f ms   p99 %9.3f ms   max %9.3f ms\n", name,
+            latencies[n / 2] * 1e3, latencies[( n * 99 ) / 100] * 1e3,
+            latencies[n - 1] * 1e3 );
+}
+
+int main( int argc, char *argv[] ) {
+
+    if ( argc < 3 ) {
+        printf( "usage: %s <host> <path> [requests]\n", argv[0] );
+        return 1;
+    }
+
+    int requests = DEFAULT_REQUESTS;
+    if ( argc > 3 ) {
+        requests = atoi( argv[3] );
+    }
+    if ( requests <= 0 ) {
+        printf( "bad number of requests\n" );
+        return 1;
+    }
+
+    double *fresh = (double *)malloc( requests * sizeof( double ) );
+    double *pooled = (double *)malloc( requests * sizeof( double ) );
+    if ( fresh == NULL || pooled == NULL ) {
+        return 1;
+    }
+
+    curl_global_init( CURL_GLOBAL_DEFAULT );
+
+    const char *host = argv[1];
+    const char *path = argv[2];
+    char url[1024];
+    snprintf( url, sizeof( url ), "%s%s", host, path );
+
+    for ( int i = 0 ; i < requests ; i++ ) {
+        double t0 = _now();
+        if ( _fetchFresh( url ) != 0 ) {
+            printf( "failed to fetch: %s\n", url );
+            return 1;
+        }
+        fresh[i] = _now() - t0;
+    }
+
+    for ( int i = 0 ; i < requests ; i++ ) {
+        double t0 = _now();
+        if ( _fetchPooled( host, path ) != 0 ) {
+            printf( "failed to fetch: %s\n", url );
+            return 1;
+        }
+        pooled[i] = _now() - t0;
+    }
+
+    double burst[2];
+    unsigned long nconnects[2];
+    for ( int i = 0 ; i < 2 ; i++ ) {
+        double t0 = _now();
+        if ( _fetchBurst( url, requests, i == 0 ? 1 : 0, &nconnects[i] ) != 0 ) {
+            printf( "failed to fetch: %s\n", url );
+            return 1;
+        }
+        burst[i] = _now() - t0;
+    }
+
+    printf( "%s: %d requests\n", url, requests );
+    _report( "fresh", fresh, requests );
+    _report( "pooled", pooled, requests );
+    printf( "%-10s all %9.3f ms   %lu connections\n", "burst", burst[0] * 1e3, nconnects[0] );
+    printf( "%-10s all %9.3f ms   %lu connections\n", "burst mux", burst[1] * 1e3, nconnects[1] );
+
+    free( fresh );
+    free( pooled );
+
+    return 0;
+}
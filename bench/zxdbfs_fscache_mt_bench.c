@@ -0,0 +1,181 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+/**
+ * Measures FSCache getattr throughput as reader threads are added, using
+ * testdata/by-letter-X.json. Compares the lock-free epoch lookup that
+ * zxdbfsd uses against referenced gets and readers serialised by a
+ * reader/writer lock.
+ *
+ * Usage: zxdbfs_fscache_mt_bench [iterations]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <json-c/json.h>
+
+#include "zxdbfs_byletter.h"
+#include "zxdbfs_epoch.h"
+#include "zxdbfs_fscache.h"
+#include "zxdbfs_fscacheentry.h"
+
+#include <testdata/by-letter-X.h>
+
+#define DEFAULT_ITERATIONS 200
+#define MAX_THREADS 8
+
+typedef enum {
+    BENCH_LOOKUP,
+    BENCH_GET,
+    BENCH_RWLOCK,
+    BENCH_MAX
+} BenchMode;
+
+static const char *modeNames[BENCH_MAX] = { "lookup", "get", "rwlock" };
+
+static FSCache_t *cache;
+static const char **paths;
+static int npaths;
+static int iterations;
+static BenchMode mode;
+static pthread_rwlock_t rwlock = PTHREAD_RWLOCK_INITIALIZER;
+
+static double _now() {
+
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *_getattrThread( void *arg ) {
+
+    long sink = 0;
+    int offset = (int)(long)arg;
+
+    for ( int i = 0 ; i < iterations ; i++ ) {
+        for ( int j = 0 ; j < npaths ; j++ ) {
+            const char *path = paths[(j + offset) % npaths];
+            switch ( mode ) {
+                case BENCH_LOOKUP: {
+                    Epoch_enter();
+                    FSCacheEntry_t *file = FSCache_lookup( cache, path );
+                    sink += FSCacheEntry_gettype( file );
+                    sink += FSCacheEntry_getsize( file );
+                    Epoch_exit();
+                    break;
+                }
+                case BENCH_GET: {
+                    FSCacheEntry_t *file = FSCache_get( cache, path );
+                    sink += FSCacheEntry_gettype( file );
+                    sink += FSCacheEntry_getsize( file );
+                    FSCacheEntry_free( file );
+                    break;
+                }
+                default: {
+                    pthread_rwlock_rdlock( &rwlock );
+                    Epoch_enter();
+                    FSCacheEntry_t *file = FSCache_lookup( cache, path );
+                    sink += FSCacheEntry_gettype( file );
+                    sink += FSCacheEntry_getsize( file );
+                    Epoch_exit();
+                    pthread_rwlock_unlock( &rwlock );
+                    break;
+                }
+            }
+        }
+    }
+
+    return (void *)sink;
+}
+
+/**
+ * Returns the throughput in millions of getattrs per second
+ */
+static double _run( BenchMode pmode, int nthreads ) {
+
+    pthread_t threads[MAX_THREADS];
+
+    mode = pmode;
+    double t0 = _now();
+    for ( int i = 0 ; i < nthreads ; i++ ) {
+        pthread_create( &threads[i], NULL, _getattrThread, (void *)(long)(i * npaths / nthreads) );
+    }
+    for ( int i = 0 ; i < nthreads ; i++ ) {
+        pthread_join( threads[i], NULL );
+    }
+    double elapsed = _now() - t0;
+
+    return (double)nthreads * iterations * npaths / elapsed / 1e6;
+}
+
+int main( int argc, char *argv[] ) {
+
+    iterations = DEFAULT_ITERATIONS;
+    if ( argc > 1 ) {
+        iterations = atoi( argv[1] );
+    }
+
+    json_object *root = json_tokener_parse( jsonData );
+    if ( root == NULL ) {
+        printf( "failed to parse by-letter-X test data\n" );
+        return 1;
+    }
+
+    cache = FSCache_create();
+    FSCache_addAll( cache, "/by-letter/X", FSCacheEntry_createFromByLetter( "/by-letter/X", root ) );
+
+    FSCacheEntry_t *dir = FSCache_get( cache, "/by-letter/X" );
+    npaths = FSCacheEntry_getnfiles( dir );
+    paths = (const char **)malloc( npaths * sizeof( const char * ) );
+    for ( int i = 0 ; i < npaths ; i++ ) {
+        paths[i] = FSCacheEntry_getfname( FSCacheEntry_getfile( dir, i ) );
+    }
+
+    printf( "by-letter-X: %d entries, %d iterations per thread\n", npaths, iterations );
+    printf( "%-8s", "threads" );
+    for ( int m = 0 ; m < BENCH_MAX ; m++ ) {
+        printf( " %12s", modeNames[m] );
+    }
+    printf( "\n" );
+
+    double base[BENCH_MAX];
+    for ( int nthreads = 1 ; nthreads <= MAX_THREADS ; nthreads *= 2 ) {
+        printf( "%-8d", nthreads );
+        for ( int m = 0 ; m < BENCH_MAX ; m++ ) {
+            double mops = _run( (BenchMode)m, nthreads );
+            if ( nthreads == 1 ) {
+                base[m] = mops;
+            }
+            printf( " %6.2f (%3.1fx)", mops, mops / base[m] );
+        }
+        printf( " Mops/s\n" );
+    }
+
+    free( paths );
+    FSCacheEntry_free( dir );
+    FSCache_free( cache );
+    json_object_put( root );
+
+    return 0;
+}
@@ -0,0 +1,229 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+/**
+ * Compares the native FSCacheEntry node store against the original
+ * json_object-backed representation using testdata/by-letter-X.json.
+ *
+ * Usage: zxdbfs_fscacheentry_bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <json-c/json.h>
+
+#include "zxdbfs_byletter.h"
+#include "zxdbfs_fscache.h"
+#include "zxdbfs_fscacheentry.h"
+
+#include <testdata/by-letter-X.h>
+
+#define DEFAULT_ITERATIONS 2000
+
+static double _now() {
+
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * The json-c representation that FSCacheEntry used to be built on
+ */
+static json_object *_json_create( const char *fname, const char *type,
+                                  const char *url, int size ) {
+
+    json_object *obj = json_object_new_object();
+    json_object_object_add( obj, "type", json_object_new_string( type ) );
+    json_object_object_add( obj, "fname", json_object_new_string( fname ) );
+    if ( url != NULL ) {
+        json_object_object_add( obj, "url", json_object_new_string( url ) );
+    }
+    json_object_object_add( obj, "size", json_object_new_int( size ) );
+    if ( strcmp( type, "dir" ) == 0 ) {
+        json_object_object_add( obj, "files", json_object_new_array() );
+    }
+
+    return obj;
+}
+
+static FSCacheEntryType _json_gettype( json_object *obj ) {
+
+    const char *stype = json_object_get_string( json_object_object_get( obj, "type" ) );
+    if ( stype == NULL ) {
+        return FSCACHEENTRY_UNKNOWN;
+    }
+    if ( strcmp( stype, "dir" ) == 0 ) {
+        return FSCACHEENTRY_DIR;
+    }
+    if ( strcmp( stype, "dirstub" ) == 0 ) {
+        return FSCACHEENTRY_DIR_STUB;
+    }
+    if ( strcmp( stype, "file" ) == 0 ) {
+        return FSCACHEENTRY_FILE;
+    }
+
+    return FSCACHEENTRY_UNKNOWN;
+}
+
+static json_object *_json_createFromByLetter( const char *path, json_object *root ) {
+
+    json_object *dirEntry = _json_create( path, "dir", NULL, 0 );
+    json_object *files = json_object_object_get( dirEntry, "files" );
+    json_object *hhits = json_object_object_get( json_object_object_get( root, "hits" ), "hits" );
+
+    for ( int i = 0 ; i < json_object_array_length( hhits ) ; i++ ) {
+        json_object *temp = json_object_array_get_idx( hhits, i );
+        json_object *title = json_object_object_get( json_object_object_get( temp, "_source" ), "title" );
+        json_object *lid = json_object_object_get( temp, "_id" );
+
+        char fullpath[512];
+        sprintf( fullpath, "%s/%s_%s", path, json_object_get_string( title ), json_object_get_string( lid ) );
+        json_object_array_add( files, _json_create( fullpath, "dirstub", NULL, 0 ) );
+    }
+
+    return dirEntry;
+}
+
+static void _json_addAll( json_object *cache, const char *key, json_object *obj ) {
+
+    json_object_object_add( cache, key, obj );
+
+    json_object *files = json_object_object_get( obj, "files" );
+    for ( int i = 0 ; files != NULL && i < json_object_array_length( files ) ; i++ ) {
+        json_object *file = json_object_array_get_idx( files, i );
+        json_object *subclone = NULL;
+        json_object_deep_copy( file, &subclone, NULL );
+        _json_addAll( cache, json_object_get_string( json_object_object_get( file, "fname" ) ), subclone );
+    }
+}
+
+int main( int argc, char *argv[] ) {
+
+    int iterations = DEFAULT_ITERATIONS;
+    if ( argc > 1 ) {
+        iterations = atoi( argv[1] );
+    }
+
+    json_object *root = json_tokener_parse( jsonData );
+    if ( root == NULL ) {
+        printf( "failed to parse by-letter-X test data\n" );
+        return 1;
+    }
+
+    volatile long sink = 0;
+    double t0, jsonBuild, nativeBuild, jsonReaddir, nativeReaddir, jsonGetattr, nativeGetattr;
+
+    /** Build the directory and populate the path index */
+    t0 = _now();
+    for ( int i = 0 ; i < iterations / 10 + 1 ; i++ ) {
+        json_object *cache = json_object_new_object();
+        _json_addAll( cache, "/by-letter/X", _json_createFromByLetter( "/by-letter/X", root ) );
+        json_object_put( cache );
+    }
+    jsonBuild = _now() - t0;
+
+    t0 = _now();
+    for ( int i = 0 ; i < iterations / 10 + 1 ; i++ ) {
+        FSCache_t *cache = FSCache_create();
+        FSCache_addAll( cache, "/by-letter/X", FSCacheEntry_createFromByLetter( "/by-letter/X", root ) );
+        FSCache_free( cache );
+    }
+    nativeBuild = _now() - t0;
+
+    json_object *jsonCache = json_object_new_object();
+    _json_addAll( jsonCache, "/by-letter/X", _json_createFromByLetter( "/by-letter/X", root ) );
+    FSCache_t *cache = FSCache_create();
+    FSCache_addAll( cache, "/by-letter/X", FSCacheEntry_createFromByLetter( "/by-letter/X", root ) );
+
+    /** readdir: walk every child fetching type, name and size */
+    t0 = _now();
+    for ( int i = 0 ; i < iterations ; i++ ) {
+        json_object *dir = json_object_object_get( jsonCache, "/by-letter/X" );
+        json_object *files = json_object_object_get( dir, "files" );
+        for ( int j = 0 ; j < json_object_array_length( files ) ; j++ ) {
+            json_object *file = json_object_array_get_idx( files, j );
+            sink += _json_gettype( file );
+            sink += strlen( json_object_get_string( json_object_object_get( file, "fname" ) ) );
+            sink += json_object_get_int( json_object_object_get( file, "size" ) );
+        }
+    }
+    jsonReaddir = _now() - t0;
+
+    t0 = _now();
+    for ( int i = 0 ; i < iterations ; i++ ) {
+        FSCacheEntry_t **files = NULL;
+        int nfiles = 0;
+        FSCache_getfiles( cache, "/by-letter/X", &files, &nfiles );
+        for ( int j = 0 ; j < nfiles ; j++ ) {
+            FSCacheEntry_t *file = files[j];
+            sink += FSCacheEntry_gettype( file );
+            sink += strlen( FSCacheEntry_getfname( file ) );
+            sink += FSCacheEntry_getsize( file );
+        }
+        FSCache_releasefiles( files, nfiles );
+    }
+    nativeReaddir = _now() - t0;
+
+    /** getattr: path lookup followed by type and size */
+    FSCacheEntry_t *dir = FSCache_get( cache, "/by-letter/X" );
+    int nfiles = FSCacheEntry_getnfiles( dir );
+
+    t0 = _now();
+    for ( int i = 0 ; i < iterations ; i++ ) {
+        for ( int j = 0 ; j < nfiles ; j++ ) {
+            json_object *file = json_object_object_get( jsonCache, FSCacheEntry_getfname( FSCacheEntry_getfile( dir, j ) ) );
+            sink += _json_gettype( file );
+            sink += json_object_get_int( json_object_object_get( file, "size" ) );
+        }
+    }
+    jsonGetattr = _now() - t0;
+
+    t0 = _now();
+    for ( int i = 0 ; i < iterations ; i++ ) {
+        for ( int j = 0 ; j < nfiles ; j++ ) {
+            FSCacheEntry_t *file = FSCache_get( cache, FSCacheEntry_getfname( FSCacheEntry_getfile( dir, j ) ) );
+            sink += FSCacheEntry_gettype( file );
+            sink += FSCacheEntry_getsize( file );
+            FSCacheEntry_free( file );
+        }
+    }
+    nativeGetattr = _now() - t0;
+    FSCacheEntry_free( dir );
+
+    long nops = (long)iterations * nfiles;
+    printf( "by-letter-X: %d entries, %d iterations\n", nfiles, iterations );
+    printf( "%-10s %14s %14s %10s\n", "op", "json-c", "native", "speedup" );
+    printf( "%-10s %11.1f ms %11.1f ms %9.1fx\n", "build",
+            jsonBuild * 1e3, nativeBuild * 1e3, jsonBuild / nativeBuild );
+    printf( "%-10s %11.1f ns %11.1f ns %9.1fx\n", "readdir",
+            jsonReaddir * 1e9 / nops, nativeReaddir * 1e9 / nops, jsonReaddir / nativeReaddir );
+    printf( "%-10s %11.1f ns %11.1f ns %9.1fx\n", "getattr",
+            jsonGetattr * 1e9 / nops, nativeGetattr * 1e9 / nops, jsonGetattr / nativeGetattr );
+
+    json_object_put( jsonCache );
+    FSCache_free( cache );
+    json_object_put( root );
+
+    return sink == 0;
+}
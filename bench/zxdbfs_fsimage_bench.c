@@ -0,0 +1,113 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+/**
+ * Compares a warm start from the by-letter JSON files against one from an
+ * FSCache image, using testdata/by-letter-X.json as each of the 26 letters.
+ *
+ * Usage: zxdbfs_fsimage_bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <json-c/json.h>
+
+#include "zxdbfs_byletter.h"
+#include "zxdbfs_epoch.h"
+#include "zxdbfs_fscache.h"
+#include "zxdbfs_fsimage.h"
+
+#include <testdata/by-letter-X.h>
+
+#define DEFAULT_ITERATIONS 20
+#define IMAGE_PATH "/tmp/zxdbfs_fsimage_bench.img"
+
+static double _now() {
+
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * What the daemon does for each preloaded letter today
+ */
+static FSCache_t *_startFromJSON() {
+
+    FSCache_t *cache = FSCache_create();
+
+    for ( char letter = 'A' ; letter <= 'Z' ; letter++ ) {
+        char key[20];
+        sprintf( key, "/by-letter/%c", letter );
+        json_object *root = json_tokener_parse( jsonData );
+        FSCache_addAll( cache, key, FSCacheEntry_createFromByLetter( key, root ) );
+        json_object_put( root );
+    }
+
+    return cache;
+}
+
+int main( int argc, char *argv[] ) {
+
+    int iterations = DEFAULT_ITERATIONS;
+    if ( argc > 1 ) {
+        iterations = atoi( argv[1] );
+    }
+
+    FSCache_t *cache = _startFromJSON();
+    int nentries = FSCache_getnentries( cache );
+    if ( FSImage_save( cache, IMAGE_PATH ) != 0 ) {
+        printf( "failed to save image\n" );
+        return 1;
+    }
+    FSCache_free( cache );
+    Epoch_synchronize();
+
+    double t0, jsonStart, imageStart;
+
+    t0 = _now();
+    for ( int i = 0 ; i < iterations ; i++ ) {
+        FSCache_free( _startFromJSON() );
+    }
+    jsonStart = _now() - t0;
+
+    /** Each load keeps its mapping, as the daemon would */
+    t0 = _now();
+    for ( int i = 0 ; i < iterations ; i++ ) {
+        cache = FSCache_create();
+        FSImage_load( cache, IMAGE_PATH );
+        FSCache_free( cache );
+    }
+    imageStart = _now() - t0;
+
+    unlink( IMAGE_PATH );
+
+    printf( "26 letters: %d entries, %d iterations\n", nentries, iterations );
+    printf( "%-10s %14s %14s %10s\n", "op", "json", "image", "speedup" );
+    printf( "%-10s %11.2f ms %11.2f ms %9.1fx\n", "start",
+            jsonStart * 1e3 / iterations, imageStart * 1e3 / iterations,
+            jsonStart / imageStart );
+
+    return 0;
+}
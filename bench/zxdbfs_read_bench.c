@@ -0,0 +1,97 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+/**
+ * Measures read throughput of a file, opening it afresh each iteration
+ * so every pass goes back to the filesystem. Run it against a file on a
+ * zxdbfsd mount, once as mounted by default and once with
+ * --no-passthrough, to compare passthrough with reads served by zxdbfsd.
+ *
+ * Usage: zxdbfs_read_bench <file> [iterations] [blocksize]
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_ITERATIONS 100
+#define DEFAULT_BLOCKSIZE 4096
+
+static double _now() {
+
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main( int argc, char *argv[] ) {
+
+    if ( argc < 2 ) {
+        printf( "usage: %s <file> [iterations] [blocksize]\n", argv[0] );
+        return 1;
+    }
+
+    int iterations = DEFAULT_ITERATIONS;
+    size_t blocksize = DEFAULT_BLOCKSIZE;
+    if ( argc > 2 ) {
+        iterations = atoi( argv[2] );
+    }
+    if ( argc > 3 ) {
+        blocksize = atol( argv[3] );
+    }
+    if ( iterations <= 0 || blocksize == 0 ) {
+        printf( "bad iterations or blocksize\n" );
+        return 1;
+    }
+
+    char *buf = (char *)malloc( blocksize );
+    if ( buf == NULL ) {
+        return 1;
+    }
+
+    size_t nbytes = 0;
+    double t0 = _now();
+    for ( int i = 0 ; i < iterations ; i++ ) {
+        int fd = open( argv[1], O_RDONLY );
+        if ( fd < 0 ) {
+            printf( "failed to open: %s\n", argv[1] );
+            free( buf );
+            return 1;
+        }
+        ssize_t n;
+        while ( ( n = read( fd, buf, blocksize ) ) > 0 ) {
+            nbytes += n;
+        }
+        close( fd );
+    }
+    double elapsed = _now() - t0;
+
+    free( buf );
+
+    printf( "%s: %zu bytes in %d iterations of %zu byte reads\n",
+            argv[1], nbytes / iterations, iterations, blocksize );
+    printf( "%-10s %11.3f ms %11.1f MB/s\n", "read",
+            elapsed * 1e3 / iterations, nbytes / elapsed / 1e6 );
+
+    return 0;
+}
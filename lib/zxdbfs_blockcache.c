@@ -0,0 +1,376 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zxdbfs_blockcache.h"
+#include "zxdbfs_http.h"
+
+/**
+ * Returns the length of a block, which is short for the last one
+ */
+static size_t _blockLen( BlockCache_t *cache, size_t block ) {
+
+    size_t start = block * cache->blocksize;
+
+    return cache->size - start < cache->blocksize ? cache->size - start : cache->blocksize;
+}
+
+/**
+ * BlockCache_read() with the lock held
+ */
+static size_t _read( BlockCache_t *cache, off_t offset, size_t len, char *buf ) {
+
+    size_t ncopied = 0;
+    while ( ncopied < len ) {
+        size_t pos = offset + ncopied;
+        size_t block = pos / cache->blocksize;
+        if ( cache->blocks[block] == NULL ) {
+            break;
+        }
+        size_t within = pos - block * cache->blocksize;
+        size_t n = _blockLen( cache, block ) - within;
+        if ( n > len - ncopied ) {
+            n = len - ncopied;
+        }
+        memcpy( buf + ncopied, cache->blocks[block] + within, n );
+        ncopied += n;
+    }
+
+    return ncopied;
+}
+
+/**
+ * BlockCache_put() with the lock held
+ */
+static void _put( BlockCache_t *cache, off_t offset, const char *data, size_t len ) {
+
+    size_t block = offset / cache->blocksize;
+    size_t used = 0;
+    while ( block < cache->nblocks ) {
+        size_t blen = _blockLen( cache, block );
+        if ( len - used < blen ) {
+            break;
+        }
+        if ( cache->blocks[block] == NULL ) {
+            char *copy = (char *)malloc( blen );
+            if ( copy == NULL ) {
+                break;
+            }
+            memcpy( copy, data + used, blen );
+            cache->blocks[block] = copy;
+            cache->npresent++;
+        }
+        used += blen;
+        block++;
+    }
+}
+
+/**
+ * Cuts the file short, when it turns out to be shorter than it claimed
+ */
+static void _truncate( BlockCache_t *cache, size_t size ) {
+
+    if ( size == 0 || size >= cache->size ) {
+        return;
+    }
+
+    printf( "file shorter than claimed: %lu < %lu\n",
+            (unsigned long)size, (unsigned long)cache->size );
+
+    size_t nblocks = ( size + cache->blocksize - 1 ) / cache->blocksize;
+    for ( size_t i = nblocks ; i < cache->nblocks ; i++ ) {
+        if ( cache->blocks[i] != NULL ) {
+            free( cache->blocks[i] );
+            cache->blocks[i] = NULL;
+            cache->npresent--;
+        }
+    }
+    cache->nblocks = nblocks;
+    cache->size = size;
+}
+
+/**
+ * Creates an empty block cache for a remote file
+ * In:
+ *      host - URL host. Required
+ *      path - URL path. Required
+ *      useragent - HTTP User-Agent. May be NULL
+ *      size - size of the file. Required
+ *      blocksize - bytes per block. 0 for the default
+ * Returns:
+ *      A new block cache or NULL on failure
+ */
+BlockCache_t *BlockCache_create( const char *host, const char *path,
+                                 const char *useragent, size_t size,
+                                 size_t blocksize ) {
+
+    if ( host == NULL || path == NULL || size == 0 ) {
+        return NULL;
+    }
+
+    BlockCache_t *cache = (BlockCache_t *)calloc( 1, sizeof( BlockCache_t ) );
+    if ( cache == NULL ) {
+        return NULL;
+    }
+
+    cache->size = size;
+    cache->blocksize = blocksize > 0 ? blocksize : BLOCKCACHE_DEFAULT_BLOCK_SIZE;
+    cache->nblocks = ( size + cache->blocksize - 1 ) / cache->blocksize;
+    cache->blocks = (char **)calloc( cache->nblocks, sizeof( char * ) );
+    cache->host = strdup( host );
+    cache->path = strdup( path );
+    cache->useragent = useragent != NULL ? strdup( useragent ) : NULL;
+    pthread_mutex_init( &cache->lock, NULL );
+    if ( cache->blocks == NULL || cache->host == NULL || cache->path == NULL ) {
+        BlockCache_free( cache );
+        return NULL;
+    }
+
+    return cache;
+}
+
+/**
+ * Frees a block cache and the blocks it holds
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+int BlockCache_free( BlockCache_t *cache ) {
+
+    if ( cache == NULL ) {
+        return 1;
+    }
+
+    if ( cache->blocks != NULL ) {
+        for ( size_t i = 0 ; i < cache->nblocks ; i++ ) {
+            free( cache->blocks[i] );
+        }
+        free( cache->blocks );
+    }
+    free( cache->host );
+    free( cache->path );
+    free( cache->useragent );
+    pthread_mutex_destroy( &cache->lock );
+    free( cache );
+
+    return 0;
+}
+
+/**
+ * Stores fetched data. Only whole blocks are kept, the last block of the
+ * file being whole when it runs to the end of the file
+ * In:
+ *      offset - where the data starts in the file. Must be on a block
+ *               boundary
+ *      data - the data. Required
+ *      len - bytes of data
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+int BlockCache_put( BlockCache_t *cache, off_t offset, const char *data, size_t len ) {
+
+    if ( cache == NULL || data == NULL || offset < 0 || offset % cache->blocksize != 0 ) {
+        return 1;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+    _put( cache, offset, data, len );
+    pthread_mutex_unlock( &cache->lock );
+
+    return 0;
+}
+
+/**
+ * Copies out whatever has been fetched from the start of a range
+ * In:
+ *      offset - first byte wanted
+ *      len - bytes wanted
+ * Out:
+ *      buf - receives the data
+ * Returns:
+ *      Bytes copied, which stops short at the first block not yet
+ *      fetched or the end of the file, or -1 on failure
+ */
+ssize_t BlockCache_read( BlockCache_t *cache, off_t offset, size_t len, char *buf ) {
+
+    if ( cache == NULL || buf == NULL || offset < 0 ) {
+        return -1;
+    }
+    if ( (size_t)offset >= cache->size ) {
+        return 0;
+    }
+    if ( len > cache->size - offset ) {
+        len = cache->size - offset;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+    size_t ncopied = _read( cache, offset, len, buf );
+    pthread_mutex_unlock( &cache->lock );
+
+    return ncopied;
+}
+
+/**
+ * Reads part of the file, fetching any blocks not yet fetched. Each run of
+ * missing blocks is fetched with one Range request. While reads are
+ * sequential, that request reaches further ahead each time
+ * In:
+ *      offset - first byte wanted
+ *      len - bytes wanted
+ * Out:
+ *      buf - receives the data
+ * Returns:
+ *      Bytes read, short only at the end of the file, or -1 on failure.
+ *      A file found to be shorter than it claimed is cut short
+ */
+ssize_t BlockCache_pread( BlockCache_t *cache, off_t offset, size_t len, char *buf ) {
+
+    if ( cache == NULL || buf == NULL || offset < 0 ) {
+        return -1;
+    }
+    if ( (size_t)offset >= cache->size ) {
+        return 0;
+    }
+    if ( len > cache->size - offset ) {
+        len = cache->size - offset;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+
+    if ( offset == cache->nextoffset && offset != 0 ) {
+        cache->readahead = cache->readahead > 0 ? cache->readahead * 2 : cache->blocksize;
+        if ( cache->readahead > BLOCKCACHE_MAX_READAHEAD ) {
+            cache->readahead = BLOCKCACHE_MAX_READAHEAD;
+        }
+    } else {
+        cache->readahead = 0;
+    }
+    cache->nextoffset = offset + len;
+
+    size_t ncopied = _read( cache, offset, len, buf );
+    if ( ncopied == len ) {
+        cache->nhits++;
+    } else {
+        cache->nmisses++;
+    }
+
+    while ( ncopied < len ) {
+        /** The run of missing blocks from the first one needed */
+        size_t first = ( offset + ncopied ) / cache->blocksize;
+        size_t limit = ( offset + len - 1 + cache->readahead ) / cache->blocksize;
+        if ( limit >= cache->nblocks ) {
+            limit = cache->nblocks - 1;
+        }
+        size_t end = first;
+        while ( end + 1 <= limit && cache->blocks[end + 1] == NULL ) {
+            end++;
+        }
+        cache->nranges++;
+
+        off_t start = first * cache->blocksize;
+        size_t length = end * cache->blocksize + _blockLen( cache, end ) - start;
+
+        pthread_mutex_unlock( &cache->lock );
+        struct MemoryStruct *chunk = getURLRangeViacURL( cache->host, cache->path,
+                                                         cache->useragent, start, length );
+        pthread_mutex_lock( &cache->lock );
+
+        if ( chunk == NULL ) {
+            pthread_mutex_unlock( &cache->lock );
+            return -1;
+        }
+        if ( chunk->code == 206 || chunk->code == 0 ) {
+            if ( chunk->size < length ) {
+                _truncate( cache, start + chunk->size );
+            }
+            _put( cache, start, chunk->memory, chunk->size );
+        } else if ( chunk->code == 200 ) {
+            /** The server doesn't do ranges, so this is the whole file */
+            _truncate( cache, chunk->size );
+            _put( cache, 0, chunk->memory, chunk->size );
+        } else {
+            printf( "range request failed: %ld\n", chunk->code );
+            HTTP_freechunk( chunk );
+            pthread_mutex_unlock( &cache->lock );
+            return -1;
+        }
+        HTTP_freechunk( chunk );
+
+        if ( (size_t)offset + len > cache->size ) {
+            len = (size_t)offset < cache->size ? cache->size - offset : 0;
+        }
+        size_t n = _read( cache, offset + ncopied, len - ncopied, buf + ncopied );
+        if ( n == 0 ) {
+            break;
+        }
+        ncopied += n;
+    }
+
+    pthread_mutex_unlock( &cache->lock );
+
+    return ncopied;
+}
+
+/**
+ * Returns whether every block has been fetched
+ */
+int BlockCache_iscomplete( BlockCache_t *cache ) {
+
+    if ( cache == NULL ) {
+        return 0;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+    int complete = cache->npresent == cache->nblocks;
+    pthread_mutex_unlock( &cache->lock );
+
+    return complete;
+}
+
+/**
+ * Returns the whole file once every block has been fetched
+ * Returns:
+ *      The file's contents, which the caller frees, or NULL if any are
+ *      still to be fetched or on failure
+ */
+char *BlockCache_getdata( BlockCache_t *cache ) {
+
+    if ( cache == NULL ) {
+        return NULL;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+
+    char *data = NULL;
+    if ( cache->npresent == cache->nblocks ) {
+        data = (char *)malloc( cache->size );
+        if ( data != NULL ) {
+            _read( cache, 0, cache->size, data );
+        }
+    }
+
+    pthread_mutex_unlock( &cache->lock );
+
+    return data;
+}
@@ -0,0 +1,66 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _zxdbfs_blockcache_h
+#define _zxdbfs_blockcache_h
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define BLOCKCACHE_DEFAULT_BLOCK_SIZE   (16 * 1024)
+#define BLOCKCACHE_MAX_READAHEAD        (1024 * 1024)
+
+/**
+ * The parts of a remote file read so far, fetched a run of blocks at a
+ * time with HTTP Range requests. Blocks not yet read are NULL. A server
+ * that doesn't support ranges sends the whole file in answer to the
+ * first request, filling every block at once
+ */
+typedef struct BlockCache {
+    pthread_mutex_t lock;
+    char *host;
+    char *path;
+    char *useragent;
+    size_t size;
+    size_t blocksize;
+    size_t nblocks;
+    char **blocks;
+    size_t npresent;
+    off_t nextoffset;               /** Where a sequential read would carry on */
+    size_t readahead;               /** Grows while reads are sequential */
+    unsigned long nhits;
+    unsigned long nmisses;
+    unsigned long nranges;          /** Range requests made */
+} BlockCache_t;
+
+extern BlockCache_t *BlockCache_create( const char *host, const char *path,
+                                        const char *useragent, size_t size,
+                                        size_t blocksize );
+extern int BlockCache_free( BlockCache_t *cache );
+
+extern int BlockCache_put( BlockCache_t *cache, off_t offset, const char *data, size_t len );
+extern ssize_t BlockCache_read( BlockCache_t *cache, off_t offset, size_t len, char *buf );
+extern ssize_t BlockCache_pread( BlockCache_t *cache, off_t offset, size_t len, char *buf );
+
+extern int BlockCache_iscomplete( BlockCache_t *cache );
+extern char *BlockCache_getdata( BlockCache_t *cache );
+
+#endif /** !_zxdbfs_blockcache_h */
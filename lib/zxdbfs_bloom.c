@@ -0,0 +1,150 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zxdbfs_bloom.h"
+
+#define BLOOM_WORDBITS  (8 * sizeof( unsigned long ))
+
+/**
+ * 64-bit FNV-1a. The two halves seed the double hashing that derives
+ * each of the filter's bit positions
+ */
+static unsigned long long _hash( const char *key ) {
+
+    unsigned long long hash = 14695981039346656037ULL;
+    while ( *key != '\0' ) {
+        hash ^= (unsigned char)*key++;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/**
+ * Creates an empty Bloom filter
+ * In:
+ *   nbits: Size of the filter in bits. 0 for the default
+ *   nhashes: Bits set per key. 0 for the default
+ * Returns:
+ *   A new Bloom filter or NULL on failure
+ */
+Bloom_t *Bloom_create( unsigned long nbits, int nhashes ) {
+
+    if ( nhashes < 0 ) {
+        return NULL;
+    }
+    if ( nbits == 0 ) {
+        nbits = BLOOM_DEFAULT_NBITS;
+    }
+    if ( nhashes == 0 ) {
+        nhashes = BLOOM_DEFAULT_NHASHES;
+    }
+
+    unsigned long nwords = ( nbits + BLOOM_WORDBITS - 1 ) / BLOOM_WORDBITS;
+    Bloom_t *bloom =
+        (Bloom_t *)calloc( 1, sizeof( Bloom_t ) + nwords * sizeof( unsigned long ) );
+    if ( bloom == NULL ) {
+        return NULL;
+    }
+    bloom->nbits = nwords * BLOOM_WORDBITS;
+    bloom->nhashes = nhashes;
+
+    return bloom;
+}
+
+/**
+ * Frees a Bloom filter
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+int Bloom_free( Bloom_t *bloom ) {
+
+    if ( bloom == NULL ) {
+        return 1;
+    }
+
+    free( bloom );
+
+    return 0;
+}
+
+/**
+ * Adds a key to the filter
+ * In:
+ *   key: Key to add
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+int Bloom_add( Bloom_t *bloom, const char *key ) {
+
+    if ( bloom == NULL || key == NULL ) {
+        return 1;
+    }
+
+    unsigned long long hash = _hash( key );
+    unsigned long h1 = (unsigned long)( hash & 0xffffffff );
+    unsigned long h2 = (unsigned long)( hash >> 32 ) | 1;
+
+    for ( int i = 0 ; i < bloom->nhashes ; i++ ) {
+        unsigned long bit = ( h1 + i * h2 ) % bloom->nbits;
+        __atomic_fetch_or( &bloom->bits[bit / BLOOM_WORDBITS],
+                           1UL << ( bit % BLOOM_WORDBITS ), __ATOMIC_RELAXED );
+    }
+    __atomic_add_fetch( &bloom->nkeys, 1, __ATOMIC_RELAXED );
+
+    return 0;
+}
+
+/**
+ * Tests whether a key may have been added
+ * In:
+ *   key: Key to test
+ * Returns:
+ *   0: The key was never added
+ *   1: The key was probably added
+ *   2: Failure
+ */
+int Bloom_test( Bloom_t *bloom, const char *key ) {
+
+    if ( bloom == NULL || key == NULL ) {
+        return 2;
+    }
+
+    unsigned long long hash = _hash( key );
+    unsigned long h1 = (unsigned long)( hash & 0xffffffff );
+    unsigned long h2 = (unsigned long)( hash >> 32 ) | 1;
+
+    for ( int i = 0 ; i < bloom->nhashes ; i++ ) {
+        unsigned long bit = ( h1 + i * h2 ) % bloom->nbits;
+        unsigned long word =
+            __atomic_load_n( &bloom->bits[bit / BLOOM_WORDBITS], __ATOMIC_RELAXED );
+        if ( ( word & ( 1UL << ( bit % BLOOM_WORDBITS ) ) ) == 0 ) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
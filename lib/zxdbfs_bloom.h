@@ -0,0 +1,45 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _zxdbfs_bloom_h
+#define _zxdbfs_bloom_h
+
+/** Sized for every ZXDB game ID at well under 0.1% false positives */
+#define BLOOM_DEFAULT_NBITS     (1 << 20)
+#define BLOOM_DEFAULT_NHASHES   7
+
+/**
+ * A Bloom filter over strings. Bloom_test() never reports a key that was
+ * added as absent, so a miss proves the key was never added. Keys may be
+ * added and tested concurrently
+ */
+typedef struct Bloom {
+    unsigned long nbits;
+    int nhashes;
+    unsigned long nkeys;
+    unsigned long bits[];
+} Bloom_t;
+
+extern Bloom_t *Bloom_create( unsigned long nbits, int nhashes );
+extern int Bloom_free( Bloom_t *bloom );
+extern int Bloom_add( Bloom_t *bloom, const char *key );
+extern int Bloom_test( Bloom_t *bloom, const char *key );
+
+#endif /** !_zxdbfs_bloom_h */
@@ -18,13 +18,106 @@
 
 */
 
+#include <ctype.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 
 #include "zxdbfs_fscache.h"
 #include "zxdbfs_gameid.h"
 #include "zxdbfs_paths.h"
 
+/**
+ * Synthesizes the directory name for a game in a by-letter listing. Titles
+ * are not unique so the ID is appended
+ * In:
+ *      hit - one entry of the listing's hits.hits array
+ * Out:
+ *      fname - directory name. At least 256 bytes
+ * Returns:
+ *      0 = success
+ *      1 = failure
+ */
+int getByLetterFilename( json_object *hit, char *fname ) {
+
+    json_object *tempsource = json_object_object_get( hit, "_source" );
+    if ( tempsource == NULL ) {
+        return 1;
+    }
+    json_object *title = json_object_object_get( tempsource, "title" );
+    json_object *lid = json_object_object_get( hit, "_id" );
+
+    /** We need to synthesize a unique filename due to duplicate titles */
+    snprintf( fname, 256, "%s_%s", json_object_get_string( title ), json_object_get_string( lid )  );
+
+    /** Sanitise the filename in case there are illegal characters */
+    for ( int j = 0 ; j < strlen( fname ) ; j++ ) {
+        if ( fname[j] == '/' || fname[j] == ':' ) {
+            fname[j] = '_';
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Parses a set of by-letter directories such as "all", "none", "S",
+ * "A-F" or "A-F,X". Letters are case-insensitive
+ * In:
+ *      spec - the set to parse
+ * Out:
+ *      letters - bit n is set if letter 'A' + n is in the set
+ * Returns:
+ *      0 = success
+ *      1 = failure
+ */
+int parseByLetterRange( const char *spec, unsigned int *letters ) {
+
+    if ( spec == NULL || letters == NULL ) {
+        return 1;
+    }
+
+    if ( strcasecmp( spec, "all" ) == 0 ) {
+        *letters = ( 1U << 26 ) - 1;
+        return 0;
+    }
+    if ( strcasecmp( spec, "none" ) == 0 ) {
+        *letters = 0;
+        return 0;
+    }
+
+    unsigned int rv = 0;
+    const char *p = spec;
+    while ( 1 ) {
+        int first = toupper( (unsigned char)p[0] ) - 'A';
+        if ( first < 0 || first >= 26 ) {
+            return 1;
+        }
+        int last = first;
+        p++;
+        if ( *p == '-' ) {
+            last = toupper( (unsigned char)p[1] ) - 'A';
+            if ( last < first || last >= 26 ) {
+                return 1;
+            }
+            p += 2;
+        }
+        for ( int i = first ; i <= last ; i++ ) {
+            rv |= 1U << i;
+        }
+        if ( *p == '\0' ) {
+            break;
+        }
+        if ( *p != ',' ) {
+            return 1;
+        }
+        p++;
+    }
+
+    *letters = rv;
+    return 0;
+}
+
 /**
  */
 FSCacheEntry_t *FSCacheEntry_createFromByLetter( const char *path, 
@@ -56,22 +149,8 @@ FSCacheEntry_t *FSCacheEntry_createFromByLetter( const char *path,
     for ( int i = 0 ; i < json_object_array_length( hhits ) ; i++ ) {
         json_object *temp = json_object_array_get_idx( hhits, i );
         if ( temp != NULL ) {
-            json_object *tempsource = json_object_object_get( temp, "_source" );
-            if ( tempsource != NULL ) {
-                json_object *title = json_object_object_get( tempsource, "title" );
-                json_object *lid = json_object_object_get( temp, "_id" );
-
-                /** We need to synthesize a unique filename due to duplicate titles */
-                char fname[256];
-                sprintf( fname, "%s_%s", json_object_get_string( title ), json_object_get_string( lid )  );
-
-                /** Sanitise the filename in case there are illegal characters */
-                for ( int j = 0 ; j < strlen( fname ) ; j++ ) {
-                    if ( fname[j] == '/' || fname[j] == ':' ) {
-                        fname[j] = '_';
-                    }
-                }
-
+            char fname[256];
+            if ( getByLetterFilename( temp, fname ) == 0 ) {
                 char fullpath[256];
                 sprintf( fullpath, "%s/%s", path, fname );
 
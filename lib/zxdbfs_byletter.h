@@ -26,6 +26,8 @@
 #include "zxdbfs_fscache.h"
 #include "zxdbfs_fscacheentry.h"
 
+extern int getByLetterFilename( json_object *hit, char *fname );
+extern int parseByLetterRange( const char *spec, unsigned int *letters );
 extern FSCacheEntry_t *FSCacheEntry_createFromByLetter( const char *path,
                                                         json_object *gameData );
 
@@ -0,0 +1,353 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "zxdbfs_byletter.h"
+#include "zxdbfs_byletterindex.h"
+
+/**
+ * Orders (id, entry) pairs by ID, then by listing position
+ */
+static int _compareIDs( const void *a, const void *b ) {
+
+    const uint32_t *pa = (const uint32_t *)a;
+    const uint32_t *pb = (const uint32_t *)b;
+
+    if ( pa[0] != pb[0] ) {
+        return pa[0] < pb[0] ? -1 : 1;
+    }
+    return pa[1] < pb[1] ? -1 : ( pa[1] > pb[1] );
+}
+
+/**
+ * Compiles a by-letter listing from ZXDB into an index file. The index is
+ * written alongside and renamed into place
+ * In:
+ *      byLetterRoot - by-letter JSON as returned from ZXDB. Required
+ *      path - index file. Required
+ * Out:
+ *      N/A
+ * Returns:
+ *      0 = success
+ *      1 = failure
+ */
+int ByLetterIndex_write( json_object *byLetterRoot, const char *path ) {
+
+    if ( byLetterRoot == NULL || path == NULL ) {
+        return 1;
+    }
+
+    json_object *hhits =
+        json_object_object_get( json_object_object_get( byLetterRoot, "hits" ), "hits" );
+    if ( hhits == NULL ) {
+        return 1;
+    }
+
+    int rv = 1;
+    int nhits = json_object_array_length( hhits );
+    ByLetterIndexEntry_t *entries =
+        (ByLetterIndexEntry_t *)calloc( nhits + 1, sizeof( ByLetterIndexEntry_t ) );
+    uint32_t *pairs = (uint32_t *)calloc( nhits + 1, 2 * sizeof( uint32_t ) );
+    uint32_t *byid = (uint32_t *)calloc( nhits + 1, sizeof( uint32_t ) );
+    char *strings = NULL;
+    size_t stringslen = 0;
+    size_t stringssz = 0;
+    if ( entries == NULL || pairs == NULL || byid == NULL ) {
+        goto cleanup;
+    }
+
+    ByLetterIndexHeader_t header;
+    memset( &header, 0, sizeof( header ) );
+    header.entries = sizeof( ByLetterIndexHeader_t );
+
+    uint32_t nentries = 0;
+    for ( int i = 0 ; i < nhits ; i++ ) {
+        json_object *hit = json_object_array_get_idx( hhits, i );
+        char fname[256];
+        if ( hit == NULL || getByLetterFilename( hit, fname ) != 0 ) {
+            continue;
+        }
+
+        size_t len = strlen( fname ) + 1;
+        if ( stringslen + len > stringssz ) {
+            stringssz = stringssz * 2 + len + 4096;
+            char *grown = (char *)realloc( strings, stringssz );
+            if ( grown == NULL ) {
+                goto cleanup;
+            }
+            strings = grown;
+        }
+        memcpy( &strings[stringslen], fname, len );
+
+        entries[nentries].name = stringslen;
+        entries[nentries].id =
+            strtoul( json_object_get_string( json_object_object_get( hit, "_id" ) ), NULL, 10 );
+        pairs[nentries * 2] = entries[nentries].id;
+        pairs[nentries * 2 + 1] = nentries;
+        stringslen += len;
+        nentries++;
+    }
+
+    qsort( pairs, nentries, 2 * sizeof( uint32_t ), _compareIDs );
+    for ( uint32_t i = 0 ; i < nentries ; i++ ) {
+        byid[i] = pairs[i * 2 + 1];
+    }
+
+    memcpy( header.magic, BYLETTERINDEX_MAGIC, sizeof( BYLETTERINDEX_MAGIC ) );
+    header.version = BYLETTERINDEX_VERSION;
+    header.nentries = nentries;
+    header.byid = header.entries + nentries * sizeof( ByLetterIndexEntry_t );
+    header.strings = header.byid + nentries * sizeof( uint32_t );
+    header.size = header.strings + stringslen;
+    for ( uint32_t i = 0 ; i < nentries ; i++ ) {
+        entries[i].name += header.strings;
+    }
+
+    char tmppath[1024];
+    snprintf( tmppath, sizeof( tmppath ), "%s.tmp", path );
+    FILE *f = fopen( tmppath, "wb" );
+    if ( f == NULL ) {
+        printf( "failed to open by-letter index: %s\n", tmppath );
+        goto cleanup;
+    }
+    int ok = fwrite( &header, sizeof( header ), 1, f ) == 1 &&
+             fwrite( entries, sizeof( ByLetterIndexEntry_t ), nentries, f ) == nentries &&
+             fwrite( byid, sizeof( uint32_t ), nentries, f ) == nentries &&
+             fwrite( strings, 1, stringslen, f ) == stringslen;
+    if ( fclose( f ) != 0 ) {
+        ok = 0;
+    }
+    if ( !ok || rename( tmppath, path ) != 0 ) {
+        printf( "failed to write by-letter index: %s\n", path );
+        unlink( tmppath );
+        goto cleanup;
+    }
+
+    rv = 0;
+
+cleanup:
+    free( strings );
+    free( byid );
+    free( pairs );
+    free( entries );
+
+    return rv;
+}
+
+/**
+ * Checks the structure of a mapped index before any of it is trusted
+ */
+static int _isValidIndex( const char *map, size_t size ) {
+
+    if ( size < sizeof( ByLetterIndexHeader_t ) ) {
+        return 0;
+    }
+
+    const ByLetterIndexHeader_t *header = (const ByLetterIndexHeader_t *)map;
+    if ( memcmp( header->magic, BYLETTERINDEX_MAGIC, sizeof( BYLETTERINDEX_MAGIC ) ) != 0 ||
+         header->version != BYLETTERINDEX_VERSION ||
+         header->size != size ||
+         header->entries != sizeof( ByLetterIndexHeader_t ) ||
+         header->byid != header->entries + (uint64_t)header->nentries * sizeof( ByLetterIndexEntry_t ) ||
+         header->strings != header->byid + (uint64_t)header->nentries * sizeof( uint32_t ) ||
+         header->strings > size ||
+         ( header->strings < size && map[size - 1] != '\0' ) ) {
+        return 0;
+    }
+
+    const ByLetterIndexEntry_t *entries = (const ByLetterIndexEntry_t *)( map + header->entries );
+    const uint32_t *byid = (const uint32_t *)( map + header->byid );
+    for ( uint32_t i = 0 ; i < header->nentries ; i++ ) {
+        if ( entries[i].name < header->strings || entries[i].name >= size ||
+             byid[i] >= header->nentries ||
+             ( i > 0 && entries[byid[i]].id < entries[byid[i - 1]].id ) ) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Maps an index file
+ * In:
+ *      path - index file. Required
+ * Out:
+ *      N/A
+ * Returns:
+ *      The mapped index, or NULL if missing or invalid
+ */
+ByLetterIndex_t *ByLetterIndex_open( const char *path ) {
+
+    if ( path == NULL ) {
+        return NULL;
+    }
+
+    int fd = open( path, O_RDONLY );
+    if ( fd == -1 ) {
+        return NULL;
+    }
+
+    struct stat st;
+    if ( fstat( fd, &st ) != 0 || st.st_size < (off_t)sizeof( ByLetterIndexHeader_t ) ) {
+        close( fd );
+        return NULL;
+    }
+
+    const char *map = (const char *)mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if ( map == MAP_FAILED ) {
+        return NULL;
+    }
+
+    ByLetterIndex_t *index = (ByLetterIndex_t *)calloc( 1, sizeof( ByLetterIndex_t ) );
+    if ( index == NULL || !_isValidIndex( map, st.st_size ) ) {
+        printf( "ignoring invalid by-letter index: %s\n", path );
+        free( index );
+        munmap( (void *)map, st.st_size );
+        return NULL;
+    }
+
+    index->map = map;
+    index->size = st.st_size;
+    index->header = (const ByLetterIndexHeader_t *)map;
+    index->entries = (const ByLetterIndexEntry_t *)( map + index->header->entries );
+    index->byid = (const uint32_t *)( map + index->header->byid );
+
+    return index;
+}
+
+/**
+ * Unmaps an index. Names returned from it are no longer valid
+ * Returns:
+ *      0 = success
+ *      1 = failure
+ */
+int ByLetterIndex_close( ByLetterIndex_t *index ) {
+
+    if ( index == NULL ) {
+        return 1;
+    }
+
+    munmap( (void *)index->map, index->size );
+    free( index );
+
+    return 0;
+}
+
+int ByLetterIndex_getnentries( ByLetterIndex_t *index ) {
+
+    if ( index == NULL ) {
+        return 0;
+    }
+
+    return index->header->nentries;
+}
+
+/**
+ * Returns:
+ *      The directory name of the i'th game in listing order, or NULL
+ */
+const char *ByLetterIndex_getname( ByLetterIndex_t *index, int i ) {
+
+    if ( index == NULL || i < 0 || i >= index->header->nentries ) {
+        return NULL;
+    }
+
+    return index->map + index->entries[i].name;
+}
+
+/**
+ * Returns:
+ *      The ZXDB ID of the i'th game in listing order, or -1
+ */
+int ByLetterIndex_getid( ByLetterIndex_t *index, int i ) {
+
+    if ( index == NULL || i < 0 || i >= index->header->nentries ) {
+        return -1;
+    }
+
+    return index->entries[i].id;
+}
+
+/**
+ * Finds a game by ZXDB ID
+ * Returns:
+ *      Listing position of the game, or -1 if not listed
+ */
+int ByLetterIndex_findid( ByLetterIndex_t *index, int id ) {
+
+    if ( index == NULL || id < 0 ) {
+        return -1;
+    }
+
+    int lo = 0;
+    int hi = index->header->nentries;
+    while ( lo < hi ) {
+        int mid = lo + ( hi - lo ) / 2;
+        if ( index->entries[index->byid[mid]].id < (uint32_t)id ) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if ( lo < index->header->nentries &&
+         index->entries[index->byid[lo]].id == (uint32_t)id ) {
+        return index->byid[lo];
+    }
+
+    return -1;
+}
+
+/**
+ * Builds a by-letter directory from an index, as
+ * FSCacheEntry_createFromByLetter() would from the JSON it was compiled from
+ */
+FSCacheEntry_t *FSCacheEntry_createFromByLetterIndex( const char *path,
+                                                      ByLetterIndex_t *index ) {
+
+    if ( path == NULL || index == NULL ) {
+        return NULL;
+    }
+
+    FSCacheEntry_t *dirEntry =
+        FSCacheEntry_create( path, FSCACHEENTRY_DIR, NULL, 0 );
+    if ( dirEntry == NULL ) {
+        return NULL;
+    }
+
+    for ( int i = 0 ; i < index->header->nentries ; i++ ) {
+        char fullpath[512];
+        snprintf( fullpath, sizeof( fullpath ), "%s/%s", path, ByLetterIndex_getname( index, i ) );
+
+        FSCacheEntry_t *fsCacheEntry =
+            FSCacheEntry_create( fullpath, FSCACHEENTRY_DIR_STUB, NULL, 0 );
+        FSCacheEntry_addFile( dirEntry, fsCacheEntry );
+    }
+
+    return dirEntry;
+}
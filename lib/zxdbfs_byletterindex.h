@@ -0,0 +1,79 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _zxdbfs_byletterindex_h
+#define _zxdbfs_byletterindex_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <json-c/json.h>
+
+#include "zxdbfs_fscacheentry.h"
+
+#define BYLETTERINDEX_MAGIC     "ZXDBBLI"
+#define BYLETTERINDEX_VERSION   1
+
+/**
+ * A by-letter listing compiled down from ZXDB's JSON so that it can be
+ * mapped and used without parsing.
+ *
+ *   header | entries | byid | strings
+ *
+ * Entries are in listing order and name each game's directory in the
+ * string table. byid holds entry indices in ascending ID order for
+ * binary search
+ */
+typedef struct ByLetterIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nentries;
+    uint32_t entries;               /** Offset of the entries */
+    uint32_t byid;                  /** Offset of the ID order */
+    uint32_t strings;               /** Offset of the string table */
+    uint32_t size;                  /** Size of the whole index */
+} ByLetterIndexHeader_t;
+
+typedef struct ByLetterIndexEntry {
+    uint32_t name;                  /** String offset of "Title_ID" */
+    uint32_t id;                    /** ZXDB game ID */
+} ByLetterIndexEntry_t;
+
+typedef struct ByLetterIndex {
+    const char *map;
+    size_t size;
+    const ByLetterIndexHeader_t *header;
+    const ByLetterIndexEntry_t *entries;
+    const uint32_t *byid;
+} ByLetterIndex_t;
+
+extern int ByLetterIndex_write( json_object *byLetterRoot, const char *path );
+extern ByLetterIndex_t *ByLetterIndex_open( const char *path );
+extern int ByLetterIndex_close( ByLetterIndex_t *index );
+
+extern int ByLetterIndex_getnentries( ByLetterIndex_t *index );
+extern const char *ByLetterIndex_getname( ByLetterIndex_t *index, int i );
+extern int ByLetterIndex_getid( ByLetterIndex_t *index, int i );
+extern int ByLetterIndex_findid( ByLetterIndex_t *index, int id );
+
+extern FSCacheEntry_t *FSCacheEntry_createFromByLetterIndex( const char *path,
+                                                             ByLetterIndex_t *index );
+
+#endif /** !_zxdbfs_byletterindex_h */
@@ -0,0 +1,373 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "zxdbfs_contentcache.h"
+
+/** Length of a cached file's name, the URL hash in hex */
+#define CONTENTCACHE_NAME_LEN   16
+
+/** A file found in the cache directory */
+typedef struct ContentFile {
+    char name[CONTENTCACHE_NAME_LEN + 1];
+    time_t mtime;
+    size_t size;
+} ContentFile_t;
+
+/**
+ * Lists the cached files, leaving out any still being written
+ * Out:
+ *      nbytes - their total size
+ * Returns:
+ *      How many were found, or -1 on failure. The caller frees files
+ */
+static int _scan( ContentCache_t *cache, ContentFile_t **files, size_t *nbytes ) {
+
+    *files = NULL;
+    *nbytes = 0;
+
+    DIR *dir = opendir( cache->dir );
+    if ( dir == NULL ) {
+        return -1;
+    }
+
+    int nfiles = 0;
+    int maxfiles = 0;
+    struct dirent *de;
+    while ( ( de = readdir( dir ) ) != NULL ) {
+        if ( strlen( de->d_name ) != CONTENTCACHE_NAME_LEN ) {
+            continue;
+        }
+        struct stat st;
+        if ( fstatat( dirfd( dir ), de->d_name, &st, 0 ) != 0 || !S_ISREG( st.st_mode ) ) {
+            continue;
+        }
+        if ( nfiles == maxfiles ) {
+            maxfiles = maxfiles > 0 ? maxfiles * 2 : 64;
+            ContentFile_t *grown = (ContentFile_t *)realloc( *files, maxfiles * sizeof( ContentFile_t ) );
+            if ( grown == NULL ) {
+                break;
+            }
+            *files = grown;
+        }
+        ContentFile_t *file = &(*files)[nfiles++];
+        strcpy( file->name, de->d_name );
+        file->mtime = st.st_mtime;
+        file->size = st.st_size;
+        *nbytes += st.st_size;
+    }
+    closedir( dir );
+
+    return nfiles;
+}
+
+static int _compareMtime( const void *a, const void *b ) {
+
+    time_t ma = ( (const ContentFile_t *)a )->mtime;
+    time_t mb = ( (const ContentFile_t *)b )->mtime;
+
+    return ( ma > mb ) - ( ma < mb );
+}
+
+/**
+ * Deletes the least recently opened files until the rest fit the byte
+ * budget, or every file if flushing. Called with the lock held
+ * In:
+ *      keep - name of a file not to delete. May be NULL
+ */
+static void _evict( ContentCache_t *cache, const char *keep, int flush ) {
+
+    ContentFile_t *files;
+    size_t nbytes;
+    int nfiles = _scan( cache, &files, &nbytes );
+    if ( nfiles < 0 ) {
+        return;
+    }
+
+    qsort( files, nfiles, sizeof( ContentFile_t ), _compareMtime );
+
+    int nleft = nfiles;
+    for ( int i = 0 ; i < nfiles && ( flush || nbytes > cache->maxbytes ) ; i++ ) {
+        if ( keep != NULL && strcmp( files[i].name, keep ) == 0 ) {
+            continue;
+        }
+        char path[1024];
+        snprintf( path, sizeof( path ), "%s/%s", cache->dir, files[i].name );
+        if ( unlink( path ) == 0 ) {
+            nbytes -= files[i].size;
+            nleft--;
+            if ( !flush ) {
+                cache->nevictions++;
+            }
+        }
+    }
+    free( files );
+
+    /** Counted afresh, so files removed behind our back are accounted for */
+    cache->nbytes = nbytes;
+    cache->nfiles = nleft;
+}
+
+/**
+ * Creates a content cache in a directory below the cache root directory,
+ * creating the directory if need be. Files left from an earlier run
+ * count against the byte budget
+ * In:
+ *   maxbytes: Byte budget for cached files. 0 for the default
+ * Returns:
+ *   A new content cache or NULL on failure
+ */
+ContentCache_t *ContentCache_create( const char *cacherootdir, size_t maxbytes ) {
+
+    if ( cacherootdir == NULL ) {
+        return NULL;
+    }
+
+    ContentCache_t *cache = (ContentCache_t *)calloc( 1, sizeof( ContentCache_t ) );
+    if ( cache == NULL ) {
+        return NULL;
+    }
+    pthread_mutex_init( &cache->lock, NULL );
+    cache->maxbytes = maxbytes > 0 ? maxbytes : CONTENTCACHE_DEFAULT_MAX_BYTES;
+
+    size_t dirsz = strlen( cacherootdir ) + strlen( CONTENTCACHE_DIRNAME ) + 2;
+    cache->dir = (char *)malloc( dirsz );
+    if ( cache->dir == NULL ) {
+        free( cache );
+        return NULL;
+    }
+    snprintf( cache->dir, dirsz, "%s/%s", cacherootdir, CONTENTCACHE_DIRNAME );
+
+    if ( mkdir( cache->dir, 0755 ) != 0 && errno != EEXIST ) {
+        printf( "failed to create content cache: %s\n", cache->dir );
+        ContentCache_free( cache );
+        return NULL;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+    _evict( cache, NULL, 0 );
+    pthread_mutex_unlock( &cache->lock );
+
+    return cache;
+}
+
+/**
+ * Frees a content cache. The files are left on disk
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+int ContentCache_free( ContentCache_t *cache ) {
+
+    if ( cache == NULL ) {
+        return 1;
+    }
+
+    pthread_mutex_destroy( &cache->lock );
+    free( cache->dir );
+    free( cache );
+
+    return 0;
+}
+
+/**
+ * Deletes every cached file. Files already open stay readable until closed
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+int ContentCache_flush( ContentCache_t *cache ) {
+
+    if ( cache == NULL ) {
+        return 1;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+    _evict( cache, NULL, 1 );
+    pthread_mutex_unlock( &cache->lock );
+
+    return 0;
+}
+
+/**
+ * Names the file holding a URL's contents, by 64-bit FNV-1a hash of the URL
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+int ContentCache_getpath( ContentCache_t *cache, const char *url,
+                          char *path, size_t pathsz ) {
+
+    if ( cache == NULL || url == NULL || path == NULL ) {
+        return 1;
+    }
+
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for ( const unsigned char *p = (const unsigned char *)url ; *p != '\0' ; p++ ) {
+        hash ^= *p;
+        hash *= 0x100000001b3ULL;
+    }
+
+    int n = snprintf( path, pathsz, "%s/%016llx", cache->dir, (unsigned long long)hash );
+
+    return ( n < 0 || (size_t)n >= pathsz ) ? 1 : 0;
+}
+
+/**
+ * Opens the cached contents of a URL for reading
+ * Out:
+ *      size - the size of the contents. Optional
+ * Returns:
+ *      A read-only fd the caller must close, or -1 if not cached
+ */
+int ContentCache_open( ContentCache_t *cache, const char *url, size_t *size ) {
+
+    char path[1024];
+    if ( ContentCache_getpath( cache, url, path, sizeof( path ) ) != 0 ) {
+        return -1;
+    }
+
+    int fd = open( path, O_RDONLY | O_CLOEXEC );
+    if ( fd < 0 ) {
+        return -1;
+    }
+
+    struct stat st;
+    if ( fstat( fd, &st ) != 0 ) {
+        close( fd );
+        return -1;
+    }
+    if ( size != NULL ) {
+        *size = st.st_size;
+    }
+
+    /** Marks it as recently used, so it is evicted last */
+    futimens( fd, NULL );
+
+    return fd;
+}
+
+/**
+ * Stores the contents of a URL, replacing any already cached
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+int ContentCache_add( ContentCache_t *cache, const char *url,
+                      const char *data, size_t size ) {
+
+    if ( cache == NULL || ( data == NULL && size > 0 ) || size > cache->maxbytes ) {
+        return 1;
+    }
+
+    char path[1024];
+    if ( ContentCache_getpath( cache, url, path, sizeof( path ) ) != 0 ) {
+        return 1;
+    }
+
+    char tmppath[1040];
+    snprintf( tmppath, sizeof( tmppath ), "%s.XXXXXX", path );
+    int fd = mkstemp( tmppath );
+    if ( fd < 0 ) {
+        return 1;
+    }
+
+    size_t nwritten = 0;
+    while ( nwritten < size ) {
+        ssize_t n = write( fd, data + nwritten, size - nwritten );
+        if ( n < 0 && errno == EINTR ) {
+            continue;
+        }
+        if ( n <= 0 ) {
+            close( fd );
+            unlink( tmppath );
+            return 1;
+        }
+        nwritten += n;
+    }
+
+    fchmod( fd, 0644 );
+    if ( close( fd ) != 0 ) {
+        unlink( tmppath );
+        return 1;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+    struct stat st;
+    if ( stat( path, &st ) == 0 && (size_t)st.st_size <= cache->nbytes && cache->nfiles > 0 ) {
+        /** Replacing one already cached */
+        cache->nbytes -= st.st_size;
+        cache->nfiles--;
+    }
+    if ( rename( tmppath, path ) != 0 ) {
+        pthread_mutex_unlock( &cache->lock );
+        unlink( tmppath );
+        return 1;
+    }
+    cache->nbytes += size;
+    cache->nfiles++;
+    if ( cache->nbytes > cache->maxbytes ) {
+        _evict( cache, strrchr( path, '/' ) + 1, 0 );
+    }
+    pthread_mutex_unlock( &cache->lock );
+
+    return 0;
+}
+
+/**
+ * Returns the total size of the cached files
+ */
+size_t ContentCache_getnbytes( ContentCache_t *cache ) {
+
+    if ( cache == NULL ) {
+        return 0;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+    size_t nbytes = cache->nbytes;
+    pthread_mutex_unlock( &cache->lock );
+
+    return nbytes;
+}
+
+/**
+ * Returns how many files are cached
+ */
+int ContentCache_getnfiles( ContentCache_t *cache ) {
+
+    if ( cache == NULL ) {
+        return 0;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+    int nfiles = cache->nfiles;
+    pthread_mutex_unlock( &cache->lock );
+
+    return nfiles;
+}
@@ -0,0 +1,60 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _zxdbfs_contentcache_h
+#define _zxdbfs_contentcache_h
+
+#include <pthread.h>
+#include <stddef.h>
+
+#define CONTENTCACHE_DIRNAME            "content"
+#define CONTENTCACHE_DEFAULT_MAX_BYTES  (256 * 1024 * 1024)
+
+/**
+ * Downloaded file contents kept on disk under the cache root directory,
+ * one file per URL. Files are written whole and renamed into place, so
+ * any file present is complete and can be handed out as an fd. Opening a
+ * file touches its mtime, and once the files outgrow the byte budget the
+ * least recently opened are deleted first. Files already open stay
+ * readable until closed
+ */
+typedef struct ContentCache {
+    pthread_mutex_t lock;
+    char *dir;
+    size_t nbytes;
+    size_t maxbytes;
+    int nfiles;
+    unsigned long nevictions;
+} ContentCache_t;
+
+extern ContentCache_t *ContentCache_create( const char *cacherootdir, size_t maxbytes );
+extern int ContentCache_free( ContentCache_t *cache );
+extern int ContentCache_flush( ContentCache_t *cache );
+
+extern int ContentCache_getpath( ContentCache_t *cache, const char *url,
+                                 char *path, size_t pathsz );
+extern int ContentCache_open( ContentCache_t *cache, const char *url, size_t *size );
+extern int ContentCache_add( ContentCache_t *cache, const char *url,
+                             const char *data, size_t size );
+
+extern size_t ContentCache_getnbytes( ContentCache_t *cache );
+extern int ContentCache_getnfiles( ContentCache_t *cache );
+
+#endif /** !_zxdbfs_contentcache_h */
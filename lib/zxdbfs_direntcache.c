@@ -0,0 +1,485 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zxdbfs_direntcache.h"
+
+/**
+ * Creates an empty buffer for a directory listing
+ * In:
+ *      ino - the directory's inode number
+ *      generation - the directory's generation being encoded
+ *      plus - 1 if entries carry attributes, 0 otherwise
+ * Returns:
+ *      A new buffer holding one reference, or NULL on failure
+ */
+DirentBuf_t *DirentBuf_create( uint64_t ino, uint64_t generation, int plus ) {
+
+    DirentBuf_t *buf = (DirentBuf_t *)calloc( 1, sizeof( DirentBuf_t ) );
+    if ( buf == NULL ) {
+        return NULL;
+    }
+
+    buf->offsets = (size_t *)calloc( 1, sizeof( size_t ) );
+    if ( buf->offsets == NULL ) {
+        free( buf );
+        return NULL;
+    }
+    buf->refcount = 1;
+    buf->ino = ino;
+    buf->generation = generation;
+    buf->plus = plus;
+
+    return buf;
+}
+
+DirentBuf_t *DirentBuf_ref( DirentBuf_t *buf ) {
+
+    if ( buf != NULL ) {
+        __atomic_add_fetch( &buf->refcount, 1, __ATOMIC_RELAXED );
+    }
+
+    return buf;
+}
+
+/**
+ * Drops a reference on a buffer, freeing it with the last one
+ */
+void DirentBuf_free( DirentBuf_t *buf ) {
+
+    if ( buf == NULL ) {
+        return;
+    }
+
+    if ( __atomic_sub_fetch( &buf->refcount, 1, __ATOMIC_ACQ_REL ) > 0 ) {
+        return;
+    }
+
+    free( buf->offsets );
+    free( buf->inos );
+    free( buf->data );
+    free( buf );
+}
+
+/**
+ * Appends space for one encoded entry to a buffer that hasn't been added
+ * to a cache yet
+ * In:
+ *      buf - the buffer. Required
+ *      len - the entry's encoded length
+ *      ino - the inode number the entry hands the kernel, 0 for none
+ * Returns:
+ *      Where to encode the entry, or NULL on failure
+ */
+char *DirentBuf_append( DirentBuf_t *buf, size_t len, uint64_t ino ) {
+
+    if ( buf == NULL || len == 0 ) {
+        return NULL;
+    }
+
+    if ( buf->nentries == buf->entriessz ) {
+        int entriessz = buf->entriessz > 0 ? buf->entriessz * 2 : DIRENTCACHE_DEFAULT_NENTRIES;
+        size_t *offsets = (size_t *)realloc( buf->offsets, ( entriessz + 1 ) * sizeof( size_t ) );
+        if ( offsets == NULL ) {
+            return NULL;
+        }
+        buf->offsets = offsets;
+        uint64_t *inos = (uint64_t *)realloc( buf->inos, entriessz * sizeof( uint64_t ) );
+        if ( inos == NULL ) {
+            return NULL;
+        }
+        buf->inos = inos;
+        buf->entriessz = entriessz;
+    }
+
+    size_t used = buf->offsets[buf->nentries];
+    if ( used + len > buf->datasz ) {
+        size_t datasz = buf->datasz > 0 ? buf->datasz : 4096;
+        while ( used + len > datasz ) {
+            datasz *= 2;
+        }
+        char *data = (char *)realloc( buf->data, datasz );
+        if ( data == NULL ) {
+            return NULL;
+        }
+        buf->data = data;
+        buf->datasz = datasz;
+    }
+
+    buf->inos[buf->nentries] = ino;
+    buf->nentries++;
+    buf->offsets[buf->nentries] = used + len;
+
+    return buf->data + used;
+}
+
+/**
+ * Finds the run of whole entries starting at an entry that fits a reply
+ * In:
+ *      buf - the buffer. Required
+ *      first - index of the first entry
+ *      size - most bytes the reply may hold
+ * Out:
+ *      nentries - how many entries are in the run
+ *      len - the run's length in bytes
+ * Returns:
+ *      The start of the run, or NULL if buf is NULL. Past the last entry
+ *      the run is empty
+ */
+const char *DirentBuf_getwindow( DirentBuf_t *buf, int first, size_t size,
+                                 int *nentries, size_t *len ) {
+
+    if ( nentries != NULL ) {
+        *nentries = 0;
+    }
+    if ( len != NULL ) {
+        *len = 0;
+    }
+    if ( buf == NULL ) {
+        return NULL;
+    }
+
+    if ( first < 0 ) {
+        first = 0;
+    }
+    if ( first >= buf->nentries ) {
+        return buf->data != NULL ? buf->data + buf->offsets[buf->nentries] : "";
+    }
+
+    /** Offsets only grow, so the last entry that fits can be bisected */
+    size_t start = buf->offsets[first];
+    int lo = first;
+    int hi = buf->nentries;
+    while ( lo < hi ) {
+        int mid = lo + ( hi - lo + 1 ) / 2;
+        if ( buf->offsets[mid] - start <= size ) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    if ( nentries != NULL ) {
+        *nentries = lo - first;
+    }
+    if ( len != NULL ) {
+        *len = buf->offsets[lo] - start;
+    }
+
+    return buf->data + start;
+}
+
+int DirentBuf_getnentries( DirentBuf_t *buf ) {
+
+    if ( buf == NULL ) {
+        return 0;
+    }
+
+    return buf->nentries;
+}
+
+uint64_t DirentBuf_getino( DirentBuf_t *buf, int index ) {
+
+    if ( buf == NULL || index < 0 || index >= buf->nentries ) {
+        return 0;
+    }
+
+    return buf->inos[index];
+}
+
+/**
+ * Returns an estimate of the memory held by a buffer
+ */
+size_t DirentBuf_getnbytes( DirentBuf_t *buf ) {
+
+    if ( buf == NULL ) {
+        return 0;
+    }
+
+    return sizeof( DirentBuf_t ) + buf->datasz +
+           ( buf->entriessz + 1 ) * sizeof( size_t ) +
+           buf->entriessz * sizeof( uint64_t );
+}
+
+/**
+ * Buffers are keyed by themselves, on their directory and mode
+ */
+static unsigned long _hashKey( const void *k ) {
+
+    const DirentBuf_t *buf = (const DirentBuf_t *)k;
+    uint64_t key = ( buf->ino << 1 ) | ( buf->plus ? 1 : 0 );
+
+    return (unsigned long)( key * 0x9e3779b97f4a7c15ULL );
+}
+
+static int _equalKey( const void *k1, const void *k2 ) {
+
+    const DirentBuf_t *buf1 = (const DirentBuf_t *)k1;
+    const DirentBuf_t *buf2 = (const DirentBuf_t *)k2;
+
+    return buf1->ino == buf2->ino && !buf1->plus == !buf2->plus;
+}
+
+/**
+ * Releases the cache's reference on a buffer. Called by the hash table
+ * on deletion
+ */
+static void _freeCacheEntry( struct lh_entry *e ) {
+
+    DirentBuf_free( (DirentBuf_t *)lh_entry_v( e ) );
+}
+
+static void _unlink( DirentCache_t *cache, DirentBuf_t *buf ) {
+
+    if ( buf->prev != NULL ) {
+        buf->prev->next = buf->next;
+    } else {
+        cache->head = buf->next;
+    }
+    if ( buf->next != NULL ) {
+        buf->next->prev = buf->prev;
+    } else {
+        cache->tail = buf->prev;
+    }
+    buf->prev = NULL;
+    buf->next = NULL;
+}
+
+static void _push( DirentCache_t *cache, DirentBuf_t *buf ) {
+
+    buf->prev = NULL;
+    buf->next = cache->head;
+    if ( cache->head != NULL ) {
+        cache->head->prev = buf;
+    } else {
+        cache->tail = buf;
+    }
+    cache->head = buf;
+}
+
+/**
+ * Removes a buffer from the LRU and the hash table, dropping the cache's
+ * reference on it
+ */
+static void _remove( DirentCache_t *cache, DirentBuf_t *buf ) {
+
+    _unlink( cache, buf );
+    cache->nbytes -= DirentBuf_getnbytes( buf );
+
+    struct lh_entry *e = lh_table_lookup_entry( cache->cache, buf );
+    if ( e != NULL ) {
+        lh_table_delete_entry( cache->cache, e );
+    }
+}
+
+/**
+ * Creates a new dirent cache
+ * In:
+ *   maxbytes: Byte budget for encoded listings. 0 for the default
+ * Returns:
+ *   A new dirent cache or NULL on failure
+ */
+DirentCache_t *DirentCache_create( size_t maxbytes ) {
+
+    DirentCache_t *cache = (DirentCache_t *)calloc( 1, sizeof( DirentCache_t ) );
+    if ( cache == NULL ) {
+        return NULL;
+    }
+
+    cache->cache = lh_table_new( DIRENTCACHE_DEFAULT_HASH_SIZE, _freeCacheEntry,
+                                 _hashKey, _equalKey );
+    if ( cache->cache == NULL ) {
+        free( cache );
+        return NULL;
+    }
+    cache->maxbytes = maxbytes > 0 ? maxbytes : DIRENTCACHE_DEFAULT_MAX_BYTES;
+    pthread_mutex_init( &cache->lock, NULL );
+
+    return cache;
+}
+
+/**
+ * Frees a dirent cache. Buffers still referenced elsewhere live on
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+int DirentCache_free( DirentCache_t *cache ) {
+
+    if ( cache == NULL ) {
+        return 1;
+    }
+
+    lh_table_free( cache->cache );
+    pthread_mutex_destroy( &cache->lock );
+    free( cache );
+
+    return 0;
+}
+
+/**
+ * Discards all cached listings. Counters are retained
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+int DirentCache_flush( DirentCache_t *cache ) {
+
+    if ( cache == NULL ) {
+        return 1;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+    while ( cache->head != NULL ) {
+        _remove( cache, cache->head );
+    }
+    pthread_mutex_unlock( &cache->lock );
+
+    return 0;
+}
+
+/**
+ * Retrieves the encoded listing of a directory. A listing encoded from
+ * any other generation of the directory is discarded
+ * In:
+ *      cache - the cache. Required
+ *      ino - the directory's inode number
+ *      generation - the directory's current generation
+ *      plus - 1 for the listing with attributes, 0 without
+ * Returns:
+ *      The buffer with a reference for the caller, or NULL if there is
+ *      none for this generation
+ */
+DirentBuf_t *DirentCache_get( DirentCache_t *cache, uint64_t ino,
+                              uint64_t generation, int plus ) {
+
+    if ( cache == NULL ) {
+        return NULL;
+    }
+
+    DirentBuf_t key;
+    key.ino = ino;
+    key.plus = plus;
+
+    pthread_mutex_lock( &cache->lock );
+
+    DirentBuf_t *buf = NULL;
+    if ( !lh_table_lookup_ex( cache->cache, &key, (void **)&buf ) ) {
+        cache->nmisses++;
+        pthread_mutex_unlock( &cache->lock );
+        return NULL;
+    }
+
+    if ( buf->generation != generation ) {
+        _remove( cache, buf );
+        cache->nmisses++;
+        pthread_mutex_unlock( &cache->lock );
+        return NULL;
+    }
+
+    _unlink( cache, buf );
+    _push( cache, buf );
+    cache->nhits++;
+    DirentBuf_ref( buf );
+
+    pthread_mutex_unlock( &cache->lock );
+
+    return buf;
+}
+
+/**
+ * Adds an encoded listing, replacing any other for the same directory
+ * and mode. Least recently used listings are dropped to stay within the
+ * byte budget. The cache takes its own reference on the buffer, which
+ * must not be appended to afterwards
+ * Returns:
+ *   0: Success
+ *   1: Failure, including a buffer larger than the whole budget
+ */
+int DirentCache_add( DirentCache_t *cache, DirentBuf_t *buf ) {
+
+    if ( cache == NULL || buf == NULL ) {
+        return 1;
+    }
+
+    size_t nbytes = DirentBuf_getnbytes( buf );
+
+    pthread_mutex_lock( &cache->lock );
+
+    if ( nbytes > cache->maxbytes ) {
+        pthread_mutex_unlock( &cache->lock );
+        return 1;
+    }
+
+    DirentBuf_t *existing = NULL;
+    if ( lh_table_lookup_ex( cache->cache, buf, (void **)&existing ) ) {
+        if ( existing == buf ) {
+            pthread_mutex_unlock( &cache->lock );
+            return 0;
+        }
+        _remove( cache, existing );
+    }
+
+    while ( cache->tail != NULL && cache->nbytes + nbytes > cache->maxbytes ) {
+        _remove( cache, cache->tail );
+        cache->nevictions++;
+    }
+
+    if ( lh_table_insert( cache->cache, buf, DirentBuf_ref( buf ) ) != 0 ) {
+        DirentBuf_free( buf );
+        pthread_mutex_unlock( &cache->lock );
+        return 1;
+    }
+    _push( cache, buf );
+    cache->nbytes += nbytes;
+
+    pthread_mutex_unlock( &cache->lock );
+
+    return 0;
+}
+
+int DirentCache_getnentries( DirentCache_t *cache ) {
+
+    if ( cache == NULL ) {
+        return 0;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+    int nentries = cache->cache->count;
+    pthread_mutex_unlock( &cache->lock );
+
+    return nentries;
+}
+
+size_t DirentCache_getnbytes( DirentCache_t *cache ) {
+
+    if ( cache == NULL ) {
+        return 0;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+    size_t nbytes = cache->nbytes;
+    pthread_mutex_unlock( &cache->lock );
+
+    return nbytes;
+}
@@ -0,0 +1,90 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _zxdbfs_direntcache_h
+#define _zxdbfs_direntcache_h
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <json-c/json.h>
+#include <json-c/linkhash.h>
+
+#define DIRENTCACHE_DEFAULT_HASH_SIZE   64
+#define DIRENTCACHE_DEFAULT_MAX_BYTES   (16 * 1024 * 1024)
+#define DIRENTCACHE_DEFAULT_NENTRIES    64
+
+/**
+ * A directory listing already encoded as the kernel reads it, so a
+ * listing request is answered with a single copy. Entry i occupies
+ * data[offsets[i]] up to data[offsets[i + 1]]. A buffer is only valid
+ * for the generation of the directory it was encoded from, and is not
+ * changed once added to the cache
+ */
+typedef struct DirentBuf {
+    int refcount;
+    uint64_t ino;                   /** Of the directory */
+    uint64_t generation;            /** Of the directory when encoded */
+    int plus;                       /** Encoded with attributes */
+    int nentries;
+    int entriessz;
+    size_t *offsets;                /** nentries + 1 of them */
+    uint64_t *inos;                 /** Of each entry. 0 = not looked up */
+    char *data;
+    size_t datasz;
+    struct DirentBuf *prev;
+    struct DirentBuf *next;
+} DirentBuf_t;
+
+typedef struct DirentCache {
+    pthread_mutex_t lock;
+    struct lh_table *cache;
+    DirentBuf_t *head;              /** Most recent */
+    DirentBuf_t *tail;
+    size_t nbytes;
+    size_t maxbytes;
+    unsigned long nhits;
+    unsigned long nmisses;
+    unsigned long nevictions;
+} DirentCache_t;
+
+extern DirentBuf_t *DirentBuf_create( uint64_t ino, uint64_t generation, int plus );
+extern DirentBuf_t *DirentBuf_ref( DirentBuf_t *buf );
+extern void DirentBuf_free( DirentBuf_t *buf );
+extern char *DirentBuf_append( DirentBuf_t *buf, size_t len, uint64_t ino );
+extern const char *DirentBuf_getwindow( DirentBuf_t *buf, int first, size_t size,
+                                        int *nentries, size_t *len );
+extern int DirentBuf_getnentries( DirentBuf_t *buf );
+extern uint64_t DirentBuf_getino( DirentBuf_t *buf, int index );
+extern size_t DirentBuf_getnbytes( DirentBuf_t *buf );
+
+extern DirentCache_t *DirentCache_create( size_t maxbytes );
+extern int DirentCache_free( DirentCache_t *cache );
+extern int DirentCache_flush( DirentCache_t *cache );
+
+extern DirentBuf_t *DirentCache_get( DirentCache_t *cache, uint64_t ino,
+                                     uint64_t generation, int plus );
+extern int DirentCache_add( DirentCache_t *cache, DirentBuf_t *buf );
+
+extern int DirentCache_getnentries( DirentCache_t *cache );
+extern size_t DirentCache_getnbytes( DirentCache_t *cache );
+
+#endif /** !_zxdbfs_direntcache_h */
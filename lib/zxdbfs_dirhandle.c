@@ -0,0 +1,240 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zxdbfs_dirhandle.h"
+#include "zxdbfs_epoch.h"
+#include "zxdbfs_paths.h"
+
+#define DIRHANDLE_INITIAL_ENTRIES   8
+#define DIRHANDLE_INITIAL_NAMES     256
+
+/**
+ * Creates an empty directory snapshot
+ * Returns:
+ *   A new directory handle or NULL on failure
+ */
+DirHandle_t *DirHandle_create( void ) {
+
+    DirHandle_t *dirHandle = (DirHandle_t *)calloc( 1, sizeof( DirHandle_t ) );
+    if ( dirHandle == NULL ) {
+        return NULL;
+    }
+
+    return dirHandle;
+}
+
+/**
+ * Grows the entry and name arrays to hold at least nentries entries and
+ * namesbytes bytes of names
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+static int _reserve( DirHandle_t *dirHandle, int nentries, size_t namesbytes ) {
+
+    if ( nentries > dirHandle->entriessz ) {
+        int entriessz = dirHandle->entriessz > 0 ? dirHandle->entriessz : DIRHANDLE_INITIAL_ENTRIES;
+        while ( entriessz < nentries ) {
+            entriessz *= 2;
+        }
+        DirHandleEntry_t *entries =
+            (DirHandleEntry_t *)realloc( dirHandle->entries, entriessz * sizeof( DirHandleEntry_t ) );
+        if ( entries == NULL ) {
+            return 1;
+        }
+        dirHandle->entries = entries;
+        dirHandle->entriessz = entriessz;
+    }
+
+    if ( namesbytes > dirHandle->namessz ) {
+        size_t namessz = dirHandle->namessz > 0 ? dirHandle->namessz : DIRHANDLE_INITIAL_NAMES;
+        while ( namessz < namesbytes ) {
+            namessz *= 2;
+        }
+        char *names = (char *)realloc( dirHandle->names, namessz );
+        if ( names == NULL ) {
+            return 1;
+        }
+        dirHandle->names = names;
+        dirHandle->namessz = namessz;
+    }
+
+    return 0;
+}
+
+/**
+ * Frees a directory snapshot
+ */
+void DirHandle_free( DirHandle_t *dirHandle ) {
+
+    if ( dirHandle == NULL ) {
+        return;
+    }
+
+    free( dirHandle->entries );
+    free( dirHandle->names );
+    free( dirHandle );
+}
+
+/**
+ * Appends an entry to a directory snapshot
+ * In:
+ *      dirHandle - the directory handle. Required
+ *      name - the entry's name within the directory. Required
+ *      type - the entry's type
+ *      size - the entry's size in bytes
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+int DirHandle_add( DirHandle_t *dirHandle, const char *name,
+                   FSCacheEntryType type, size_t size ) {
+
+    if ( dirHandle == NULL || name == NULL ) {
+        return 1;
+    }
+
+    size_t namelen = strlen( name ) + 1;
+    if ( _reserve( dirHandle, dirHandle->nentries + 1, dirHandle->namesused + namelen ) != 0 ) {
+        return 1;
+    }
+
+    DirHandleEntry_t *entry = &dirHandle->entries[dirHandle->nentries++];
+    entry->name = dirHandle->namesused;
+    entry->type = type;
+    entry->size = size;
+    memcpy( &dirHandle->names[dirHandle->namesused], name, namelen );
+    dirHandle->namesused += namelen;
+
+    return 0;
+}
+
+/**
+ * Appends the children of a directory to a snapshot, by final path
+ * segment. The caller must hold a reference to the directory
+ * In:
+ *      dirHandle - the directory handle. Required
+ *      dirFSCacheEntry - the directory. Required
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+int DirHandle_addFromFSCacheEntry( DirHandle_t *dirHandle,
+                                   FSCacheEntry_t *dirFSCacheEntry ) {
+
+    if ( dirHandle == NULL || dirFSCacheEntry == NULL ) {
+        return 1;
+    }
+
+    /**
+     * The list may be replaced meanwhile but stays valid in the epoch.
+     * The snapshot only has the directory's generation if that didn't
+     * change while copying
+     */
+    Epoch_enter();
+    uint64_t generation = FSCacheEntry_getgeneration( dirFSCacheEntry );
+    int nfiles = 0;
+    FSCacheEntry_t **files = FSCacheEntry_getfilelist( dirFSCacheEntry, &nfiles );
+
+    /** Size everything up front so a big directory is copied in one go */
+    size_t namesbytes = dirHandle->namesused;
+    for ( int i = 0 ; i < nfiles ; i++ ) {
+        const char *fname = FSCacheEntry_getfname( files[i] );
+        if ( fname != NULL ) {
+            namesbytes += strlen( fname ) + 1;
+        }
+    }
+    if ( _reserve( dirHandle, dirHandle->nentries + nfiles, namesbytes ) != 0 ) {
+        Epoch_exit();
+        return 1;
+    }
+
+    for ( int i = 0 ; i < nfiles ; i++ ) {
+        FSCacheEntry_t *file = files[i];
+        const char *fname = FSCacheEntry_getfname( file );
+        if ( fname == NULL ) {
+            continue;
+        }
+
+        char basename[256] = { 0 };
+        getBasename( fname, basename );
+        DirHandle_add( dirHandle, basename, FSCacheEntry_gettype( file ),
+                       FSCacheEntry_getsize( file ) );
+    }
+    dirHandle->generation =
+        generation == FSCacheEntry_getgeneration( dirFSCacheEntry ) ? generation : 0;
+    Epoch_exit();
+
+    return 0;
+}
+
+int DirHandle_getnentries( DirHandle_t *dirHandle ) {
+
+    if ( dirHandle == NULL ) {
+        return 0;
+    }
+
+    return dirHandle->nentries;
+}
+
+const char *DirHandle_getname( DirHandle_t *dirHandle, int index ) {
+
+    if ( dirHandle == NULL || index < 0 || index >= dirHandle->nentries ) {
+        return NULL;
+    }
+
+    return &dirHandle->names[dirHandle->entries[index].name];
+}
+
+FSCacheEntryType DirHandle_gettype( DirHandle_t *dirHandle, int index ) {
+
+    if ( dirHandle == NULL || index < 0 || index >= dirHandle->nentries ) {
+        return FSCACHEENTRY_UNKNOWN;
+    }
+
+    return dirHandle->entries[index].type;
+}
+
+size_t DirHandle_getsize( DirHandle_t *dirHandle, int index ) {
+
+    if ( dirHandle == NULL || index < 0 || index >= dirHandle->nentries ) {
+        return 0;
+    }
+
+    return dirHandle->entries[index].size;
+}
+
+/**
+ * Returns the generation of the directory snapshotted by
+ * DirHandle_addFromFSCacheEntry(), or 0 if there is none or it changed
+ * while being snapshotted
+ */
+uint64_t DirHandle_getgeneration( DirHandle_t *dirHandle ) {
+
+    if ( dirHandle == NULL ) {
+        return 0;
+    }
+
+    return dirHandle->generation;
+}
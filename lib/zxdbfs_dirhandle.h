@@ -0,0 +1,65 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _zxdbfs_dirhandle_h
+#define _zxdbfs_dirhandle_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "zxdbfs_fscacheentry.h"
+
+/**
+ * A snapshot of a directory listing taken when the directory is opened.
+ * Entry i is handed out with the offset cookie i + 1, so a continued
+ * listing resumes directly at the entry after the cookie it was given,
+ * and sees the same entries even if the directory changes meanwhile
+ */
+typedef struct DirHandleEntry {
+    size_t name;                    /** Offset into names */
+    FSCacheEntryType type;
+    size_t size;
+} DirHandleEntry_t;
+
+typedef struct DirHandle {
+    int nentries;
+    int entriessz;
+    DirHandleEntry_t *entries;
+    size_t namesused;
+    size_t namessz;
+    char *names;
+    uint64_t generation;            /** Of the snapshotted directory */
+} DirHandle_t;
+
+extern DirHandle_t *DirHandle_create( void );
+extern void DirHandle_free( DirHandle_t *dirHandle );
+
+extern int DirHandle_add( DirHandle_t *dirHandle, const char *name,
+                          FSCacheEntryType type, size_t size );
+extern int DirHandle_addFromFSCacheEntry( DirHandle_t *dirHandle,
+                                          FSCacheEntry_t *dirFSCacheEntry );
+
+extern int DirHandle_getnentries( DirHandle_t *dirHandle );
+extern const char *DirHandle_getname( DirHandle_t *dirHandle, int index );
+extern FSCacheEntryType DirHandle_gettype( DirHandle_t *dirHandle, int index );
+extern size_t DirHandle_getsize( DirHandle_t *dirHandle, int index );
+extern uint64_t DirHandle_getgeneration( DirHandle_t *dirHandle );
+
+#endif /** !_zxdbfs_dirhandle_h */
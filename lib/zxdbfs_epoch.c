@@ -0,0 +1,270 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+
+#include "zxdbfs_epoch.h"
+
+/**
+ * Per-thread state. Records are never freed; a thread's record is
+ * recycled by a later thread once it exits
+ */
+typedef struct EpochThread {
+    unsigned long epoch;            /** Epoch observed on entry. 0 = quiescent */
+    int nesting;
+    int inuse;
+    struct EpochThread *next;
+} EpochThread_t;
+
+typedef struct EpochRetired {
+    void *ptr;
+    void (*freefn)( void * );
+    unsigned long epoch;
+    struct EpochRetired *next;
+} EpochRetired_t;
+
+static unsigned long globalEpoch = 1;
+static EpochThread_t *threads = NULL;
+static __thread EpochThread_t *self = NULL;
+
+static pthread_once_t keyonce = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+
+/** Guards the retired list and thread registration */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static EpochRetired_t *retired = NULL;
+static int nretired = 0;
+
+static void _threadExit( void *arg ) {
+
+    EpochThread_t *thread = (EpochThread_t *)arg;
+
+    __atomic_store_n( &thread->epoch, 0, __ATOMIC_RELEASE );
+    thread->nesting = 0;
+    __atomic_store_n( &thread->inuse, 0, __ATOMIC_RELEASE );
+}
+
+static void _createKey() {
+    pthread_key_create( &key, _threadExit );
+}
+
+/**
+ * Finds or creates the calling thread's record
+ */
+static EpochThread_t *_register() {
+
+    pthread_once( &keyonce, _createKey );
+
+    pthread_mutex_lock( &lock );
+
+    EpochThread_t *thread = threads;
+    while ( thread != NULL && __atomic_load_n( &thread->inuse, __ATOMIC_ACQUIRE ) ) {
+        thread = thread->next;
+    }
+    if ( thread == NULL ) {
+        thread = (EpochThread_t *)calloc( 1, sizeof( EpochThread_t ) );
+        if ( thread == NULL ) {
+            pthread_mutex_unlock( &lock );
+            abort();
+        }
+        thread->next = threads;
+        __atomic_store_n( &threads, thread, __ATOMIC_RELEASE );
+    }
+    thread->nesting = 0;
+    __atomic_store_n( &thread->inuse, 1, __ATOMIC_RELEASE );
+
+    pthread_mutex_unlock( &lock );
+
+    pthread_setspecific( key, thread );
+
+    return thread;
+}
+
+/**
+ * Advances the global epoch if every thread inside a critical section
+ * has observed the current one. Called with the lock held
+ * Returns:
+ *      The global epoch
+ */
+static unsigned long _tryAdvance() {
+
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+
+    unsigned long epoch = __atomic_load_n( &globalEpoch, __ATOMIC_ACQUIRE );
+    for ( EpochThread_t *thread = threads ; thread != NULL ; thread = thread->next ) {
+        unsigned long tepoch = __atomic_load_n( &thread->epoch, __ATOMIC_ACQUIRE );
+        if ( tepoch != 0 && tepoch != epoch ) {
+            return epoch;
+        }
+    }
+
+    __atomic_store_n( &globalEpoch, epoch + 1, __ATOMIC_RELEASE );
+
+    return epoch + 1;
+}
+
+/**
+ * Detaches everything retired at least two epochs ago. Called with the
+ * lock held
+ */
+static EpochRetired_t *_collect( unsigned long epoch ) {
+
+    EpochRetired_t *freeable = NULL;
+    EpochRetired_t **prev = &retired;
+
+    while ( *prev != NULL ) {
+        EpochRetired_t *r = *prev;
+        if ( r->epoch + 2 <= epoch ) {
+            *prev = r->next;
+            r->next = freeable;
+            freeable = r;
+            nretired--;
+        } else {
+            prev = &r->next;
+        }
+    }
+
+    return freeable;
+}
+
+/**
+ * Runs the free functions outside the lock, as they may retire more
+ */
+static void _reclaim( EpochRetired_t *freeable ) {
+
+    while ( freeable != NULL ) {
+        EpochRetired_t *next = freeable->next;
+        freeable->freefn( freeable->ptr );
+        free( freeable );
+        freeable = next;
+    }
+}
+
+/**
+ * Enters a read-side critical section. Objects reached from shared
+ * structures stay valid until the matching Epoch_exit(). Critical
+ * sections may nest but must not block
+ */
+void Epoch_enter() {
+
+    EpochThread_t *thread = self;
+    if ( thread == NULL ) {
+        thread = self = _register();
+    }
+
+    if ( thread->nesting++ == 0 ) {
+        __atomic_store_n( &thread->epoch,
+                          __atomic_load_n( &globalEpoch, __ATOMIC_ACQUIRE ),
+                          __ATOMIC_RELAXED );
+        __atomic_thread_fence( __ATOMIC_SEQ_CST );
+    }
+}
+
+/**
+ * Leaves a read-side critical section
+ */
+void Epoch_exit() {
+
+    EpochThread_t *thread = self;
+    if ( thread == NULL || thread->nesting == 0 ) {
+        return;
+    }
+
+    if ( --thread->nesting == 0 ) {
+        __atomic_store_n( &thread->epoch, 0, __ATOMIC_RELEASE );
+    }
+}
+
+/**
+ * Defers freeing an object that has been unpublished until no reader
+ * can hold a reference to it
+ * In:
+ *      ptr - the object. Ignored if NULL
+ *      freefn - called with ptr once it's safe to free. Required
+ * Out:
+ *      N/A
+ * Returns:
+ *      N/A
+ */
+void Epoch_retire( void *ptr, void (*freefn)( void * ) ) {
+
+    if ( ptr == NULL || freefn == NULL ) {
+        return;
+    }
+
+    EpochRetired_t *r = (EpochRetired_t *)malloc( sizeof( EpochRetired_t ) );
+    if ( r == NULL ) {
+        /** Leaking is safer than freeing early */
+        return;
+    }
+    r->ptr = ptr;
+    r->freefn = freefn;
+
+    EpochRetired_t *freeable = NULL;
+
+    pthread_mutex_lock( &lock );
+    r->epoch = __atomic_load_n( &globalEpoch, __ATOMIC_ACQUIRE );
+    r->next = retired;
+    retired = r;
+    if ( ++nretired >= EPOCH_DEFAULT_RECLAIM_THRESHOLD ) {
+        freeable = _collect( _tryAdvance() );
+    }
+    pthread_mutex_unlock( &lock );
+
+    _reclaim( freeable );
+}
+
+/**
+ * Waits for all current readers to leave their critical sections and
+ * frees everything retired so far. Must not be called from within a
+ * critical section
+ */
+void Epoch_synchronize() {
+
+    for ( ;; ) {
+        pthread_mutex_lock( &lock );
+        if ( retired == NULL ) {
+            pthread_mutex_unlock( &lock );
+            return;
+        }
+        EpochRetired_t *freeable = _collect( _tryAdvance() );
+        pthread_mutex_unlock( &lock );
+
+        if ( freeable != NULL ) {
+            _reclaim( freeable );
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+/**
+ * Returns the number of objects awaiting reclamation
+ */
+int Epoch_getnretired() {
+
+    pthread_mutex_lock( &lock );
+    int n = nretired;
+    pthread_mutex_unlock( &lock );
+
+    return n;
+}
@@ -0,0 +1,38 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _zxdbfs_epoch_h
+#define _zxdbfs_epoch_h
+
+#define EPOCH_DEFAULT_RECLAIM_THRESHOLD 64
+
+/**
+ * Epoch-based reclamation. Readers bracket their use of shared objects
+ * with Epoch_enter()/Epoch_exit() and take no locks. Writers unpublish an
+ * object and hand it to Epoch_retire(); it is freed once every thread
+ * that might still see it has left its critical section
+ */
+extern void Epoch_enter();
+extern void Epoch_exit();
+extern void Epoch_retire( void *ptr, void (*freefn)( void * ) );
+extern void Epoch_synchronize();
+extern int Epoch_getnretired();
+
+#endif /** !_zxdbfs_epoch_h */
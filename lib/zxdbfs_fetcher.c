@@ -0,0 +1,559 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zxdbfs_fetcher.h"
+
+/**
+ * Drops a reference on a fetch, freeing it and anything it still holds
+ * with the last one
+ */
+static void _release( Fetch_t *fetch ) {
+
+    if ( __atomic_sub_fetch( &fetch->refcount, 1, __ATOMIC_ACQ_REL ) > 0 ) {
+        return;
+    }
+
+    if ( fetch->curl != NULL ) {
+        curl_easy_cleanup( fetch->curl );
+    }
+    curl_slist_free_all( fetch->headers );
+    HTTP_freechunk( fetch->chunk );
+    pthread_cond_destroy( &fetch->arrived );
+    pthread_cond_destroy( &fetch->done );
+    pthread_mutex_destroy( &fetch->lock );
+    free( fetch );
+}
+
+/**
+ * Marks a fetch as finished, waking its waiter, and drops the event
+ * loop's reference on it
+ */
+static void _complete( Fetch_t *fetch, CURLcode result ) {
+
+    if ( fetch->curl != NULL ) {
+        curl_easy_cleanup( fetch->curl );
+        fetch->curl = NULL;
+    }
+    curl_slist_free_all( fetch->headers );
+    fetch->headers = NULL;
+
+    pthread_mutex_lock( &fetch->lock );
+    fetch->result = result;
+    fetch->finished = 1;
+    pthread_cond_broadcast( &fetch->done );
+    pthread_cond_broadcast( &fetch->arrived );
+    pthread_mutex_unlock( &fetch->lock );
+
+    _release( fetch );
+}
+
+static void _unlinkInflight( Fetcher_t *fetcher, Fetch_t *fetch ) {
+
+    if ( fetch->prev != NULL ) {
+        fetch->prev->next = fetch->next;
+    } else {
+        fetcher->inflight = fetch->next;
+    }
+    if ( fetch->next != NULL ) {
+        fetch->next->prev = fetch->prev;
+    }
+    fetch->prev = fetch->next = NULL;
+    __atomic_sub_fetch( &fetcher->ninflight, 1, __ATOMIC_RELAXED );
+}
+
+/**
+ * Completes every finished transfer
+ */
+static void _reap( Fetcher_t *fetcher ) {
+
+    CURLMsg *msg;
+    int nmsgs;
+    while ( ( msg = curl_multi_info_read( fetcher->multi, &nmsgs ) ) != NULL ) {
+        if ( msg->msg != CURLMSG_DONE ) {
+            continue;
+        }
+        CURL *curl = msg->easy_handle;
+        CURLcode result = msg->data.result;
+        Fetch_t *fetch = NULL;
+        curl_easy_getinfo( curl, CURLINFO_PRIVATE, (char **)&fetch );
+        curl_multi_remove_handle( fetcher->multi, curl );
+
+        long nconnects = 0;
+        curl_easy_getinfo( curl, CURLINFO_NUM_CONNECTS, &nconnects );
+        fetcher->nconnects += nconnects;
+        fetch->code = HTTP_getcode( curl, result );
+
+        if ( result != CURLE_OK ) {
+            printf( "fetch failed: %s\n", curl_easy_strerror( result ) );
+            fetcher->nfailures++;
+        } else {
+            fetch->notmodified = HTTP_complete( curl, fetch->chunk, &fetch->validators );
+        }
+        _unlinkInflight( fetcher, fetch );
+        _complete( fetch, result );
+    }
+}
+
+/**
+ * The event loop. Takes on submitted requests, drives every transfer and
+ * completes them. On shutdown, anything still in flight is abandoned and
+ * completed as failed
+ */
+static void *_loop( void *arg ) {
+
+    Fetcher_t *fetcher = (Fetcher_t *)arg;
+
+    for ( ;; ) {
+        pthread_mutex_lock( &fetcher->lock );
+        Fetch_t *submitted = fetcher->submitted;
+        fetcher->submitted = NULL;
+        fetcher->lastsubmitted = NULL;
+        int shutdown = fetcher->shutdown;
+        pthread_mutex_unlock( &fetcher->lock );
+
+        while ( submitted != NULL ) {
+            Fetch_t *fetch = submitted;
+            submitted = fetch->next;
+            fetch->next = NULL;
+            if ( shutdown || curl_multi_add_handle( fetcher->multi, fetch->curl ) != CURLM_OK ) {
+                fetcher->nfailures++;
+                _complete( fetch, CURLE_ABORTED_BY_CALLBACK );
+                continue;
+            }
+            fetch->next = fetcher->inflight;
+            if ( fetcher->inflight != NULL ) {
+                fetcher->inflight->prev = fetch;
+            }
+            fetcher->inflight = fetch;
+            __atomic_add_fetch( &fetcher->ninflight, 1, __ATOMIC_RELAXED );
+        }
+
+        if ( shutdown ) {
+            break;
+        }
+
+        int running = 0;
+        curl_multi_perform( fetcher->multi, &running );
+        _reap( fetcher );
+
+        /** Woken early by a submission or shutdown */
+        curl_multi_poll( fetcher->multi, NULL, 0, FETCHER_POLL_TIMEOUT_MS, NULL );
+    }
+
+    /** Abandon anything still in flight */
+    while ( fetcher->inflight != NULL ) {
+        Fetch_t *fetch = fetcher->inflight;
+        curl_multi_remove_handle( fetcher->multi, fetch->curl );
+        _unlinkInflight( fetcher, fetch );
+        fetcher->nfailures++;
+        _complete( fetch, CURLE_ABORTED_BY_CALLBACK );
+    }
+
+    return NULL;
+}
+
+/**
+ * Creates a fetcher and starts its event loop
+ * In:
+ *      maxhostconnections - most connections open to one host at once.
+ *                           0 for the default
+ *      maxstreams - most requests multiplexed onto one HTTP/2 connection.
+ *                   0 for the default, 1 for no multiplexing
+ * Returns:
+ *      A new fetcher or NULL on failure
+ */
+Fetcher_t *Fetcher_create( long maxhostconnections, long maxstreams ) {
+
+    HTTP_init();
+
+    Fetcher_t *fetcher = (Fetcher_t *)calloc( 1, sizeof( Fetcher_t ) );
+    if ( fetcher == NULL ) {
+        return NULL;
+    }
+
+    fetcher->multi = curl_multi_init();
+    if ( fetcher->multi == NULL ) {
+        free( fetcher );
+        return NULL;
+    }
+    curl_multi_setopt( fetcher->multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+                       maxhostconnections > 0 ? maxhostconnections : FETCHER_DEFAULT_MAX_HOST_CONNECTIONS );
+    if ( maxstreams <= 0 ) {
+        maxstreams = FETCHER_DEFAULT_MAX_STREAMS;
+    }
+    fetcher->multiplex = maxstreams > 1;
+    curl_multi_setopt( fetcher->multi, CURLMOPT_PIPELINING,
+                       fetcher->multiplex ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING );
+    curl_multi_setopt( fetcher->multi, CURLMOPT_MAX_CONCURRENT_STREAMS, maxstreams );
+    pthread_mutex_init( &fetcher->lock, NULL );
+
+    if ( pthread_create( &fetcher->thread, NULL, _loop, fetcher ) != 0 ) {
+        pthread_mutex_destroy( &fetcher->lock );
+        curl_multi_cleanup( fetcher->multi );
+        free( fetcher );
+        return NULL;
+    }
+
+    return fetcher;
+}
+
+/**
+ * Stops the event loop and frees the fetcher. Requests still in flight
+ * fail, and no more may be submitted
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+int Fetcher_free( Fetcher_t *fetcher ) {
+
+    if ( fetcher == NULL ) {
+        return 1;
+    }
+
+    pthread_mutex_lock( &fetcher->lock );
+    fetcher->shutdown = 1;
+    pthread_mutex_unlock( &fetcher->lock );
+    curl_multi_wakeup( fetcher->multi );
+
+    pthread_join( fetcher->thread, NULL );
+
+    curl_multi_cleanup( fetcher->multi );
+    pthread_mutex_destroy( &fetcher->lock );
+    free( fetcher );
+
+    return 0;
+}
+
+/**
+ * Appends to a streamed body under the fetch's lock, so it can be read
+ * while it grows, and wakes any reader waiting for it. Gives up on the
+ * transfer once nobody is left to read it, or if the server refused it
+ */
+static size_t _writeStream( void *contents, size_t size, size_t nmemb, void *userp ) {
+
+    size_t realsize = size * nmemb;
+    Fetch_t *fetch = (Fetch_t *)userp;
+
+    if ( __atomic_load_n( &fetch->refcount, __ATOMIC_ACQUIRE ) < 2 ) {
+        return 0;
+    }
+
+    long code = 0;
+    curl_easy_getinfo( fetch->curl, CURLINFO_RESPONSE_CODE, &code );
+    if ( code >= 400 ) {
+        return 0;
+    }
+
+    pthread_mutex_lock( &fetch->lock );
+    struct MemoryStruct *mem = fetch->chunk;
+    char *memory = (char *)realloc( mem->memory, mem->size + realsize + 1 );
+    if ( memory == NULL ) {
+        pthread_mutex_unlock( &fetch->lock );
+        printf( "not enough memory (realloc returned NULL)\n" );
+        return 0;
+    }
+    mem->memory = memory;
+    memcpy( &mem->memory[mem->size], contents, realsize );
+    mem->size += realsize;
+    mem->memory[mem->size] = 0;
+    pthread_cond_broadcast( &fetch->arrived );
+    pthread_mutex_unlock( &fetch->lock );
+
+    return realsize;
+}
+
+/**
+ * Sets up a request and queues it for the event loop
+ */
+static Fetch_t *_submit( Fetcher_t *fetcher, const char *url, const char *useragent,
+                         const HTTPValidators_t *validators, int parse,
+                         const char *range, int stream ) {
+
+    if ( fetcher == NULL || url == NULL ) {
+        return NULL;
+    }
+
+    Fetch_t *fetch = (Fetch_t *)calloc( 1, sizeof( Fetch_t ) );
+    if ( fetch == NULL ) {
+        return NULL;
+    }
+    fetch->chunk = HTTP_newchunk( parse );
+    fetch->curl = curl_easy_init();
+    if ( fetch->chunk == NULL || fetch->curl == NULL ) {
+        curl_easy_cleanup( fetch->curl );
+        HTTP_freechunk( fetch->chunk );
+        free( fetch );
+        return NULL;
+    }
+    fetch->refcount = 2;
+    pthread_mutex_init( &fetch->lock, NULL );
+    pthread_cond_init( &fetch->done, NULL );
+    pthread_cond_init( &fetch->arrived, NULL );
+    if ( validators != NULL ) {
+        fetch->validators = *validators;
+    }
+    fetch->headers = HTTP_setup( fetch->curl, url, useragent, fetch->chunk, &fetch->validators );
+    curl_easy_setopt( fetch->curl, CURLOPT_PRIVATE, fetch );
+    if ( range != NULL ) {
+        curl_easy_setopt( fetch->curl, CURLOPT_RANGE, range );
+    }
+    if ( stream ) {
+        curl_easy_setopt( fetch->curl, CURLOPT_WRITEFUNCTION, _writeStream );
+        curl_easy_setopt( fetch->curl, CURLOPT_WRITEDATA, fetch );
+    }
+
+    /**
+     * Rather than opening a connection of its own, wait to see if a
+     * connection being opened to the same host can be multiplexed
+     */
+    if ( fetcher->multiplex ) {
+        curl_easy_setopt( fetch->curl, CURLOPT_PIPEWAIT, 1L );
+    }
+
+    pthread_mutex_lock( &fetcher->lock );
+    if ( fetcher->shutdown ) {
+        pthread_mutex_unlock( &fetcher->lock );
+        fetch->refcount = 1;
+        _release( fetch );
+        return NULL;
+    }
+    if ( fetcher->lastsubmitted != NULL ) {
+        fetcher->lastsubmitted->next = fetch;
+    } else {
+        fetcher->submitted = fetch;
+    }
+    fetcher->lastsubmitted = fetch;
+    fetcher->nfetches++;
+    pthread_mutex_unlock( &fetcher->lock );
+
+    curl_multi_wakeup( fetcher->multi );
+
+    return fetch;
+}
+
+/**
+ * Submits a request to the event loop
+ * In:
+ *      fetcher - the fetcher. Required
+ *      url - the full URL. Required
+ *      useragent - HTTP User-Agent. May be NULL
+ *      validators - of a copy already held, to make the request
+ *                   conditional. May be NULL
+ *      parse - 1 to ask for the body compressed and parse it as JSON as
+ *              it arrives, into the chunk's obj
+ * Returns:
+ *      The fetch, to be waited on with Fetch_wait() or abandoned with
+ *      Fetch_free(), or NULL on failure
+ */
+Fetch_t *Fetcher_submit( Fetcher_t *fetcher, const char *url, const char *useragent,
+                         const HTTPValidators_t *validators, int parse ) {
+
+    return _submit( fetcher, url, useragent, validators, parse, NULL, 0 );
+}
+
+/**
+ * Submits a request for part of a URL to the event loop
+ * In:
+ *      fetcher - the fetcher. Required
+ *      url - the full URL. Required
+ *      useragent - HTTP User-Agent. May be NULL
+ *      offset - first byte wanted
+ *      length - bytes wanted
+ * Returns:
+ *      As Fetcher_submit(). The chunk's code tells a range (206) from a
+ *      whole file sent by a server that ignores ranges (200)
+ */
+Fetch_t *Fetcher_submitrange( Fetcher_t *fetcher, const char *url, const char *useragent,
+                              off_t offset, size_t length ) {
+
+    if ( offset < 0 || length == 0 ) {
+        return NULL;
+    }
+
+    char range[64];
+    snprintf( range, sizeof( range ), "%ld-%ld", (long)offset, (long)( offset + length - 1 ) );
+
+    return _submit( fetcher, url, useragent, NULL, 0, range, 0 );
+}
+
+/**
+ * Submits a request to the event loop whose body can be read with
+ * Fetch_read() while it is still arriving
+ * In:
+ *      fetcher - the fetcher. Required
+ *      url - the full URL. Required
+ *      useragent - HTTP User-Agent. May be NULL
+ * Returns:
+ *      As Fetcher_submit(). Freeing the fetch before it finishes stops
+ *      the transfer
+ */
+Fetch_t *Fetcher_submitstream( Fetcher_t *fetcher, const char *url, const char *useragent ) {
+
+    return _submit( fetcher, url, useragent, NULL, 0, NULL, 1 );
+}
+
+/**
+ * Returns how many requests the event loop is driving
+ */
+int Fetcher_getninflight( Fetcher_t *fetcher ) {
+
+    if ( fetcher == NULL ) {
+        return 0;
+    }
+
+    return __atomic_load_n( &fetcher->ninflight, __ATOMIC_RELAXED );
+}
+
+/**
+ * Waits for a fetch to finish and frees it
+ * In:
+ *      fetch - the fetch. Required
+ * Out:
+ *      validators - of the response. May be NULL
+ *      notmodified - set to 1 if the copy already held is unchanged. May
+ *                    be NULL
+ * Returns:
+ *      The response body, which the caller frees, or NULL if unchanged
+ *      or the request failed
+ */
+struct MemoryStruct *Fetch_wait( Fetch_t *fetch, HTTPValidators_t *validators,
+                                 int *notmodified ) {
+
+    return Fetch_waitcode( fetch, validators, notmodified, NULL );
+}
+
+/**
+ * As Fetch_wait()
+ * Out:
+ *      code - as HTTP_getcode(), so a failed request can be told apart
+ *             from a missing URL. May be NULL
+ */
+struct MemoryStruct *Fetch_waitcode( Fetch_t *fetch, HTTPValidators_t *validators,
+                                     int *notmodified, long *code ) {
+
+    if ( notmodified != NULL ) {
+        *notmodified = 0;
+    }
+    if ( code != NULL ) {
+        *code = -1;
+    }
+
+    if ( fetch == NULL ) {
+        return NULL;
+    }
+
+    pthread_mutex_lock( &fetch->lock );
+    while ( !fetch->finished ) {
+        pthread_cond_wait( &fetch->done, &fetch->lock );
+    }
+    pthread_mutex_unlock( &fetch->lock );
+
+    if ( code != NULL ) {
+        *code = fetch->code;
+    }
+
+    struct MemoryStruct *chunk = NULL;
+    if ( fetch->result == CURLE_OK && fetch->notmodified ) {
+        if ( notmodified != NULL ) {
+            *notmodified = 1;
+        }
+    } else if ( fetch->result == CURLE_OK ) {
+        if ( validators != NULL ) {
+            *validators = fetch->validators;
+        }
+        chunk = fetch->chunk;
+        fetch->chunk = NULL;
+        printf( "chunk.size: %ld\n", chunk->size );
+    }
+    Fetch_free( fetch );
+
+    return chunk;
+}
+
+/**
+ * Reads from the body of a streamed fetch, waiting only until the bytes
+ * wanted have arrived or the fetch has finished
+ * In:
+ *      fetch - a fetch from Fetcher_submitstream(). Required
+ *      offset - first byte wanted
+ *      len - bytes wanted
+ * Out:
+ *      buf - the bytes read. Required
+ * Returns:
+ *      Bytes read, fewer than len only at the end of the body, or -1 if
+ *      the fetch failed
+ */
+ssize_t Fetch_read( Fetch_t *fetch, off_t offset, size_t len, char *buf ) {
+
+    if ( fetch == NULL || buf == NULL || offset < 0 ) {
+        return -1;
+    }
+
+    pthread_mutex_lock( &fetch->lock );
+    while ( !fetch->finished && fetch->chunk->size < (size_t)offset + len ) {
+        pthread_cond_wait( &fetch->arrived, &fetch->lock );
+    }
+
+    ssize_t nread = -1;
+    if ( !fetch->finished || fetch->result == CURLE_OK ) {
+        nread = 0;
+        if ( (size_t)offset < fetch->chunk->size ) {
+            nread = fetch->chunk->size - offset;
+            if ( (size_t)nread > len ) {
+                nread = len;
+            }
+            memcpy( buf, &fetch->chunk->memory[offset], nread );
+        }
+    }
+    pthread_mutex_unlock( &fetch->lock );
+
+    return nread;
+}
+
+/**
+ * Returns whether a fetch has finished, without waiting
+ */
+int Fetch_isdone( Fetch_t *fetch ) {
+
+    if ( fetch == NULL ) {
+        return 0;
+    }
+
+    pthread_mutex_lock( &fetch->lock );
+    int finished = fetch->finished;
+    pthread_mutex_unlock( &fetch->lock );
+
+    return finished;
+}
+
+/**
+ * Drops the submitter's interest in a fetch. A fetch still in flight
+ * carries on and is freed when it finishes
+ */
+void Fetch_free( Fetch_t *fetch ) {
+
+    if ( fetch != NULL ) {
+        _release( fetch );
+    }
+}
@@ -0,0 +1,98 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _zxdbfs_fetcher_h
+#define _zxdbfs_fetcher_h
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <curl/curl.h>
+
+#include "zxdbfs_http.h"
+
+#define FETCHER_DEFAULT_MAX_HOST_CONNECTIONS    8
+#define FETCHER_DEFAULT_MAX_STREAMS             100
+#define FETCHER_POLL_TIMEOUT_MS                 1000
+
+/**
+ * An upstream request made by a fetcher's event loop. Whoever submits a
+ * request gets a fetch back, which completes in the background and can
+ * be waited on, or abandoned with Fetch_free()
+ */
+typedef struct Fetch {
+    int refcount;                   /** The submitter's and the event loop's */
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    pthread_cond_t arrived;         /** Broadcast as a streamed body grows */
+    int finished;
+    CURLcode result;
+    long code;                      /** As HTTP_getcode() */
+    CURL *curl;
+    struct curl_slist *headers;
+    struct MemoryStruct *chunk;
+    HTTPValidators_t validators;
+    int notmodified;
+    struct Fetch *prev;
+    struct Fetch *next;             /** Submitted or in flight */
+} Fetch_t;
+
+/**
+ * One thread driving a curl multi handle, so any number of requests are
+ * in flight at once without a thread each. Requests to the same host
+ * share connections, up to maxhostconnections of them. Over HTTP/2,
+ * concurrent requests are multiplexed onto one connection, up to
+ * maxstreams at a time, before another is opened
+ */
+typedef struct Fetcher {
+    pthread_t thread;
+    CURLM *multi;
+    pthread_mutex_t lock;
+    Fetch_t *submitted;             /** Oldest first */
+    Fetch_t *lastsubmitted;
+    Fetch_t *inflight;              /** Owned by the event loop */
+    int shutdown;
+    int ninflight;
+    int multiplex;
+    unsigned long nfetches;
+    unsigned long nfailures;
+    unsigned long nconnects;        /** New connections made */
+} Fetcher_t;
+
+extern Fetcher_t *Fetcher_create( long maxhostconnections, long maxstreams );
+extern int Fetcher_free( Fetcher_t *fetcher );
+extern Fetch_t *Fetcher_submit( Fetcher_t *fetcher, const char *url,
+                                const char *useragent,
+                                const HTTPValidators_t *validators, int parse );
+extern Fetch_t *Fetcher_submitrange( Fetcher_t *fetcher, const char *url,
+                                     const char *useragent, off_t offset, size_t length );
+extern Fetch_t *Fetcher_submitstream( Fetcher_t *fetcher, const char *url,
+                                      const char *useragent );
+extern int Fetcher_getninflight( Fetcher_t *fetcher );
+
+extern struct MemoryStruct *Fetch_wait( Fetch_t *fetch, HTTPValidators_t *validators,
+                                        int *notmodified );
+extern struct MemoryStruct *Fetch_waitcode( Fetch_t *fetch, HTTPValidators_t *validators,
+                                            int *notmodified, long *code );
+extern ssize_t Fetch_read( Fetch_t *fetch, off_t offset, size_t len, char *buf );
+extern int Fetch_isdone( Fetch_t *fetch );
+extern void Fetch_free( Fetch_t *fetch );
+
+#endif /** !_zxdbfs_fetcher_h */
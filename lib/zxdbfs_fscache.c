@@ -19,10 +19,368 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+#include "zxdbfs_epoch.h"
 #include "zxdbfs_fscache.h"
 #include "zxdbfs_json.h"
+#include "zxdbfs_strpool.h"
+
+/** Approximate overhead of a key in the hash table */
+#define FSCACHE_KEY_NBYTES  (sizeof( FSCacheNode_t ) + sizeof( FSCacheNode_t * ))
+
+/**
+ * FNV-1a hash of a key
+ */
+static unsigned long _hash( const char *key ) {
+
+    unsigned long hash = 2166136261UL;
+    while ( *key != '\0' ) {
+        hash ^= (unsigned char)*key++;
+        hash *= 16777619UL;
+    }
+
+    return hash;
+}
+
+static FSCacheTable_t *_allocTable( unsigned long size ) {
+
+    return (FSCacheTable_t *)calloc( 1, sizeof( FSCacheTable_t ) + size * sizeof( FSCacheNode_t * ) );
+}
+
+/**
+ * Frees a node once no reader can see it. The entry reference has
+ * already been dropped or handed on by the writer
+ */
+static void _freeNode( void *ptr ) {
+
+    FSCacheNode_t *node = (FSCacheNode_t *)ptr;
+
+    StringPool_release( node->key );
+    free( node );
+}
+
+/**
+ * Frees a table and the nodes still chained from it once no reader can
+ * see it
+ */
+static void _freeTable( void *ptr ) {
+
+    FSCacheTable_t *table = (FSCacheTable_t *)ptr;
+
+    for ( unsigned long i = 0 ; i < table->size ; i++ ) {
+        FSCacheNode_t *node = table->buckets[i];
+        while ( node != NULL ) {
+            FSCacheNode_t *next = node->next;
+            _freeNode( node );
+            node = next;
+        }
+    }
+    free( table );
+}
+
+/**
+ * Finds the link pointing at the node for a key. Only valid whilst
+ * holding the writer lock
+ * Returns:
+ *      The link, which points at NULL if the key is not present
+ */
+static FSCacheNode_t **_findLink( FSCache_t *cache, const char *key, unsigned long hash ) {
+
+    FSCacheTable_t *table = cache->table;
+    FSCacheNode_t **link = &table->buckets[hash & (table->size - 1)];
+
+    while ( *link != NULL ) {
+        if ( (*link)->hash == hash && strcmp( (*link)->key, key ) == 0 ) {
+            break;
+        }
+        link = &(*link)->next;
+    }
+
+    return link;
+}
+
+/**
+ * Returns the entry at a key without taking a reference. Only valid
+ * whilst holding the writer lock, as nothing else modifies the index
+ */
+static FSCacheEntry_t *_peek( FSCache_t *cache, const char *key ) {
+
+    FSCacheNode_t *node = *_findLink( cache, key, _hash( key ) );
+
+    return node != NULL ? node->entry : NULL;
+}
+
+/**
+ * Doubles the table. Readers may still be walking the old chains, so
+ * the nodes are copied and the old table retired whole
+ */
+static void _grow( FSCache_t *cache ) {
+
+    FSCacheTable_t *table = cache->table;
+    FSCacheTable_t *ntable = _allocTable( table->size * 2 );
+    if ( ntable == NULL ) {
+        /** Carry on with longer chains */
+        return;
+    }
+    ntable->size = table->size * 2;
+
+    for ( unsigned long i = 0 ; i < table->size ; i++ ) {
+        for ( FSCacheNode_t *node = table->buckets[i] ; node != NULL ; node = node->next ) {
+            FSCacheNode_t *nnode = (FSCacheNode_t *)malloc( sizeof( FSCacheNode_t ) );
+            if ( nnode == NULL ) {
+                _freeTable( ntable );
+                return;
+            }
+            nnode->key = StringPool_ref( node->key );
+            nnode->hash = node->hash;
+            nnode->entry = node->entry;
+            FSCacheNode_t **bucket = &ntable->buckets[node->hash & (ntable->size - 1)];
+            nnode->next = *bucket;
+            *bucket = nnode;
+        }
+    }
+
+    /** The entry references move across with the nodes */
+    __atomic_store_n( &cache->table, ntable, __ATOMIC_RELEASE );
+    Epoch_retire( table, _freeTable );
+}
+
+/**
+ * Indexes an entry at a key not yet present. Takes over the caller's
+ * reference on the entry
+ */
+static int _insert( FSCache_t *cache, const char *key, unsigned long hash,
+                    FSCacheEntry_t *fsCacheEntry ) {
+
+    FSCacheNode_t *node = (FSCacheNode_t *)malloc( sizeof( FSCacheNode_t ) );
+    if ( node == NULL ) {
+        return 1;
+    }
+    node->key = StringPool_intern( key );
+    if ( node->key == NULL ) {
+        free( node );
+        return 1;
+    }
+    node->hash = hash;
+    node->entry = fsCacheEntry;
+
+    FSCacheNode_t **bucket = &cache->table->buckets[hash & (cache->table->size - 1)];
+    node->next = *bucket;
+    __atomic_store_n( bucket, node, __ATOMIC_RELEASE );
+
+    __atomic_store_n( &cache->nentries, cache->nentries + 1, __ATOMIC_RELAXED );
+    if ( (unsigned long)cache->nentries > cache->table->size ) {
+        _grow( cache );
+    }
+
+    return 0;
+}
+
+/**
+ * Unindexes the node at a link and drops the index's reference on its entry
+ */
+static void _unlink( FSCache_t *cache, FSCacheNode_t **link ) {
+
+    FSCacheNode_t *node = *link;
+
+    __atomic_store_n( link, node->next, __ATOMIC_RELEASE );
+    __atomic_store_n( &cache->nentries, cache->nentries - 1, __ATOMIC_RELAXED );
+
+    FSCacheEntry_free( node->entry );
+    Epoch_retire( node, _freeNode );
+}
+
+/**
+ * Marks an entry as recently used. The bit is only written when clear so
+ * hot entries don't bounce their cache line between readers
+ */
+static void _markReferenced( FSCacheEntry_t *fsCacheEntry ) {
+
+    if ( !__atomic_load_n( &fsCacheEntry->referenced, __ATOMIC_RELAXED ) ) {
+        __atomic_store_n( &fsCacheEntry->referenced, 1, __ATOMIC_RELAXED );
+    }
+}
+
+/**
+ * Clears the referenced bits of an entry and everything beneath it
+ * Returns:
+ *      1 if any of them were set
+ */
+static int _clearReferenced( FSCacheEntry_t *fsCacheEntry ) {
+
+    int referenced = __atomic_exchange_n( &fsCacheEntry->referenced, 0, __ATOMIC_RELAXED );
+    int nfiles;
+    FSCacheEntry_t **files = FSCacheEntry_getfilelist( fsCacheEntry, &nfiles );
+    for ( int i = 0 ; i < nfiles ; i++ ) {
+        referenced |= _clearReferenced( files[i] );
+    }
+
+    return referenced;
+}
+
+/**
+ * Charges an entry's memory to the cache
+ */
+static void _charge( FSCache_t *cache, FSCacheEntry_t *fsCacheEntry ) {
+
+    fsCacheEntry->nbytes = FSCacheEntry_getnbytes( fsCacheEntry ) + FSCACHE_KEY_NBYTES;
+    cache->nbytes += fsCacheEntry->nbytes;
+}
+
+/**
+ * Returns an entry's charged memory to the cache
+ */
+static void _uncharge( FSCache_t *cache, FSCacheEntry_t *fsCacheEntry ) {
+
+    if ( fsCacheEntry->nbytes > cache->nbytes ) {
+        cache->nbytes = 0;
+    } else {
+        cache->nbytes -= fsCacheEntry->nbytes;
+    }
+}
+
+/**
+ * Points an entry and everything beneath it at an eviction unit
+ */
+static void _setUnit( FSCacheEntry_t *fsCacheEntry, FSCacheUnit_t *unit ) {
+
+    fsCacheEntry->unit = unit;
+    int nfiles;
+    FSCacheEntry_t **files = FSCacheEntry_getfilelist( fsCacheEntry, &nfiles );
+    for ( int i = 0 ; i < nfiles ; i++ ) {
+        _setUnit( files[i], unit );
+    }
+}
+
+/**
+ * Takes a unit off the CLOCK ring and detaches it from its entries
+ */
+static void _unlinkUnit( FSCache_t *cache, FSCacheUnit_t *unit ) {
+
+    if ( unit->next == unit ) {
+        cache->clockhand = NULL;
+    } else {
+        unit->prev->next = unit->next;
+        unit->next->prev = unit->prev;
+        if ( cache->clockhand == unit ) {
+            cache->clockhand = unit->next;
+        }
+    }
+    cache->nunits--;
+
+    _setUnit( unit->entry, NULL );
+    free( unit );
+}
+
+/**
+ * Places an evictable entry onto the CLOCK ring behind the hand
+ */
+static FSCacheUnit_t *_linkUnit( FSCache_t *cache, FSCacheEntry_t *fsCacheEntry ) {
+
+    FSCacheUnit_t *unit = (FSCacheUnit_t *)malloc( sizeof( FSCacheUnit_t ) );
+    if ( unit == NULL ) {
+        return NULL;
+    }
+
+    unit->entry = fsCacheEntry;
+    if ( cache->clockhand == NULL ) {
+        unit->prev = unit;
+        unit->next = unit;
+        cache->clockhand = unit;
+    } else {
+        unit->next = cache->clockhand;
+        unit->prev = cache->clockhand->prev;
+        unit->prev->next = unit;
+        cache->clockhand->prev = unit;
+    }
+    cache->nunits++;
+
+    _setUnit( fsCacheEntry, unit );
+    _clearReferenced( fsCacheEntry );
+
+    return unit;
+}
+
+/**
+ * Drops the index keys for everything beneath an entry
+ */
+static void _deleteChildKeys( FSCache_t *cache, FSCacheEntry_t *fsCacheEntry ) {
+
+    int nfiles;
+    FSCacheEntry_t **files = FSCacheEntry_getfilelist( fsCacheEntry, &nfiles );
+    for ( int i = 0 ; i < nfiles ; i++ ) {
+        FSCacheEntry_t *file = files[i];
+        _deleteChildKeys( cache, file );
+
+        FSCacheNode_t **link = _findLink( cache, file->fname, _hash( file->fname ) );
+        if ( *link != NULL && (*link)->entry == file ) {
+            _uncharge( cache, file );
+            _unlink( cache, link );
+        }
+    }
+}
+
+/**
+ * Evicts a unit: its subtree leaves the index and the directory itself
+ * drops back to a stub so it can be unstubbed again on next access
+ */
+static void _evictUnit( FSCache_t *cache, FSCacheUnit_t *unit ) {
+
+    FSCacheEntry_t *fsCacheEntry = unit->entry;
+
+    printf( "fscache: evicting %s\n", fsCacheEntry->fname );
+
+    _unlinkUnit( cache, unit );
+    _deleteChildKeys( cache, fsCacheEntry );
+
+    _uncharge( cache, fsCacheEntry );
+    FSCacheEntry_restub( fsCacheEntry );
+    _charge( cache, fsCacheEntry );
+
+    cache->nevictions++;
+}
+
+/**
+ * Runs the CLOCK hand until the cache is back under budget. The unit
+ * being inserted is never chosen
+ */
+static void _enforceBudget( FSCache_t *cache, FSCacheUnit_t *protect ) {
+
+    if ( cache->maxbytes == 0 ) {
+        return;
+    }
+
+    /** Two sweeps are enough to clear every reference bit */
+    int nsteps = cache->nunits * 2 + 1;
+    while ( cache->nbytes > cache->maxbytes && cache->clockhand != NULL && nsteps-- > 0 ) {
+        FSCacheUnit_t *hand = cache->clockhand;
+        if ( hand == protect ) {
+            if ( hand->next == hand ) {
+                break;
+            }
+            cache->clockhand = hand->next;
+            continue;
+        }
+        if ( _clearReferenced( hand->entry ) ) {
+            cache->clockhand = hand->next;
+            continue;
+        }
+        _evictUnit( cache, hand );
+    }
+}
+
+/**
+ * Detaches any eviction units from the entries prior to emptying the cache
+ */
+static void _releaseUnits( FSCache_t *cache ) {
+
+    while ( cache->clockhand != NULL ) {
+        _unlinkUnit( cache, cache->clockhand );
+    }
+}
 
 /**
  * Initialise a new FSCache
@@ -35,22 +393,27 @@
  */
 FSCache_t *FSCache_create() {
 
-    FSCache_t *tmp = (FSCache_t *)malloc( sizeof( FSCache_t ) );
+    FSCache_t *tmp = (FSCache_t *)calloc( 1, sizeof( FSCache_t ) );
     if ( tmp == NULL ) {
         return NULL;
     }
 
-    tmp->cache = json_object_new_object();
-    if ( tmp->cache == NULL ) {
+    tmp->table = _allocTable( FSCACHE_DEFAULT_HASH_SIZE );
+    if ( tmp->table == NULL ) {
         free( tmp );
         return NULL;
     }
+    tmp->table->size = FSCACHE_DEFAULT_HASH_SIZE;
+    tmp->ttl[FSCACHE_TTL_BYLETTER] = FSCACHE_DEFAULT_TTL_BYLETTER;
+    tmp->ttl[FSCACHE_TTL_GAME] = FSCACHE_DEFAULT_TTL_GAME;
+    tmp->ttl[FSCACHE_TTL_SEARCH] = FSCACHE_DEFAULT_TTL_SEARCH;
+    pthread_mutex_init( &tmp->lock, NULL );
 
     return tmp;
 }
 
 /**
- * Frees the cache
+ * Frees the cache. No other thread may be using it
  * In:
  *      N/A
  * Out:
@@ -61,13 +424,23 @@ FSCache_t *FSCache_create() {
  */
 int FSCache_free( FSCache_t *cache ) {
 
-    if ( cache == NULL || cache->cache == NULL ) {
+    if ( cache == NULL ) {
         return 1;
     }
 
-    json_object_put( cache->cache );
+    _releaseUnits( cache );
+    for ( unsigned long i = 0 ; i < cache->table->size ; i++ ) {
+        for ( FSCacheNode_t *node = cache->table->buckets[i] ; node != NULL ; node = node->next ) {
+            FSCacheEntry_free( node->entry );
+        }
+    }
+    _freeTable( cache->table );
+    pthread_mutex_destroy( &cache->lock );
     free( cache );
 
+    /** Nothing retired by this cache outlives it */
+    Epoch_synchronize();
+
     return 0;
 }
 
@@ -83,45 +456,144 @@ int FSCache_free( FSCache_t *cache ) {
  */
 int FSCache_flush( FSCache_t *cache ) {
 
-    if ( cache == NULL || cache->cache == NULL ) {
+    if ( cache == NULL ) {
         return 1;
     }
 
-    json_object_put( cache->cache );
-    cache->cache = json_object_new_object();
-    if ( cache->cache == NULL ) {
-        free( cache );
+    pthread_mutex_lock( &cache->lock );
+
+    FSCacheTable_t *table = _allocTable( FSCACHE_DEFAULT_HASH_SIZE );
+    if ( table == NULL ) {
+        pthread_mutex_unlock( &cache->lock );
         return 1;
     }
+    table->size = FSCACHE_DEFAULT_HASH_SIZE;
+
+    _releaseUnits( cache );
+
+    /** Swap in an empty index; readers may still be walking the old one */
+    FSCacheTable_t *otable = cache->table;
+    __atomic_store_n( &cache->table, table, __ATOMIC_RELEASE );
+    __atomic_store_n( &cache->nentries, 0, __ATOMIC_RELAXED );
+    for ( unsigned long i = 0 ; i < otable->size ; i++ ) {
+        for ( FSCacheNode_t *node = otable->buckets[i] ; node != NULL ; node = node->next ) {
+            FSCacheEntry_free( node->entry );
+        }
+    }
+    Epoch_retire( otable, _freeTable );
+    cache->nbytes = 0;
+
+    pthread_mutex_unlock( &cache->lock );
 
     return 0;
 }
 
 /**
- * Adds an item to the cache. This will overwrite anything already at the
- * key
+ * Returns the number of keys held in the cache
  * In:
- *      key - cache key. Required.
- *      fsCacheEntry - cache value. Required
+ *      cache - the cache. Required
+ * Out:
+ *      N/A
+ * Returns:
+ *      Number of keys
+ */
+int FSCache_getnentries( FSCache_t *cache ) {
+
+    if ( cache == NULL ) {
+        return 0;
+    }
+
+    return __atomic_load_n( &cache->nentries, __ATOMIC_RELAXED );
+}
+
+/**
+ * Sets the memory budget for the cache. When exceeded, least recently
+ * used game directories are evicted back to stubs
+ * In:
+ *      cache - the cache. Required
+ *      maxbytes - budget in bytes. 0 = unlimited
  * Out:
  *      N/A
  * Returns:
  *      0 = success
  *      1 = failure
  */
-int FSCache_add( FSCache_t *cache, const char *key, FSCacheEntry_t *fsCacheEntry ) {
+int FSCache_setmaxbytes( FSCache_t *cache, size_t maxbytes ) {
 
-    if ( cache == NULL || key == NULL || fsCacheEntry == NULL || cache->cache == NULL ) {
+    if ( cache == NULL ) {
         return 1;
     }
 
-    return json_object_object_add( cache->cache, key, fsCacheEntry );
+    pthread_mutex_lock( &cache->lock );
+    cache->maxbytes = maxbytes;
+    _enforceBudget( cache, NULL );
+    pthread_mutex_unlock( &cache->lock );
+
+    return 0;
 }
 
 /**
- * Adds an item to the cache and all it's available sub-entries.
- * This will overwrite anything already at the
- * key
+ * Returns the estimated memory held by the cache
+ * In:
+ *      cache - the cache. Required
+ * Out:
+ *      N/A
+ * Returns:
+ *      Size in bytes
+ */
+size_t FSCache_getnbytes( FSCache_t *cache ) {
+
+    if ( cache == NULL ) {
+        return 0;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+    size_t nbytes = cache->nbytes;
+    pthread_mutex_unlock( &cache->lock );
+
+    return nbytes;
+}
+
+/**
+ * FSCache_add() with the writer lock held
+ */
+static int _add( FSCache_t *cache, const char *key, FSCacheEntry_t *fsCacheEntry ) {
+
+    unsigned long hash = _hash( key );
+    FSCacheNode_t **link = _findLink( cache, key, hash );
+
+    if ( *link != NULL ) {
+        FSCacheEntry_t *existing = (*link)->entry;
+        if ( existing != fsCacheEntry && existing->unit != NULL &&
+             existing->unit->entry == existing ) {
+            _unlinkUnit( cache, existing->unit );
+            _deleteChildKeys( cache, existing );
+        }
+        _uncharge( cache, existing );
+
+        /**
+         * _deleteChildKeys() may have unlinked nodes in the same chain, so
+         * look the link up again. Readers that already saw the old entry
+         * can keep using it until they leave their epoch
+         */
+        link = _findLink( cache, key, hash );
+        __atomic_store_n( &(*link)->entry, fsCacheEntry, __ATOMIC_RELEASE );
+        FSCacheEntry_free( existing );
+        _charge( cache, fsCacheEntry );
+        return 0;
+    }
+
+    if ( _insert( cache, key, hash, fsCacheEntry ) != 0 ) {
+        return 1;
+    }
+    _charge( cache, fsCacheEntry );
+
+    return 0;
+}
+
+/**
+ * Adds an item to the cache. This will overwrite anything already at the
+ * key. The cache takes over the caller's reference on the item
  * In:
  *      key - cache key. Required.
  *      fsCacheEntry - cache value. Required
@@ -131,17 +603,23 @@ int FSCache_add( FSCache_t *cache, const char *key, FSCacheEntry_t *fsCacheEntry
  *      0 = success
  *      1 = failure
  */
-int FSCache_addAll( FSCache_t *cache, const char *key, FSCacheEntry_t *fsCacheEntry ) {
+int FSCache_add( FSCache_t *cache, const char *key, FSCacheEntry_t *fsCacheEntry ) {
 
-    if ( cache == NULL || key == NULL || fsCacheEntry == NULL || cache->cache == NULL ) {
+    if ( cache == NULL || key == NULL || fsCacheEntry == NULL ) {
         return 1;
     }
 
-    /** Add top-level entry */
-    int rv = json_object_object_add( cache->cache, key, fsCacheEntry );
-    if ( rv != 0 ) {
-        return 1;
-    }
+    pthread_mutex_lock( &cache->lock );
+    int rv = _add( cache, key, fsCacheEntry );
+    pthread_mutex_unlock( &cache->lock );
+
+    return rv;
+}
+
+/**
+ * Indexes the sub-entries of an item by their fname
+ */
+static int _addChildren( FSCache_t *cache, FSCacheEntry_t *fsCacheEntry ) {
 
     /** Traverse 'files' and recursively add the entries */
     int nfiles = FSCacheEntry_getnfiles( fsCacheEntry );
@@ -151,20 +629,209 @@ int FSCache_addAll( FSCache_t *cache, const char *key, FSCacheEntry_t *fsCacheEn
             return 1;
         }
 
-        json_object *subclone = NULL;
-        if ( json_object_deep_copy( file, &subclone, NULL ) == 1 ) {
+        if ( _add( cache, FSCacheEntry_getfname( file ),
+                   FSCacheEntry_ref( file ) ) != 0 ) {
+            return 1;
+        }
+        if ( _addChildren( cache, file ) != 0 ) {
             return 1;
         }
-        const char *file_fname = FSCacheEntry_getfname( file );
-        rv = FSCache_addAll( cache, FSCacheEntry_getfname( file ), subclone );
-        if ( rv != 0 ) {
+    }
+
+    return 0;
+}
+
+/**
+ * Swaps any "dirstub" children of a new, unpublished directory for the
+ * directories already loaded at their keys, so that refreshing a listing
+ * doesn't discard the games beneath it
+ */
+static void _keepLoaded( FSCache_t *cache, FSCacheEntry_t *fsCacheEntry ) {
+
+    FSCacheEntryFiles_t *files = fsCacheEntry->files;
+    if ( files == NULL ) {
+        return;
+    }
+
+    for ( int i = 0 ; i < files->nfiles ; i++ ) {
+        FSCacheEntry_t *file = files->files[i];
+        if ( file->type != FSCACHEENTRY_DIR_STUB ) {
+            continue;
+        }
+        FSCacheEntry_t *loaded = _peek( cache, file->fname );
+        if ( loaded != NULL && loaded != file && loaded->type == FSCACHEENTRY_DIR ) {
+            files->files[i] = FSCacheEntry_ref( loaded );
+            FSCacheEntry_free( file );
+        }
+    }
+}
+
+/**
+ * FSCache_addAll() with the writer lock held
+ */
+static int _addAll( FSCache_t *cache, const char *key, FSCacheEntry_t *fsCacheEntry ) {
+
+    /** Directories fetched without a timestamp are stamped by key class */
+    if ( fsCacheEntry->fetched == 0 ) {
+        FSCacheTTLClass ttlclass = FSCache_getttlclass( key );
+        if ( ttlclass != FSCACHE_TTL_MAX ) {
+            FSCacheEntry_setfetched( fsCacheEntry, time( NULL ), cache->ttl[ttlclass] );
+        }
+    }
+    _keepLoaded( cache, fsCacheEntry );
+
+    /**
+     * Add top-level entry, upgrading an existing stub or refreshing an
+     * existing directory in place if present
+     */
+    FSCacheEntry_t *existing = _peek( cache, key );
+    if ( existing != NULL && existing != fsCacheEntry &&
+         ( existing->type == FSCACHEENTRY_DIR_STUB ||
+           ( existing->type == FSCACHEENTRY_DIR && fsCacheEntry->type == FSCACHEENTRY_DIR ) ) ) {
+        int refresh = existing->type == FSCACHEENTRY_DIR;
+        if ( refresh && existing->unit != NULL && existing->unit->entry == existing ) {
+            _unlinkUnit( cache, existing->unit );
+            _deleteChildKeys( cache, existing );
+        }
+        _uncharge( cache, existing );
+        int rv = refresh ? FSCacheEntry_refresh( existing, fsCacheEntry )
+                         : FSCacheEntry_unstub( existing, fsCacheEntry );
+        if ( rv == 0 && refresh ) {
+            cache->nrefreshes++;
+        }
+        _charge( cache, existing );
+        if ( rv == 0 ) {
+            FSCacheEntry_free( fsCacheEntry );
+            fsCacheEntry = existing;
+        } else {
+            if ( _add( cache, key, fsCacheEntry ) != 0 ) {
+                return 1;
+            }
+        }
+    } else {
+        if ( _add( cache, key, fsCacheEntry ) != 0 ) {
             return 1;
         }
     }
 
+    if ( _addChildren( cache, fsCacheEntry ) != 0 ) {
+        return 1;
+    }
+
+    if ( (fsCacheEntry->flags & FSCACHEENTRY_FLAG_EVICTABLE) &&
+         fsCacheEntry->unit == NULL ) {
+        FSCacheUnit_t *unit = _linkUnit( cache, fsCacheEntry );
+        if ( unit != NULL ) {
+            _enforceBudget( cache, unit );
+        }
+    }
+
     return 0;
 }
 
+/**
+ * Adds an item to the cache and all it's available sub-entries.
+ * Sub-entries are indexed by their fname and shared with the item's
+ * file list rather than copied. If the key currently holds a "dirstub",
+ * the stub is filled in with the item's contents in place so that
+ * parent directories listing the stub see the full directory.
+ * Otherwise, this will overwrite anything already at the key.
+ *
+ * Evictable items (game directories) become an eviction unit and may
+ * cause older units to be evicted to honour the memory budget
+ * In:
+ *      key - cache key. Required.
+ *      fsCacheEntry - cache value. Required
+ * Out:
+ *      N/A
+ * Returns:
+ *      0 = success
+ *      1 = failure
+ */
+int FSCache_addAll( FSCache_t *cache, const char *key, FSCacheEntry_t *fsCacheEntry ) {
+
+    if ( cache == NULL || key == NULL || fsCacheEntry == NULL ) {
+        return 1;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+    int rv = _addAll( cache, key, fsCacheEntry );
+    pthread_mutex_unlock( &cache->lock );
+
+    return rv;
+}
+
+/**
+ * Appends an entry to the file list of the directory held at a key. The
+ * new entry is not itself indexed
+ * In:
+ *      cache - the cache. Required
+ *      key - cache key of a directory. Required.
+ *      file - entry to append. The directory takes the caller's reference
+ * Out:
+ *      N/A
+ * Returns:
+ *      0 = success
+ *      1 = failure
+ *      2 = cache key not present
+ */
+int FSCache_addFile( FSCache_t *cache, const char *key, FSCacheEntry_t *file ) {
+
+    if ( cache == NULL || key == NULL || file == NULL ) {
+        return 1;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+
+    FSCacheEntry_t *fsCacheEntry = _peek( cache, key );
+    if ( fsCacheEntry == NULL ) {
+        pthread_mutex_unlock( &cache->lock );
+        return 2;
+    }
+
+    _uncharge( cache, fsCacheEntry );
+    int rv = FSCacheEntry_addFile( fsCacheEntry, file );
+    _charge( cache, fsCacheEntry );
+
+    pthread_mutex_unlock( &cache->lock );
+
+    return rv;
+}
+
+/**
+ * Looks up an item without taking a reference or any locks. The caller
+ * must be inside an epoch, and the item and its file list are only valid
+ * until the epoch is exited
+ * In:
+ *      cache - the cache. Required
+ *      key - cache key. Required.
+ * Out:
+ *      N/A
+ * Returns:
+ *      The cached object or NULL
+ */
+FSCacheEntry_t *FSCache_lookup( FSCache_t *cache, const char *key ) {
+
+    if ( cache == NULL || key == NULL ) {
+        return NULL;
+    }
+
+    unsigned long hash = _hash( key );
+    FSCacheTable_t *table = __atomic_load_n( &cache->table, __ATOMIC_ACQUIRE );
+    FSCacheNode_t *node = __atomic_load_n( &table->buckets[hash & (table->size - 1)],
+                                           __ATOMIC_ACQUIRE );
+    while ( node != NULL ) {
+        if ( node->hash == hash && strcmp( node->key, key ) == 0 ) {
+            FSCacheEntry_t *fsCacheEntry = __atomic_load_n( &node->entry, __ATOMIC_ACQUIRE );
+            _markReferenced( fsCacheEntry );
+            return fsCacheEntry;
+        }
+        node = __atomic_load_n( &node->next, __ATOMIC_ACQUIRE );
+    }
+
+    return NULL;
+}
+
 /**
  * Retrieves an item from the cache
  * In:
@@ -173,18 +840,89 @@ int FSCache_addAll( FSCache_t *cache, const char *key, FSCacheEntry_t *fsCacheEn
  * Out:
  *      N/A
  * Returns:
- *      Copy of the cached object or NULL
+ *      A new reference on the cached object, released with
+ *      FSCacheEntry_free(), or NULL
  */
 FSCacheEntry_t *FSCache_get( FSCache_t *cache, const char *key ) {
 
-    if ( cache == NULL || key == NULL || cache->cache == NULL ) {
+    if ( cache == NULL || key == NULL ) {
         return NULL;
     }
 
-    json_object *tmp = json_object_object_get( cache->cache, key );
-    if ( tmp == NULL ) {
-        return NULL;
+    FSCacheEntry_t *fsCacheEntry;
+
+    /** A failed tryref means the item was replaced under us, so look again */
+    Epoch_enter();
+    do {
+        fsCacheEntry = FSCache_lookup( cache, key );
+    } while ( fsCacheEntry != NULL && FSCacheEntry_tryref( fsCacheEntry ) == NULL );
+    Epoch_exit();
+
+    return fsCacheEntry;
+}
+
+/**
+ * Retrieves a snapshot of the file list of the item at a key that
+ * remains valid outside an epoch
+ * In:
+ *      cache - the cache. Required
+ *      key - cache key. Required.
+ * Out:
+ *      files - references on the files. Release with FSCache_releasefiles()
+ *      nfiles - number of files
+ * Returns:
+ *      0 = success
+ *      1 = failure
+ *      2 = cache key not present
+ */
+int FSCache_getfiles( FSCache_t *cache, const char *key,
+                      FSCacheEntry_t ***files, int *nfiles ) {
+
+    if ( cache == NULL || key == NULL || files == NULL || nfiles == NULL ) {
+        return 1;
+    }
+
+    *files = NULL;
+    *nfiles = 0;
+
+    int rv = 0;
+
+    Epoch_enter();
+    FSCacheEntry_t *fsCacheEntry = FSCache_lookup( cache, key );
+    if ( fsCacheEntry == NULL ) {
+        rv = 2;
+    } else {
+        int n;
+        FSCacheEntry_t **list = FSCacheEntry_getfilelist( fsCacheEntry, &n );
+        if ( n > 0 ) {
+            *files = (FSCacheEntry_t **)malloc( n * sizeof( FSCacheEntry_t * ) );
+            if ( *files == NULL ) {
+                rv = 1;
+            } else {
+                /** Files dropped by a concurrent eviction are skipped */
+                for ( int i = 0 ; i < n ; i++ ) {
+                    FSCacheEntry_t *file = FSCacheEntry_tryref( list[i] );
+                    if ( file != NULL ) {
+                        (*files)[(*nfiles)++] = file;
+                    }
+                }
+            }
+        }
     }
+    Epoch_exit();
+
+    return rv;
+}
+
+/**
+ * Releases a snapshot returned by FSCache_getfiles()
+ */
+void FSCache_releasefiles( FSCacheEntry_t **files, int nfiles ) {
+
+    for ( int i = 0 ; i < nfiles ; i++ ) {
+        FSCacheEntry_free( files[i] );
+    }
+    free( files );
 }
 
 /**
@@ -204,14 +942,142 @@ int FSCache_delete( FSCache_t *cache, const char *key ) {
     if ( cache == NULL || key == NULL ) {
         return 1;
     }
-    
-    json_object *tmpobj = json_object_object_get( cache->cache, key );
-    if ( tmpobj == NULL ) {
+
+    pthread_mutex_lock( &cache->lock );
+
+    FSCacheEntry_t *fsCacheEntry = _peek( cache, key );
+    if ( fsCacheEntry == NULL ) {
         /** Not present in the cache */
+        pthread_mutex_unlock( &cache->lock );
+        return 2;
+    }
+
+    /** Game directories take their contents with them */
+    if ( fsCacheEntry->unit != NULL && fsCacheEntry->unit->entry == fsCacheEntry ) {
+        _unlinkUnit( cache, fsCacheEntry->unit );
+        _deleteChildKeys( cache, fsCacheEntry );
+    }
+    _uncharge( cache, fsCacheEntry );
+    _unlink( cache, _findLink( cache, key, _hash( key ) ) );
+
+    pthread_mutex_unlock( &cache->lock );
+
+    return 0;
+}
+
+/**
+ * Evicts a game directory, dropping the keys for its contents and
+ * returning the directory to a stub
+ * In:
+ *      cache - the cache. Required
+ *      key - cache key of an evictable directory. Required.
+ * Out:
+ *      N/A
+ * Returns:
+ *      0 = success
+ *      1 = failure
+ *      2 = cache key not present or not evictable
+ */
+int FSCache_evict( FSCache_t *cache, const char *key ) {
+
+    if ( cache == NULL || key == NULL ) {
+        return 1;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+
+    FSCacheEntry_t *fsCacheEntry = _peek( cache, key );
+    if ( fsCacheEntry == NULL || fsCacheEntry->unit == NULL ||
+         fsCacheEntry->unit->entry != fsCacheEntry ) {
+        pthread_mutex_unlock( &cache->lock );
         return 2;
     }
 
-    json_object_object_del( cache->cache, key );
+    _evictUnit( cache, fsCacheEntry->unit );
+
+    pthread_mutex_unlock( &cache->lock );
+
+    return 0;
+}
+
+/**
+ * Sets how long fetched directories of a class stay fresh. Applies to
+ * directories added from now on
+ * In:
+ *      cache - the cache. Required
+ *      ttlclass - the class of directory
+ *      ttl - seconds. 0 = never expires
+ * Out:
+ *      N/A
+ * Returns:
+ *      0 = success
+ *      1 = failure
+ */
+int FSCache_setttl( FSCache_t *cache, FSCacheTTLClass ttlclass, int ttl ) {
+
+    if ( cache == NULL || ttlclass < 0 || ttlclass >= FSCACHE_TTL_MAX || ttl < 0 ) {
+        return 1;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+    cache->ttl[ttlclass] = ttl;
+    pthread_mutex_unlock( &cache->lock );
 
     return 0;
 }
+
+/**
+ * Returns the TTL of a class of directory in seconds. 0 = never expires
+ */
+int FSCache_getttl( FSCache_t *cache, FSCacheTTLClass ttlclass ) {
+
+    if ( cache == NULL || ttlclass < 0 || ttlclass >= FSCACHE_TTL_MAX ) {
+        return 0;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+    int ttl = cache->ttl[ttlclass];
+    pthread_mutex_unlock( &cache->lock );
+
+    return ttl;
+}
+
+/**
+ * Classifies a cache key for expiry. /by-letter/[A-Z] and /search/[term]
+ * are listings; anything deeper beneath them is a game directory
+ * In:
+ *      key - cache key. Required
+ * Out:
+ *      N/A
+ * Returns:
+ *      The class, or FSCACHE_TTL_MAX if the key never expires
+ */
+FSCacheTTLClass FSCache_getttlclass( const char *key ) {
+
+    if ( key == NULL ) {
+        return FSCACHE_TTL_MAX;
+    }
+
+    FSCacheTTLClass listing;
+    if ( strncmp( key, "/by-letter/", 11 ) == 0 ) {
+        listing = FSCACHE_TTL_BYLETTER;
+    } else if ( strncmp( key, "/search/", 8 ) == 0 ) {
+        listing = FSCACHE_TTL_SEARCH;
+    } else {
+        return FSCACHE_TTL_MAX;
+    }
+
+    /** Count the path segments, ignoring a trailing slash */
+    int nsegments = 0;
+    for ( const char *p = key ; *p != '\0' ; p++ ) {
+        if ( *p == '/' && p[1] != '\0' && p[1] != '/' ) {
+            nsegments++;
+        }
+    }
+
+    if ( nsegments < 2 ) {
+        return FSCACHE_TTL_MAX;
+    }
+
+    return nsegments == 2 ? listing : FSCACHE_TTL_GAME;
+}
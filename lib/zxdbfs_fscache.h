@@ -21,25 +21,94 @@
 #ifndef _zxdbfs_fscache_h
 #define _zxdbfs_fscache_h
 
+#include <pthread.h>
+
 #include <json-c/json.h>
-#include <json-c/linkhash.h>
 
 #include "zxdbfs_fscacheentry.h"
 
 #define FSCACHE_DEFAULT_HASH_SIZE 16
+#define FSCACHE_DEFAULT_MAX_BYTES (64 * 1024 * 1024)
+
+/**
+ * Fetched directories expire after a TTL chosen by their class. Expired
+ * directories are still served while they are refreshed
+ */
+typedef enum {
+    FSCACHE_TTL_BYLETTER,           /** /by-letter/[A-Z] */
+    FSCACHE_TTL_GAME,               /** Game directories */
+    FSCACHE_TTL_SEARCH,             /** /search/[term] */
+    FSCACHE_TTL_MAX
+} FSCacheTTLClass;
+
+#define FSCACHE_DEFAULT_TTL_BYLETTER    (7 * 24 * 60 * 60)
+#define FSCACHE_DEFAULT_TTL_GAME        (24 * 60 * 60)
+#define FSCACHE_DEFAULT_TTL_SEARCH      (60 * 60)
+
+/**
+ * An evictable subtree of the cache, typically a game directory. Units
+ * sit on a CLOCK ring; lookups of any entry in the subtree mark it as
+ * recently referenced
+ */
+typedef struct FSCacheUnit {
+    FSCacheEntry_t *entry;
+    struct FSCacheUnit *prev;
+    struct FSCacheUnit *next;
+} FSCacheUnit_t;
+
+/**
+ * The key index is a hash table readers walk without taking any locks,
+ * inside an epoch (see zxdbfs_epoch.h). Writers are serialised by the
+ * cache lock and only ever publish fully built nodes and tables; anything
+ * they unlink is retired rather than freed
+ */
+typedef struct FSCacheNode {
+    const char *key;                /** Interned via the string pool */
+    unsigned long hash;
+    FSCacheEntry_t *entry;
+    struct FSCacheNode *next;
+} FSCacheNode_t;
+
+typedef struct FSCacheTable {
+    unsigned long size;             /** Power of 2 */
+    FSCacheNode_t *buckets[];
+} FSCacheTable_t;
 
 typedef struct FSCache {
-    json_object *cache;
+    FSCacheTable_t *table;
+    int nentries;
+    pthread_mutex_t lock;       /** Writer lock */
+    size_t nbytes;
+    size_t maxbytes;            /** 0 = unlimited */
+    FSCacheUnit_t *clockhand;
+    int nunits;
+    int nevictions;
+    int ttl[FSCACHE_TTL_MAX];   /** Seconds. 0 = never expires */
+    int nrefreshes;
 } FSCache_t;
 
 extern FSCache_t *FSCache_create();
 extern int FSCache_free( FSCache_t *cache );
 extern int FSCache_flush( FSCache_t *cache );
+extern int FSCache_getnentries( FSCache_t *cache );
 
+extern FSCacheEntry_t *FSCache_lookup( FSCache_t *cache, const char *key );
 extern FSCacheEntry_t *FSCache_get( FSCache_t *cache, const char *key );
+extern int FSCache_getfiles( FSCache_t *cache, const char *key,
+                             FSCacheEntry_t ***files, int *nfiles );
+extern void FSCache_releasefiles( FSCacheEntry_t **files, int nfiles );
 extern int FSCache_add( FSCache_t *cache, const char *key, FSCacheEntry_t *fsCacheEntry );
 extern int FSCache_addAll( FSCache_t *cache, const char *key, FSCacheEntry_t *fsCacheEntry );
+extern int FSCache_addFile( FSCache_t *cache, const char *key, FSCacheEntry_t *file );
 extern int FSCache_delete( FSCache_t *cache, const char *key );
 
+extern int FSCache_setmaxbytes( FSCache_t *cache, size_t maxbytes );
+extern size_t FSCache_getnbytes( FSCache_t *cache );
+extern int FSCache_evict( FSCache_t *cache, const char *key );
+
+extern int FSCache_setttl( FSCache_t *cache, FSCacheTTLClass ttlclass, int ttl );
+extern int FSCache_getttl( FSCache_t *cache, FSCacheTTLClass ttlclass );
+extern FSCacheTTLClass FSCache_getttlclass( const char *key );
+
 
 #endif /** !_zxdbfs_fscache_h */
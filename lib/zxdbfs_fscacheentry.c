@@ -19,10 +19,28 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "zxdbfs_epoch.h"
 #include "zxdbfs_fscacheentry.h"
 #include "zxdbfs_json.h"
+#include "zxdbfs_strpool.h"
+
+#define FSCACHEENTRY_DEFAULT_NFILES 8
+
+/** Generations are never reused, even by a new entry at the same path */
+static uint64_t nextgeneration = 0;
+
+/**
+ * Marks a change to an entry's children
+ */
+static void _bumpGeneration( FSCacheEntry_t *fsCacheEntry ) {
+
+    __atomic_store_n( &fsCacheEntry->generation,
+                      __atomic_add_fetch( &nextgeneration, 1, __ATOMIC_RELAXED ),
+                      __ATOMIC_RELEASE );
+}
 
 /**
  * Return a suitably organised FSCacheEntry
@@ -35,7 +53,7 @@
  *      N/A
  * Returns:
  *      NULL - creation fails
- *      json_object * - creation OK
+ *      FSCacheEntry_t * - creation OK
  */
 FSCacheEntry_t *FSCacheEntry_create( const char *fname,
                                      FSCacheEntryType type,
@@ -46,13 +64,18 @@ FSCacheEntry_t *FSCacheEntry_create( const char *fname,
         return NULL;
     }
 
-    FSCacheEntry_t *tmpobj = json_object_new_object();
+    FSCacheEntry_t *tmpobj = (FSCacheEntry_t *)calloc( 1, sizeof( FSCacheEntry_t ) );
     if ( tmpobj == NULL ) {
         return NULL;
     }
 
+    tmpobj->refcount = 1;
+    _bumpGeneration( tmpobj );
     FSCacheEntry_settype( tmpobj, type );
-    FSCacheEntry_setfname( tmpobj, fname );
+    if ( FSCacheEntry_setfname( tmpobj, fname ) != 0 ) {
+        free( tmpobj );
+        return NULL;
+    }
     FSCacheEntry_seturl( tmpobj, url );
     FSCacheEntry_setsize( tmpobj, size );
     if ( type == FSCACHEENTRY_DIR ) {
@@ -63,7 +86,105 @@ FSCacheEntry_t *FSCacheEntry_create( const char *fname,
 }
 
 /**
- * Releases a cache entry object
+ * Allocates an empty child list
+ */
+static FSCacheEntryFiles_t *_allocFiles( int filessz ) {
+
+    FSCacheEntryFiles_t *files = (FSCacheEntryFiles_t *)
+        malloc( sizeof( FSCacheEntryFiles_t ) + filessz * sizeof( FSCacheEntry_t * ) );
+    if ( files == NULL ) {
+        return NULL;
+    }
+    files->nfiles = 0;
+    files->filessz = filessz;
+
+    return files;
+}
+
+/**
+ * Unpublishes the child list of an entry and drops its references on the
+ * children. The list and the children are reclaimed by epoch, so readers
+ * still walking it are unaffected
+ */
+static void _freeFiles( FSCacheEntry_t *obj ) {
+
+    FSCacheEntryFiles_t *files = obj->files;
+    if ( files == NULL ) {
+        return;
+    }
+
+    __atomic_store_n( &obj->files, NULL, __ATOMIC_RELEASE );
+    for ( int i = 0 ; i < files->nfiles ; i++ ) {
+        FSCacheEntry_free( files->files[i] );
+    }
+    Epoch_retire( files, free );
+}
+
+/**
+ * Releases the memory of an entry once no reader can see it
+ */
+static void _destroy( void *ptr ) {
+
+    FSCacheEntry_t *obj = (FSCacheEntry_t *)ptr;
+
+    _freeFiles( obj );
+    StringPool_release( obj->fname );
+    free( obj->url );
+    free( obj );
+}
+
+/**
+ * Takes an additional reference on a cache entry. Entries are shared
+ * between their parent's file list and the FSCache path index
+ * In:
+ *      obj - object to reference
+ * Out:
+ *      N/A
+ * Returns:
+ *      obj
+ */
+FSCacheEntry_t *FSCacheEntry_ref( FSCacheEntry_t *obj ) {
+
+    if ( obj == NULL ) {
+        return NULL;
+    }
+
+    __atomic_add_fetch( &obj->refcount, 1, __ATOMIC_RELAXED );
+
+    return obj;
+}
+
+/**
+ * Takes a reference on an entry found without holding a reference,
+ * unless its last reference has already gone. Call within an epoch
+ * In:
+ *      obj - object to reference
+ * Out:
+ *      N/A
+ * Returns:
+ *      obj or NULL if it is being released
+ */
+FSCacheEntry_t *FSCacheEntry_tryref( FSCacheEntry_t *obj ) {
+
+    if ( obj == NULL ) {
+        return NULL;
+    }
+
+    int refcount = __atomic_load_n( &obj->refcount, __ATOMIC_RELAXED );
+    do {
+        if ( refcount == 0 ) {
+            return NULL;
+        }
+    } while ( !__atomic_compare_exchange_n( &obj->refcount, &refcount, refcount + 1,
+                                            1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) );
+
+    return obj;
+}
+
+/**
+ * Drops a reference on a cache entry object. The last reference releases
+ * the entry and its references on any entries it contains. The memory
+ * itself is reclaimed once no reader in an epoch can still see it
  * In:
  *      obj - object to free
  * Out:
@@ -77,7 +198,11 @@ void FSCacheEntry_free( FSCacheEntry_t *obj ) {
         return;
     }
 
-    json_object_put( obj );
+    if ( __atomic_sub_fetch( &obj->refcount, 1, __ATOMIC_ACQ_REL ) > 0 ) {
+        return;
+    }
+
+    Epoch_retire( obj, _destroy );
 }
 
 /**
@@ -96,17 +221,190 @@ FSCacheEntry_t *FSCacheEntry_clone( FSCacheEntry_t *obj ) {
         return NULL;
     }
 
-    json_object *tmpobj = NULL;
-    int rv = json_object_deep_copy( obj, &tmpobj, NULL );
-    if ( rv != 0 ) {
+    FSCacheEntry_t *tmpobj = (FSCacheEntry_t *)calloc( 1, sizeof( FSCacheEntry_t ) );
+    if ( tmpobj == NULL ) {
         return NULL;
     }
 
+    tmpobj->refcount = 1;
+    tmpobj->type = obj->type;
+    tmpobj->flags = obj->flags;
+    tmpobj->fname = StringPool_ref( obj->fname );
+    tmpobj->size = obj->size;
+    tmpobj->fetched = obj->fetched;
+    tmpobj->ttl = obj->ttl;
+    if ( obj->url != NULL ) {
+        tmpobj->url = strdup( obj->url );
+        if ( tmpobj->url == NULL ) {
+            FSCacheEntry_free( tmpobj );
+            return NULL;
+        }
+    }
+
+    if ( obj->files != NULL ) {
+        FSCacheEntry_setfiles( tmpobj );
+        for ( int i = 0 ; i < obj->files->nfiles ; i++ ) {
+            FSCacheEntry_t *file = FSCacheEntry_clone( obj->files->files[i] );
+            if ( file == NULL || FSCacheEntry_addFile( tmpobj, file ) != 0 ) {
+                FSCacheEntry_free( file );
+                FSCacheEntry_free( tmpobj );
+                return NULL;
+            }
+        }
+    }
+
     return tmpobj;
 }
 
 /**
- * Adds a "file" (or "dir") FSCacheEntry to a "dir" FSCacheEntry
+ * Moves the children and fetch state of one directory entry to another
+ */
+static void _adopt( FSCacheEntry_t *dst, FSCacheEntry_t *src ) {
+
+    FSCacheEntryFiles_t *files = dst->files;
+
+    dst->flags |= src->flags;
+    __atomic_store_n( &dst->size, src->size, __ATOMIC_RELAXED );
+    __atomic_store_n( &dst->fetched, src->fetched, __ATOMIC_RELAXED );
+    __atomic_store_n( &dst->ttl, src->ttl, __ATOMIC_RELAXED );
+    __atomic_store_n( &dst->refreshed, 0, __ATOMIC_RELAXED );
+    __atomic_store_n( &dst->files, src->files, __ATOMIC_RELEASE );
+    src->files = NULL;
+    _bumpGeneration( dst );
+
+    /** Only now drop the old children, readers may still be listing them */
+    if ( files != NULL ) {
+        for ( int i = 0 ; i < files->nfiles ; i++ ) {
+            FSCacheEntry_free( files->files[i] );
+        }
+        Epoch_retire( files, free );
+    }
+}
+
+/**
+ * Turns a "dirstub" FSCacheEntry into the full directory in place so
+ * that everything already referencing the stub sees the real contents.
+ * The children of the full entry are moved across to the stub
+ * In:
+ *      stubFSCacheEntry - a "dirstub" FSCacheEntry. Required
+ *      fsCacheEntry - the full "dir" FSCacheEntry. Required
+ * Out:
+ *      N/A
+ * Returns:
+ *      0 = success
+ *      1 = failure
+ */
+int FSCacheEntry_unstub( FSCacheEntry_t *stubFSCacheEntry,
+                         FSCacheEntry_t *fsCacheEntry ) {
+
+    if ( stubFSCacheEntry == NULL || fsCacheEntry == NULL ||
+         stubFSCacheEntry == fsCacheEntry ) {
+        return 1;
+    }
+
+    if ( stubFSCacheEntry->type != FSCACHEENTRY_DIR_STUB ||
+         fsCacheEntry->type != FSCACHEENTRY_DIR ) {
+        return 1;
+    }
+
+    /** Publish the children before readers can see the type change */
+    _adopt( stubFSCacheEntry, fsCacheEntry );
+    __atomic_store_n( &stubFSCacheEntry->type, FSCACHEENTRY_DIR, __ATOMIC_RELEASE );
+
+    return 0;
+}
+
+/**
+ * Replaces the contents of a "dir" FSCacheEntry in place with those of a
+ * freshly fetched one. Readers see either the old or the new children
+ * In:
+ *      dirFSCacheEntry - the cached "dir" FSCacheEntry. Required
+ *      fsCacheEntry - the fresh "dir" FSCacheEntry. Required
+ * Out:
+ *      N/A
+ * Returns:
+ *      0 = success
+ *      1 = failure
+ */
+int FSCacheEntry_refresh( FSCacheEntry_t *dirFSCacheEntry,
+                          FSCacheEntry_t *fsCacheEntry ) {
+
+    if ( dirFSCacheEntry == NULL || fsCacheEntry == NULL ||
+         dirFSCacheEntry == fsCacheEntry ) {
+        return 1;
+    }
+
+    if ( dirFSCacheEntry->type != FSCACHEENTRY_DIR ||
+         fsCacheEntry->type != FSCACHEENTRY_DIR ) {
+        return 1;
+    }
+
+    _adopt( dirFSCacheEntry, fsCacheEntry );
+
+    return 0;
+}
+
+/**
+ * Turns a "dir" FSCacheEntry back into a "dirstub", releasing its
+ * contents. The entry can be filled in again by FSCacheEntry_unstub()
+ * In:
+ *      fsCacheEntry - a "dir" FSCacheEntry. Required
+ * Out:
+ *      N/A
+ * Returns:
+ *      0 = success
+ *      1 = failure
+ */
+int FSCacheEntry_restub( FSCacheEntry_t *fsCacheEntry ) {
+
+    if ( fsCacheEntry == NULL || fsCacheEntry->type != FSCACHEENTRY_DIR ) {
+        return 1;
+    }
+
+    _freeFiles( fsCacheEntry );
+    _bumpGeneration( fsCacheEntry );
+    __atomic_store_n( &fsCacheEntry->type, FSCACHEENTRY_DIR_STUB, __ATOMIC_RELEASE );
+    fsCacheEntry->flags &= ~FSCACHEENTRY_FLAG_EVICTABLE;
+    FSCacheEntry_setfetched( fsCacheEntry, 0, 0 );
+    __atomic_store_n( &fsCacheEntry->size, 0, __ATOMIC_RELAXED );
+
+    return 0;
+}
+
+/**
+ * Returns an estimate of the memory held by a single entry, excluding
+ * the entries it contains
+ * In:
+ *      fsCacheEntry - the entry. Required
+ * Out:
+ *      N/A
+ * Returns:
+ *      Size in bytes
+ */
+size_t FSCacheEntry_getnbytes( FSCacheEntry_t *fsCacheEntry ) {
+
+    if ( fsCacheEntry == NULL ) {
+        return 0;
+    }
+
+    size_t nbytes = sizeof( FSCacheEntry_t );
+    if ( fsCacheEntry->files != NULL ) {
+        nbytes += sizeof( FSCacheEntryFiles_t ) +
+                  fsCacheEntry->files->filessz * sizeof( FSCacheEntry_t * );
+    }
+    if ( fsCacheEntry->fname != NULL ) {
+        nbytes += strlen( fsCacheEntry->fname ) + 1 + sizeof( int );
+    }
+    if ( fsCacheEntry->url != NULL ) {
+        nbytes += strlen( fsCacheEntry->url ) + 1;
+    }
+
+    return nbytes;
+}
+
+/**
+ * Adds a "file" (or "dir") FSCacheEntry to a "dir" FSCacheEntry. The
+ * "dir" entry takes ownership of the added entry
  * In:
  *     fsCacheEntry - a "dir" FSCacheEntry. Required
  *     fileFSCacheEntry - a "file" or "dir" FSCacheEntry. Required
@@ -123,21 +421,33 @@ int FSCacheEntry_addFile( FSCacheEntry_t *fsCacheEntry,
         return 1;
     }
 
-    FSCacheEntryType fsctype = FSCacheEntry_gettype( fsCacheEntry );
-    FSCacheEntryType filefsctype = FSCacheEntry_gettype( fileFSCacheEntry );
-    if ( fsctype != FSCACHEENTRY_DIR &&
-         filefsctype != FSCACHEENTRY_FILE &&
-         filefsctype != FSCACHEENTRY_DIR &&
-         filefsctype != FSCACHEENTRY_DIR_STUB ) {
+    if ( fsCacheEntry->type == FSCACHEENTRY_FILE ||
+         FSCacheEntry_isValidType( fileFSCacheEntry->type ) != 0 ) {
         return 1;
     }
 
-    json_object *files = json_object_object_get( fsCacheEntry, "files" );
-    if ( files == NULL ) {
-        files = json_object_new_array();
+    FSCacheEntryFiles_t *files = fsCacheEntry->files;
+    if ( files == NULL || files->nfiles == files->filessz ) {
+        /** Grow by copying, as readers may be walking the current list */
+        int filessz = files != NULL ? files->filessz * 2 : FSCACHEENTRY_DEFAULT_NFILES;
+        FSCacheEntryFiles_t *nfiles = _allocFiles( filessz );
+        if ( nfiles == NULL ) {
+            return 1;
+        }
+        if ( files != NULL ) {
+            memcpy( nfiles->files, files->files, files->nfiles * sizeof( FSCacheEntry_t * ) );
+            nfiles->nfiles = files->nfiles;
+        }
+        __atomic_store_n( &fsCacheEntry->files, nfiles, __ATOMIC_RELEASE );
+        Epoch_retire( files, free );
+        files = nfiles;
     }
 
-    return json_object_array_add( files, fileFSCacheEntry );
+    files->files[files->nfiles] = fileFSCacheEntry;
+    __atomic_store_n( &files->nfiles, files->nfiles + 1, __ATOMIC_RELEASE );
+    _bumpGeneration( fsCacheEntry );
+
+    return 0;
 }
 
 /**
@@ -162,88 +472,44 @@ int FSCacheEntry_isValidType( FSCacheEntryType type ) {
 
 int FSCacheEntry_getnfiles( FSCacheEntry_t *fsCacheEntry ) {
 
-    json_object *files = json_object_object_get( fsCacheEntry, "files" );
-    if ( files == NULL ) {
-        return 0;
-    }
+    int nfiles = 0;
+    FSCacheEntry_getfilelist( fsCacheEntry, &nfiles );
 
-    return json_object_array_length( files );
+    return nfiles;
 }
 
 FSCacheEntryType FSCacheEntry_gettype( FSCacheEntry_t *fsCacheEntry ) {
 
-    json_object *type = json_object_object_get( fsCacheEntry, "type" );
-    if ( type == NULL ) {
-        return FSCACHEENTRY_UNKNOWN;
-    }
-
-    const char *stype = json_object_get_string( type );
-    if ( stype == NULL ) {
+    if ( fsCacheEntry == NULL ) {
         return FSCACHEENTRY_UNKNOWN;
     }
 
-    if ( strcmp( stype, "dir" ) == 0 ) {
-        return FSCACHEENTRY_DIR;
-    } else {
-        if ( strcmp( stype, "dirstub" ) == 0 ) {
-            return FSCACHEENTRY_DIR_STUB;
-        } else {
-            if ( strcmp( stype, "file" ) == 0 ) {
-                return FSCACHEENTRY_FILE;
-            }
-        }
-    }
-
-    return FSCACHEENTRY_UNKNOWN;
+    /** May race with an in-place unstub or eviction */
+    return __atomic_load_n( &fsCacheEntry->type, __ATOMIC_ACQUIRE );
 }
 
 int FSCacheEntry_settype( FSCacheEntry_t *fsCacheEntry, FSCacheEntryType ptype ) {
 
-    int rv = 0;
-
     if ( fsCacheEntry == NULL ) {
         return 1;
     }
 
-    switch ( ptype ) {
-        case FSCACHEENTRY_DIR: {
-            json_object *tmpobj = json_object_new_string( "dir" );
-            if ( tmpobj == NULL ) {
-                return 1;
-            }
-            return json_object_object_add( fsCacheEntry, "type", tmpobj );
-        }
-        case FSCACHEENTRY_DIR_STUB: {
-            json_object *tmpobj = json_object_new_string( "dirstub" );
-            if ( tmpobj == NULL ) {
-                return 1;
-            }
-            return json_object_object_add( fsCacheEntry, "type", tmpobj );
-        }
-        case FSCACHEENTRY_FILE: {
-            json_object *tmpobj = json_object_new_string( "file" );
-            if ( tmpobj == NULL ) {
-                return 1;
-            }
-            return json_object_object_add( fsCacheEntry, "type", tmpobj );
-        }
+    if ( FSCacheEntry_isValidType( ptype ) != 0 ) {
+        fsCacheEntry->type = FSCACHEENTRY_UNKNOWN;
+    } else {
+        fsCacheEntry->type = ptype;
     }
 
-    json_object *tmpobj = json_object_new_string( "unknown" );
-    if ( tmpobj == NULL ) {
-        return 1;
-    }
-    return json_object_object_add( fsCacheEntry, "type", tmpobj );
+    return 0;
 }
 
 const char *FSCacheEntry_getfname( FSCacheEntry_t *fsCacheEntry ) {
 
-    json_object *fname = json_object_object_get( fsCacheEntry, "fname" );
-    if ( fname == NULL ) {
+    if ( fsCacheEntry == NULL ) {
         return NULL;
     }
 
-    return json_object_get_string( fname );
+    return fsCacheEntry->fname;
 }
 
 int FSCacheEntry_setfname( FSCacheEntry_t *fsCacheEntry, const char *fname ) {
@@ -252,18 +518,24 @@ int FSCacheEntry_setfname( FSCacheEntry_t *fsCacheEntry, const char *fname ) {
         return 1;
     }
 
-    json_object *tmpobj = json_object_new_string( fname );
-    return json_object_object_add( fsCacheEntry, "fname", tmpobj );
+    const char *tmpfname = StringPool_intern( fname );
+    if ( tmpfname == NULL ) {
+        return 1;
+    }
+
+    StringPool_release( fsCacheEntry->fname );
+    fsCacheEntry->fname = tmpfname;
+
+    return 0;
 }
 
 const char *FSCacheEntry_geturl( FSCacheEntry_t *fsCacheEntry ) {
 
-    json_object *url = json_object_object_get( fsCacheEntry, "url" );
-    if ( url == NULL ) {
+    if ( fsCacheEntry == NULL ) {
         return NULL;
     }
 
-    return json_object_get_string( url );
+    return fsCacheEntry->url;
 }
 
 int FSCacheEntry_seturl( FSCacheEntry_t *fsCacheEntry, const char *url ) {
@@ -272,18 +544,24 @@ int FSCacheEntry_seturl( FSCacheEntry_t *fsCacheEntry, const char *url ) {
         return 1;
     }
     
-    json_object *tmpobj = json_object_new_string( url );
-    return json_object_object_add( fsCacheEntry, "url", tmpobj );
+    char *tmpurl = strdup( url );
+    if ( tmpurl == NULL ) {
+        return 1;
+    }
+
+    free( fsCacheEntry->url );
+    fsCacheEntry->url = tmpurl;
+
+    return 0;
 }
 
 int FSCacheEntry_getsize( FSCacheEntry_t *fsCacheEntry ) {
 
-    json_object *size = json_object_object_get( fsCacheEntry, "size" );
-    if ( size == NULL ) {
+    if ( fsCacheEntry == NULL ) {
         return 0;
     }
 
-    return json_object_get_int( size );
+    return (int)__atomic_load_n( &fsCacheEntry->size, __ATOMIC_RELAXED );
 }
 
 int FSCacheEntry_setsize( FSCacheEntry_t *fsCacheEntry, int size ) {
@@ -292,18 +570,46 @@ int FSCacheEntry_setsize( FSCacheEntry_t *fsCacheEntry, int size ) {
         return 1;
     }
 
-    json_object *tmpobj = json_object_new_int( size );
-    return json_object_object_add( fsCacheEntry, "size", tmpobj );
+    fsCacheEntry->size = size;
+
+    return 0;
 }
 
 FSCacheEntry_t *FSCacheEntry_getfile( FSCacheEntry_t *fsCacheEntry, int findex ) {
 
-    json_object *files = json_object_object_get( fsCacheEntry, "files" );
+    int nfiles = 0;
+    FSCacheEntry_t **files = FSCacheEntry_getfilelist( fsCacheEntry, &nfiles );
+    if ( findex < 0 || findex >= nfiles ) {
+        return NULL;
+    }
+
+    return files[findex];
+}
+
+/**
+ * Returns a consistent view of an entry's children. Without a reference
+ * on the entry, the list is only valid until the end of the caller's epoch
+ * In:
+ *      fsCacheEntry - the entry. Required
+ * Out:
+ *      nfiles - number of children
+ * Returns:
+ *      The children or NULL if there are none
+ */
+FSCacheEntry_t **FSCacheEntry_getfilelist( FSCacheEntry_t *fsCacheEntry, int *nfiles ) {
+
+    *nfiles = 0;
+    if ( fsCacheEntry == NULL ) {
+        return NULL;
+    }
+
+    FSCacheEntryFiles_t *files = __atomic_load_n( &fsCacheEntry->files, __ATOMIC_ACQUIRE );
     if ( files == NULL ) {
         return NULL;
     }
+    *nfiles = __atomic_load_n( &files->nfiles, __ATOMIC_ACQUIRE );
 
-    return json_object_array_get_idx( files, findex );
+    return files->files;
 }
 
 int FSCacheEntry_setfiles( FSCacheEntry_t *fsCacheEntry ) {
@@ -312,7 +618,111 @@ int FSCacheEntry_setfiles( FSCacheEntry_t *fsCacheEntry ) {
         return 1;
     }
 
-    json_object *files = json_object_new_array();
-    return json_object_object_add( fsCacheEntry, "files", files );
+    _freeFiles( fsCacheEntry );
+
+    FSCacheEntryFiles_t *files = _allocFiles( FSCACHEENTRY_DEFAULT_NFILES );
+    if ( files == NULL ) {
+        return 1;
+    }
+    __atomic_store_n( &fsCacheEntry->files, files, __ATOMIC_RELEASE );
+
+    return 0;
+}
+
+/**
+ * Records when an entry's contents were fetched and how long they stay
+ * fresh
+ * In:
+ *      fsCacheEntry - the entry. Required
+ *      fetched - fetch time. 0 = not tracked
+ *      ttl - seconds the contents stay fresh. 0 = forever
+ * Out:
+ *      N/A
+ * Returns:
+ *      0 = success
+ *      1 = failure
+ */
+int FSCacheEntry_setfetched( FSCacheEntry_t *fsCacheEntry, time_t fetched, int ttl ) {
+
+    if ( fsCacheEntry == NULL ) {
+        return 1;
+    }
+
+    __atomic_store_n( &fsCacheEntry->fetched, fetched, __ATOMIC_RELAXED );
+    __atomic_store_n( &fsCacheEntry->ttl, ttl, __ATOMIC_RELAXED );
+    __atomic_store_n( &fsCacheEntry->refreshed, 0, __ATOMIC_RELAXED );
+
+    return 0;
+}
+
+/**
+ * Returns whether an entry's contents have outlived their TTL
+ * In:
+ *      fsCacheEntry - the entry. Required
+ *      now - current time
+ * Out:
+ *      N/A
+ * Returns:
+ *      1 = stale
+ *      0 = fresh or not tracked
+ */
+int FSCacheEntry_isstale( FSCacheEntry_t *fsCacheEntry, time_t now ) {
+
+    if ( fsCacheEntry == NULL ) {
+        return 0;
+    }
+
+    time_t fetched = __atomic_load_n( &fsCacheEntry->fetched, __ATOMIC_RELAXED );
+    int ttl = __atomic_load_n( &fsCacheEntry->ttl, __ATOMIC_RELAXED );
+
+    return fetched != 0 && ttl > 0 && now - fetched >= ttl;
 }
 
+/**
+ * Claims the refresh of a stale entry, so that only one caller refetches
+ * it. If a refresh doesn't replace the contents, e.g. because ZXDB is
+ * unreachable, the stale contents are served and another refresh may
+ * be claimed after FSCACHEENTRY_REFRESH_RETRY seconds
+ * In:
+ *      fsCacheEntry - the entry. Required
+ *      now - current time
+ * Out:
+ *      N/A
+ * Returns:
+ *      1 = the caller should refresh the entry
+ *      0 = fresh, or a refresh is already under way
+ */
+int FSCacheEntry_claimrefresh( FSCacheEntry_t *fsCacheEntry, time_t now ) {
+
+    if ( !FSCacheEntry_isstale( fsCacheEntry, now ) ) {
+        return 0;
+    }
+
+    time_t refreshed = __atomic_load_n( &fsCacheEntry->refreshed, __ATOMIC_RELAXED );
+    if ( refreshed != 0 && now - refreshed < FSCACHEENTRY_REFRESH_RETRY ) {
+        return 0;
+    }
+
+    return __atomic_compare_exchange_n( &fsCacheEntry->refreshed, &refreshed, now,
+                                        0, __ATOMIC_RELAXED, __ATOMIC_RELAXED );
+}
+
+/**
+ * Returns the generation of an entry's children. Any change to them,
+ * by adding a file, unstubbing, refreshing or restubbing, gives the
+ * entry a new generation that no entry has had before
+ * In:
+ *      fsCacheEntry - the entry. Required
+ * Out:
+ *      N/A
+ * Returns:
+ *      The generation, or 0 if fsCacheEntry is NULL
+ */
+uint64_t FSCacheEntry_getgeneration( FSCacheEntry_t *fsCacheEntry ) {
+
+    if ( fsCacheEntry == NULL ) {
+        return 0;
+    }
+
+    return __atomic_load_n( &fsCacheEntry->generation, __ATOMIC_ACQUIRE );
+}
@@ -21,6 +21,10 @@
 #ifndef _zxdbfs_fscacheentry_h
 #define _zxdbfs_fscacheentry_h
 
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
 #include <json-c/json.h>
 
 typedef enum { 
@@ -30,25 +34,62 @@ typedef enum {
     FSCACHEENTRY_DIR_STUB
 } FSCacheEntryType;
 
-/*
+/** The entry roots a directory that can be dropped back to a stub */
+#define FSCACHEENTRY_FLAG_EVICTABLE     0x01
+
+/** Seconds before a failed refresh of a stale entry is retried */
+#define FSCACHEENTRY_REFRESH_RETRY      60
+
+struct FSCacheUnit;
+
 struct FSCacheEntry;
+
+/**
+ * A directory's children. Readers may walk the list without locks inside
+ * an epoch: children are appended in place while there is room, and a
+ * grown or discarded list is replaced as a whole and retired
+ */
+typedef struct FSCacheEntryFiles {
+    int nfiles;
+    int filessz;
+    struct FSCacheEntry *files[];
+} FSCacheEntryFiles_t;
+
 typedef struct FSCacheEntry {
+    int refcount;
     FSCacheEntryType type;
-    char fname[256];
-    char url[256];
+    unsigned int flags;
+    int referenced;                 /** Set on lookup, cleared by the CLOCK hand */
+    const char *fname;              /** Interned via the string pool */
+    char *url;
     size_t size;
-    struct FSCacheEntry **files;
-    int nfiles;
+    FSCacheEntryFiles_t *files;
+    time_t fetched;                 /** When the contents were fetched. 0 = not tracked */
+    int ttl;                        /** Seconds the contents stay fresh. 0 = forever */
+    time_t refreshed;               /** Last refresh attempt of stale contents */
+    size_t nbytes;                  /** Bytes charged to the FSCache */
+    struct FSCacheUnit *unit;       /** FSCache eviction unit, if any */
+    uint64_t generation;            /** Changes whenever the children do */
 } FSCacheEntry_t;
-*/
-#define FSCacheEntry_t json_object
 
 extern FSCacheEntry_t *FSCacheEntry_create( const char *fname,
                                             FSCacheEntryType type,
                                             const char *url,
                                             int size );
 extern FSCacheEntry_t *FSCacheEntry_clone( FSCacheEntry_t *obj );
+extern FSCacheEntry_t *FSCacheEntry_ref( FSCacheEntry_t *fsCacheEntry );
+extern FSCacheEntry_t *FSCacheEntry_tryref( FSCacheEntry_t *fsCacheEntry );
 extern void FSCacheEntry_free( FSCacheEntry_t *fsCacheEntry );
+extern int FSCacheEntry_unstub( FSCacheEntry_t *stubFSCacheEntry,
+                                FSCacheEntry_t *fsCacheEntry );
+extern int FSCacheEntry_restub( FSCacheEntry_t *fsCacheEntry );
+extern int FSCacheEntry_refresh( FSCacheEntry_t *dirFSCacheEntry,
+                                 FSCacheEntry_t *fsCacheEntry );
+extern int FSCacheEntry_setfetched( FSCacheEntry_t *fsCacheEntry, time_t fetched, int ttl );
+extern int FSCacheEntry_isstale( FSCacheEntry_t *fsCacheEntry, time_t now );
+extern int FSCacheEntry_claimrefresh( FSCacheEntry_t *fsCacheEntry, time_t now );
+extern uint64_t FSCacheEntry_getgeneration( FSCacheEntry_t *fsCacheEntry );
+extern size_t FSCacheEntry_getnbytes( FSCacheEntry_t *fsCacheEntry );
 extern int FSCacheEntry_addFile( FSCacheEntry_t *fsCacheEntry,
                                  FSCacheEntry_t *fileFSCacheEntry );
 extern int FSCacheEntry_isValidType( FSCacheEntryType type );
@@ -63,6 +104,7 @@ extern int FSCacheEntry_seturl( FSCacheEntry_t *fsCacheEntry, const char *url );
 extern int FSCacheEntry_getsize( FSCacheEntry_t *fsCacheEntry );
 extern int FSCacheEntry_setsize( FSCacheEntry_t *fsCacheEntry, int url );
 extern FSCacheEntry_t *FSCacheEntry_getfile( FSCacheEntry_t *fsCacheEntry, int findex );
+extern FSCacheEntry_t **FSCacheEntry_getfilelist( FSCacheEntry_t *fsCacheEntry, int *nfiles );
 extern int FSCacheEntry_setfiles( FSCacheEntry_t *fsCacheEntry );
 
 #endif /** !_zxdbfs_fscacheentry_h */
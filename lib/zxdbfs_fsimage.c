@@ -0,0 +1,521 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <json-c/linkhash.h>
+
+#include "zxdbfs_epoch.h"
+#include "zxdbfs_fsimage.h"
+#include "zxdbfs_strpool.h"
+
+#define FSIMAGE_HASH_SIZE   1024
+
+/** Rounds up to a multiple of a, a power of 2 */
+#define _align(n, a)    (((n) + (a) - 1) & ~((size_t)(a) - 1))
+
+/**
+ * State while flattening a cache into an image
+ */
+typedef struct FSImageWriter {
+    struct lh_table *indices;       /** Entry -> position in entries + 1 */
+    FSCacheEntry_t **entries;       /** Children before parents */
+    int nentries;
+    int entriessz;
+    struct lh_table *offsets;       /** String -> offset in the image */
+    char *strings;
+    size_t stringslen;
+    size_t stringssz;
+} FSImageWriter_t;
+
+/**
+ * Appends a string to the string table, once per distinct string
+ * Returns:
+ *   Offset of the string in the image or 0 on failure
+ */
+static uint64_t _writeString( FSImageWriter_t *writer, const char *str ) {
+
+    struct lh_entry *e = lh_table_lookup_entry( writer->offsets, str );
+    if ( e != NULL ) {
+        return (uint64_t)(uintptr_t)lh_entry_v( e );
+    }
+
+    size_t len = strlen( str );
+    size_t nbytes = _align( sizeof( StringPoolEntry_t ) + len + 1, sizeof( int ) );
+    if ( writer->stringslen + nbytes > writer->stringssz ) {
+        size_t stringssz = writer->stringssz * 2 + nbytes;
+        char *strings = (char *)realloc( writer->strings, stringssz );
+        if ( strings == NULL ) {
+            return 0;
+        }
+        writer->strings = strings;
+        writer->stringssz = stringssz;
+    }
+
+    StringPoolEntry_t *entry = (StringPoolEntry_t *)&writer->strings[writer->stringslen];
+    memset( entry, 0, nbytes );
+    entry->refcount = STRPOOL_REFCOUNT_STATIC;
+    memcpy( entry->str, str, len );
+
+    uint64_t offset = sizeof( FSImageHeader_t ) + writer->stringslen +
+                      offsetof( StringPoolEntry_t, str );
+    writer->stringslen += nbytes;
+
+    /** The string table moves as it grows, so key by a separate copy */
+    char *key = strdup( str );
+    if ( key == NULL ||
+         lh_table_insert( writer->offsets, key, (void *)(uintptr_t)offset ) != 0 ) {
+        free( key );
+        return 0;
+    }
+
+    return offset;
+}
+
+static void _freeOffset( struct lh_entry *e ) {
+    free( (void *)lh_entry_k( e ) );
+}
+
+/**
+ * Numbers an entry and everything beneath it, children first
+ */
+static int _visit( FSImageWriter_t *writer, FSCacheEntry_t *fsCacheEntry ) {
+
+    if ( lh_table_lookup_entry( writer->indices, fsCacheEntry ) != NULL ) {
+        return 0;
+    }
+    /** Placeholder so that a malformed cycle is only walked once */
+    if ( lh_table_insert( writer->indices, fsCacheEntry, NULL ) != 0 ) {
+        return 1;
+    }
+
+    int nfiles;
+    FSCacheEntry_t **files = FSCacheEntry_getfilelist( fsCacheEntry, &nfiles );
+    for ( int i = 0 ; i < nfiles ; i++ ) {
+        if ( _visit( writer, files[i] ) != 0 ) {
+            return 1;
+        }
+    }
+
+    if ( writer->nentries == writer->entriessz ) {
+        int entriessz = writer->entriessz * 2 + 64;
+        FSCacheEntry_t **entries = (FSCacheEntry_t **)
+            realloc( writer->entries, entriessz * sizeof( FSCacheEntry_t * ) );
+        if ( entries == NULL ) {
+            return 1;
+        }
+        writer->entries = entries;
+        writer->entriessz = entriessz;
+    }
+    writer->entries[writer->nentries++] = fsCacheEntry;
+
+    struct lh_entry *e = lh_table_lookup_entry( writer->indices, fsCacheEntry );
+    e->v = (void *)(uintptr_t)writer->nentries;
+
+    return 0;
+}
+
+/**
+ * Returns the image index of a numbered entry. Parents come first in the
+ * image, so this reverses the order they were numbered in
+ */
+static uint32_t _index( FSImageWriter_t *writer, FSCacheEntry_t *fsCacheEntry ) {
+
+    struct lh_entry *e = lh_table_lookup_entry( writer->indices, fsCacheEntry );
+
+    return writer->nentries - (uint32_t)(uintptr_t)lh_entry_v( e );
+}
+
+/**
+ * Writes a snapshot of the cache to an image file. The image is written
+ * alongside and renamed into place, so a reader never sees it half done
+ * In:
+ *   cache: Cache to save
+ *   path: Image file
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+int FSImage_save( FSCache_t *cache, const char *path ) {
+
+    if ( cache == NULL || path == NULL ) {
+        return 1;
+    }
+
+    int rv = 1;
+    FSImageHeader_t header;
+    FSImageEntry_t *entries = NULL;
+    uint32_t *children = NULL;
+    FSImageKey_t *keys = NULL;
+
+    FSImageWriter_t writer;
+    memset( &writer, 0, sizeof( writer ) );
+    writer.indices = lh_kptr_table_new( FSIMAGE_HASH_SIZE, NULL );
+    writer.offsets = lh_kchar_table_new( FSIMAGE_HASH_SIZE, _freeOffset );
+    if ( writer.indices == NULL || writer.offsets == NULL ) {
+        goto cleanup;
+    }
+
+    /** Flatten the cache while writers are held off */
+    pthread_mutex_lock( &cache->lock );
+
+    FSCacheTable_t *table = cache->table;
+    uint32_t nkeys = 0;
+    for ( unsigned long i = 0 ; i < table->size ; i++ ) {
+        for ( FSCacheNode_t *node = table->buckets[i] ; node != NULL ; node = node->next ) {
+            if ( _visit( &writer, node->entry ) != 0 ) {
+                pthread_mutex_unlock( &cache->lock );
+                goto cleanup;
+            }
+            nkeys++;
+        }
+    }
+
+    uint32_t nchildren = 0;
+    for ( int i = 0 ; i < writer.nentries ; i++ ) {
+        nchildren += FSCacheEntry_getnfiles( writer.entries[i] );
+    }
+
+    entries = (FSImageEntry_t *)calloc( writer.nentries + 1, sizeof( FSImageEntry_t ) );
+    children = (uint32_t *)calloc( nchildren + 1, sizeof( uint32_t ) );
+    keys = (FSImageKey_t *)calloc( nkeys + 1, sizeof( FSImageKey_t ) );
+    if ( entries == NULL || children == NULL || keys == NULL ) {
+        pthread_mutex_unlock( &cache->lock );
+        goto cleanup;
+    }
+
+    uint32_t nchild = 0;
+    for ( uint32_t i = 0 ; i < (uint32_t)writer.nentries ; i++ ) {
+        FSCacheEntry_t *fsCacheEntry = writer.entries[writer.nentries - 1 - i];
+        FSImageEntry_t *record = &entries[i];
+
+        record->fname = _writeString( &writer, fsCacheEntry->fname );
+        if ( record->fname == 0 ) {
+            pthread_mutex_unlock( &cache->lock );
+            goto cleanup;
+        }
+        if ( fsCacheEntry->url != NULL ) {
+            record->url = _writeString( &writer, fsCacheEntry->url );
+            if ( record->url == 0 ) {
+                pthread_mutex_unlock( &cache->lock );
+                goto cleanup;
+            }
+        }
+        record->size = FSCacheEntry_getsize( fsCacheEntry );
+        record->fetched = fsCacheEntry->fetched;
+        record->ttl = fsCacheEntry->ttl;
+        record->type = FSCacheEntry_gettype( fsCacheEntry );
+        record->flags = fsCacheEntry->flags;
+
+        int nfiles;
+        FSCacheEntry_t **files = FSCacheEntry_getfilelist( fsCacheEntry, &nfiles );
+        record->nfiles = nfiles;
+        record->files = nchild;
+        for ( int j = 0 ; j < nfiles ; j++ ) {
+            children[nchild++] = _index( &writer, files[j] );
+        }
+    }
+
+    uint32_t nkey = 0;
+    for ( unsigned long i = 0 ; i < table->size ; i++ ) {
+        for ( FSCacheNode_t *node = table->buckets[i] ; node != NULL ; node = node->next ) {
+            keys[nkey].key = _writeString( &writer, node->key );
+            keys[nkey].entry = _index( &writer, node->entry );
+            if ( keys[nkey].key == 0 ) {
+                pthread_mutex_unlock( &cache->lock );
+                goto cleanup;
+            }
+            nkey++;
+        }
+    }
+
+    pthread_mutex_unlock( &cache->lock );
+
+    memset( &header, 0, sizeof( header ) );
+    memcpy( header.magic, FSIMAGE_MAGIC, sizeof( FSIMAGE_MAGIC ) );
+    header.version = FSIMAGE_VERSION;
+    header.nentries = writer.nentries;
+    header.nchildren = nchildren;
+    header.nkeys = nkeys;
+    header.strings = sizeof( FSImageHeader_t );
+    header.entries = _align( header.strings + writer.stringslen, sizeof( uint64_t ) );
+    header.children = header.entries + header.nentries * sizeof( FSImageEntry_t );
+    header.keys = _align( header.children + nchildren * sizeof( uint32_t ), sizeof( uint64_t ) );
+    header.size = header.keys + nkeys * sizeof( FSImageKey_t );
+
+    char tmppath[1024];
+    snprintf( tmppath, sizeof( tmppath ), "%s.tmp", path );
+    FILE *f = fopen( tmppath, "wb" );
+    if ( f == NULL ) {
+        printf( "failed to open fscache image: %s\n", tmppath );
+        goto cleanup;
+    }
+
+    static const char zeros[8] = { 0 };
+    int ok = fwrite( &header, sizeof( header ), 1, f ) == 1 &&
+             fwrite( writer.strings, 1, writer.stringslen, f ) == writer.stringslen &&
+             fwrite( zeros, 1, header.entries - header.strings - writer.stringslen, f ) ==
+                 header.entries - header.strings - writer.stringslen &&
+             fwrite( entries, sizeof( FSImageEntry_t ), header.nentries, f ) == header.nentries &&
+             fwrite( children, sizeof( uint32_t ), nchildren, f ) == nchildren &&
+             fwrite( zeros, 1, header.keys - header.children - nchildren * sizeof( uint32_t ), f ) ==
+                 header.keys - header.children - nchildren * sizeof( uint32_t ) &&
+             fwrite( keys, sizeof( FSImageKey_t ), nkeys, f ) == nkeys;
+    if ( fclose( f ) != 0 ) {
+        ok = 0;
+    }
+    if ( !ok || rename( tmppath, path ) != 0 ) {
+        printf( "failed to write fscache image: %s\n", path );
+        unlink( tmppath );
+        goto cleanup;
+    }
+
+    printf( "fscache image: saved %u entries, %u keys to %s (%lu bytes)\n",
+            header.nentries, nkeys, path, (unsigned long)header.size );
+    rv = 0;
+
+cleanup:
+    free( keys );
+    free( children );
+    free( entries );
+    free( writer.strings );
+    free( writer.entries );
+    if ( writer.offsets != NULL ) {
+        lh_table_free( writer.offsets );
+    }
+    if ( writer.indices != NULL ) {
+        lh_table_free( writer.indices );
+    }
+
+    return rv;
+}
+
+/**
+ * Checks that a string offset lands on a string pool entry within the
+ * string table
+ */
+static int _isValidString( const char *map, const FSImageHeader_t *header, uint64_t offset ) {
+
+    if ( offset < header->strings + offsetof( StringPoolEntry_t, str ) ||
+         offset >= header->entries || ( offset & ( sizeof( int ) - 1 ) ) != 0 ) {
+        return 0;
+    }
+
+    const StringPoolEntry_t *entry = (const StringPoolEntry_t *)
+        ( map + offset - offsetof( StringPoolEntry_t, str ) );
+    if ( entry->refcount != STRPOOL_REFCOUNT_STATIC ) {
+        return 0;
+    }
+
+    return memchr( entry->str, '\0', header->entries - offset ) != NULL;
+}
+
+/**
+ * Checks the structure of a mapped image before any of it is trusted
+ */
+static int _isValidImage( const char *map, size_t size ) {
+
+    if ( size < sizeof( FSImageHeader_t ) ) {
+        return 0;
+    }
+
+    const FSImageHeader_t *header = (const FSImageHeader_t *)map;
+    if ( memcmp( header->magic, FSIMAGE_MAGIC, sizeof( FSIMAGE_MAGIC ) ) != 0 ||
+         header->version != FSIMAGE_VERSION ||
+         header->size != size ||
+         header->strings != sizeof( FSImageHeader_t ) ||
+         header->entries < header->strings ||
+         ( header->entries & ( sizeof( uint64_t ) - 1 ) ) != 0 ||
+         header->children != header->entries + (uint64_t)header->nentries * sizeof( FSImageEntry_t ) ||
+         header->keys < header->children + (uint64_t)header->nchildren * sizeof( uint32_t ) ||
+         ( header->keys & ( sizeof( uint64_t ) - 1 ) ) != 0 ||
+         header->size != header->keys + (uint64_t)header->nkeys * sizeof( FSImageKey_t ) ) {
+        return 0;
+    }
+
+    const FSImageEntry_t *entries = (const FSImageEntry_t *)( map + header->entries );
+    const uint32_t *children = (const uint32_t *)( map + header->children );
+    const FSImageKey_t *keys = (const FSImageKey_t *)( map + header->keys );
+
+    for ( uint32_t i = 0 ; i < header->nentries ; i++ ) {
+        const FSImageEntry_t *record = &entries[i];
+        if ( !_isValidString( map, header, record->fname ) ||
+             ( record->url != 0 && !_isValidString( map, header, record->url ) ) ||
+             FSCacheEntry_isValidType( (FSCacheEntryType)record->type ) != 0 ||
+             ( record->nfiles > 0 && record->type != FSCACHEENTRY_DIR ) ||
+             (uint64_t)record->files + record->nfiles > header->nchildren ) {
+            return 0;
+        }
+        /** Children always follow their parents, so there are no cycles */
+        for ( uint32_t j = 0 ; j < record->nfiles ; j++ ) {
+            uint32_t child = children[record->files + j];
+            if ( child <= i || child >= header->nentries ) {
+                return 0;
+            }
+        }
+    }
+
+    for ( uint32_t i = 0 ; i < header->nkeys ; i++ ) {
+        if ( !_isValidString( map, header, keys[i].key ) ||
+             keys[i].entry >= header->nentries ) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Pools a string from the image in place
+ */
+static const char *_adoptString( const char *map, uint64_t offset ) {
+
+    return StringPool_adopt( (const StringPoolEntry_t *)
+                             ( map + offset - offsetof( StringPoolEntry_t, str ) ) );
+}
+
+/**
+ * Populates a cache from an image file. The image is mapped read-only
+ * and its strings are used in place rather than copied, so the mapping
+ * is kept for the life of the process. Cache entries are allocated as
+ * usual and can be changed freely; the image itself is never written
+ * In:
+ *   cache: Cache to populate. Anything already at the image's keys is
+ *          replaced
+ *   path: Image file
+ * Returns:
+ *   0: Success
+ *   1: Failure, eg, a corrupt image or one from another version
+ *   2: No image
+ */
+int FSImage_load( FSCache_t *cache, const char *path ) {
+
+    if ( cache == NULL || path == NULL ) {
+        return 1;
+    }
+
+    int fd = open( path, O_RDONLY );
+    if ( fd == -1 ) {
+        return 2;
+    }
+
+    struct stat st;
+    if ( fstat( fd, &st ) != 0 || st.st_size < (off_t)sizeof( FSImageHeader_t ) ) {
+        close( fd );
+        return 1;
+    }
+
+    const char *map = (const char *)mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if ( map == MAP_FAILED ) {
+        return 1;
+    }
+
+    if ( !_isValidImage( map, st.st_size ) ) {
+        printf( "ignoring invalid fscache image: %s\n", path );
+        munmap( (void *)map, st.st_size );
+        return 1;
+    }
+
+    const FSImageHeader_t *header = (const FSImageHeader_t *)map;
+    const FSImageEntry_t *entries = (const FSImageEntry_t *)( map + header->entries );
+    const uint32_t *children = (const uint32_t *)( map + header->children );
+    const FSImageKey_t *keys = (const FSImageKey_t *)( map + header->keys );
+
+    /** Entries that some directory lists, which their parent will index */
+    unsigned char *ischild = (unsigned char *)calloc( header->nentries + 1, 1 );
+    FSCacheEntry_t **objs =
+        (FSCacheEntry_t **)calloc( header->nentries + 1, sizeof( FSCacheEntry_t * ) );
+    if ( ischild == NULL || objs == NULL ) {
+        free( ischild );
+        free( objs );
+        munmap( (void *)map, st.st_size );
+        return 1;
+    }
+
+    /** Children first so that each directory can list them as it's built */
+    int rv = 0;
+    for ( uint32_t i = header->nentries ; i-- > 0 ; ) {
+        const FSImageEntry_t *record = &entries[i];
+
+        const char *fname = _adoptString( map, record->fname );
+        objs[i] = FSCacheEntry_create( fname, (FSCacheEntryType)record->type,
+                                       record->url != 0 ? map + record->url : NULL,
+                                       (int)record->size );
+        StringPool_release( fname );
+        if ( objs[i] == NULL ) {
+            rv = 1;
+            break;
+        }
+        objs[i]->flags = record->flags;
+        FSCacheEntry_setfetched( objs[i], (time_t)record->fetched, record->ttl );
+
+        for ( uint32_t j = 0 ; j < record->nfiles ; j++ ) {
+            uint32_t child = children[record->files + j];
+            ischild[child] = 1;
+            FSCacheEntry_addFile( objs[i], FSCacheEntry_ref( objs[child] ) );
+        }
+    }
+
+    if ( rv == 0 ) {
+        /**
+         * Top-level directories index everything beneath them, then game
+         * directories are re-added to become eviction units, then any keys
+         * that don't match an entry's own name are filled in
+         */
+        for ( int pass = 0 ; pass < 3 ; pass++ ) {
+            for ( uint32_t i = 0 ; i < header->nkeys ; i++ ) {
+                FSCacheEntry_t *fsCacheEntry = objs[keys[i].entry];
+                const char *key = _adoptString( map, keys[i].key );
+                if ( pass == 0 && !ischild[keys[i].entry] ) {
+                    FSCache_addAll( cache, key, FSCacheEntry_ref( fsCacheEntry ) );
+                } else if ( pass == 1 && ischild[keys[i].entry] &&
+                            ( fsCacheEntry->flags & FSCACHEENTRY_FLAG_EVICTABLE ) &&
+                            FSCacheEntry_gettype( fsCacheEntry ) == FSCACHEENTRY_DIR ) {
+                    FSCache_addAll( cache, key, FSCacheEntry_ref( fsCacheEntry ) );
+                } else if ( pass == 2 ) {
+                    Epoch_enter();
+                    int indexed = FSCache_lookup( cache, key ) == fsCacheEntry;
+                    Epoch_exit();
+                    if ( !indexed ) {
+                        FSCache_add( cache, key, FSCacheEntry_ref( fsCacheEntry ) );
+                    }
+                }
+                StringPool_release( key );
+            }
+        }
+        printf( "fscache image: loaded %u entries, %u keys from %s\n",
+                header->nentries, header->nkeys, path );
+    }
+
+    for ( uint32_t i = 0 ; i < header->nentries ; i++ ) {
+        FSCacheEntry_free( objs[i] );
+    }
+    free( objs );
+    free( ischild );
+
+    return rv;
+}
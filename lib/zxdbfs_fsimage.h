@@ -0,0 +1,78 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _zxdbfs_fsimage_h
+#define _zxdbfs_fsimage_h
+
+#include <stdint.h>
+
+#include "zxdbfs_fscache.h"
+
+#define FSIMAGE_MAGIC       "ZXDBFSI"
+#define FSIMAGE_VERSION     1
+#define FSIMAGE_FILENAME    "fscache.img"
+
+/**
+ * An FSCache image is a snapshot of the cache that can be mapped straight
+ * back in on the next start. Everything is addressed by file offset or
+ * index, never by pointer, so the image can be mapped anywhere.
+ *
+ *   header | strings | entries | children | keys
+ *
+ * Strings are laid out as static string pool entries and are pooled in
+ * place from the mapping. Entries are ordered parents first, and each
+ * entry's children are a run of indices in the children array
+ */
+typedef struct FSImageHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nentries;
+    uint32_t nchildren;
+    uint32_t nkeys;
+    uint64_t strings;               /** Offset of the string table */
+    uint64_t entries;               /** Offset of the entry records */
+    uint64_t children;              /** Offset of the child indices */
+    uint64_t keys;                  /** Offset of the key records */
+    uint64_t size;                  /** Size of the whole image */
+} FSImageHeader_t;
+
+typedef struct FSImageEntry {
+    uint64_t fname;                 /** String offset */
+    uint64_t url;                   /** String offset. 0 = none */
+    int64_t size;
+    int64_t fetched;
+    int32_t ttl;
+    uint32_t type;
+    uint32_t flags;
+    uint32_t nfiles;
+    uint32_t files;                 /** First index in the children array */
+    uint32_t reserved;
+} FSImageEntry_t;
+
+typedef struct FSImageKey {
+    uint64_t key;                   /** String offset */
+    uint32_t entry;                 /** Entry index */
+    uint32_t reserved;
+} FSImageKey_t;
+
+extern int FSImage_save( FSCache_t *cache, const char *path );
+extern int FSImage_load( FSCache_t *cache, const char *path );
+
+#endif /** !_zxdbfs_fsimage_h */
@@ -45,6 +45,9 @@ FSCacheEntry_t *FSCacheEntry_createFromGame( const char *path,
         return NULL;
     }
 
+    /** Game directories can always be re-fetched so may be evicted */
+    dirEntry->flags |= FSCACHEENTRY_FLAG_EVICTABLE;
+
     json_object *source_o = json_object_object_get( gameData_o, "_source" );
     if ( source_o == NULL ) {
         FSCacheEntry_free( dirEntry );
@@ -224,11 +227,12 @@ FSCacheEntry_t *FSCacheEntry_createFromGame( const char *path,
  * /by-letter/[A-Z]/[Game Title + ID]/SCRSHOT/*
  * So, we want the bit between the third and fourth / (assuming 4 exists)
  */
-FSCacheEntry_t *FSCacheEntry_getAndCreateGame( json_object *urlcache,
+FSCacheEntry_t *FSCacheEntry_getAndCreateGame( URLCache_t *urlcache,
                                                const char *filepath,
                                                const char *urlhost,
                                                const char *urlpath,
-                                               const char *useragent ) {
+                                               const char *useragent,
+                                               int ttl ) {
 
     //FSCacheEntry_t *gameRoot = NULL;
 
@@ -259,7 +263,7 @@ FSCacheEntry_t *FSCacheEntry_getAndCreateGame( json_object *urlcache,
     printf( "URL: %s\n", url );
     printf( "FS Game Root: %s\n", gamerootpath );
 
-    json_object *gameData = getURL( urlcache, urlhost, url, useragent );
+    json_object *gameData = getURL( urlcache, urlhost, url, useragent, ttl );
     if ( gameData == NULL ) {
         printf( ">>> FAILED TO RETRIEVE JSON OBJECT\n" );
         return NULL;
@@ -268,10 +272,11 @@ FSCacheEntry_t *FSCacheEntry_getAndCreateGame( json_object *urlcache,
     }
 
     FSCacheEntry_t *fsCacheEntry = FSCacheEntry_createFromGame( gamerootpath, gameData );
+
+    /** The URL cache holds its own reference */
+    json_object_put( gameData );
+
     if ( fsCacheEntry == NULL ) {
-        if ( urlcache != NULL ) {
-//            json_object_put( gameData );
-        }
         return NULL;
     }
 
@@ -25,13 +25,15 @@
 
 #include "zxdbfs_fscache.h"
 #include "zxdbfs_fscacheentry.h"
+#include "zxdbfs_urlcache.h"
 
 extern FSCacheEntry_t *FSCacheEntry_createFromGame( const char *path,
                                                     json_object *gameData );
-extern FSCacheEntry_t *FSCacheEntry_getAndCreateGame( json_object *urlcache,
+extern FSCacheEntry_t *FSCacheEntry_getAndCreateGame( URLCache_t *urlcache,
                                                const char *filepath,
                                                const char *urlhost,
                                                const char *urlpath,
-                                               const char *useragent );
+                                               const char *useragent,
+                                               int ttl );
 
 #endif /** !_zxdbfs_gameid_h */
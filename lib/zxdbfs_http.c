@@ -19,13 +19,16 @@
 */
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 
 #include <json-c/json.h>
 
 #include <curl/curl.h>
 
+#include "zxdbfs_fetcher.h"
 #include "zxdbfs_fscache.h"
 #include "zxdbfs_http.h"
 #include "zxdbfs_json.h"
@@ -58,6 +61,21 @@ write_data(void *contents, size_t size, size_t nmemb, void *userp)
     size_t realsize = size * nmemb;
     struct MemoryStruct *mem = (struct MemoryStruct *)userp;
 
+    /** Parse straight from the decompressed stream, never keeping the body */
+    if ( mem->tokener != NULL ) {
+        mem->size += realsize;
+        if ( mem->obj != NULL ) {
+            return realsize;
+        }
+        mem->obj = json_tokener_parse_ex( mem->tokener, (const char *)contents, (int)realsize );
+        enum json_tokener_error jerr = json_tokener_get_error( mem->tokener );
+        if ( mem->obj == NULL && jerr != json_tokener_continue ) {
+            printf( "JSON parse failed: %s\n", json_tokener_error_desc( jerr ) );
+            return 0;
+        }
+        return realsize;
+    }
+
     mem->memory = (char *)realloc(mem->memory, mem->size + realsize + 1);
     if(mem->memory == NULL) {
         printf( "not enough memory (realloc returned NULL)\n" );
@@ -71,70 +89,448 @@ write_data(void *contents, size_t size, size_t nmemb, void *userp)
     return realsize;
 }
 
+/**
+ * Shared by every thread's handle, so a host is only resolved and a TLS
+ * session only negotiated once whichever thread fetches from it
+ */
+static CURLSH *share = NULL;
+static pthread_mutex_t sharelocks[CURL_LOCK_DATA_LAST];
+static pthread_once_t shareonce = PTHREAD_ONCE_INIT;
+
+/** Each thread's easy handle */
+static pthread_key_t handlekey;
+
+/** Event loop making requests on behalf of getURLViacURL(), if any */
+static Fetcher_t *fetcher = NULL;
+
+/** Response code of each thread's last request, as HTTP_getcode() */
+static __thread long lastcode = -1;
+
+/** Responses sent in full and responses found unchanged */
+static unsigned long nmodified = 0;
+static unsigned long nnotmodified = 0;
+
+static void _lockShare( CURL *handle, curl_lock_data data,
+                        curl_lock_access access, void *userptr ) {
+
+    (void) handle;
+    (void) access;
+    (void) userptr;
+
+    pthread_mutex_lock( &sharelocks[data] );
+}
+
+static void _unlockShare( CURL *handle, curl_lock_data data, void *userptr ) {
+
+    (void) handle;
+    (void) userptr;
+
+    pthread_mutex_unlock( &sharelocks[data] );
+}
+
+static void _freeHandle( void *handle ) {
+
+    curl_easy_cleanup( (CURL *)handle );
+}
+
+static void _initShare( void ) {
+
+    curl_global_init( CURL_GLOBAL_DEFAULT );
+
+    for ( int i = 0 ; i < CURL_LOCK_DATA_LAST ; i++ ) {
+        pthread_mutex_init( &sharelocks[i], NULL );
+    }
+    pthread_key_create( &handlekey, _freeHandle );
+
+    /**
+     * Connections aren't shared, as libcurl doesn't support sharing them
+     * between concurrent threads. Each thread's handle keeps its own
+     */
+    share = curl_share_init();
+    if ( share != NULL ) {
+        curl_share_setopt( share, CURLSHOPT_LOCKFUNC, _lockShare );
+        curl_share_setopt( share, CURLSHOPT_UNLOCKFUNC, _unlockShare );
+        curl_share_setopt( share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS );
+        curl_share_setopt( share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION );
+    }
+}
+
+/**
+ * Initialises libcurl and the share. Called before any other use of
+ * libcurl, as libcurl's own initialisation isn't thread safe
+ */
+void HTTP_init( void ) {
+
+    pthread_once( &shareonce, _initShare );
+}
+
+/**
+ * Returns the calling thread's easy handle, reset for a new request. The
+ * handle lives as long as the thread, so its open connections are reused
+ * by the thread's next request to the same host
+ */
+static CURL *_getHandle( void ) {
+
+    HTTP_init();
+
+    CURL *curl = (CURL *)pthread_getspecific( handlekey );
+    if ( curl == NULL ) {
+        curl = curl_easy_init();
+        if ( curl == NULL || pthread_setspecific( handlekey, curl ) != 0 ) {
+            curl_easy_cleanup( curl );
+            return NULL;
+        }
+    } else {
+        curl_easy_reset( curl );
+    }
+
+    return curl;
+}
+
+/**
+ * Creates an empty chunk for a response body
+ * In:
+ *      parse - 1 to parse the body as JSON as it arrives rather than keep it
+ * Returns:
+ *      A new chunk, to be freed with HTTP_freechunk(), or NULL on failure
+ */
+struct MemoryStruct *HTTP_newchunk( int parse ) {
+
+    struct MemoryStruct *chunk = (struct MemoryStruct *)calloc( 1, sizeof( struct MemoryStruct ) );
+    if ( chunk == NULL ) {
+        return NULL;
+    }
+
+    chunk->memory = (char *)malloc( 1 );  /* will be grown as needed by write_data() */
+    if ( parse ) {
+        chunk->tokener = json_tokener_new();
+    }
+    if ( chunk->memory == NULL || ( parse && chunk->tokener == NULL ) ) {
+        HTTP_freechunk( chunk );
+        return NULL;
+    }
+    chunk->memory[0] = '\0';
+
+    return chunk;
+}
+
+/**
+ * Frees a chunk, along with any body or parsed body still held
+ */
+void HTTP_freechunk( struct MemoryStruct *chunk ) {
+
+    if ( chunk == NULL ) {
+        return;
+    }
+
+    free( chunk->memory );
+    if ( chunk->tokener != NULL ) {
+        json_tokener_free( chunk->tokener );
+    }
+    if ( chunk->obj != NULL ) {
+        json_object_put( chunk->obj );
+    }
+    free( chunk );
+}
+
+/**
+ * Picks the ETag out of the response headers. Each response followed
+ * through a redirect starts afresh
+ */
+static size_t _readHeader( char *buffer, size_t size, size_t nitems, void *userdata ) {
+
+    size_t len = size * nitems;
+    HTTPValidators_t *validators = (HTTPValidators_t *)userdata;
+
+    if ( len >= 5 && strncmp( buffer, "HTTP/", 5 ) == 0 ) {
+        validators->etag[0] = '\0';
+    } else if ( len > 5 && strncasecmp( buffer, "ETag:", 5 ) == 0 ) {
+        const char *value = buffer + 5;
+        const char *end = buffer + len;
+        while ( value < end && ( *value == ' ' || *value == '\t' ) ) {
+            value++;
+        }
+        while ( end > value && ( end[-1] == '\r' || end[-1] == '\n' || end[-1] == ' ' ) ) {
+            end--;
+        }
+        size_t vlen = end - value;
+        if ( vlen > 0 && vlen < sizeof( validators->etag ) ) {
+            memcpy( validators->etag, value, vlen );
+            validators->etag[vlen] = '\0';
+        }
+    }
+
+    return len;
+}
+
+/**
+ * Sets up an easy handle to fetch a URL into a chunk, the same way for
+ * every upstream request
+ * In:
+ *      curl - the easy handle. Required
+ *      url - the full URL. Required
+ *      useragent - HTTP User-Agent. May be NULL
+ *      chunk - receives the response body. Required. If it has a
+ *              tokener, the body is asked for compressed and parsed as it
+ *              is decompressed
+ *      validators - sent to make the request conditional, and replaced
+ *                   with the response's own. Must last until
+ *                   HTTP_complete(). May be NULL
+ * Returns:
+ *      The request headers, to be freed with curl_slist_free_all() once
+ *      the request has finished
+ */
+struct curl_slist *HTTP_setup( CURL *curl, const char *url, const char *useragent,
+                               struct MemoryStruct *chunk, HTTPValidators_t *validators ) {
+
+    HTTP_init();
+
+    char luseragent[128];
+    if ( useragent != NULL ) {
+        snprintf( luseragent, sizeof( luseragent ), "User-Agent: %s", useragent );
+    } else {
+        sprintf( luseragent, "User-Agent: zxdbfs" );
+    }
+
+    struct curl_slist *headers = NULL; // init to NULL is important
+    headers = curl_slist_append( headers, luseragent );
+    headers = curl_slist_append( headers, "charsets: utf-8" );
+    headers = curl_slist_append( headers, "Accept: text/html,application/xhtml+xml,application/xml,application/json,application/zip;q=0.9,image/webp,*/*;q=0.8" );
+
+    if ( validators != NULL ) {
+        if ( validators->etag[0] != '\0' ) {
+            char ifnonematch[sizeof( validators->etag ) + 32];
+            snprintf( ifnonematch, sizeof( ifnonematch ), "If-None-Match: %s", validators->etag );
+            headers = curl_slist_append( headers, ifnonematch );
+        }
+        if ( validators->lastmodified > 0 ) {
+            curl_easy_setopt( curl, CURLOPT_TIMECONDITION, (long)CURL_TIMECOND_IFMODSINCE );
+            curl_easy_setopt( curl, CURLOPT_TIMEVALUE_LARGE, (curl_off_t)validators->lastmodified );
+        }
+        curl_easy_setopt( curl, CURLOPT_FILETIME, 1L );
+        curl_easy_setopt( curl, CURLOPT_HEADERFUNCTION, _readHeader );
+        curl_easy_setopt( curl, CURLOPT_HEADERDATA, (void *)validators );
+    }
+
+    if ( share != NULL ) {
+        curl_easy_setopt( curl, CURLOPT_SHARE, share );
+    }
+
+    /**
+     * API responses compress well. Game files are already compressed, so
+     * are fetched as they are
+     */
+    if ( chunk->tokener != NULL ) {
+        curl_easy_setopt( curl, CURLOPT_ACCEPT_ENCODING, "" );
+    }
+    curl_easy_setopt( curl, CURLOPT_URL, url );
+    curl_easy_setopt( curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt( curl, CURLOPT_VERBOSE, 1 );
+    curl_easy_setopt( curl, CURLOPT_HTTPHEADER, headers );
+    curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, write_data );
+    curl_easy_setopt( curl, CURLOPT_WRITEDATA, (void *)chunk );
+    curl_easy_setopt( curl, CURLOPT_NOSIGNAL, 1 );
+    curl_easy_setopt( curl, CURLOPT_FOLLOWLOCATION, 1L );
+    curl_easy_setopt( curl, CURLOPT_TIMEOUT, 30L );
+    curl_easy_setopt( curl, CURLOPT_TCP_KEEPALIVE, 1L );
+    curl_easy_setopt( curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS );
+
+    /** This needs to be outside of the SSL test as we might be following a redirect.... */
+    if ( 1 ) {
+        curl_easy_setopt( curl, CURLOPT_SSL_VERIFYPEER, 1L );
+        curl_easy_setopt( curl, CURLOPT_SSL_VERIFYHOST, 2L );
+    } else {
+        curl_easy_setopt( curl, CURLOPT_SSL_VERIFYPEER, 0L );
+        curl_easy_setopt( curl, CURLOPT_SSL_VERIFYHOST, 0L );
+    }
+
+    if ( 1 ) {
+        curl_easy_setopt( curl, CURLOPT_USE_SSL, CURLUSESSL_ALL );
+    }
+
+    return headers;
+}
+
+/**
+ * Finishes off a successful request set up by HTTP_setup()
+ * In:
+ *      curl - the easy handle. Required
+ *      chunk - as passed to HTTP_setup(). Required
+ *      validators - as passed to HTTP_setup(). May be NULL
+ * Out:
+ *      validators - the response's validators, unless it was unchanged
+ * Returns:
+ *      1 if the response was unchanged since the validators sent, so has
+ *      no body, otherwise 0
+ */
+int HTTP_complete( CURL *curl, struct MemoryStruct *chunk, HTTPValidators_t *validators ) {
+
+    long code = 0;
+    long unmet = 0;
+    curl_easy_getinfo( curl, CURLINFO_RESPONSE_CODE, &code );
+    curl_easy_getinfo( curl, CURLINFO_CONDITION_UNMET, &unmet );
+    chunk->code = code;
+
+    /** file:// has no response codes, but honours If-Modified-Since */
+    if ( code == 304 || unmet ) {
+        __atomic_add_fetch( &nnotmodified, 1, __ATOMIC_RELAXED );
+        return 1;
+    }
+    if ( code == 200 || code == 0 ) {
+        __atomic_add_fetch( &nmodified, 1, __ATOMIC_RELAXED );
+    }
+
+    /** The end of the body ends anything still being parsed, such as a number */
+    if ( chunk->tokener != NULL && chunk->obj == NULL && chunk->size > 0 &&
+         json_tokener_get_error( chunk->tokener ) == json_tokener_continue ) {
+        chunk->obj = json_tokener_parse_ex( chunk->tokener, "", 1 );
+    }
+
+    if ( validators != NULL ) {
+        curl_off_t filetime = -1;
+        curl_easy_getinfo( curl, CURLINFO_FILETIME_T, &filetime );
+        validators->lastmodified = filetime > 0 ? (time_t)filetime : 0;
+    }
+
+    return 0;
+}
+
+/**
+ * Returns the response code of a finished request. A file:// URL that
+ * isn't there counts as 404, so it is told apart from a failure
+ * In:
+ *      curl - the request's handle. Required
+ *      result - what the request returned
+ * Returns:
+ *      The HTTP response code, 0 for a file:// URL read successfully or
+ *      -1 if there was no response, such as on a timeout or DNS failure
+ */
+long HTTP_getcode( CURL *curl, CURLcode result ) {
+
+    if ( result == CURLE_FILE_COULDNT_READ_FILE || result == CURLE_REMOTE_FILE_NOT_FOUND ) {
+        return 404;
+    }
+
+    long code = 0;
+    curl_easy_getinfo( curl, CURLINFO_RESPONSE_CODE, &code );
+    if ( code == 0 && result != CURLE_OK ) {
+        return -1;
+    }
+
+    return code;
+}
+
+/**
+ * Returns the response code of the calling thread's last request made by
+ * getURLViacURLIfModified(), as HTTP_getcode(), or -1 if getURL() was
+ * since answered from the URL cache without one
+ */
+long HTTP_getlastcode( void ) {
+
+    return lastcode;
+}
+
+/**
+ * Returns how many responses were sent in full and how many were found
+ * unchanged by a conditional request
+ */
+void HTTP_getstats( unsigned long *lnmodified, unsigned long *lnnotmodified ) {
+
+    if ( lnmodified != NULL ) {
+        *lnmodified = __atomic_load_n( &nmodified, __ATOMIC_RELAXED );
+    }
+    if ( lnnotmodified != NULL ) {
+        *lnnotmodified = __atomic_load_n( &nnotmodified, __ATOMIC_RELAXED );
+    }
+}
+
+/**
+ * Hands every later getURLViacURL() to an event loop, or back to the
+ * calling thread if fetcher is NULL. Must not be changed while requests
+ * are being made
+ */
+void HTTP_setfetcher( Fetcher_t *lfetcher ) {
+
+    __atomic_store_n( &fetcher, lfetcher, __ATOMIC_RELEASE );
+}
+
 struct MemoryStruct *getURLViacURL( const char *host, const char *path, const char *useragent ) {
 
-    json_object *rv = NULL;
+    return getURLViacURLIfModified( host, path, useragent, NULL, NULL, 0 );
+}
+
+/**
+ * Fetches a URL, conditionally if validators are given
+ * In:
+ *      host - URL host. Required
+ *      path - URL path. Required
+ *      useragent - HTTP User-Agent. May be NULL
+ *      validators - of the copy already held. May be NULL
+ *      parse - 1 to ask for the body compressed and parse it as JSON as
+ *              it arrives, into the returned chunk's obj
+ * Out:
+ *      validators - of the response fetched
+ *      notmodified - set to 1 if the copy already held is unchanged. May
+ *                    be NULL
+ * Returns:
+ *      The response body, or NULL if unchanged or on failure
+ */
+struct MemoryStruct *getURLViacURLIfModified( const char *host, const char *path,
+                                              const char *useragent,
+                                              HTTPValidators_t *validators, int *notmodified,
+                                              int parse ) {
 
     CURL *curl;
     CURLcode res;
 
     struct MemoryStruct *chunk = NULL;
 
-    curl = curl_easy_init();
-    if ( curl ) {
+    if ( notmodified != NULL ) {
+        *notmodified = 0;
+    }
 
-        chunk = (struct MemoryStruct *)malloc( sizeof( struct MemoryStruct ) );
+    char fullurl[1024];
+    snprintf( fullurl, sizeof( fullurl ), "%s%s", host, path );
+    printf( "fullurl: %s\n", fullurl );
 
-        chunk->memory = (char *)malloc(1);  /* will be grown as needed by the realloc above */
-        chunk->size = 0;    /* no data at this point */
+    /** The event loop makes the request while this thread waits for it */
+    Fetcher_t *lfetcher = __atomic_load_n( &fetcher, __ATOMIC_ACQUIRE );
+    if ( lfetcher != NULL ) {
+        Fetch_t *fetch = Fetcher_submit( lfetcher, fullurl, useragent, validators, parse );
+        if ( fetch != NULL ) {
+            return Fetch_waitcode( fetch, validators, notmodified, &lastcode );
+        }
+    }
 
-        char fullurl[1024];
-        sprintf( fullurl, "%s%s", host, path );
-        printf( "fullurl: %s\n", fullurl );
+    curl = _getHandle();
+    if ( curl ) {
 
-        char luseragent[128];
-        if ( useragent != NULL ) {
-            snprintf( luseragent, sizeof( luseragent ), "User-Agent: %s", useragent );
-        } else {
-            sprintf( luseragent, "User-Agent: zxdbfs" );
-        }
-
-        struct curl_slist *headers = NULL; // init to NULL is important
-        headers = curl_slist_append( headers, luseragent );
-        headers = curl_slist_append( headers, "charsets: utf-8" );
-        headers = curl_slist_append( headers, "Accept: text/html,application/xhtml+xml,application/xml,application/json,application/zip;q=0.9,image/webp,*/*;q=0.8" );
-
-        curl_easy_setopt( curl, CURLOPT_URL, fullurl );
-        curl_easy_setopt( curl, CURLOPT_FOLLOWLOCATION, 1L);
-        curl_easy_setopt( curl, CURLOPT_VERBOSE, 1 );
-        curl_easy_setopt( curl, CURLOPT_HTTPHEADER, headers );
-        curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, write_data );
-        curl_easy_setopt( curl, CURLOPT_WRITEDATA, (void *)chunk );
-        curl_easy_setopt( curl, CURLOPT_NOSIGNAL, 1 );
-        curl_easy_setopt( curl, CURLOPT_FOLLOWLOCATION, 1L );
-        curl_easy_setopt( curl, CURLOPT_TIMEOUT, 30L );
-
-        /** This needs to be outside of the SSL test as we might be following a redirect.... */
-        if ( 1 ) {
-            curl_easy_setopt( curl, CURLOPT_SSL_VERIFYPEER, 1L );
-            curl_easy_setopt( curl, CURLOPT_SSL_VERIFYHOST, 2L );
-        } else {
-            curl_easy_setopt( curl, CURLOPT_SSL_VERIFYPEER, 0L );
-            curl_easy_setopt( curl, CURLOPT_SSL_VERIFYHOST, 0L );
+        chunk = HTTP_newchunk( parse );
+        if ( chunk == NULL ) {
+            return NULL;
         }
 
-        if ( 1 ) {
-            curl_easy_setopt( curl, CURLOPT_USE_SSL, CURLUSESSL_ALL );
-        }
+        struct curl_slist *headers = HTTP_setup( curl, fullurl, useragent, chunk, validators );
 
         /* Perform the request, res will get the return code */
         res = curl_easy_perform( curl );
+        lastcode = HTTP_getcode( curl, res );
         /* Check for errors */
         if ( res != CURLE_OK ) {
             printf( "curl_easy_perform() failed: %s\n", curl_easy_strerror(res) );
             goto curl_cleanup;
         }
 
+        if ( HTTP_complete( curl, chunk, validators ) ) {
+            printf( "CURL: not modified\n" );
+            if ( notmodified != NULL ) {
+                *notmodified = 1;
+            }
+            curl_slist_free_all( headers );
+            HTTP_freechunk( chunk );
+            return NULL;
+        }
+
         /** Content length */
         double ct;
         res = curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD, &ct);
@@ -147,16 +543,11 @@ struct MemoryStruct *getURLViacURL( const char *host, const char *path, const ch
 
 curl_cleanup:
         curl_slist_free_all( headers );
-        curl_easy_cleanup( curl );
 
         if ( chunk != NULL ) {
             printf( "chunk.size: %ld\n", chunk->size );
             if ( res != CURLE_OK ) {
-                if ( chunk->memory != NULL ) {
-                    free( chunk->memory );
-                    chunk->memory = NULL;
-                }
-                free( chunk );
+                HTTP_freechunk( chunk );
                 chunk = NULL;
                 return chunk;
             }
@@ -169,54 +560,152 @@ curl_cleanup:
     return chunk;
 }
 
+/**
+ * Fetches part of a URL with an HTTP Range request
+ * In:
+ *      host - URL host. Required
+ *      path - URL path. Required
+ *      useragent - HTTP User-Agent. May be NULL
+ *      offset - first byte wanted
+ *      length - bytes wanted. Fewer come back at the end of the file
+ * Returns:
+ *      The response, or NULL on failure. A server that doesn't support
+ *      ranges sends the whole file instead, with a code of 200 rather
+ *      than 206. file:// URLs always honour the range, with a code of 0
+ */
+struct MemoryStruct *getURLRangeViacURL( const char *host, const char *path,
+                                         const char *useragent, off_t offset, size_t length ) {
+
+    if ( host == NULL || path == NULL || offset < 0 || length == 0 ) {
+        return NULL;
+    }
+
+    char fullurl[1024];
+    snprintf( fullurl, sizeof( fullurl ), "%s%s", host, path );
+    printf( "fullurl: %s (bytes %ld+%lu)\n", fullurl, (long)offset, (unsigned long)length );
+
+    Fetcher_t *lfetcher = __atomic_load_n( &fetcher, __ATOMIC_ACQUIRE );
+    if ( lfetcher != NULL ) {
+        Fetch_t *fetch = Fetcher_submitrange( lfetcher, fullurl, useragent, offset, length );
+        if ( fetch != NULL ) {
+            return Fetch_wait( fetch, NULL, NULL );
+        }
+    }
+
+    /**
+     * A handle of its own, as libcurl carries some of a range's state over
+     * a reset into the thread handle's next file:// request
+     */
+    HTTP_init();
+    CURL *curl = curl_easy_init();
+    if ( curl == NULL ) {
+        return NULL;
+    }
+    struct MemoryStruct *chunk = HTTP_newchunk( 0 );
+    if ( chunk == NULL ) {
+        curl_easy_cleanup( curl );
+        return NULL;
+    }
+
+    struct curl_slist *headers = HTTP_setup( curl, fullurl, useragent, chunk, NULL );
+    char range[64];
+    snprintf( range, sizeof( range ), "%ld-%ld", (long)offset, (long)( offset + length - 1 ) );
+    curl_easy_setopt( curl, CURLOPT_RANGE, range );
+
+    CURLcode res = curl_easy_perform( curl );
+    if ( res != CURLE_OK ) {
+        printf( "curl_easy_perform() failed: %s\n", curl_easy_strerror( res ) );
+        curl_easy_cleanup( curl );
+        curl_slist_free_all( headers );
+        HTTP_freechunk( chunk );
+        return NULL;
+    }
+    HTTP_complete( curl, chunk, NULL );
+    curl_easy_cleanup( curl );
+    curl_slist_free_all( headers );
+
+    return chunk;
+}
+
 /**
  * Return a JSON object either from cache or via cURL. In either case,
- * the cache will be updated
+ * the cache will be updated. A cached response older than its TTL is
+ * refetched, but is still returned if ZXDB can't be reached. The refetch
+ * is conditional, so an unchanged response is simply made fresh again
+ * without being sent or parsed
+ * In:
+ *      urlcache - URL cache. May be NULL
+ *      host - URL host. Required
+ *      path - URL path. Required
+ *      useragent - HTTP User-Agent. May be NULL
+ *      ttl - seconds a fetched response stays fresh. 0 = forever
  */
-json_object *getURL( json_object *urlcache, const char *host, const char *path, const char *useragent ) {
+json_object *getURL( URLCache_t *urlcache, const char *host, const char *path,
+                     const char *useragent, int ttl ) {
 
     if ( host == NULL || path == NULL ) {
         return NULL;
     }
 
     json_object *jsonObject = NULL;
+    int stale = 0;
+
+    lastcode = -1;
 
     /** Check the URL cache */
     char cachekey[256];
     sprintf( cachekey, "%s%s", host, path );
     if ( urlcache != NULL ) {
-        jsonObject = json_object_object_get( urlcache, cachekey );
+        jsonObject = URLCache_get( urlcache, cachekey, &stale );
     }
 
-    if ( jsonObject != NULL ) {
+    if ( jsonObject != NULL && !stale ) {
         printf( ">>> USING CACHE\n" );
-        return json_object_get( jsonObject );
+        return jsonObject;
     } else {
         printf( ">>> NOT USING CACHE\n" );
         /** Make a call to ZXDB */
 
-        struct MemoryStruct *chunk = getURLViacURL( host, path, useragent );
-        if ( chunk == NULL || chunk->memory == NULL ) {
-            return NULL;
+        HTTPValidators_t validators = { { 0 }, 0 };
+        if ( jsonObject != NULL ) {
+            URLCache_getvalidators( urlcache, cachekey, validators.etag,
+                                    sizeof( validators.etag ), &validators.lastmodified );
         }
 
-        jsonObject = json_tokener_parse( chunk->memory );
-        if ( !jsonObject ) {
-            free( chunk );
-            return NULL;
+        int notmodified = 0;
+        struct MemoryStruct *chunk = getURLViacURLIfModified( host, path, useragent,
+                                                              &validators, &notmodified, 1 );
+        if ( notmodified && jsonObject != NULL ) {
+            printf( ">>> REVALIDATED CACHE: %s\n", cachekey );
+            URLCache_revalidate( urlcache, cachekey );
+            return jsonObject;
+        }
+        /** An error response may be JSON too, but it isn't what was asked for */
+        if ( chunk == NULL || chunk->obj == NULL || chunk->code >= 400 ) {
+            HTTP_freechunk( chunk );
+            if ( jsonObject != NULL ) {
+                printf( ">>> USING STALE CACHE: %s\n", cachekey );
+            }
+            return jsonObject;
         }
 
-        free( chunk->memory );
-        chunk->memory = NULL;
-        free( chunk );
-        chunk = NULL;
+        /** Parsed as it arrived */
+        json_object *fetched = chunk->obj;
+        chunk->obj = NULL;
+        if ( jsonObject != NULL ) {
+            json_object_put( jsonObject );
+        }
+        jsonObject = fetched;
 
-        /** Populate the cache */
+        /** Populate the cache, charging the decompressed size of the response body */
         if ( urlcache != NULL ) {
-            json_object_object_add( urlcache, cachekey, json_object_get( jsonObject ) );
+            URLCache_add( urlcache, cachekey, jsonObject, chunk->size, ttl );
+            URLCache_setvalidators( urlcache, cachekey, validators.etag, validators.lastmodified );
         }
+
+        HTTP_freechunk( chunk );
+        chunk = NULL;
     }
 
     return jsonObject;
 }
-
@@ -21,16 +21,59 @@
 #ifndef _zxdbfs_http_h
 #define _zxdbfs_http_h
 
+#include <sys/types.h>
+#include <time.h>
+
+#include <curl/curl.h>
+
+#include <json-c/json.h>
+
+#include "zxdbfs_urlcache.h"
+
+#define HTTP_ETAG_SIZE 128
+
 struct MemoryStruct {
     char *memory;
     size_t size;
+    json_tokener *tokener;          /** Parses the body as it arrives instead. May be NULL */
+    json_object *obj;               /** The parsed body */
+    long code;                      /** HTTP response code. 0 for file:// */
 };
 
+/**
+ * Validators of a response. Sent back when refetching it, so that an
+ * unchanged response comes back as 304 Not Modified with no body
+ */
+typedef struct HTTPValidators {
+    char etag[HTTP_ETAG_SIZE];      /** Empty if none */
+    time_t lastmodified;            /** 0 if none */
+} HTTPValidators_t;
+
 int HTTP_TO_OSCODE( int res );
 
 static size_t write_data(void *contents, size_t size, size_t nmemb, void *userp);
 
+struct Fetcher;
+
+void HTTP_init( void );
+struct MemoryStruct *HTTP_newchunk( int parse );
+void HTTP_freechunk( struct MemoryStruct *chunk );
+struct curl_slist *HTTP_setup( CURL *curl, const char *url, const char *useragent,
+                               struct MemoryStruct *chunk, HTTPValidators_t *validators );
+int HTTP_complete( CURL *curl, struct MemoryStruct *chunk, HTTPValidators_t *validators );
+long HTTP_getcode( CURL *curl, CURLcode result );
+long HTTP_getlastcode( void );
+void HTTP_setfetcher( struct Fetcher *fetcher );
+void HTTP_getstats( unsigned long *nmodified, unsigned long *nnotmodified );
+
 struct MemoryStruct *getURLViacURL( const char *host, const char *path, const char *useragent );
-json_object *getURL( json_object *urlcache, const char *host, const char *path, const char *useragent );
+struct MemoryStruct *getURLViacURLIfModified( const char *host, const char *path,
+                                              const char *useragent,
+                                              HTTPValidators_t *validators, int *notmodified,
+                                              int parse );
+struct MemoryStruct *getURLRangeViacURL( const char *host, const char *path,
+                                         const char *useragent, off_t offset, size_t length );
+json_object *getURL( URLCache_t *urlcache, const char *host, const char *path,
+                     const char *useragent, int ttl );
 
 #endif /** !_zxdbfs_http_h */
@@ -0,0 +1,357 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zxdbfs_inode.h"
+#include "zxdbfs_paths.h"
+#include "zxdbfs_strpool.h"
+
+/**
+ * Releases an inode's path. Called by the path table on deletion
+ */
+static void _freeInode( struct lh_entry *e ) {
+
+    Inode_t *inode = (Inode_t *)lh_entry_v( e );
+
+    StringPool_release( inode->path );
+    free( inode );
+}
+
+/**
+ * Derives a stable inode number for a game or something within it
+ * In:
+ *      id - the game's seven digit ZXDB ID. Required
+ *      slot - 0 for the game's directory, otherwise a position within the
+ *             game of at most INODE_GAME_MAX_SLOT
+ * Returns:
+ *      The inode number, or 0 if there isn't a stable one
+ */
+uint64_t Inode_fromGameID( const char *id, unsigned int slot ) {
+
+    if ( id == NULL || isAllDigits( id ) != 0 || slot > INODE_GAME_MAX_SLOT ) {
+        return 0;
+    }
+
+    uint64_t gameid = strtoull( id, NULL, 10 );
+    if ( gameid == 0 ) {
+        return 0;
+    }
+
+    return ( gameid << INODE_GAME_SHIFT ) | slot;
+}
+
+/**
+ * Creates a new inode table holding just the root directory
+ * Returns:
+ *   A new inode table or NULL on failure
+ */
+InodeTable_t *InodeTable_create( void ) {
+
+    InodeTable_t *table = (InodeTable_t *)calloc( 1, sizeof( InodeTable_t ) );
+    if ( table == NULL ) {
+        return NULL;
+    }
+
+    table->bypath = lh_kchar_table_new( INODE_DEFAULT_HASH_SIZE, _freeInode );
+    table->byino = lh_kptr_table_new( INODE_DEFAULT_HASH_SIZE, NULL );
+    if ( table->bypath == NULL || table->byino == NULL ) {
+        InodeTable_free( table );
+        return NULL;
+    }
+    table->nextino = INODE_DYNAMIC_BASE;
+    pthread_mutex_init( &table->lock, NULL );
+
+    /** The kernel never looks up or forgets the root */
+    if ( InodeTable_lookup( table, "/", INODE_ROOT ) != INODE_ROOT ) {
+        InodeTable_free( table );
+        return NULL;
+    }
+
+    return table;
+}
+
+/**
+ * Frees an inode table
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+int InodeTable_free( InodeTable_t *table ) {
+
+    if ( table == NULL ) {
+        return 1;
+    }
+
+    if ( table->byino != NULL ) {
+        lh_table_free( table->byino );
+    }
+    if ( table->bypath != NULL ) {
+        lh_table_free( table->bypath );
+    }
+    pthread_mutex_destroy( &table->lock );
+    free( table );
+
+    return 0;
+}
+
+/**
+ * Counts one kernel lookup of a path, numbering it if it's new
+ * In:
+ *      table - the inode table. Required
+ *      path - the path looked up. Required
+ *      stableino - the number the path should have, or 0 if none can be
+ *                  derived. Ignored if the number is already taken
+ * Returns:
+ *      The path's inode number, or 0 on failure
+ */
+uint64_t InodeTable_lookup( InodeTable_t *table, const char *path,
+                            uint64_t stableino ) {
+
+    if ( table == NULL || path == NULL ) {
+        return 0;
+    }
+
+    pthread_mutex_lock( &table->lock );
+
+    Inode_t *inode = NULL;
+    if ( lh_table_lookup_ex( table->bypath, path, (void **)&inode ) ) {
+        inode->nlookup++;
+        pthread_mutex_unlock( &table->lock );
+        return inode->ino;
+    }
+
+    inode = (Inode_t *)calloc( 1, sizeof( Inode_t ) );
+    if ( inode == NULL ) {
+        pthread_mutex_unlock( &table->lock );
+        return 0;
+    }
+    inode->path = StringPool_intern( path );
+    inode->nlookup = 1;
+
+    /** Another path may hold the number after its directory was refreshed */
+    if ( stableino != 0 &&
+         !lh_table_lookup_ex( table->byino, (void *)(uintptr_t)stableino, NULL ) ) {
+        inode->ino = stableino;
+    } else {
+        inode->ino = table->nextino++;
+    }
+
+    if ( inode->path == NULL ||
+         lh_table_insert( table->bypath, inode->path, inode ) != 0 ) {
+        StringPool_release( inode->path );
+        free( inode );
+        pthread_mutex_unlock( &table->lock );
+        return 0;
+    }
+    if ( lh_table_insert( table->byino, (void *)(uintptr_t)inode->ino, inode ) != 0 ) {
+        lh_table_delete( table->bypath, inode->path );
+        pthread_mutex_unlock( &table->lock );
+        return 0;
+    }
+    table->nentries++;
+
+    uint64_t ino = inode->ino;
+    pthread_mutex_unlock( &table->lock );
+
+    return ino;
+}
+
+/**
+ * Retrieves the path an inode number stands for
+ * Returns:
+ *      The interned path, which the caller must release via
+ *      StringPool_release, or NULL if the number is unknown
+ */
+const char *InodeTable_getpath( InodeTable_t *table, uint64_t ino ) {
+
+    if ( table == NULL || ino == 0 ) {
+        return NULL;
+    }
+
+    const char *path = NULL;
+
+    pthread_mutex_lock( &table->lock );
+    Inode_t *inode = NULL;
+    if ( lh_table_lookup_ex( table->byino, (void *)(uintptr_t)ino, (void **)&inode ) ) {
+        path = StringPool_ref( inode->path );
+    }
+    pthread_mutex_unlock( &table->lock );
+
+    return path;
+}
+
+/**
+ * Retrieves the inode number of a path without counting a lookup
+ * Returns:
+ *      The inode number, or 0 if the path hasn't been numbered
+ */
+uint64_t InodeTable_getino( InodeTable_t *table, const char *path ) {
+
+    if ( table == NULL || path == NULL ) {
+        return 0;
+    }
+
+    uint64_t ino = 0;
+
+    pthread_mutex_lock( &table->lock );
+    Inode_t *inode = NULL;
+    if ( lh_table_lookup_ex( table->bypath, path, (void **)&inode ) ) {
+        ino = inode->ino;
+    }
+    pthread_mutex_unlock( &table->lock );
+
+    return ino;
+}
+
+/**
+ * Counts lookups the kernel has forgotten, dropping the inode once they
+ * all have been. The root is never dropped
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ *   2: Inode not present
+ */
+int InodeTable_forget( InodeTable_t *table, uint64_t ino, uint64_t nlookup ) {
+
+    if ( table == NULL ) {
+        return 1;
+    }
+
+    pthread_mutex_lock( &table->lock );
+
+    Inode_t *inode = NULL;
+    if ( !lh_table_lookup_ex( table->byino, (void *)(uintptr_t)ino, (void **)&inode ) ) {
+        pthread_mutex_unlock( &table->lock );
+        return 2;
+    }
+
+    inode->nlookup = nlookup < inode->nlookup ? inode->nlookup - nlookup : 0;
+    if ( inode->nlookup == 0 && ino != INODE_ROOT ) {
+        lh_table_delete( table->byino, (void *)(uintptr_t)ino );
+        lh_table_delete( table->bypath, inode->path );
+        table->nentries--;
+    }
+
+    pthread_mutex_unlock( &table->lock );
+
+    return 0;
+}
+
+/**
+ * Records the generation of the listing the kernel is caching for a
+ * directory. The kernel's cached listing goes with its inode, so a
+ * forgotten inode starts again from 0
+ * In:
+ *      table - the inode table. Required
+ *      ino - the directory's inode number
+ *      generation - the generation now being listed
+ * Returns:
+ *      The generation previously recorded, or 0 if there was none
+ */
+uint64_t InodeTable_setgeneration( InodeTable_t *table, uint64_t ino,
+                                   uint64_t generation ) {
+
+    if ( table == NULL ) {
+        return 0;
+    }
+
+    uint64_t previous = 0;
+
+    pthread_mutex_lock( &table->lock );
+    Inode_t *inode = NULL;
+    if ( lh_table_lookup_ex( table->byino, (void *)(uintptr_t)ino, (void **)&inode ) ) {
+        previous = inode->generation;
+        inode->generation = generation;
+    }
+    pthread_mutex_unlock( &table->lock );
+
+    return previous;
+}
+
+int InodeTable_getnentries( InodeTable_t *table ) {
+
+    if ( table == NULL ) {
+        return 0;
+    }
+
+    pthread_mutex_lock( &table->lock );
+    int nentries = table->nentries;
+    pthread_mutex_unlock( &table->lock );
+
+    return nentries;
+}
+
+/**
+ * Calls a function for a path and everything numbered beneath it. The
+ * matches are gathered first, so the function is called without the
+ * table locked and may use it
+ * In:
+ *      table - the inode table. Required
+ *      prefix - the path. Required
+ *      fn - called with each inode number and path. Required
+ *      arg - passed through to fn
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+int InodeTable_foreach( InodeTable_t *table, const char *prefix,
+                        InodeTableFn fn, void *arg ) {
+
+    if ( table == NULL || prefix == NULL || fn == NULL ) {
+        return 1;
+    }
+
+    size_t prefixlen = strlen( prefix );
+    int isroot = strcmp( prefix, "/" ) == 0;
+
+    pthread_mutex_lock( &table->lock );
+
+    Inode_t *matches = (Inode_t *)malloc( ( table->nentries + 1 ) * sizeof( Inode_t ) );
+    if ( matches == NULL ) {
+        pthread_mutex_unlock( &table->lock );
+        return 1;
+    }
+
+    int nmatches = 0;
+    struct lh_entry *e;
+    lh_foreach( table->bypath, e ) {
+        Inode_t *inode = (Inode_t *)lh_entry_v( e );
+        if ( isroot ||
+             ( strncmp( inode->path, prefix, prefixlen ) == 0 &&
+               ( inode->path[prefixlen] == '\0' || inode->path[prefixlen] == '/' ) ) ) {
+            matches[nmatches].ino = inode->ino;
+            matches[nmatches].path = StringPool_ref( inode->path );
+            nmatches++;
+        }
+    }
+
+    pthread_mutex_unlock( &table->lock );
+
+    for ( int i = 0 ; i < nmatches ; i++ ) {
+        fn( matches[i].ino, matches[i].path, arg );
+        StringPool_release( matches[i].path );
+    }
+    free( matches );
+
+    return 0;
+}
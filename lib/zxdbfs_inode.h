@@ -0,0 +1,76 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _zxdbfs_inode_h
+#define _zxdbfs_inode_h
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <json-c/linkhash.h>
+
+#define INODE_ROOT                  1           /** FUSE_ROOT_ID */
+#define INODE_GAME_SHIFT            16          /** Game ID << 16 | slot in the game */
+#define INODE_GAME_MAX_SLOT         0xffff
+#define INODE_DYNAMIC_BASE          (1ULL << 62)
+#define INODE_DEFAULT_HASH_SIZE     1024
+
+/**
+ * Maps the inode numbers handed to the kernel to paths and back. Paths
+ * are given a stable number where the caller can derive one, so the same
+ * game or file keeps its inode across mounts, and otherwise the next
+ * free number from INODE_DYNAMIC_BASE. An inode lives until the kernel
+ * has forgotten every lookup of it
+ */
+typedef struct Inode {
+    uint64_t ino;
+    const char *path;               /** Interned via the string pool */
+    uint64_t nlookup;
+    uint64_t generation;            /** Of the directory listing the kernel caches */
+} Inode_t;
+
+typedef struct InodeTable {
+    pthread_mutex_t lock;
+    struct lh_table *bypath;
+    struct lh_table *byino;
+    uint64_t nextino;
+    int nentries;
+} InodeTable_t;
+
+extern uint64_t Inode_fromGameID( const char *id, unsigned int slot );
+
+extern InodeTable_t *InodeTable_create( void );
+extern int InodeTable_free( InodeTable_t *table );
+
+extern uint64_t InodeTable_lookup( InodeTable_t *table, const char *path,
+                                   uint64_t stableino );
+extern const char *InodeTable_getpath( InodeTable_t *table, uint64_t ino );
+extern uint64_t InodeTable_getino( InodeTable_t *table, const char *path );
+extern int InodeTable_forget( InodeTable_t *table, uint64_t ino, uint64_t nlookup );
+extern uint64_t InodeTable_setgeneration( InodeTable_t *table, uint64_t ino,
+                                          uint64_t generation );
+
+extern int InodeTable_getnentries( InodeTable_t *table );
+
+typedef void (*InodeTableFn)( uint64_t ino, const char *path, void *arg );
+extern int InodeTable_foreach( InodeTable_t *table, const char *prefix,
+                               InodeTableFn fn, void *arg );
+
+#endif /** !_zxdbfs_inode_h */
@@ -36,3 +36,177 @@ void dumpJSON( json_object *obj ) {
     const char *output = json_object_to_json_string_ext(obj, JSON_C_TO_STRING_PRETTY);
     printf( "%s\n", output );
 }
+
+/**
+ * Converts a FSCacheEntry (and its children) into its JSON representation
+ * In:
+ *      fsCacheEntry - the entry to convert. Required
+ * Out:
+ *      N/A
+ * Returns:
+ *      NULL - conversion failed
+ *      json_object * - new JSON object. Release with json_object_put()
+ */
+json_object *FSCacheEntry_convertToJSON( FSCacheEntry_t *fsCacheEntry ) {
+
+    if ( fsCacheEntry == NULL ) {
+        return NULL;
+    }
+
+    json_object *obj = json_object_new_object();
+    if ( obj == NULL ) {
+        return NULL;
+    }
+
+    const char *stype = "unknown";
+    switch ( FSCacheEntry_gettype( fsCacheEntry ) ) {
+        case FSCACHEENTRY_DIR: {
+            stype = "dir";
+            break;
+        }
+        case FSCACHEENTRY_DIR_STUB: {
+            stype = "dirstub";
+            break;
+        }
+        case FSCACHEENTRY_FILE: {
+            stype = "file";
+            break;
+        }
+        default: {
+            break;
+        }
+    }
+    json_object_object_add( obj, "type", json_object_new_string( stype ) );
+    json_object_object_add( obj, "fname",
+                            json_object_new_string( FSCacheEntry_getfname( fsCacheEntry ) ) );
+    if ( FSCacheEntry_geturl( fsCacheEntry ) != NULL ) {
+        json_object_object_add( obj, "url",
+                                json_object_new_string( FSCacheEntry_geturl( fsCacheEntry ) ) );
+    }
+    json_object_object_add( obj, "size",
+                            json_object_new_int( FSCacheEntry_getsize( fsCacheEntry ) ) );
+
+    if ( __atomic_load_n( &fsCacheEntry->files, __ATOMIC_ACQUIRE ) != NULL ) {
+        json_object *files = json_object_new_array();
+        for ( int i = 0 ; i < FSCacheEntry_getnfiles( fsCacheEntry ) ; i++ ) {
+            json_object_array_add( files,
+                FSCacheEntry_convertToJSON( FSCacheEntry_getfile( fsCacheEntry, i ) ) );
+        }
+        json_object_object_add( obj, "files", files );
+    }
+
+    return obj;
+}
+
+/**
+ * Creates a FSCacheEntry (and its children) from its JSON representation
+ * In:
+ *      obj - JSON as produced by FSCacheEntry_convertToJSON(). Required
+ * Out:
+ *      N/A
+ * Returns:
+ *      NULL - conversion failed
+ *      FSCacheEntry_t * - new entry
+ */
+FSCacheEntry_t *FSCacheEntry_convertFromJSON( json_object *obj ) {
+
+    if ( obj == NULL ) {
+        return NULL;
+    }
+
+    const char *stype = json_object_get_string( json_object_object_get( obj, "type" ) );
+    if ( stype == NULL ) {
+        return NULL;
+    }
+
+    FSCacheEntryType type = FSCACHEENTRY_UNKNOWN;
+    if ( strcmp( stype, "dir" ) == 0 ) {
+        type = FSCACHEENTRY_DIR;
+    } else {
+        if ( strcmp( stype, "dirstub" ) == 0 ) {
+            type = FSCACHEENTRY_DIR_STUB;
+        } else {
+            if ( strcmp( stype, "file" ) == 0 ) {
+                type = FSCACHEENTRY_FILE;
+            }
+        }
+    }
+
+    FSCacheEntry_t *fsCacheEntry =
+        FSCacheEntry_create( json_object_get_string( json_object_object_get( obj, "fname" ) ),
+                             type,
+                             json_object_get_string( json_object_object_get( obj, "url" ) ),
+                             json_object_get_int( json_object_object_get( obj, "size" ) ) );
+    if ( fsCacheEntry == NULL ) {
+        return NULL;
+    }
+
+    json_object *files = json_object_object_get( obj, "files" );
+    if ( files != NULL ) {
+        for ( int i = 0 ; i < json_object_array_length( files ) ; i++ ) {
+            FSCacheEntry_t *file =
+                FSCacheEntry_convertFromJSON( json_object_array_get_idx( files, i ) );
+            if ( FSCacheEntry_addFile( fsCacheEntry, file ) != 0 ) {
+                FSCacheEntry_free( file );
+                FSCacheEntry_free( fsCacheEntry );
+                return NULL;
+            }
+        }
+    }
+
+    return fsCacheEntry;
+}
+
+/**
+ * Converts the whole FSCache into a JSON object keyed by cache key
+ * In:
+ *      cache - the cache. Required
+ * Out:
+ *      N/A
+ * Returns:
+ *      NULL - conversion failed
+ *      json_object * - new JSON object. Release with json_object_put()
+ */
+json_object *FSCache_convertToJSON( FSCache_t *cache ) {
+
+    if ( cache == NULL ) {
+        return NULL;
+    }
+
+    json_object *obj = json_object_new_object();
+    if ( obj == NULL ) {
+        return NULL;
+    }
+
+    /** Holding the writer lock keeps every entry stable whilst walked */
+    pthread_mutex_lock( &cache->lock );
+    for ( unsigned long i = 0 ; i < cache->table->size ; i++ ) {
+        for ( FSCacheNode_t *node = cache->table->buckets[i] ; node != NULL ; node = node->next ) {
+            json_object_object_add( obj, node->key,
+                                    FSCacheEntry_convertToJSON( node->entry ) );
+        }
+    }
+    pthread_mutex_unlock( &cache->lock );
+
+    return obj;
+}
+
+/**
+ * Dump a FSCacheEntry in pretty JSON format to stdout
+ */
+void dumpFSCacheEntry( FSCacheEntry_t *fsCacheEntry ) {
+
+    json_object *obj = FSCacheEntry_convertToJSON( fsCacheEntry );
+    dumpJSON( obj );
+    json_object_put( obj );
+}
+
+/**
+ * Dump the FSCache in pretty JSON format to stdout
+ */
+void dumpFSCache( FSCache_t *cache ) {
+
+    json_object *obj = FSCache_convertToJSON( cache );
+    dumpJSON( obj );
+    json_object_put( obj );
+}
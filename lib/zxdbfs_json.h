@@ -23,11 +23,15 @@
 
 #include <json-c/json.h>
 
+#include "zxdbfs_fscache.h"
 #include "zxdbfs_fscacheentry.h"
 
-//extern json_object *FSCacheEntry_convertToJSON( FSCacheEntry_t *fsCacheEntry );
-//extern FSCacheEntry_t *FSCacheEntry_convertFromJSON( json_object *fsCacheEntry );
+extern json_object *FSCacheEntry_convertToJSON( FSCacheEntry_t *fsCacheEntry );
+extern FSCacheEntry_t *FSCacheEntry_convertFromJSON( json_object *fsCacheEntry );
+extern json_object *FSCache_convertToJSON( FSCache_t *cache );
 
 extern void dumpJSON( json_object *obj );
+extern void dumpFSCacheEntry( FSCacheEntry_t *fsCacheEntry );
+extern void dumpFSCache( FSCache_t *cache );
 
 #endif /** !_zxdbfs_fscache_h */
@@ -0,0 +1,303 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zxdbfs_negcache.h"
+#include "zxdbfs_strpool.h"
+
+/**
+ * Releases an entry's key. Called by the hash table on deletion
+ */
+static void _freeCacheEntry( struct lh_entry *e ) {
+
+    NegCacheEntry_t *entry = (NegCacheEntry_t *)lh_entry_v( e );
+
+    StringPool_release( entry->key );
+    free( entry );
+}
+
+/**
+ * Removes an entry from the FIFO and the hash table
+ */
+static void _remove( NegCache_t *cache, NegCacheEntry_t *entry ) {
+
+    if ( entry->prev != NULL ) {
+        entry->prev->next = entry->next;
+    } else {
+        cache->head = entry->next;
+    }
+    if ( entry->next != NULL ) {
+        entry->next->prev = entry->prev;
+    } else {
+        cache->tail = entry->prev;
+    }
+    cache->nentries--;
+
+    struct lh_entry *e = lh_table_lookup_entry( cache->cache, entry->key );
+    if ( e != NULL ) {
+        lh_table_delete_entry( cache->cache, e );
+    }
+}
+
+/**
+ * Creates a new negative cache
+ * In:
+ *   maxentries: Most paths remembered at once. 0 for the default
+ *   ttl: Seconds a path is remembered for. 0 for the default
+ * Returns:
+ *   A new negative cache or NULL on failure
+ */
+NegCache_t *NegCache_create( int maxentries, int ttl ) {
+
+    if ( maxentries < 0 || ttl < 0 ) {
+        return NULL;
+    }
+
+    NegCache_t *cache = (NegCache_t *)calloc( 1, sizeof( NegCache_t ) );
+    if ( cache == NULL ) {
+        return NULL;
+    }
+
+    cache->cache = lh_kchar_table_new( NEGCACHE_DEFAULT_HASH_SIZE, _freeCacheEntry );
+    if ( cache->cache == NULL ) {
+        free( cache );
+        return NULL;
+    }
+    cache->maxentries = maxentries > 0 ? maxentries : NEGCACHE_DEFAULT_MAX_ENTRIES;
+    cache->ttl = ttl > 0 ? ttl : NEGCACHE_DEFAULT_TTL;
+    pthread_mutex_init( &cache->lock, NULL );
+
+    return cache;
+}
+
+/**
+ * Frees a negative cache
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+int NegCache_free( NegCache_t *cache ) {
+
+    if ( cache == NULL ) {
+        return 1;
+    }
+
+    lh_table_free( cache->cache );
+    pthread_mutex_destroy( &cache->lock );
+    free( cache );
+
+    return 0;
+}
+
+/**
+ * Forgets every remembered path. Counters are retained
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+int NegCache_flush( NegCache_t *cache ) {
+
+    if ( cache == NULL ) {
+        return 1;
+    }
+
+    struct lh_table *flushed = lh_kchar_table_new( NEGCACHE_DEFAULT_HASH_SIZE, _freeCacheEntry );
+    if ( flushed == NULL ) {
+        return 1;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+    lh_table_free( cache->cache );
+    cache->cache = flushed;
+    cache->head = NULL;
+    cache->tail = NULL;
+    cache->nentries = 0;
+    pthread_mutex_unlock( &cache->lock );
+
+    return 0;
+}
+
+/**
+ * Remembers that a path does not exist. Expired paths are dropped first,
+ * then the oldest if the cache is still full
+ * In:
+ *   key: Path
+ *   now: Current time
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+int NegCache_add( NegCache_t *cache, const char *key, time_t now ) {
+
+    if ( cache == NULL || key == NULL ) {
+        return 1;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+
+    struct lh_entry *e = lh_table_lookup_entry( cache->cache, key );
+    if ( e != NULL ) {
+        _remove( cache, (NegCacheEntry_t *)lh_entry_v( e ) );
+    }
+    while ( cache->tail != NULL &&
+            ( cache->tail->expires <= now || cache->nentries >= cache->maxentries ) ) {
+        _remove( cache, cache->tail );
+    }
+
+    NegCacheEntry_t *entry = (NegCacheEntry_t *)calloc( 1, sizeof( NegCacheEntry_t ) );
+    if ( entry == NULL ) {
+        pthread_mutex_unlock( &cache->lock );
+        return 1;
+    }
+    entry->key = StringPool_intern( key );
+    if ( entry->key == NULL ) {
+        free( entry );
+        pthread_mutex_unlock( &cache->lock );
+        return 1;
+    }
+    if ( lh_table_insert( cache->cache, entry->key, entry ) != 0 ) {
+        StringPool_release( entry->key );
+        free( entry );
+        pthread_mutex_unlock( &cache->lock );
+        return 1;
+    }
+    entry->expires = now + cache->ttl;
+    entry->next = cache->head;
+    if ( cache->head != NULL ) {
+        cache->head->prev = entry;
+    } else {
+        cache->tail = entry;
+    }
+    cache->head = entry;
+    cache->nentries++;
+
+    pthread_mutex_unlock( &cache->lock );
+
+    return 0;
+}
+
+/**
+ * Checks whether a path is known not to exist
+ * In:
+ *   key: Path
+ *   now: Current time
+ * Returns:
+ *   0: Not known to be missing
+ *   1: Known to be missing
+ */
+int NegCache_contains( NegCache_t *cache, const char *key, time_t now ) {
+
+    if ( cache == NULL || key == NULL ) {
+        return 0;
+    }
+
+    int rv = 0;
+
+    pthread_mutex_lock( &cache->lock );
+
+    struct lh_entry *e = lh_table_lookup_entry( cache->cache, key );
+    if ( e != NULL ) {
+        NegCacheEntry_t *entry = (NegCacheEntry_t *)lh_entry_v( e );
+        if ( entry->expires > now ) {
+            rv = 1;
+        } else {
+            _remove( cache, entry );
+        }
+    }
+    if ( rv ) {
+        cache->nhits++;
+    } else {
+        cache->nmisses++;
+    }
+
+    pthread_mutex_unlock( &cache->lock );
+
+    return rv;
+}
+
+/**
+ * Forgets a path, eg, because it has since been found
+ * In:
+ *   key: Path
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ *   2: Path was not remembered
+ */
+int NegCache_delete( NegCache_t *cache, const char *key ) {
+
+    if ( cache == NULL || key == NULL ) {
+        return 1;
+    }
+
+    int rv = 2;
+
+    pthread_mutex_lock( &cache->lock );
+    struct lh_entry *e = lh_table_lookup_entry( cache->cache, key );
+    if ( e != NULL ) {
+        _remove( cache, (NegCacheEntry_t *)lh_entry_v( e ) );
+        rv = 0;
+    }
+    pthread_mutex_unlock( &cache->lock );
+
+    return rv;
+}
+
+/**
+ * Returns:
+ *   Number of remembered paths, including any that have expired but not
+ *   yet been dropped
+ */
+int NegCache_getnentries( NegCache_t *cache ) {
+
+    if ( cache == NULL ) {
+        return 0;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+    int nentries = cache->nentries;
+    pthread_mutex_unlock( &cache->lock );
+
+    return nentries;
+}
+
+/**
+ * Sets how long newly added paths are remembered for
+ * In:
+ *   ttl: Seconds. Must be positive
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+int NegCache_setttl( NegCache_t *cache, int ttl ) {
+
+    if ( cache == NULL || ttl <= 0 ) {
+        return 1;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+    cache->ttl = ttl;
+    pthread_mutex_unlock( &cache->lock );
+
+    return 0;
+}
@@ -0,0 +1,69 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _zxdbfs_negcache_h
+#define _zxdbfs_negcache_h
+
+#include <pthread.h>
+#include <time.h>
+
+#include <json-c/linkhash.h>
+
+#define NEGCACHE_DEFAULT_HASH_SIZE      64
+#define NEGCACHE_DEFAULT_MAX_ENTRIES    1024
+#define NEGCACHE_DEFAULT_TTL            60
+
+/**
+ * Remembers paths that were found not to exist, so repeated probes for
+ * them are answered without going back to ZXDB. Every entry lives for
+ * the same TTL, so the FIFO is also in expiry order
+ */
+struct NegCacheEntry;
+typedef struct NegCacheEntry {
+    const char *key;                /** Interned via the string pool */
+    time_t expires;
+    struct NegCacheEntry *prev;
+    struct NegCacheEntry *next;
+} NegCacheEntry_t;
+
+typedef struct NegCache {
+    pthread_mutex_t lock;
+    struct lh_table *cache;
+    NegCacheEntry_t *head;          /** Newest */
+    NegCacheEntry_t *tail;
+    int nentries;
+    int maxentries;
+    int ttl;                        /** Seconds */
+    unsigned long nhits;
+    unsigned long nmisses;
+} NegCache_t;
+
+extern NegCache_t *NegCache_create( int maxentries, int ttl );
+extern int NegCache_free( NegCache_t *cache );
+extern int NegCache_flush( NegCache_t *cache );
+
+extern int NegCache_add( NegCache_t *cache, const char *key, time_t now );
+extern int NegCache_contains( NegCache_t *cache, const char *key, time_t now );
+extern int NegCache_delete( NegCache_t *cache, const char *key );
+
+extern int NegCache_getnentries( NegCache_t *cache );
+extern int NegCache_setttl( NegCache_t *cache, int ttl );
+
+#endif /** !_zxdbfs_negcache_h */
@@ -136,7 +136,7 @@ FSCacheEntry_t *FSCacheEntry_filterSearchResults( FSCacheEntry_t *searchResults,
     printf( "nfiles: %d\n", nfiles );
     for ( int i = 0 ; i < nfiles ; i++ ) {
         FSCacheEntry_t *filex = FSCacheEntry_getfile( searchResults, i );
-        dumpJSON( filex );
+        dumpFSCacheEntry( filex );
         if ( FSCacheEntry_gettype( filex ) != FSCACHEENTRY_FILE ) {
             continue;
         }
@@ -147,11 +147,12 @@ FSCacheEntry_t *FSCacheEntry_filterSearchResults( FSCacheEntry_t *searchResults,
     return NULL;
 }
 
-FSCacheEntry_t *FSCacheEntry_getAndCreateSearch( json_object *urlcache,
+FSCacheEntry_t *FSCacheEntry_getAndCreateSearch( URLCache_t *urlcache,
                                                  const char *filepath,
                                                  const char *urlhost,
                                                  const char *urlpath,
-                                                 const char *useragent ) {
+                                                 const char *useragent,
+                                                 int ttl ) {
 
     char searchTerm[128] = { 0 };
     char searchRootPath[256] = { 0 };
@@ -178,7 +179,7 @@ FSCacheEntry_t *FSCacheEntry_getAndCreateSearch( json_object *urlcache,
     printf( "URL: %s\n", url );
 
     /** Retrieve the full search data from ZXDB */
-    json_object *urlobj = getURL( urlcache, urlhost, url, useragent );
+    json_object *urlobj = getURL( urlcache, urlhost, url, useragent, ttl );
     if ( urlobj == NULL ) {
         printf( "Failed to retrieve search data from ZXDB\n" );
         free( url );
@@ -191,6 +192,10 @@ FSCacheEntry_t *FSCacheEntry_getAndCreateSearch( json_object *urlcache,
 
     FSCacheEntry_t *fsCacheEntry =
         FSCacheEntry_createFromSearch( filepath, urlobj, 0, searchTerm );
+
+    /** The URL cache holds its own reference */
+    json_object_put( urlobj );
+
     if ( fsCacheEntry == NULL ) {
         return NULL;
     }
@@ -21,14 +21,17 @@
 #ifndef _zxdbfs_search_h
 #define _zxdbfs_search_h
 
+#include "zxdbfs_urlcache.h"
+
 extern FSCacheEntry_t *FSCacheEntry_createFromSearch( const char *path,
                                                json_object *searchData_o,
                                                float minscore,
                                                const char *searchTerm );
-extern FSCacheEntry_t *FSCacheEntry_getAndCreateSearch( json_object *urlcache,
+extern FSCacheEntry_t *FSCacheEntry_getAndCreateSearch( URLCache_t *urlcache,
                                                  const char *filepath,
                                                  const char *urlhost,
                                                  const char *urlpath,
-                                                 const char *useragent );
+                                                 const char *useragent,
+                                                 int ttl );
 
 #endif /** !_zxdbfs_search_h */
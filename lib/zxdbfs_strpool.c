@@ -0,0 +1,215 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <json-c/linkhash.h>
+
+#include "zxdbfs_strpool.h"
+
+static struct lh_table *pool = NULL;
+/** Names are interned and released from every FUSE worker thread */
+static pthread_mutex_t poollock = PTHREAD_MUTEX_INITIALIZER;
+
+#define _entryFromString(s) \
+    ((StringPoolEntry_t *)((char *)(s) - offsetof( StringPoolEntry_t, str )))
+
+static void _freeEntry( struct lh_entry *e ) {
+    free( _entryFromString( lh_entry_k( e ) ) );
+}
+
+/**
+ * Creates the pool on first use. Call with the pool lock held
+ */
+static int _createPool() {
+
+    if ( pool == NULL ) {
+        pool = lh_kchar_table_new( STRPOOL_DEFAULT_HASH_SIZE, _freeEntry );
+    }
+
+    return pool != NULL ? 0 : 1;
+}
+
+/**
+ * Returns the pooled copy of a string, creating it if required
+ * In:
+ *      str - the string to intern. Required
+ * Out:
+ *      N/A
+ * Returns:
+ *      NULL - failure
+ *      const char * - pooled string. Release with StringPool_release()
+ */
+const char *StringPool_intern( const char *str ) {
+
+    if ( str == NULL ) {
+        return NULL;
+    }
+
+    pthread_mutex_lock( &poollock );
+
+    if ( _createPool() != 0 ) {
+        pthread_mutex_unlock( &poollock );
+        return NULL;
+    }
+
+    unsigned long hash = lh_get_hash( pool, str );
+    struct lh_entry *e = lh_table_lookup_entry_w_hash( pool, str, hash );
+    if ( e != NULL ) {
+        StringPoolEntry_t *entry = _entryFromString( lh_entry_k( e ) );
+        if ( entry->refcount != STRPOOL_REFCOUNT_STATIC ) {
+            entry->refcount++;
+        }
+        pthread_mutex_unlock( &poollock );
+        return (const char *)lh_entry_k( e );
+    }
+
+    size_t len = strlen( str );
+    StringPoolEntry_t *entry =
+        (StringPoolEntry_t *)malloc( sizeof( StringPoolEntry_t ) + len + 1 );
+    if ( entry == NULL ) {
+        pthread_mutex_unlock( &poollock );
+        return NULL;
+    }
+    entry->refcount = 1;
+    memcpy( entry->str, str, len + 1 );
+
+    if ( lh_table_insert_w_hash( pool, entry->str, entry, hash, 0 ) != 0 ) {
+        pthread_mutex_unlock( &poollock );
+        free( entry );
+        return NULL;
+    }
+
+    pthread_mutex_unlock( &poollock );
+
+    return entry->str;
+}
+
+/**
+ * Pools a string in place without copying it, eg, from a mapped FSCache
+ * image. The entry must be marked STRPOOL_REFCOUNT_STATIC and outlive the
+ * pool; it is never written to or freed. If the string is already pooled,
+ * the existing copy is used instead
+ * In:
+ *      entry - string and its refcount. Required
+ * Out:
+ *      N/A
+ * Returns:
+ *      NULL - failure
+ *      const char * - pooled string. Release with StringPool_release()
+ */
+const char *StringPool_adopt( const StringPoolEntry_t *entry ) {
+
+    if ( entry == NULL || entry->refcount != STRPOOL_REFCOUNT_STATIC ) {
+        return NULL;
+    }
+
+    pthread_mutex_lock( &poollock );
+
+    if ( _createPool() != 0 ) {
+        pthread_mutex_unlock( &poollock );
+        return NULL;
+    }
+
+    unsigned long hash = lh_get_hash( pool, entry->str );
+    struct lh_entry *e = lh_table_lookup_entry_w_hash( pool, entry->str, hash );
+    if ( e != NULL ) {
+        StringPoolEntry_t *existing = _entryFromString( lh_entry_k( e ) );
+        if ( existing->refcount != STRPOOL_REFCOUNT_STATIC ) {
+            existing->refcount++;
+        }
+        pthread_mutex_unlock( &poollock );
+        return (const char *)lh_entry_k( e );
+    }
+
+    if ( lh_table_insert_w_hash( pool, entry->str, (void *)entry, hash, 0 ) != 0 ) {
+        pthread_mutex_unlock( &poollock );
+        return NULL;
+    }
+
+    pthread_mutex_unlock( &poollock );
+
+    return entry->str;
+}
+
+/**
+ * Takes an additional reference on an already pooled string
+ * In:
+ *      istr - string previously returned from StringPool_intern(). Required
+ * Out:
+ *      N/A
+ * Returns:
+ *      istr
+ */
+const char *StringPool_ref( const char *istr ) {
+
+    if ( istr == NULL ) {
+        return NULL;
+    }
+
+    pthread_mutex_lock( &poollock );
+    StringPoolEntry_t *entry = _entryFromString( istr );
+    if ( entry->refcount != STRPOOL_REFCOUNT_STATIC ) {
+        entry->refcount++;
+    }
+    pthread_mutex_unlock( &poollock );
+
+    return istr;
+}
+
+/**
+ * Drops a reference on a pooled string, freeing it with the last one
+ * In:
+ *      istr - string previously returned from StringPool_intern()
+ * Out:
+ *      N/A
+ * Returns:
+ *      N/A
+ */
+void StringPool_release( const char *istr ) {
+
+    if ( istr == NULL || pool == NULL ) {
+        return;
+    }
+
+    pthread_mutex_lock( &poollock );
+
+    StringPoolEntry_t *entry = _entryFromString( istr );
+    if ( entry->refcount != STRPOOL_REFCOUNT_STATIC && --entry->refcount == 0 ) {
+        lh_table_delete( pool, istr );
+    }
+
+    pthread_mutex_unlock( &poollock );
+}
+
+/**
+ * Returns the number of distinct strings currently pooled
+ */
+int StringPool_getnentries() {
+
+    pthread_mutex_lock( &poollock );
+    int nentries = pool != NULL ? lh_table_length( pool ) : 0;
+    pthread_mutex_unlock( &poollock );
+
+    return nentries;
+}
@@ -0,0 +1,45 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _zxdbfs_strpool_h
+#define _zxdbfs_strpool_h
+
+#define STRPOOL_DEFAULT_HASH_SIZE 1024
+
+/**
+ * Interned strings live inline after their refcount so that a pool
+ * reference can be mapped straight back to its entry. A negative
+ * refcount marks a string adopted from storage the pool doesn't own,
+ * which is never counted or freed
+ */
+typedef struct StringPoolEntry {
+    int refcount;
+    char str[];
+} StringPoolEntry_t;
+
+#define STRPOOL_REFCOUNT_STATIC (-1)
+
+extern const char *StringPool_intern( const char *str );
+extern const char *StringPool_adopt( const StringPoolEntry_t *entry );
+extern const char *StringPool_ref( const char *istr );
+extern void StringPool_release( const char *istr );
+extern int StringPool_getnentries();
+
+#endif /** !_zxdbfs_strpool_h */
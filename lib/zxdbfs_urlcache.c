@@ -0,0 +1,558 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zxdbfs_urlcache.h"
+#include "zxdbfs_strpool.h"
+
+/** Share of the byte budget given to the A1in FIFO */
+#define URLCACHE_A1IN_DIVISOR   4
+
+/**
+ * Unlinks an entry from whichever queue it is on
+ */
+static void _unlink( URLCache_t *cache, URLCacheEntry_t *entry ) {
+
+    URLCacheList_t *list = &cache->queues[entry->queue];
+
+    if ( entry->prev != NULL ) {
+        entry->prev->next = entry->next;
+    } else {
+        list->head = entry->next;
+    }
+    if ( entry->next != NULL ) {
+        entry->next->prev = entry->prev;
+    } else {
+        list->tail = entry->prev;
+    }
+    entry->prev = NULL;
+    entry->next = NULL;
+
+    list->nentries--;
+    list->nbytes -= entry->nbytes;
+}
+
+/**
+ * Pushes an entry onto the head of a queue
+ */
+static void _push( URLCache_t *cache, URLCacheEntry_t *entry, URLCacheQueue queue ) {
+
+    URLCacheList_t *list = &cache->queues[queue];
+
+    entry->queue = queue;
+    entry->prev = NULL;
+    entry->next = list->head;
+    if ( list->head != NULL ) {
+        list->head->prev = entry;
+    } else {
+        list->tail = entry;
+    }
+    list->head = entry;
+
+    list->nentries++;
+    list->nbytes += entry->nbytes;
+}
+
+/**
+ * Forgets an entry's validators
+ */
+static void _clearValidators( URLCacheEntry_t *entry ) {
+
+    free( entry->etag );
+    entry->etag = NULL;
+    entry->lastmodified = 0;
+}
+
+/**
+ * Releases an entry's key and response. Called by the hash table on
+ * deletion
+ */
+static void _freeCacheEntry( struct lh_entry *e ) {
+
+    URLCacheEntry_t *entry = (URLCacheEntry_t *)lh_entry_v( e );
+
+    StringPool_release( entry->key );
+    if ( entry->obj != NULL ) {
+        json_object_put( entry->obj );
+    }
+    _clearValidators( entry );
+    free( entry );
+}
+
+/**
+ * Removes an entry from its queue and the hash table
+ */
+static void _remove( URLCache_t *cache, URLCacheEntry_t *entry ) {
+
+    _unlink( cache, entry );
+
+    struct lh_entry *e = lh_table_lookup_entry( cache->cache, entry->key );
+    if ( e != NULL ) {
+        lh_table_delete_entry( cache->cache, e );
+    }
+}
+
+/**
+ * Drops the response held by an entry and remembers its key in A1out
+ */
+static void _demote( URLCache_t *cache, URLCacheEntry_t *entry ) {
+
+    _unlink( cache, entry );
+
+    json_object_put( entry->obj );
+    entry->obj = NULL;
+    entry->nbytes = 0;
+    _clearValidators( entry );
+
+    _push( cache, entry, URLCACHEQUEUE_A1OUT );
+
+    /** Bound the ghost queue */
+    while ( cache->queues[URLCACHEQUEUE_A1OUT].nentries > cache->maxghosts ) {
+        _remove( cache, cache->queues[URLCACHEQUEUE_A1OUT].tail );
+    }
+}
+
+/**
+ * Frees space until the resident queues fit the byte budget. A1in is
+ * drained first while it holds more than its share so one-pass scans
+ * recycle their own slots rather than pushing out Am
+ */
+static void _reclaim( URLCache_t *cache ) {
+
+    URLCacheList_t *a1in = &cache->queues[URLCACHEQUEUE_A1IN];
+    URLCacheList_t *am = &cache->queues[URLCACHEQUEUE_AM];
+    size_t kin = cache->maxbytes / URLCACHE_A1IN_DIVISOR;
+
+    while ( a1in->nbytes + am->nbytes > cache->maxbytes ) {
+        if ( a1in->tail != NULL && ( a1in->nbytes > kin || am->tail == NULL ) ) {
+            _demote( cache, a1in->tail );
+        } else if ( am->tail != NULL ) {
+            _remove( cache, am->tail );
+        } else {
+            break;
+        }
+        cache->nevictions++;
+    }
+}
+
+/**
+ * Creates a new URL cache
+ * In:
+ *   maxbytes: Byte budget for cached responses. 0 for the default
+ * Returns:
+ *   A new URL cache or NULL on failure
+ */
+URLCache_t *URLCache_create( size_t maxbytes ) {
+
+    URLCache_t *cache = (URLCache_t *)calloc( 1, sizeof( URLCache_t ) );
+    if ( cache == NULL ) {
+        return NULL;
+    }
+
+    cache->cache = lh_kchar_table_new( URLCACHE_DEFAULT_HASH_SIZE, _freeCacheEntry );
+    if ( cache->cache == NULL ) {
+        free( cache );
+        return NULL;
+    }
+    cache->maxbytes = maxbytes > 0 ? maxbytes : URLCACHE_DEFAULT_MAX_BYTES;
+    cache->maxghosts = URLCACHE_DEFAULT_NGHOSTS;
+    pthread_mutex_init( &cache->lock, NULL );
+
+    return cache;
+}
+
+/**
+ * Frees a URL cache and all cached responses
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+int URLCache_free( URLCache_t *cache ) {
+
+    if ( cache == NULL ) {
+        return 1;
+    }
+
+    lh_table_free( cache->cache );
+    pthread_mutex_destroy( &cache->lock );
+    free( cache );
+
+    return 0;
+}
+
+/**
+ * Discards all cached responses and ghosts. Counters are retained
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+int URLCache_flush( URLCache_t *cache ) {
+
+    if ( cache == NULL ) {
+        return 1;
+    }
+
+    struct lh_table *flushed = lh_kchar_table_new( URLCACHE_DEFAULT_HASH_SIZE, _freeCacheEntry );
+    if ( flushed == NULL ) {
+        return 1;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+    lh_table_free( cache->cache );
+    cache->cache = flushed;
+    memset( cache->queues, 0, sizeof( cache->queues ) );
+    pthread_mutex_unlock( &cache->lock );
+
+    return 0;
+}
+
+/**
+ * Looks up a cached response. A hit in A1in is left in place; a hit in
+ * Am moves the entry to the head of Am. Expired responses are still
+ * returned so that callers can fall back on them if a refetch fails
+ * In:
+ *   key: Cache key
+ * Out:
+ *   stale: Set to 1 if the response has outlived its TTL. May be NULL
+ * Returns:
+ *   A new reference to the cached response which the caller must put,
+ *   or NULL if not resident
+ */
+json_object *URLCache_get( URLCache_t *cache, const char *key, int *stale ) {
+
+    if ( stale != NULL ) {
+        *stale = 0;
+    }
+    if ( cache == NULL || key == NULL ) {
+        return NULL;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+
+    struct lh_entry *e = lh_table_lookup_entry( cache->cache, key );
+    URLCacheEntry_t *entry = e != NULL ? (URLCacheEntry_t *)lh_entry_v( e ) : NULL;
+    if ( entry == NULL || entry->obj == NULL ) {
+        cache->nmisses++;
+        pthread_mutex_unlock( &cache->lock );
+        return NULL;
+    }
+
+    if ( entry->queue == URLCACHEQUEUE_AM ) {
+        _unlink( cache, entry );
+        _push( cache, entry, URLCACHEQUEUE_AM );
+    }
+    if ( entry->ttl > 0 && time( NULL ) - entry->fetched >= entry->ttl ) {
+        cache->nstale++;
+        if ( stale != NULL ) {
+            *stale = 1;
+        }
+    } else {
+        cache->nhits++;
+    }
+    json_object *obj = json_object_get( entry->obj );
+
+    pthread_mutex_unlock( &cache->lock );
+
+    return obj;
+}
+
+/**
+ * URLCache_add() with the lock held
+ */
+static int _add( URLCache_t *cache, const char *key, json_object *obj,
+                 size_t nbytes, int ttl ) {
+
+    /** Responses larger than the budget are never admitted */
+    if ( nbytes > cache->maxbytes ) {
+        return 1;
+    }
+
+    URLCacheQueue queue = URLCACHEQUEUE_A1IN;
+
+    unsigned long hash = lh_get_hash( cache->cache, key );
+    struct lh_entry *e = lh_table_lookup_entry_w_hash( cache->cache, key, hash );
+    URLCacheEntry_t *entry = NULL;
+    if ( e != NULL ) {
+        entry = (URLCacheEntry_t *)lh_entry_v( e );
+        if ( entry->queue != URLCACHEQUEUE_A1IN ) {
+            queue = URLCACHEQUEUE_AM;
+        }
+        _unlink( cache, entry );
+        if ( entry->obj != NULL ) {
+            json_object_put( entry->obj );
+        }
+        _clearValidators( entry );
+    } else {
+        entry = (URLCacheEntry_t *)calloc( 1, sizeof( URLCacheEntry_t ) );
+        if ( entry == NULL ) {
+            return 1;
+        }
+        entry->key = StringPool_intern( key );
+        if ( entry->key == NULL ) {
+            free( entry );
+            return 1;
+        }
+        if ( lh_table_insert_w_hash( cache->cache, entry->key, entry, hash, 0 ) != 0 ) {
+            StringPool_release( entry->key );
+            free( entry );
+            return 1;
+        }
+    }
+
+    entry->obj = json_object_get( obj );
+    entry->nbytes = nbytes;
+    entry->fetched = time( NULL );
+    entry->ttl = ttl;
+    _push( cache, entry, queue );
+
+    _reclaim( cache );
+
+    return 0;
+}
+
+/**
+ * Adds a response to the cache. Keys remembered in A1out are admitted
+ * straight to Am; anything else starts in A1in. Any validators of the
+ * previous response are forgotten
+ * In:
+ *   key: Cache key
+ *   obj: Response. The cache takes its own reference
+ *   nbytes: Size of the response body charged against the budget
+ *   ttl: Seconds before the response is stale. 0 = never
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+int URLCache_add( URLCache_t *cache, const char *key, json_object *obj,
+                  size_t nbytes, int ttl ) {
+
+    if ( cache == NULL || key == NULL || obj == NULL ) {
+        return 1;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+    int rv = _add( cache, key, obj, nbytes, ttl );
+    pthread_mutex_unlock( &cache->lock );
+
+    return rv;
+}
+
+/**
+ * Removes a response, or ghost, from the cache
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ *   2: Key not present
+ */
+int URLCache_delete( URLCache_t *cache, const char *key ) {
+
+    if ( cache == NULL || key == NULL ) {
+        return 1;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+
+    struct lh_entry *e = lh_table_lookup_entry( cache->cache, key );
+    if ( e == NULL ) {
+        pthread_mutex_unlock( &cache->lock );
+        return 2;
+    }
+
+    _remove( cache, (URLCacheEntry_t *)lh_entry_v( e ) );
+
+    pthread_mutex_unlock( &cache->lock );
+
+    return 0;
+}
+
+/**
+ * Looks up a resident response's entry with the lock held
+ */
+static URLCacheEntry_t *_getResident( URLCache_t *cache, const char *key ) {
+
+    struct lh_entry *e = lh_table_lookup_entry( cache->cache, key );
+    URLCacheEntry_t *entry = e != NULL ? (URLCacheEntry_t *)lh_entry_v( e ) : NULL;
+
+    return entry != NULL && entry->obj != NULL ? entry : NULL;
+}
+
+/**
+ * Records the validators sent with a cached response, so that it can be
+ * refetched conditionally once it expires
+ * In:
+ *   key: Cache key
+ *   etag: ETag response header. May be NULL
+ *   lastmodified: Last-Modified response header. 0 if none
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ *   2: Response not resident
+ */
+int URLCache_setvalidators( URLCache_t *cache, const char *key,
+                            const char *etag, time_t lastmodified ) {
+
+    if ( cache == NULL || key == NULL ) {
+        return 1;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+
+    URLCacheEntry_t *entry = _getResident( cache, key );
+    if ( entry == NULL ) {
+        pthread_mutex_unlock( &cache->lock );
+        return 2;
+    }
+
+    _clearValidators( entry );
+    if ( etag != NULL && etag[0] != '\0' ) {
+        entry->etag = strdup( etag );
+    }
+    entry->lastmodified = lastmodified;
+
+    pthread_mutex_unlock( &cache->lock );
+
+    return 0;
+}
+
+/**
+ * Returns the validators of a cached response
+ * In:
+ *   key: Cache key
+ *   etagsize: Size of the etag buffer
+ * Out:
+ *   etag: ETag, or empty if none. Truncated ETags are not returned
+ *   lastmodified: Last-Modified time, or 0 if none
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ *   2: Response not resident
+ */
+int URLCache_getvalidators( URLCache_t *cache, const char *key,
+                            char *etag, size_t etagsize, time_t *lastmodified ) {
+
+    if ( cache == NULL || key == NULL || etag == NULL || etagsize == 0 || lastmodified == NULL ) {
+        return 1;
+    }
+
+    etag[0] = '\0';
+    *lastmodified = 0;
+
+    pthread_mutex_lock( &cache->lock );
+
+    URLCacheEntry_t *entry = _getResident( cache, key );
+    if ( entry == NULL ) {
+        pthread_mutex_unlock( &cache->lock );
+        return 2;
+    }
+
+    if ( entry->etag != NULL && strlen( entry->etag ) < etagsize ) {
+        strcpy( etag, entry->etag );
+    }
+    *lastmodified = entry->lastmodified;
+
+    pthread_mutex_unlock( &cache->lock );
+
+    return 0;
+}
+
+/**
+ * Marks a cached response as fresh again, once the server has confirmed
+ * it is unchanged
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ *   2: Response not resident
+ */
+int URLCache_revalidate( URLCache_t *cache, const char *key ) {
+
+    if ( cache == NULL || key == NULL ) {
+        return 1;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+
+    URLCacheEntry_t *entry = _getResident( cache, key );
+    if ( entry == NULL ) {
+        pthread_mutex_unlock( &cache->lock );
+        return 2;
+    }
+
+    entry->fetched = time( NULL );
+    cache->nrevalidated++;
+
+    pthread_mutex_unlock( &cache->lock );
+
+    return 0;
+}
+
+/**
+ * Returns the number of resident responses, excluding ghosts
+ */
+int URLCache_getnentries( URLCache_t *cache ) {
+
+    if ( cache == NULL ) {
+        return 0;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+    int nentries = cache->queues[URLCACHEQUEUE_A1IN].nentries + cache->queues[URLCACHEQUEUE_AM].nentries;
+    pthread_mutex_unlock( &cache->lock );
+
+    return nentries;
+}
+
+/**
+ * Returns the bytes charged for resident responses
+ */
+size_t URLCache_getnbytes( URLCache_t *cache ) {
+
+    if ( cache == NULL ) {
+        return 0;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+    size_t nbytes = cache->queues[URLCACHEQUEUE_A1IN].nbytes + cache->queues[URLCACHEQUEUE_AM].nbytes;
+    pthread_mutex_unlock( &cache->lock );
+
+    return nbytes;
+}
+
+/**
+ * Sets the byte budget, evicting immediately if already over
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+int URLCache_setmaxbytes( URLCache_t *cache, size_t maxbytes ) {
+
+    if ( cache == NULL || maxbytes == 0 ) {
+        return 1;
+    }
+
+    pthread_mutex_lock( &cache->lock );
+    cache->maxbytes = maxbytes;
+    _reclaim( cache );
+    pthread_mutex_unlock( &cache->lock );
+
+    return 0;
+}
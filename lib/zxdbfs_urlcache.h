@@ -0,0 +1,101 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _zxdbfs_urlcache_h
+#define _zxdbfs_urlcache_h
+
+#include <pthread.h>
+#include <time.h>
+
+#include <json-c/json.h>
+#include <json-c/linkhash.h>
+
+#define URLCACHE_DEFAULT_HASH_SIZE 64
+#define URLCACHE_DEFAULT_MAX_BYTES (4 * 1024 * 1024)
+#define URLCACHE_DEFAULT_NGHOSTS 512
+
+/**
+ * The URL cache uses the 2Q replacement policy. New responses enter a
+ * small FIFO (A1in). Only responses requested again after leaving A1in,
+ * which are remembered by key in a ghost FIFO (A1out), are promoted into
+ * the main LRU (Am). One-shot responses from trawls therefore never
+ * displace frequently reopened ones
+ */
+typedef enum {
+    URLCACHEQUEUE_A1IN,
+    URLCACHEQUEUE_A1OUT,
+    URLCACHEQUEUE_AM,
+    URLCACHEQUEUE_MAX
+} URLCacheQueue;
+
+struct URLCacheEntry;
+typedef struct URLCacheEntry {
+    const char *key;                /** Interned via the string pool */
+    json_object *obj;               /** NULL for A1out ghosts */
+    size_t nbytes;
+    time_t fetched;
+    int ttl;                        /** Seconds. 0 = never expires */
+    char *etag;                     /** Validators for refetching. May be NULL */
+    time_t lastmodified;            /** 0 if not known */
+    URLCacheQueue queue;
+    struct URLCacheEntry *prev;
+    struct URLCacheEntry *next;
+} URLCacheEntry_t;
+
+typedef struct URLCacheList {
+    URLCacheEntry_t *head;          /** Most recent */
+    URLCacheEntry_t *tail;
+    int nentries;
+    size_t nbytes;
+} URLCacheList_t;
+
+typedef struct URLCache {
+    pthread_mutex_t lock;
+    struct lh_table *cache;
+    URLCacheList_t queues[URLCACHEQUEUE_MAX];
+    size_t maxbytes;
+    int maxghosts;
+    unsigned long nhits;
+    unsigned long nmisses;
+    unsigned long nevictions;
+    unsigned long nstale;           /** Expired responses handed back */
+    unsigned long nrevalidated;     /** Expired responses found unchanged */
+} URLCache_t;
+
+extern URLCache_t *URLCache_create( size_t maxbytes );
+extern int URLCache_free( URLCache_t *cache );
+extern int URLCache_flush( URLCache_t *cache );
+
+extern json_object *URLCache_get( URLCache_t *cache, const char *key, int *stale );
+extern int URLCache_add( URLCache_t *cache, const char *key, json_object *obj,
+                         size_t nbytes, int ttl );
+extern int URLCache_delete( URLCache_t *cache, const char *key );
+
+extern int URLCache_setvalidators( URLCache_t *cache, const char *key,
+                                   const char *etag, time_t lastmodified );
+extern int URLCache_getvalidators( URLCache_t *cache, const char *key,
+                                   char *etag, size_t etagsize, time_t *lastmodified );
+extern int URLCache_revalidate( URLCache_t *cache, const char *key );
+
+extern int URLCache_getnentries( URLCache_t *cache );
+extern size_t URLCache_getnbytes( URLCache_t *cache );
+extern int URLCache_setmaxbytes( URLCache_t *cache, size_t maxbytes );
+
+#endif /** !_zxdbfs_urlcache_h */
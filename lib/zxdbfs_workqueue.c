@@ -0,0 +1,225 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "zxdbfs_workqueue.h"
+
+static void *_worker( void *arg ) {
+
+    WorkQueue_t *workqueue = (WorkQueue_t *)arg;
+
+    pthread_mutex_lock( &workqueue->lock );
+    for ( ;; ) {
+        while ( workqueue->head == NULL && !workqueue->shutdown ) {
+            pthread_cond_wait( &workqueue->ready, &workqueue->lock );
+        }
+        if ( workqueue->head == NULL ) {
+            /** Shutting down with nothing left to do */
+            break;
+        }
+
+        WorkQueueItem_t *item = workqueue->head;
+        workqueue->head = item->next;
+        if ( workqueue->head == NULL ) {
+            workqueue->tail = NULL;
+        }
+
+        pthread_mutex_unlock( &workqueue->lock );
+        item->fn( item->arg );
+        free( item );
+        pthread_mutex_lock( &workqueue->lock );
+
+        if ( --workqueue->npending == 0 ) {
+            pthread_cond_broadcast( &workqueue->idle );
+        }
+    }
+    pthread_mutex_unlock( &workqueue->lock );
+
+    return NULL;
+}
+
+/**
+ * Starts a work queue
+ * In:
+ *      nthreads - number of worker threads. 0 for the default
+ * Out:
+ *      N/A
+ * Returns:
+ *      New work queue or NULL on failure
+ */
+WorkQueue_t *WorkQueue_create( int nthreads ) {
+
+    if ( nthreads < 0 ) {
+        return NULL;
+    }
+    if ( nthreads == 0 ) {
+        nthreads = WORKQUEUE_DEFAULT_NTHREADS;
+    }
+
+    WorkQueue_t *workqueue = (WorkQueue_t *)calloc( 1, sizeof( WorkQueue_t ) );
+    if ( workqueue == NULL ) {
+        return NULL;
+    }
+    workqueue->threads = (pthread_t *)calloc( nthreads, sizeof( pthread_t ) );
+    if ( workqueue->threads == NULL ) {
+        free( workqueue );
+        return NULL;
+    }
+
+    pthread_mutex_init( &workqueue->lock, NULL );
+    pthread_cond_init( &workqueue->ready, NULL );
+    pthread_cond_init( &workqueue->idle, NULL );
+
+    for ( int i = 0 ; i < nthreads ; i++ ) {
+        if ( pthread_create( &workqueue->threads[i], NULL, _worker, workqueue ) != 0 ) {
+            printf( "workqueue: failed to start worker %d\n", i );
+            break;
+        }
+        workqueue->nthreads++;
+    }
+    if ( workqueue->nthreads == 0 ) {
+        WorkQueue_free( workqueue );
+        return NULL;
+    }
+
+    return workqueue;
+}
+
+/**
+ * Runs any jobs still queued, then stops the workers and frees the queue
+ * In:
+ *      workqueue - the work queue. Required
+ * Out:
+ *      N/A
+ * Returns:
+ *      0 = success
+ *      1 = failure
+ */
+int WorkQueue_free( WorkQueue_t *workqueue ) {
+
+    if ( workqueue == NULL ) {
+        return 1;
+    }
+
+    pthread_mutex_lock( &workqueue->lock );
+    workqueue->shutdown = 1;
+    pthread_cond_broadcast( &workqueue->ready );
+    pthread_mutex_unlock( &workqueue->lock );
+
+    for ( int i = 0 ; i < workqueue->nthreads ; i++ ) {
+        pthread_join( workqueue->threads[i], NULL );
+    }
+
+    pthread_cond_destroy( &workqueue->idle );
+    pthread_cond_destroy( &workqueue->ready );
+    pthread_mutex_destroy( &workqueue->lock );
+    free( workqueue->threads );
+    free( workqueue );
+
+    return 0;
+}
+
+/**
+ * Queues a job
+ * In:
+ *      workqueue - the work queue. Required
+ *      fn - called with arg on a worker thread. Required
+ *      arg - passed to fn, which owns it from then on
+ * Out:
+ *      N/A
+ * Returns:
+ *      0 = success
+ *      1 = failure. fn is not called
+ */
+int WorkQueue_add( WorkQueue_t *workqueue, WorkQueueFn fn, void *arg ) {
+
+    if ( workqueue == NULL || fn == NULL ) {
+        return 1;
+    }
+
+    WorkQueueItem_t *item = (WorkQueueItem_t *)malloc( sizeof( WorkQueueItem_t ) );
+    if ( item == NULL ) {
+        return 1;
+    }
+    item->fn = fn;
+    item->arg = arg;
+    item->next = NULL;
+
+    pthread_mutex_lock( &workqueue->lock );
+    if ( workqueue->shutdown ) {
+        pthread_mutex_unlock( &workqueue->lock );
+        free( item );
+        return 1;
+    }
+    if ( workqueue->tail != NULL ) {
+        workqueue->tail->next = item;
+    } else {
+        workqueue->head = item;
+    }
+    workqueue->tail = item;
+    workqueue->npending++;
+    pthread_cond_signal( &workqueue->ready );
+    pthread_mutex_unlock( &workqueue->lock );
+
+    return 0;
+}
+
+/**
+ * Blocks until every queued job has run
+ * In:
+ *      workqueue - the work queue. Required
+ * Out:
+ *      N/A
+ * Returns:
+ *      0 = success
+ *      1 = failure
+ */
+int WorkQueue_wait( WorkQueue_t *workqueue ) {
+
+    if ( workqueue == NULL ) {
+        return 1;
+    }
+
+    pthread_mutex_lock( &workqueue->lock );
+    while ( workqueue->npending > 0 ) {
+        pthread_cond_wait( &workqueue->idle, &workqueue->lock );
+    }
+    pthread_mutex_unlock( &workqueue->lock );
+
+    return 0;
+}
+
+/**
+ * Returns the number of jobs queued or running
+ */
+int WorkQueue_getnpending( WorkQueue_t *workqueue ) {
+
+    if ( workqueue == NULL ) {
+        return 0;
+    }
+
+    pthread_mutex_lock( &workqueue->lock );
+    int npending = workqueue->npending;
+    pthread_mutex_unlock( &workqueue->lock );
+
+    return npending;
+}
@@ -0,0 +1,58 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _zxdbfs_workqueue_h
+#define _zxdbfs_workqueue_h
+
+#include <pthread.h>
+
+#define WORKQUEUE_DEFAULT_NTHREADS 2
+
+typedef void (*WorkQueueFn)( void *arg );
+
+typedef struct WorkQueueItem {
+    WorkQueueFn fn;
+    void *arg;
+    struct WorkQueueItem *next;
+} WorkQueueItem_t;
+
+/**
+ * A FIFO of jobs run by a small pool of background threads, so that slow
+ * work such as refetching from ZXDB never holds up a FUSE request
+ */
+typedef struct WorkQueue {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;           /** Signalled when work is queued */
+    pthread_cond_t idle;            /** Signalled when the last job finishes */
+    WorkQueueItem_t *head;
+    WorkQueueItem_t *tail;
+    int npending;                   /** Queued and running jobs */
+    int shutdown;
+    int nthreads;
+    pthread_t *threads;
+} WorkQueue_t;
+
+extern WorkQueue_t *WorkQueue_create( int nthreads );
+extern int WorkQueue_free( WorkQueue_t *workqueue );
+extern int WorkQueue_add( WorkQueue_t *workqueue, WorkQueueFn fn, void *arg );
+extern int WorkQueue_wait( WorkQueue_t *workqueue );
+extern int WorkQueue_getnpending( WorkQueue_t *workqueue );
+
+#endif /** !_zxdbfs_workqueue_h */
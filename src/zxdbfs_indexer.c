@@ -0,0 +1,60 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+/**
+ * Compiles a by-letter JSON file, as fetched from ZXDB, into the binary
+ * index that zxdbfsd maps at startup.
+ *
+ * Usage: zxdbfs-indexer by-letter-X.json by-letter-X.idx
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <json-c/json.h>
+
+#include <zxdbfs_byletterindex.h>
+
+int main( int argc, char *argv[] ) {
+
+    if ( argc != 3 ) {
+        printf( "usage: %s <by-letter json> <by-letter index>\n", argv[0] );
+        return 1;
+    }
+
+    json_object *root = json_object_from_file( argv[1] );
+    if ( root == NULL ) {
+        printf( "failed to parse: %s\n", argv[1] );
+        return 1;
+    }
+
+    int rv = ByLetterIndex_write( root, argv[2] );
+    json_object_put( root );
+    if ( rv != 0 ) {
+        printf( "failed to write: %s\n", argv[2] );
+        return 1;
+    }
+
+    ByLetterIndex_t *index = ByLetterIndex_open( argv[2] );
+    printf( "%s: %d games\n", argv[2], ByLetterIndex_getnentries( index ) );
+    ByLetterIndex_close( index );
+
+    return 0;
+}
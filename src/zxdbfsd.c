@@ -22,7 +22,7 @@
 
 /** @file
  *
- * Filesystem fronting ZXDB using high-level API
+ * Filesystem fronting ZXDB using the low-level API
  *
  * ## Source code ##
  * \include zxdbfs.c
@@ -30,7 +30,7 @@
 
 #define FUSE_USE_VERSION 31
 
-#include <fuse3/fuse.h>
+#include <fuse3/fuse_lowlevel.h>
 #include <ctype.h>
 #include <stdio.h>
 #include <string.h>
@@ -38,18 +38,33 @@
 #include <fcntl.h>
 #include <stddef.h>
 #include <assert.h>
+#include <pthread.h>
 #include <unistd.h>
 
 #include <json-c/json.h>
 
 #include <curl/curl.h>
 
+#include <zxdbfs_blockcache.h>
+#include <zxdbfs_bloom.h>
 #include <zxdbfs_byletter.h>
+#include <zxdbfs_byletterindex.h>
+#include <zxdbfs_contentcache.h>
+#include <zxdbfs_direntcache.h>
+#include <zxdbfs_dirhandle.h>
+#include <zxdbfs_epoch.h>
+#include <zxdbfs_fetcher.h>
+#include <zxdbfs_fsimage.h>
 #include <zxdbfs_gameid.h>
+#include <zxdbfs_inode.h>
 #include <zxdbfs_http.h>
 #include <zxdbfs_json.h>
+#include <zxdbfs_negcache.h>
 #include <zxdbfs_paths.h>
 #include <zxdbfs_search.h>
+#include <zxdbfs_strpool.h>
+#include <zxdbfs_urlcache.h>
+#include <zxdbfs_workqueue.h>
 
 typedef unsigned int UINT;
 
@@ -65,6 +80,18 @@ static struct options {
     const char *cacherootdir;
     const char *cacherooturl;
     const char *useragent;
+    unsigned long fscachemaxbytes;
+    unsigned long urlcachemaxbytes;
+    unsigned long direntcachemaxbytes;
+    unsigned long contentcachemaxbytes;
+    long maxhostconnections;
+    long maxhoststreams;
+    int ttlbyletter;
+    int ttlgame;
+    int ttlsearch;
+    int ttlnegative;
+    const char *preload;
+    int nopassthrough;
     int localroot;
 	int show_help;
 } options;
@@ -76,21 +103,203 @@ static const struct fuse_opt option_spec[] = {
 	OPTION("--cacherootdir=%s", cacherootdir),
 	OPTION("--cacherooturl=%s", cacherooturl),
 	OPTION("--useragent=%s", useragent),
+	OPTION("--fscache-max-bytes=%lu", fscachemaxbytes),
+	OPTION("--urlcache-max-bytes=%lu", urlcachemaxbytes),
+	OPTION("--direntcache-max-bytes=%lu", direntcachemaxbytes),
+	OPTION("--contentcache-max-bytes=%lu", contentcachemaxbytes),
+	OPTION("--max-host-connections=%ld", maxhostconnections),
+	OPTION("--max-host-streams=%ld", maxhoststreams),
+	OPTION("--ttl-byletter=%d", ttlbyletter),
+	OPTION("--ttl-game=%d", ttlgame),
+	OPTION("--ttl-search=%d", ttlsearch),
+	OPTION("--ttl-negative=%d", ttlnegative),
+	OPTION("--preload=%s", preload),
+	OPTION("--no-passthrough", nopassthrough),
 	OPTION("-h", show_help),
 	OPTION("--help", show_help),
 	FUSE_OPT_END
 };
 
 /** Various caches */
-static json_object *urlcache = NULL;
+static URLCache_t *urlcache = NULL;
 static FSCache_t *fscache = NULL;
 static FSCache_t *bylettercache = NULL;
 
+/** Directory listings encoded as the kernel reads them */
+static DirentCache_t *direntcache = NULL;
+
+/** Makes every upstream request from one event loop */
+static Fetcher_t *fetcher = NULL;
+
+/** Background refreshes of expired directories and kernel invalidations */
+static WorkQueue_t *refreshqueue = NULL;
+
+/** The FUSE session, used to tell the kernel to drop what it has cached */
+static struct fuse_session *session = NULL;
+
+/** Downloaded file contents on disk */
+static ContentCache_t *contentcache = NULL;
+
+/** Set once the kernel has agreed to pass reads through to cached files */
+static int passthrough = 0;
+
+/**
+ * An open file. Its contents are either on disk in the content cache,
+ * fetched a block at a time as they are read, still downloading or, if
+ * they couldn't be cached, in memory
+ */
+typedef struct FileHandle {
+    struct MemoryStruct *chunk;
+    BlockCache_t *blocks;
+    Fetch_t *download;              /** Readable while it arrives */
+    char *url;                      /** Content cache key once all of it is read */
+    int fd;                         /** -1 if not cached */
+    size_t size;
+    int backingid;                  /** Passthrough backing ID. 0 = none */
+} FileHandle_t;
+
+/** Inode numbers handed to the kernel */
+static InodeTable_t *inodes = NULL;
+
+/**
+ * How long the kernel may cache an entry or its attributes, in seconds.
+ * The kernel is told to drop anything that changes before then
+ */
+#define ZXDBFS_TIMEOUT          86400
+
+/** Fixed inode numbers of /by-letter/[A-Z] */
+#define ZXDBFS_INO_BYLETTER     0x100
+
+/** Loads of by-letter listings at mount time */
+static WorkQueue_t *preloadqueue = NULL;
+
+/**
+ * One per letter. While a thread is loading a listing, any other thread
+ * wanting the same letter waits on that letter's condition rather than
+ * loading it again
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t loaded;
+    int loading;
+} ByLetterLoad_t;
+static ByLetterLoad_t byletterloads[26];
+
+/** Paths recently found not to exist */
+static NegCache_t *negcache = NULL;
+
+/**
+ * Every game ID listed by the by-letter directories loaded so far. Bit n
+ * of gameidletters is set once the IDs for letter 'A' + n are all in
+ */
+static Bloom_t *gameids = NULL;
+static unsigned int gameidletters = 0;
+
+/**
+ * Notes the game IDs in a by-letter listing
+ */
+static void _addGameIDs( const char *key, FSCacheEntry_t *byLetter ) {
+
+    char title[128];
+    char id[16];
+    char gamerootpath[256];
+
+    for ( int i = 0 ; i < FSCacheEntry_getnfiles( byLetter ) ; i++ ) {
+        const char *fname = FSCacheEntry_getfname( FSCacheEntry_getfile( byLetter, i ) );
+        memset( title, 0, sizeof( title ) );
+        memset( id, 0, sizeof( id ) );
+        memset( gamerootpath, 0, sizeof( gamerootpath ) );
+        if ( fname != NULL && getTitleAndIDFromPath( fname, title, id, gamerootpath ) == 0 ) {
+            Bloom_add( gameids, id );
+        }
+    }
+
+    int letter = toupper( key[11] ) - 'A';
+    if ( letter >= 0 && letter < 26 ) {
+        __atomic_or_fetch( &gameidletters, 1U << letter, __ATOMIC_RELEASE );
+    }
+}
+
+/**
+ * Adds a by-letter listing to the fscache, noting its game IDs first
+ */
+static int _addByLetter( const char *key, FSCacheEntry_t *byLetter ) {
+
+    _addGameIDs( key, byLetter );
+
+    return FSCache_addAll( fscache, key, byLetter );
+}
+
+/**
+ * Checks a game ID under /by-letter/[A-Z] against the IDs in that letter's
+ * listing. Without the listing loaded, nothing can be ruled out
+ * Returns:
+ *   0: The game may exist
+ *   1: The game does not exist
+ */
+static int _isUnknownGameID( const char *path, const char *id ) {
+
+    if ( strncmp( path, "/by-letter/", 11 ) != 0 || path[11] == '\0' ) {
+        return 0;
+    }
+
+    int letter = toupper( path[11] ) - 'A';
+    if ( letter < 0 || letter >= 26 ||
+         ( __atomic_load_n( &gameidletters, __ATOMIC_ACQUIRE ) & ( 1U << letter ) ) == 0 ) {
+        return 0;
+    }
+
+    return Bloom_test( gameids, id ) == 0;
+}
+
+/**
+ * Preload the by-letter cache from its compiled index, which is mapped
+ * rather than parsed
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+static int _preloadByLetterIndex( char letter, const char *key ) {
+
+    char path[256];
+    sprintf( path, "%s/by-letter-%c.idx", options.cacherootdir, letter );
+
+    struct stat st;
+    if ( stat( path, &st ) == -1 ) {
+        return 1;
+    }
+
+    ByLetterIndex_t *index = ByLetterIndex_open( path );
+    if ( index == NULL ) {
+        printf( "failed to open preload index: %s\n", path );
+        return 1;
+    }
+    printf( "preload index: %s (%d games)\n", path, ByLetterIndex_getnentries( index ) );
+
+    FSCacheEntry_t *byLetter = FSCacheEntry_createFromByLetterIndex( key, index );
+    ByLetterIndex_close( index );
+    if ( byLetter == NULL ) {
+        return 1;
+    }
+
+    /** The index is as old as the data it was compiled from */
+    FSCacheEntry_setfetched( byLetter, st.st_mtime,
+                             FSCache_getttl( fscache, FSCACHE_TTL_BYLETTER ) );
+
+    return _addByLetter( key, byLetter );
+}
+
 /**
  * Preload the by-letter cache
  */
 void _preloadByLetterCache( char letter ) {
 
+    char key[20] = { 0 };
+    sprintf( key, "/by-letter/%c", letter );
+    if ( _preloadByLetterIndex( letter, key ) == 0 ) {
+        return;
+    }
+
     char path[256];
     sprintf( path, "%s/by-letter-%c.json", options.cacherootdir, letter );
 
@@ -103,74 +312,351 @@ void _preloadByLetterCache( char letter ) {
     printf( "preload file: %s (%ld bytes)\n", path, st.st_size );
 
     unsigned char *buf = (unsigned char *)malloc( st.st_size + 256 );
+    if ( buf == NULL ) {
+        printf( "failed to allocate preload buffer: %s\n", path );
+        return;
+    }
 
     FILE *f = fopen( path, "rb" );
     if ( f == NULL ) {
         printf( "failed to open preload file: %s\n", path );
+        free( buf );
         return;
     }
 
-    fread( buf, 1, st.st_size, f );
+    /** A short read, such as of a file being rewritten, is a failed preload */
+    size_t nread = fread( buf, 1, st.st_size, f );
     fclose( f );
+    if ( nread != (size_t)st.st_size ) {
+        printf( "short read of preload file: %s (%zu of %ld bytes)\n", path, nread, st.st_size );
+        free( buf );
+        return;
+    }
+    buf[st.st_size] = '\0';
 
     json_object *rv = json_tokener_parse( buf );
+    free( buf );
     if ( rv == NULL ) {
         printf( "failed to preload: %s\n", path );
     } else {
         printf( "preloaded: %s\n", path );
-        char key[20] = { 0 };
-        sprintf( key, "/by-letter/%c", letter );
+
+        /** Compile the index for next time, dated as the JSON is */
+        char ipath[256];
+        sprintf( ipath, "%s/by-letter-%c.idx", options.cacherootdir, letter );
+        if ( ByLetterIndex_write( rv, ipath ) == 0 ) {
+            struct timespec times[2] = { st.st_atim, st.st_mtim };
+            utimensat( AT_FDCWD, ipath, times, 0 );
+        }
+
         FSCacheEntry_t *byLetter =
             FSCacheEntry_createFromByLetter( key, rv );
         json_object_put( rv );
         if ( byLetter != NULL ) {
+            /** The file is as old as its last writeback from ZXDB */
+            FSCacheEntry_setfetched( byLetter, st.st_mtime,
+                                     FSCache_getttl( fscache, FSCACHE_TTL_BYLETTER ) );
             printf( "adding all...\n" );
-            FSCache_addAll( fscache, key, byLetter );
+            _addByLetter( key, byLetter );
+        }
+    }
+}
+
+/**
+ * Retrieve the full by-letter data from ZXDB, write it back to the
+ * local cache and build the directory from it
+ */
+FSCacheEntry_t *_fetchByLetter( char letter, const char *key ) {
+
+    char url[256];
+    sprintf( url, "/games/byletter/%c?contenttype=SOFTWARE&mode=tiny&size=5000&offset=0", letter );
+    printf( "by-letter URL: %s\n", url );
+
+    json_object *urlobj =
+        getURL( urlcache, options.zxdbrooturl, url, options.useragent,
+                FSCache_getttl( fscache, FSCACHE_TTL_BYLETTER ) );
+    if ( urlobj == NULL ) {
+        printf( "Failed to retrieve by-letter data from ZXDB\n" );
+        return NULL;
+    }
+
+    /** Write back the data to the local cache */
+    char cname[256];
+    sprintf( cname, "%s/by-letter-%c.json", options.cacherootdir, letter );
+    FILE *f = fopen( cname, "wb" );
+    if ( f != NULL ) {
+        const char *output = json_object_to_json_string_ext(urlobj, JSON_C_TO_STRING_PRETTY);
+        fprintf( f, "%s\n", output );
+        fclose( f );
+        printf( "Writeback of by-letter cache OK\n" );
+    } else {
+        printf( "Failed to writeback the by-letter cache\n" );
+    }
+    sprintf( cname, "%s/by-letter-%c.idx", options.cacherootdir, letter );
+    if ( ByLetterIndex_write( urlobj, cname ) != 0 ) {
+        printf( "Failed to writeback the by-letter index\n" );
+    }
+
+    FSCacheEntry_t *byLetter =
+        FSCacheEntry_createFromByLetter( key, urlobj );
+    json_object_put( urlobj );
+
+    return byLetter;
+}
+
+/**
+ * Returns 1 if a by-letter listing is in the fscache, 0 otherwise
+ */
+static int _isByLetterLoaded( const char *key ) {
+
+    FSCacheEntry_t *byLetter = FSCache_get( fscache, key );
+    int rv = ( byLetter != NULL );
+    FSCacheEntry_free( byLetter );
+
+    return rv;
+}
+
+/**
+ * Loads a by-letter listing into the fscache unless it's there already,
+ * first from the local cache and then, if fetch is set, from ZXDB. Only
+ * one thread loads a given letter at a time
+ * Returns:
+ *   0: Success
+ *   1: Failure
+ */
+static int _loadByLetter( char letter, int fetch ) {
+
+    char key[20] = { 0 };
+    sprintf( key, "/by-letter/%c", letter );
+    ByLetterLoad_t *load = &byletterloads[letter - 'A'];
+
+    pthread_mutex_lock( &load->lock );
+    while ( load->loading ) {
+        pthread_cond_wait( &load->loaded, &load->lock );
+    }
+    if ( _isByLetterLoaded( key ) ) {
+        pthread_mutex_unlock( &load->lock );
+        return 0;
+    }
+    load->loading = 1;
+    pthread_mutex_unlock( &load->lock );
+
+    _preloadByLetterCache( letter );
+    int rv = _isByLetterLoaded( key ) ? 0 : 1;
+    if ( rv != 0 && fetch ) {
+        printf( ">>> FAILED TO RETRIEVE BY LETTER FROM CACHE\n" );
+
+        /** Retrieve the full by-letter data from ZXDB */
+        FSCacheEntry_t *byLetter = _fetchByLetter( letter, key );
+        if ( byLetter != NULL ) {
+            rv = _addByLetter( key, byLetter );
+        }
+    }
+
+    pthread_mutex_lock( &load->lock );
+    load->loading = 0;
+    pthread_cond_broadcast( &load->loaded );
+    pthread_mutex_unlock( &load->lock );
+
+    return rv;
+}
+
+/**
+ * Loads one letter's listing from the local cache at mount time. Letters
+ * with nothing cached locally are left to be fetched on first use
+ */
+static void _preloadJob( void *arg ) {
+
+    char letter = (char)(intptr_t)arg;
+    if ( _loadByLetter( letter, 0 ) != 0 ) {
+        printf( "nothing to preload for: %c\n", letter );
+    }
+}
+
+/**
+ * Tells the kernel to drop one path's cached attributes and pages, and
+ * its name from its parent directory
+ */
+static void _invalidateIno( uint64_t ino, const char *path, void *arg ) {
+
+    int *withentry = (int *)arg;
+
+    fuse_lowlevel_notify_inval_inode( session, ino, 0, 0 );
+
+    const char *name = strrchr( path, '/' );
+    if ( !*withentry || name == NULL || name == path + strlen( path ) - 1 ) {
+        return;
+    }
+
+    char *parentpath = strndup( path, name == path ? 1 : name - path );
+    if ( parentpath == NULL ) {
+        return;
+    }
+    uint64_t parent = InodeTable_getino( inodes, parentpath );
+    if ( parent != 0 ) {
+        fuse_lowlevel_notify_inval_entry( session, parent, name + 1, strlen( name + 1 ) );
+    }
+    free( parentpath );
+}
+
+/**
+ * Tells the kernel to drop what it has cached for a path. Only paths the
+ * kernel has been given an inode number for can be cached there.
+ * In:
+ *      path - the path. Required
+ *      recursive - 1 to drop the names and attributes of everything
+ *                  beneath it as well, 0 for just its own attributes
+ *                  and contents
+ */
+static void _invalidatePath( const char *path, int recursive ) {
+
+    if ( session == NULL ) {
+        return;
+    }
+
+    printf( "invalidating: %s%s\n", path, recursive ? " and below" : "" );
+
+    if ( recursive ) {
+        int withentry = 1;
+        InodeTable_foreach( inodes, path, _invalidateIno, &withentry );
+    } else {
+        uint64_t ino = InodeTable_getino( inodes, path );
+        if ( ino != 0 ) {
+            fuse_lowlevel_notify_inval_inode( session, ino, 0, 0 );
+        }
+    }
+}
+
+typedef struct InvalidateJob {
+    char *path;
+    int recursive;
+} InvalidateJob_t;
+
+static void _invalidateJob( void *arg ) {
+
+    InvalidateJob_t *job = (InvalidateJob_t *)arg;
+    _invalidatePath( job->path, job->recursive );
+    free( job->path );
+    free( job );
+}
+
+/**
+ * Invalidates a path from a worker thread. Request handlers use this,
+ * since the kernel may be holding locks the invalidation needs until
+ * the request is answered
+ */
+static void _queueInvalidate( const char *path, int recursive ) {
+
+    InvalidateJob_t *job = (InvalidateJob_t *)malloc( sizeof( InvalidateJob_t ) );
+    if ( job == NULL ) {
+        return;
+    }
+    job->path = strdup( path );
+    job->recursive = recursive;
+    if ( job->path == NULL || WorkQueue_add( refreshqueue, _invalidateJob, job ) != 0 ) {
+        free( job->path );
+        free( job );
+    }
+}
+
+/**
+ * Refetch an expired directory in the background. Until this completes,
+ * readers carry on seeing the stale contents. If ZXDB can't be reached
+ * they keep doing so, and the refresh is retried later
+ */
+static void _refreshJob( void *arg ) {
+
+    char *path = (char *)arg;
+    FSCacheEntry_t *fresh = NULL;
+
+    printf( "refreshing: %s\n", path );
+
+    switch ( FSCache_getttlclass( path ) ) {
+        case FSCACHE_TTL_BYLETTER: {
+            fresh = _fetchByLetter( toupper( path[11] ), path );
+            break;
+        }
+        case FSCACHE_TTL_GAME: {
+            fresh = FSCacheEntry_getAndCreateGame( urlcache, path, options.zxdbrooturl, NULL, 0,
+                                                   FSCache_getttl( fscache, FSCACHE_TTL_GAME ) );
+            break;
+        }
+        case FSCACHE_TTL_SEARCH: {
+            fresh = FSCacheEntry_getAndCreateSearch( urlcache, path, options.zxdbrooturl, NULL, 0,
+                                                     FSCache_getttl( fscache, FSCACHE_TTL_SEARCH ) );
+            break;
+        }
+        default: {
+            break;
+        }
+    }
+
+    int rv = 1;
+    if ( fresh != NULL ) {
+        if ( FSCache_getttlclass( path ) == FSCACHE_TTL_BYLETTER ) {
+            rv = _addByLetter( path, fresh );
+        } else {
+            rv = FSCache_addAll( fscache, path, fresh );
         }
     }
+
+    if ( fresh == NULL ) {
+        printf( "failed to refresh, serving stale: %s\n", path );
+    } else if ( rv != 0 ) {
+        printf( "failed to add refreshed data for: %s\n", path );
+    } else {
+        printf( "refreshed: %s\n", path );
+
+        /**
+         * A refreshed game may have changed files. A refreshed listing
+         * only changes the directory itself; its games refresh on their own
+         */
+        _invalidatePath( path, FSCache_getttlclass( path ) != FSCACHE_TTL_BYLETTER );
+    }
+
+    free( path );
 }
 
 /**
- * unstub a dir_stub FSCacheEntry
+ * unstub a dir_stub FSCacheEntry. Consumes the caller's reference on
+ * fsCacheEntry and returns a reference on the result
  */
 FSCacheEntry_t *_unstub( FSCacheEntry_t *fsCacheEntry, const char *path ) {
 
-    int rv = 0;
     FSCacheEntry_t *fscrv = NULL;
 
     /** If the cache entry is a dirstub, page in the real one */
     FSCacheEntryType fsctype = FSCacheEntry_gettype( fsCacheEntry );
     if ( fsctype == FSCACHEENTRY_DIR_STUB ) {
         printf( "stub dir!\n" );
-        FSCacheEntry_t *fsCacheEntryFull = FSCacheEntry_getAndCreateGame( urlcache, path, options.zxdbrooturl, NULL, 0 );
+        FSCacheEntry_t *fsCacheEntryFull = FSCacheEntry_getAndCreateGame( urlcache, path, options.zxdbrooturl, NULL, 0,
+                                                                                 FSCache_getttl( fscache, FSCACHE_TTL_GAME ) );
         if ( fsCacheEntryFull == NULL ) {
             printf( "failed to load unstubbed data for: %s\n", path );
         } else {
             printf( "fetched unstubbed data for: %s\n", path );
-            dumpJSON( fsCacheEntry );
-            rv = FSCache_delete( fscache, path );
-            if ( rv == 1 ) {
-                printf( "fscache removal failed during unstubbing\n" );
-            } else {
-                if ( rv == 2 ) {
-                    printf( "fscacheentry not present in cache during unstubbing\n" );
-                } else {
-                    printf( "cache removal ok during unstubbing\n" );
-                }
-            }
-                
+
+            /**
+             * Fills in the stub in place, so the parent directory's
+             * file list and the path index keep sharing the same entry
+             */
             if ( FSCache_addAll( fscache, path, fsCacheEntryFull ) != 0 ) {
                 printf( "Failed to overwrite stub data with unstubbed for: %s\n", path );
+                FSCacheEntry_free( fsCacheEntry );
                 return NULL;
             }
             fscrv = FSCache_get( fscache, path );
             fsctype = FSCacheEntry_gettype( fscrv );
             if ( fscrv == NULL || fsctype != FSCACHEENTRY_DIR ) {
                 printf( "Failed to unstub from fscache for: %s\n", path );
+                FSCacheEntry_free( fscrv );
+                FSCacheEntry_free( fsCacheEntry );
                 return NULL;
             }
             printf( "replaced stub with unstub for: %s\n", path );
+            _queueInvalidate( path, 0 );
         }
+        FSCacheEntry_free( fsCacheEntry );
     } else {
         fscrv = fsCacheEntry;
     } 
@@ -179,29 +665,17 @@ FSCacheEntry_t *_unstub( FSCacheEntry_t *fsCacheEntry, const char *path ) {
 }
 
 /**
- * Handle the magic game directory structure
+ * Snapshot a directory in the fscache into an open directory handle,
+ * paging in a stubbed game directory first
  */
-int _readdirFSCache( const char *path,
-                     void *buf, 
-                     fuse_fill_dir_t filler,
-			         off_t offset, struct fuse_file_info *fi,
-			         enum fuse_readdir_flags flags, 
-                     unsigned int pnfileinfo ) {
+static int _opendirFSCache( const char *path, DirHandle_t *dirHandle ) {
 
-    int i;
-    struct stat st;
-    unsigned int nfileinfo = pnfileinfo;
-
-    memset( &st, 0, sizeof( st ) );
-
-    printf( ">>> _readdirFSCache: %s, nfileinfo = %d, offset = %ld\n", 
-            path, nfileinfo, offset );
+    printf( ">>> _opendirFSCache: %s\n", path );
 
     /** Assume the fscache is populated.... */
     FSCacheEntry_t *fsCacheEntry = FSCache_get( fscache, path );
     if ( fsCacheEntry == NULL ) {
         printf( "fscacheroot is null.....\n" );
-        /** Load the game data to the cache */
         return 0;
     }
 
@@ -211,58 +685,19 @@ int _readdirFSCache( const char *path,
         return 0;
     }
 
-    int nfiles = FSCacheEntry_getnfiles( fsCacheEntry );
-    for ( i = offset ; i < nfiles ; i++ ) {
-
-
-        FSCacheEntry_t *file = FSCacheEntry_getfile( fsCacheEntry, i );
-        if ( file == NULL ) {
-            printf( "FIXME\n" );
-        }
-        FSCacheEntryType file_type = FSCacheEntry_gettype( file );
-
-        struct stat st;
-        memset( &st, 0, sizeof( st ) );
-
-        /** Strip the path from the filename to just the final path segment */
-        const char *file_fname = FSCacheEntry_getfname( file );
-        if ( file_fname == NULL ) {
-            printf( "FIXME\n" );
-        }
-        char basename[256] = { 0 };
-        getBasename( file_fname, basename );
-
-        switch ( file_type ) {
-            case FSCACHEENTRY_FILE: {
-                //printf( "filling file: %s\n", file_fname );
-                st.st_mode = S_IFREG | 0644;
-                st.st_nlink = 1;
-                st.st_size = FSCacheEntry_getsize( file );
-                if ( filler( buf, basename, &st, nfileinfo++, FUSE_FILL_DIR_PLUS ) != 0 ) {
-                    printf( "failed to fill file: %s\n", file_fname );
-                    return 0;
-                }
-                break;
-            }
-            case FSCACHEENTRY_DIR:
-            case FSCACHEENTRY_DIR_STUB: {
-                //printf( "filling dir: %s\n", file_fname );
-                st.st_mode = S_IFDIR | 0755;
-                st.st_nlink = 2;
-                if ( filler( buf, basename, &st, nfileinfo++, FUSE_FILL_DIR_PLUS ) != 0 ) {
-                    printf( "failed to fill dir: %s\n", file_fname );
-                    return 0;
-                }
-                break;
-            }
-            default: {
-                printf( "Unknown fscacheentry\n" );
-                break;
-            }
+    /** Serve what we have and fetch a newer copy if it has expired */
+    if ( FSCacheEntry_claimrefresh( fsCacheEntry, time( NULL ) ) ) {
+        char *refreshpath = strdup( FSCacheEntry_getfname( fsCacheEntry ) );
+        if ( refreshpath != NULL &&
+             WorkQueue_add( refreshqueue, _refreshJob, refreshpath ) != 0 ) {
+            free( refreshpath );
         }
     }
 
-    return 0;
+    int rv = DirHandle_addFromFSCacheEntry( dirHandle, fsCacheEntry );
+    FSCacheEntry_free( fsCacheEntry );
+
+    return rv == 0 ? 0 : -ENOMEM;
 }
 
 /**
@@ -271,96 +706,120 @@ int _readdirFSCache( const char *path,
  * We append the underlying ID because there are clashes with titles
  * and we need to look each game's data up by ID...
  *
- * Use a preloaded cache for this since the REST endpoint offset pagination
- * isn't very compatible with libfuse offsetting
+ * The listing is loaded if need be and snapshotted when the directory is
+ * opened, so libfuse offsets index straight into the snapshot
  */
-int _readdirByLetterAZ( const char *path,
-                        void *buf, 
-                        fuse_fill_dir_t filler,
-			            off_t offset, struct fuse_file_info *fi,
-			            enum fuse_readdir_flags flags, 
-                        unsigned int pnfileinfo ) {
-
-    FSCacheEntry_t *byLetterRoot = NULL;
-    unsigned int nfileinfo = pnfileinfo;
+static int _opendirByLetterAZ( const char *path, DirHandle_t *dirHandle ) {
 
-    printf( "_readdirByLetterAZ: in /by-letter/[A-Z]: offset: %ld, nfileinfo: %d\n", offset, nfileinfo );
+    printf( "_opendirByLetterAZ: in /by-letter/[A-Z]\n" );
 
-    /** Extract the letter */
-    if ( strlen( path ) < 12 ) {
+    char letter = toupper( path[11] );
+    if ( letter < 'A' || letter > 'Z' ) {
         return -ENOENT;
     }
-
-    int eindex = strlen( path ) - 1;
-    if ( path[eindex] == '/' ) {
-        eindex--;
-    }
-    
-    char letter = path[eindex];
-    letter = toupper( letter );
     printf( "Retrieving by-letter: %c\n", letter );
 
-    char key[20] = { 0 };
-    sprintf( key, "/by-letter/%c", letter );
-    byLetterRoot = FSCache_get( fscache, key );
-    if ( byLetterRoot == NULL ) {
-        _preloadByLetterCache( letter );
-        byLetterRoot = FSCache_get( fscache, key );
-        if ( byLetterRoot == NULL ) {
-            printf( ">>> FAILED TO RETRIEVE BY LETTER FROM CACHE\n" );
-
-            /** Retrieve the full by-letter data from ZXDB */
-            char url[256];
-            sprintf( url, "/games/byletter/%c?contenttype=SOFTWARE&mode=tiny&size=5000&offset=0", letter );
-            printf( "by-letter URL: %s\n", url );
-
-            json_object *urlobj = getURL( urlcache, options.zxdbrooturl, url, options.useragent );
-            if ( urlobj == NULL ) {
-                printf( "Failed to retrieve by-letter data from ZXDB\n" );
-                return -ENODEV;
-            }
-
-            /** Write back the data to the local cache */
-            char cname[256];
-            sprintf( cname, "%s/by-letter-%c.json", options.cacherootdir, letter );
-            FILE *f = fopen( cname, "wb" );
-            if ( f != NULL ) {
-                const char *output = json_object_to_json_string_ext(urlobj, JSON_C_TO_STRING_PRETTY);
-                fprintf( f, "%s\n", output );
-                fclose( f );
-                printf( "Writeback of by-letter cache OK\n" );
-            } else {
-                printf( "Failed to writeback the by-letter cache\n" );
-            }
-
-            /** Attempt final instantiation */
-            byLetterRoot =
-                FSCacheEntry_createFromByLetter( path, urlobj );
-            if ( byLetterRoot != NULL ) {
-                FSCache_addAll( fscache, key, byLetterRoot );
-            }
-        }
+    /** Waits if this letter is still being preloaded */
+    if ( _loadByLetter( letter, 1 ) != 0 ) {
+        return -ENODEV;
     }
 
-    return _readdirFSCache( path, buf, filler, offset, fi,
-                            flags, nfileinfo );
+    return _opendirFSCache( path, dirHandle );
 }
 
 /**
  * Initialise the filesystem
  */
-static void *zxdb_fuse_init(struct fuse_conn_info *conn,
-			struct fuse_config *cfg)
+static void zxdb_fuse_init( void *userdata, struct fuse_conn_info *conn )
 {
-	(void) conn;
-	cfg->auto_cache = 1;
-    cfg->attr_timeout = 3600;
+	(void) userdata;
+
+#ifdef FUSE_CAP_PASSTHROUGH
+    /** Reads of cached files can bypass us entirely */
+    if ( !options.nopassthrough && ( conn->capable & FUSE_CAP_PASSTHROUGH ) ) {
+        conn->want |= FUSE_CAP_PASSTHROUGH;
+        passthrough = 1;
+    }
+#endif
+    printf( "passthrough: %s\n", passthrough ? "on" : "off" );
+
+    /** Otherwise reads of cached files are spliced to the kernel */
+    if ( conn->capable & FUSE_CAP_SPLICE_WRITE ) {
+        conn->want |= FUSE_CAP_SPLICE_WRITE;
+    }
 
-    urlcache = json_object_new_object();
+    fetcher = Fetcher_create( options.maxhostconnections, options.maxhoststreams );
+    HTTP_setfetcher( fetcher );
+    inodes = InodeTable_create();
+    contentcache = ContentCache_create( options.cacherootdir, options.contentcachemaxbytes );
+    urlcache = URLCache_create( options.urlcachemaxbytes );
+    direntcache = DirentCache_create( options.direntcachemaxbytes );
     fscache = FSCache_create();
+    FSCache_setmaxbytes( fscache, options.fscachemaxbytes );
+    FSCache_setttl( fscache, FSCACHE_TTL_BYLETTER, options.ttlbyletter );
+    FSCache_setttl( fscache, FSCACHE_TTL_GAME, options.ttlgame );
+    FSCache_setttl( fscache, FSCACHE_TTL_SEARCH, options.ttlsearch );
+    refreshqueue = WorkQueue_create( 0 );
+    negcache = NegCache_create( 0, options.ttlnegative );
+    gameids = Bloom_create( 0, 0 );
+
+    /** Pick up where the last mount left off */
+    char imagepath[256];
+    sprintf( imagepath, "%s/%s", options.cacherootdir, FSIMAGE_FILENAME );
+    if ( FSImage_load( fscache, imagepath ) == 0 ) {
+        for ( char letter = 'A' ; letter <= 'Z' ; letter++ ) {
+            char key[20] = { 0 };
+            sprintf( key, "/by-letter/%c", letter );
+            FSCacheEntry_t *byLetter = FSCache_get( fscache, key );
+            if ( FSCacheEntry_gettype( byLetter ) == FSCACHEENTRY_DIR ) {
+                _addGameIDs( key, byLetter );
+            }
+            FSCacheEntry_free( byLetter );
+        }
+    }
     bylettercache = FSCache_create();
 
-	return NULL;
+    /** Load the requested letters in the background */
+    for ( int i = 0 ; i < 26 ; i++ ) {
+        pthread_mutex_init( &byletterloads[i].lock, NULL );
+        pthread_cond_init( &byletterloads[i].loaded, NULL );
+        byletterloads[i].loading = 0;
+    }
+    unsigned int letters = 0;
+    if ( parseByLetterRange( options.preload, &letters ) != 0 ) {
+        printf( "ignoring bad --preload: %s\n", options.preload );
+    }
+    if ( letters != 0 ) {
+        preloadqueue = WorkQueue_create( 0 );
+        for ( int i = 0 ; i < 26 ; i++ ) {
+            if ( letters & ( 1U << i ) ) {
+                WorkQueue_add( preloadqueue, _preloadJob, (void *)(intptr_t)( 'A' + i ) );
+            }
+        }
+    }
+}
+
+/**
+ * Tear down the filesystem, saving the fscache for the next mount
+ */
+static void zxdb_fuse_destroy( void *private_data )
+{
+    (void) private_data;
+
+    /** Let in-flight loads and refreshes land so they make it into the image */
+    WorkQueue_free( preloadqueue );
+    preloadqueue = NULL;
+    WorkQueue_free( refreshqueue );
+    refreshqueue = NULL;
+
+    /** Nothing is left to make requests */
+    HTTP_setfetcher( NULL );
+    Fetcher_free( fetcher );
+    fetcher = NULL;
+
+    char imagepath[256];
+    sprintf( imagepath, "%s/%s", options.cacherootdir, FSIMAGE_FILENAME );
+    FSImage_save( fscache, imagepath );
 }
 
 static void _getattrFromFSCache( FSCacheEntry_t *fscacheobj, struct stat *stbuf ) {
@@ -391,47 +850,109 @@ static void _getattrFromFSCache( FSCacheEntry_t *fscacheobj, struct stat *stbuf
     }
 }
 
-static FSCacheEntry_t *_getAndCreateGame( const char *path, struct stat *stbuf ) {
+/**
+ * Fills in stat from the fscache without taking locks or references
+ * Returns:
+ *      0 = success
+ *      2 = path not present
+ */
+static int _getattrFromFSCacheKey( const char *path, struct stat *stbuf ) {
 
-    /** Check the fscache first */
-    FSCacheEntry_t *fsCacheEntry = FSCache_get( fscache, path );
+    int rv = 2;
+
+    Epoch_enter();
+    FSCacheEntry_t *fsCacheEntry = FSCache_lookup( fscache, path );
     if ( fsCacheEntry != NULL ) {
-        printf( "found fscacheentry for %s\n", path );
         _getattrFromFSCache( fsCacheEntry, stbuf );
-    } else {
-        printf( "failed to find fscacheentry for %s\n", path );
-        /** Extract the gameroot path */
-        char title[128] = { 0 };
-        char id[16] = { 0 };
-        char gamerootpath[128] = { 0 };
-        getTitleAndIDFromPath( path, title, id, gamerootpath );
-        /** */
-        fsCacheEntry = FSCacheEntry_getAndCreateGame( urlcache, gamerootpath, options.zxdbrooturl, NULL, 0 );
-        if ( fsCacheEntry == NULL ) {
-            /** Failed to retrieve game data -- this is pretty bad */
-            stbuf->st_mode = S_IFDIR | 0755;
-            stbuf->st_nlink = 2;
-            return 0;
-        } else {
-            printf( "Got game data OK for: %s\n", gamerootpath );
-            /** Fully populate the game data in the FS cache */
-            FSCache_addAll( fscache, gamerootpath, fsCacheEntry );
-            /** Refetch the current fscacheentry prior in case of unstubbing */
-            fsCacheEntry = FSCache_get( fscache, path );
-            _getattrFromFSCache( fsCacheEntry, stbuf );
-            return 0;
-        }
+        rv = 0;
     }
+    Epoch_exit();
+
+    return rv;
 }
 
 /**
- * Refresh zxdbfsstatus info
+ * Remembers that a path does not exist
  */
-int _getStatus( int mode ) {
+static int _notFound( const char *path ) {
 
-    const char *tempStatusFile = "/tmp/zxdbfsstatus.txt";
+    printf( "not found: %s\n", path );
+    NegCache_add( negcache, path, time( NULL ) );
 
-    unlink( tempStatusFile );
+    return -ENOENT;
+}
+
+static int _getAndCreateGame( const char *path, struct stat *stbuf ) {
+
+    /** Check the fscache first */
+    FSCacheEntry_t *fsCacheEntry = NULL;
+    if ( _getattrFromFSCacheKey( path, stbuf ) == 0 ) {
+        printf( "found fscacheentry for %s\n", path );
+        return 0;
+    }
+
+    /** Shell probes for .git and friends, or IDs already found missing */
+    if ( NegCache_contains( negcache, path, time( NULL ) ) ) {
+        printf( "known missing: %s\n", path );
+        return -ENOENT;
+    }
+
+    printf( "failed to find fscacheentry for %s\n", path );
+    /** Extract the gameroot path */
+    char title[128] = { 0 };
+    char id[16] = { 0 };
+    char gamerootpath[128] = { 0 };
+    if ( getTitleAndIDFromPath( path, title, id, gamerootpath ) != 0 ||
+         _isUnknownGameID( path, id ) ) {
+        return _notFound( path );
+    }
+
+    /** If the game is already loaded, anything not in it doesn't exist */
+    if ( strcmp( path, gamerootpath ) != 0 ) {
+        Epoch_enter();
+        FSCacheEntryType gametype =
+            FSCacheEntry_gettype( FSCache_lookup( fscache, gamerootpath ) );
+        Epoch_exit();
+        if ( gametype == FSCACHEENTRY_DIR ) {
+            return _notFound( path );
+        }
+    }
+
+    fsCacheEntry = FSCacheEntry_getAndCreateGame( urlcache, gamerootpath, options.zxdbrooturl, NULL, 0,
+                                                  FSCache_getttl( fscache, FSCACHE_TTL_GAME ) );
+    if ( fsCacheEntry == NULL ) {
+        /**
+         * Only remember the game as missing if ZXDB said so. Otherwise it
+         * couldn't be reached or answered badly, and the game may well
+         * be there once it can
+         */
+        long code = HTTP_getlastcode();
+        if ( code == 404 || code == 410 ) {
+            return _notFound( path );
+        }
+        printf( "failed to retrieve game data for %s (%ld)\n", gamerootpath, code );
+        return -EIO;
+    }
+
+    printf( "Got game data OK for: %s\n", gamerootpath );
+    /** Fully populate the game data in the FS cache */
+    FSCache_addAll( fscache, gamerootpath, fsCacheEntry );
+    /** Refetch the current fscacheentry prior in case of unstubbing */
+    if ( _getattrFromFSCacheKey( path, stbuf ) != 0 ) {
+        return _notFound( path );
+    }
+
+    return 0;
+}
+
+/**
+ * Refresh zxdbfsstatus info
+ */
+int _getStatus( int mode ) {
+
+    const char *tempStatusFile = "/tmp/zxdbfsstatus.txt";
+
+    unlink( tempStatusFile );
 
     char cmd[256];
     switch ( mode ) {
@@ -461,10 +982,14 @@ int _getStatus( int mode ) {
     return st.st_size;
 }
 
-static int zxdb_fuse_getattr(const char *path, struct stat *stbuf,
-			 struct fuse_file_info *fi)
+/**
+ * Fills in stat for a path, fetching from ZXDB as need be
+ * Returns:
+ *   0: Success
+ *   -errno: Failure
+ */
+static int _getattrPath( const char *path, struct stat *stbuf )
 {
-	(void) fi;
     int res;
     //FILINFO finfo;
 
@@ -486,10 +1011,24 @@ static int zxdb_fuse_getattr(const char *path, struct stat *stbuf,
             if ( strcmp( path, "/cache/fscache/flush" ) == 0 ) {
                 printf( "flushing fscache\n" );
                 FSCache_flush( fscache );
+                DirentCache_flush( direntcache );
+                NegCache_flush( negcache );
+                _queueInvalidate( "/", 1 );
             } else {
-                if ( fscache != NULL && fscache->cache != NULL ) {
+                if ( fscache != NULL ) {
                     if ( strcmp( path, "/cache/fscache" ) == 0 ) {
-                        dumpJSON( fscache->cache );
+                        dumpFSCache( fscache );
+                        printf( "fscache: %d entries, %lu/%lu bytes, %d units, %d evictions, %d refreshes\n",
+                                FSCache_getnentries( fscache ),
+                                FSCache_getnbytes( fscache ), fscache->maxbytes,
+                                fscache->nunits, fscache->nevictions, fscache->nrefreshes );
+                        printf( "negcache: %d entries, %lu hits, %lu misses, %lu known game IDs\n",
+                                NegCache_getnentries( negcache ),
+                                negcache->nhits, negcache->nmisses, gameids->nkeys );
+                        printf( "direntcache: %d entries, %lu/%lu bytes, %lu hits, %lu misses, %lu evictions\n",
+                                DirentCache_getnentries( direntcache ),
+                                DirentCache_getnbytes( direntcache ), direntcache->maxbytes,
+                                direntcache->nhits, direntcache->nmisses, direntcache->nevictions );
                     }
                 }
             }
@@ -497,8 +1036,43 @@ static int zxdb_fuse_getattr(const char *path, struct stat *stbuf,
         if ( strncmp( path, "/cache/urlcache", 14 ) == 0 ) {
             if ( strcmp( path, "/cache/urlcache/flush" ) == 0 ) {
                 printf( "flushing urlcache\n" );
-                json_object_put( urlcache );
-                urlcache = json_object_new_object();
+                URLCache_flush( urlcache );
+                _queueInvalidate( "/", 1 );
+            } else {
+                if ( urlcache != NULL ) {
+                    if ( strcmp( path, "/cache/urlcache" ) == 0 ) {
+                        printf( "urlcache: %d entries, %lu/%lu bytes, %lu hits, %lu stale, %lu revalidated, %lu misses, %lu evictions\n",
+                                URLCache_getnentries( urlcache ),
+                                URLCache_getnbytes( urlcache ), urlcache->maxbytes,
+                                urlcache->nhits, urlcache->nstale, urlcache->nrevalidated,
+                                urlcache->nmisses, urlcache->nevictions );
+                        unsigned long nmodified, nnotmodified;
+                        HTTP_getstats( &nmodified, &nnotmodified );
+                        printf( "http: %lu responses sent in full (200), %lu not modified (304)\n",
+                                nmodified, nnotmodified );
+                        if ( fetcher != NULL ) {
+                            printf( "fetcher: %d in flight, %lu fetches, %lu failures, %lu connections\n",
+                                    Fetcher_getninflight( fetcher ),
+                                    fetcher->nfetches, fetcher->nfailures, fetcher->nconnects );
+                        }
+                    }
+                }
+            }
+        }
+
+        if ( strncmp( path, "/cache/contentcache", 19 ) == 0 ) {
+            if ( strcmp( path, "/cache/contentcache/flush" ) == 0 ) {
+                printf( "flushing contentcache\n" );
+                ContentCache_flush( contentcache );
+            } else {
+                if ( contentcache != NULL ) {
+                    if ( strcmp( path, "/cache/contentcache" ) == 0 ) {
+                        printf( "contentcache: %d files, %lu/%lu bytes, %lu evictions\n",
+                                ContentCache_getnfiles( contentcache ),
+                                ContentCache_getnbytes( contentcache ), contentcache->maxbytes,
+                                contentcache->nevictions );
+                    }
+                }
             }
         }
 
@@ -550,7 +1124,7 @@ static int zxdb_fuse_getattr(const char *path, struct stat *stbuf,
             return 0;
         }
             
-        _getAndCreateGame( path, stbuf );
+        return _getAndCreateGame( path, stbuf );
     }
 
     /** Handle /search magic directory */
@@ -567,10 +1141,9 @@ static int zxdb_fuse_getattr(const char *path, struct stat *stbuf,
 
         /** Process the query or pre-existing result */
         /** Check the fscache first */
-        FSCacheEntry_t *fsCacheEntry = FSCache_get( fscache, path );
-        if ( fsCacheEntry != NULL ) {
+        FSCacheEntry_t *fsCacheEntry = NULL;
+        if ( _getattrFromFSCacheKey( path, stbuf ) == 0 ) {
             printf( "found fscacheentry for %s\n", path );
-            _getattrFromFSCache( fsCacheEntry, stbuf );
         } else {
             printf( "failed to find fscacheentry for %s\n", path );
             /** This is a naked search term or a search result? */
@@ -580,14 +1153,15 @@ static int zxdb_fuse_getattr(const char *path, struct stat *stbuf,
             /** Do we have a cached entry for the naked search term? */
             if ( getSearchTermFromPath( path, searchTerm, searchRootPath ) != 0 ) {
                 printf( "failed to find search term\n" );
-                return 0;
+                return -ENOENT;
             } 
             
             char searchkey[128] = { 0 };
             sprintf( searchkey, "/search/%s", searchTerm );
             fsCacheEntry = FSCache_get( fscache, searchkey );
             if ( fsCacheEntry == NULL ) {
-                fsCacheEntry = FSCacheEntry_getAndCreateSearch( urlcache, path, options.zxdbrooturl, NULL, 0 );
+                fsCacheEntry = FSCacheEntry_getAndCreateSearch( urlcache, path, options.zxdbrooturl, NULL, 0,
+                                                                 FSCache_getttl( fscache, FSCACHE_TTL_SEARCH ) );
                 if ( fsCacheEntry == NULL ) {
                     /** Failed to retrieve search data -- this is pretty bad */
                     stbuf->st_mode = S_IFDIR | 0755;
@@ -598,20 +1172,15 @@ static int zxdb_fuse_getattr(const char *path, struct stat *stbuf,
                     /** Fully populate the game data in the FS cache */
                     FSCache_addAll( fscache, path, fsCacheEntry );
                     /** Add the search term into /search */
-                    int needsAdd = 0;
-                    FSCacheEntry_t *search = FSCache_get( fscache, "/search" );
-                    if ( search == NULL ) {
+                    FSCacheEntry_t *search_searchTerm = FSCacheEntry_create( searchkey, FSCACHEENTRY_DIR, NULL, 0 );
+                    if ( FSCache_addFile( fscache, "/search", search_searchTerm ) == 2 ) {
                         printf( "creating new /search fscache entry\n" );
-                        search = FSCacheEntry_create( "/search", FSCACHEENTRY_DIR, NULL, 0 );
-                        needsAdd = 1;
+                        FSCacheEntry_t *search = FSCacheEntry_create( "/search", FSCACHEENTRY_DIR, NULL, 0 );
+                        FSCacheEntry_addFile( search, search_searchTerm );
+                        FSCache_add( fscache, "/search", search );
                     } else {
                         printf( "reusing /search fscache entry\n" );
                     }
-                    FSCacheEntry_t *search_searchTerm = FSCacheEntry_create( searchkey, FSCACHEENTRY_DIR, NULL, 0 );
-                    FSCacheEntry_addFile( search, search_searchTerm );
-                    if ( needsAdd ) {
-                        FSCache_add( fscache, "/search", search );
-                    }
 
                     /** Refetch the current fscacheentry prior in case of unstubbing */
                     fsCacheEntry = FSCache_get( fscache, path );
@@ -622,161 +1191,583 @@ static int zxdb_fuse_getattr(const char *path, struct stat *stbuf,
             /** If we've got qualification after the search term, treat that as game data */
             if ( strlen( searchRootPath ) > 0 ) {
                 printf( "have search root path. load game data: %s\n", path );
-                _getAndCreateGame( path, stbuf );
+                FSCacheEntry_free( fsCacheEntry );
+                return _getAndCreateGame( path, stbuf );
             } else {
                 _getattrFromFSCache( fsCacheEntry, stbuf );
             }
-
-            return 0;
+            FSCacheEntry_free( fsCacheEntry );
         }
+
+        return 0;
     }
 
-	return 0;
+	return -ENOENT;
 }
 
-static int zxdb_fuse_readdir( const char *path, void *buf, 
-                                 fuse_fill_dir_t filler,
-			                     off_t offset, struct fuse_file_info *fi,
-			                     enum fuse_readdir_flags flags )
+/**
+ * Snapshot a directory's listing once, when it is opened. Each readdir
+ * continuation then resumes from its offset cookie without walking the
+ * directory again
+ * Returns:
+ *   0: Success
+ *   -errno: Failure
+ */
+static int _opendirPath( const char *path, struct fuse_file_info *fi )
 {
-    int res;
     int rv = 0;
-    unsigned int nfileinfo = offset;
 
-    struct stat st;
-    memset( &st, 0, sizeof( st ) );
+    printf( "fuse_opendir: %s\n", path );
 
-    nfileinfo++;    /** readdirplus offset needs to start at 1.. */
+    DirHandle_t *dirHandle = DirHandle_create();
+    if ( dirHandle == NULL ) {
+        return -ENOMEM;
+    }
 
-    printf( "zxdb_fuse_readdir: nfileinfo: %d\toffset: %ld\n", nfileinfo, offset );
+    DirHandle_add( dirHandle, ".", FSCACHEENTRY_DIR, 0 );
+    DirHandle_add( dirHandle, "..", FSCACHEENTRY_DIR, 0 );
 
     /**
-     * Inject "this" and parent directories only at the start of the dir read
+     * Are we in any of the magic root directories top-level to 
+     * avoid ZXDB calls?
      */
-    if ( offset == 0 ) {
-        printf( "inject default directories\n" );
-        st.st_mode = S_IFDIR | 0755;
-        st.st_nlink = 2;
-        st.st_ino = 0xffffffff; /** Needs to be set otherwise these directories won't add in plus mode. This value corresponds to FUSE_UNKNOWN_INO in fuse.c */
-        if ( filler( buf, ".", &st, nfileinfo++, FUSE_FILL_DIR_PLUS ) ) {
-            printf( "failed to inject .\n" );
+    if ( strcmp( path, "/" ) == 0 ) {
+        DirHandle_add( dirHandle, "by-letter", FSCACHEENTRY_DIR, 0 );
+        DirHandle_add( dirHandle, "search", FSCACHEENTRY_DIR, 0 );
+        DirHandle_add( dirHandle, "status", FSCACHEENTRY_DIR, 0 );
+    } else if ( strcmp( path, "/by-letter" ) == 0 ) {
+        for ( char letter = 'A' ; letter <= 'Z' ; letter++ ) {
+            char b[2] = { letter, '\0' };
+            DirHandle_add( dirHandle, b, FSCACHEENTRY_DIR, 0 );
         }
-        if ( filler( buf, "..", &st, nfileinfo++, FUSE_FILL_DIR_PLUS ) ) {
-            printf( "failed to inject .\n" );
+    } else if ( strcmp( path, "/status" ) == 0 ) {
+        /** Contains three magic files */
+        DirHandle_add( dirHandle, "text", FSCACHEENTRY_FILE, 1024 );
+        DirHandle_add( dirHandle, "json", FSCACHEENTRY_FILE, 1024 );
+        DirHandle_add( dirHandle, "summary", FSCACHEENTRY_FILE, 1024 );
+    } else if ( strncmp( path, "/by-letter/", 11 ) == 0 && strlen( path ) == 12 ) {
+        rv = _opendirByLetterAZ( path, dirHandle );
+    } else if ( strncmp( path, "/by-letter/", 11 ) == 0 ||
+                strncmp( path, "/search", 7 ) == 0 ) {
+        /** A game subdirectory, or search results */
+        rv = _opendirFSCache( path, dirHandle );
+    }
+
+    if ( rv != 0 ) {
+        DirHandle_free( dirHandle );
+        return rv;
+    }
+
+    fi->fh = (uint64_t)(uintptr_t)dirHandle;
+
+    return 0;
+}
+
+/**
+ * How long the kernel may cache a path's entry and attributes. The magic
+ * files under /cache and /status act or change on every stat so are
+ * never cached. Everything else is cached for ZXDBFS_TIMEOUT, as the
+ * kernel is told when a refresh or flush changes it
+ */
+static double _getTimeout( const char *path ) {
+
+    if ( strncmp( path, "/cache", 6 ) == 0 || strncmp( path, "/status/", 8 ) == 0 ) {
+        return 0.0;
+    }
+
+    return ZXDBFS_TIMEOUT;
+}
+
+/**
+ * Returns the position of a path within a directory in the fscache, or
+ * -1 if it isn't there
+ */
+static int _getFileIndex( const char *dirpath, const char *path ) {
+
+    int rv = -1;
+
+    Epoch_enter();
+    int nfiles = 0;
+    FSCacheEntry_t **files =
+        FSCacheEntry_getfilelist( FSCache_lookup( fscache, dirpath ), &nfiles );
+    for ( int i = 0 ; i < nfiles ; i++ ) {
+        const char *fname = FSCacheEntry_getfname( files[i] );
+        if ( fname != NULL && strcmp( fname, path ) == 0 ) {
+            rv = i;
+            break;
         }
     }
+    Epoch_exit();
+
+    return rv;
+}
+
+/**
+ * Derives the inode number a path should always have, or 0 if it has
+ * none. The magic directories are numbered by position, and games under
+ * /by-letter by ZXDB ID and the positions of their files, eg,
+ * POKES/file is 0xPPFF for the POKES directory at P - 1 in the game and
+ * the file at F - 1 in POKES
+ */
+static uint64_t _getStableIno( const char *path ) {
+
+    static const char *magic[] = {
+        "/", "/by-letter", "/search", "/status", "/cache",
+        "/status/text", "/status/json", "/status/summary",
+        "/cache/fscache", "/cache/fscache/flush",
+        "/cache/urlcache", "/cache/urlcache/flush",
+        "/cache/contentcache", "/cache/contentcache/flush",
+        NULL
+    };
+    for ( int i = 0 ; magic[i] != NULL ; i++ ) {
+        if ( strcmp( path, magic[i] ) == 0 ) {
+            return INODE_ROOT + i;
+        }
+    }
+
+    if ( strncmp( path, "/by-letter/", 11 ) != 0 || strlen( path ) >= 256 ) {
+        return 0;
+    }
+    if ( strlen( path ) == 12 ) {
+        char letter = toupper( path[11] );
+        return letter >= 'A' && letter <= 'Z' ? ZXDBFS_INO_BYLETTER + ( letter - 'A' ) : 0;
+    }
+
+    char title[128] = { 0 };
+    char id[16] = { 0 };
+    char gamerootpath[256] = { 0 };
+    if ( getTitleAndIDFromPath( path, title, id, gamerootpath ) != 0 ) {
+        return 0;
+    }
+    if ( strcmp( path, gamerootpath ) == 0 ) {
+        return Inode_fromGameID( id, 0 );
+    }
+
+    /** Within the game, at most two levels down */
+    char dirpath[256] = { 0 };
+    getDirname( path, dirpath );
+    int index = _getFileIndex( dirpath, path );
+    if ( index < 0 || index >= 0xff ) {
+        return 0;
+    }
+    if ( strcmp( dirpath, gamerootpath ) == 0 ) {
+        return Inode_fromGameID( id, index + 1 );
+    }
+
+    char parentpath[256] = { 0 };
+    getDirname( dirpath, parentpath );
+    int dirindex = _getFileIndex( gamerootpath, dirpath );
+    if ( strcmp( parentpath, gamerootpath ) != 0 || dirindex < 0 || dirindex >= 0xff ) {
+        return 0;
+    }
+
+    return Inode_fromGameID( id, ( ( dirindex + 1 ) << 8 ) | ( index + 1 ) );
+}
+
+/**
+ * Builds the path of a name within a directory given by inode number
+ * Returns:
+ *   0: Success
+ *   -errno: Failure
+ */
+static int _getChildPath( fuse_ino_t parent, const char *name, char *path, size_t pathsz ) {
+
+    const char *parentpath = InodeTable_getpath( inodes, parent );
+    if ( parentpath == NULL ) {
+        return -ESTALE;
+    }
+
+    int n = snprintf( path, pathsz, "%s/%s",
+                      strcmp( parentpath, "/" ) == 0 ? "" : parentpath, name );
+    StringPool_release( parentpath );
+
+    return n < pathsz ? 0 : -ENAMETOOLONG;
+}
+
+/**
+ * Fills in an entry for a path and counts the kernel's lookup of it
+ * Returns:
+ *   0: Success
+ *   -errno: Failure
+ */
+static int _lookupPath( const char *path, struct fuse_entry_param *e ) {
+
+    e->ino = InodeTable_lookup( inodes, path, _getStableIno( path ) );
+    if ( e->ino == 0 ) {
+        return -ENOMEM;
+    }
+    e->attr.st_ino = e->ino;
+    e->attr_timeout = _getTimeout( path );
+    e->entry_timeout = e->attr_timeout;
+
+    return 0;
+}
+
+static void zxdb_fuse_lookup( fuse_req_t req, fuse_ino_t parent, const char *name )
+{
+    char path[1024];
+    struct fuse_entry_param e;
+    memset( &e, 0, sizeof( e ) );
+
+    int rv = _getChildPath( parent, name, path, sizeof( path ) );
+    if ( rv == 0 ) {
+        rv = _getattrPath( path, &e.attr );
+    }
+
+    /** Let the kernel remember missing names for as long as we do */
+    if ( rv == -ENOENT ) {
+        e.ino = 0;
+        e.entry_timeout = options.ttlnegative;
+        fuse_reply_entry( req, &e );
+        return;
+    }
+
+    if ( rv == 0 ) {
+        rv = _lookupPath( path, &e );
+    }
+    if ( rv != 0 ) {
+        fuse_reply_err( req, -rv );
+        return;
+    }
+
+    fuse_reply_entry( req, &e );
+}
+
+static void zxdb_fuse_forget( fuse_req_t req, fuse_ino_t ino, uint64_t nlookup )
+{
+    InodeTable_forget( inodes, ino, nlookup );
+    fuse_reply_none( req );
+}
+
+static void zxdb_fuse_forget_multi( fuse_req_t req, size_t count,
+                                    struct fuse_forget_data *forgets )
+{
+    for ( size_t i = 0 ; i < count ; i++ ) {
+        InodeTable_forget( inodes, forgets[i].ino, forgets[i].nlookup );
+    }
+    fuse_reply_none( req );
+}
+
+static void zxdb_fuse_getattr( fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi )
+{
+    (void) fi;
+
+    const char *path = InodeTable_getpath( inodes, ino );
+    if ( path == NULL ) {
+        fuse_reply_err( req, ESTALE );
+        return;
+    }
+
+    struct stat st;
+    int rv = _getattrPath( path, &st );
+    if ( rv == 0 ) {
+        st.st_ino = ino;
+        fuse_reply_attr( req, &st, _getTimeout( path ) );
+    } else {
+        fuse_reply_err( req, -rv );
+    }
+    StringPool_release( path );
+}
+
+static void zxdb_fuse_opendir( fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi )
+{
+    const char *path = InodeTable_getpath( inodes, ino );
+    if ( path == NULL ) {
+        fuse_reply_err( req, ESTALE );
+        return;
+    }
+
+    int rv = _opendirPath( path, fi );
+    StringPool_release( path );
+    if ( rv != 0 ) {
+        fuse_reply_err( req, -rv );
+        return;
+    }
 
     /**
-     * Are we in any of the magic root directories top-level to 
-     * avoid ZXDB calls?
+     * The kernel caches listings from the fscache itself, and keeps what
+     * it has cached as long as the listing is the same generation as
+     * when it was cached
      */
-    if ( strcmp( path, "/" ) == 0 ) {
-        printf( "readdir: in /\n" );
+    uint64_t generation = DirHandle_getgeneration( (DirHandle_t *)(uintptr_t)fi->fh );
+    if ( generation != 0 ) {
+        fi->cache_readdir = 1;
+        fi->keep_cache = InodeTable_setgeneration( inodes, ino, generation ) == generation;
+    }
 
-        if ( offset == 0 ) {
-            if ( filler( buf, "by-letter", &st, nfileinfo++, FUSE_FILL_DIR_PLUS ) ) {
-                printf( "failed to inject by-letter\n" );
-            }
-            if ( filler( buf, "search", &st, nfileinfo++, FUSE_FILL_DIR_PLUS ) ) {
-                printf( "failed to inject search\n" );
-            }
-            if ( filler( buf, "status", &st, nfileinfo++, FUSE_FILL_DIR_PLUS ) ) {
-                printf( "failed to inject status\n" );
-            }
+    fuse_reply_open( req, fi );
+}
+
+/**
+ * Fills in the attributes of an entry in a directory snapshot
+ * Returns:
+ *   0: Success
+ *   1: The entry is of an unknown type
+ */
+static int _getattrFromDirHandle( DirHandle_t *dirHandle, int index, struct stat *stbuf ) {
+
+    switch ( DirHandle_gettype( dirHandle, index ) ) {
+        case FSCACHEENTRY_FILE: {
+            stbuf->st_mode = S_IFREG | 0644;
+            stbuf->st_nlink = 1;
+            stbuf->st_size = DirHandle_getsize( dirHandle, index );
+            return 0;
         }
+        case FSCACHEENTRY_DIR:
+        case FSCACHEENTRY_DIR_STUB: {
+            stbuf->st_mode = S_IFDIR | 0755;
+            stbuf->st_nlink = 2;
+            return 0;
+        }
+        default: {
+            printf( "Unknown fscacheentry\n" );
+            return 1;
+        }
+    }
+}
 
-        return 0;
+/**
+ * Encodes a whole directory snapshot as the kernel reads it, with entry
+ * i at cookie i + 1 as _readdir() would. In plus mode every entry
+ * other than . and .. must have a stable inode number, so that the
+ * encoding stays right for as long as the snapshot's generation does
+ * Returns:
+ *   The encoded listing, or NULL if the snapshot can't be encoded
+ */
+static DirentBuf_t *_encodeDirents( fuse_req_t req, fuse_ino_t ino, const char *dirpath,
+                                    DirHandle_t *dirHandle, int plus ) {
+
+    DirentBuf_t *direntBuf = DirentBuf_create( ino, DirHandle_getgeneration( dirHandle ), plus );
+    if ( direntBuf == NULL ) {
+        return NULL;
     }
 
-    /** Handle by-letter */
-    if ( strcmp( path, "/by-letter" ) == 0 ) {
-        printf( "readdir: in /by-letter\n" );
-        
-        st.st_mode = S_IFDIR | 0755;
-        st.st_nlink = 2;
-        st.st_ino = 0xffffffff; /** Needs to be set otherwise these directories won't add in plus mode. This value corresponds to FUSE_UNKNOWN_INO in fuse.c */
+    for ( int i = 0 ; i < DirHandle_getnentries( dirHandle ) ; i++ ) {
+        const char *name = DirHandle_getname( dirHandle, i );
+        struct fuse_entry_param e;
+        memset( &e, 0, sizeof( e ) );
 
-        int loffset = offset;
-        if ( loffset > 0 ) {
-            loffset -= 2;   /** Subtract . and .. */
+        if ( _getattrFromDirHandle( dirHandle, i, &e.attr ) != 0 ) {
+            DirentBuf_free( direntBuf );
+            return NULL;
         }
 
-        for ( int i = loffset ; i < 26 ; i++ ) {
-            char b[256];
-            sprintf( b, "%c", 'A' + i );
-            printf( "injecting %s at %i, %i\n", b, i, nfileinfo );
-            if ( filler( buf, b, &st, nfileinfo++, FUSE_FILL_DIR_PLUS ) ) {
-                break;
+        if ( strcmp( name, "." ) == 0 ) {
+            e.attr.st_ino = ino;
+        } else if ( strcmp( name, ".." ) == 0 ) {
+            e.attr.st_ino = 0xffffffff; /** FUSE_UNKNOWN_INO in fuse.c */
+        } else {
+            char path[1024];
+            snprintf( path, sizeof( path ), "%s/%s",
+                      strcmp( dirpath, "/" ) == 0 ? "" : dirpath, name );
+            e.attr.st_ino = _getStableIno( path );
+            if ( plus ) {
+                if ( e.attr.st_ino == 0 ) {
+                    DirentBuf_free( direntBuf );
+                    return NULL;
+                }
+                e.ino = e.attr.st_ino;
+                e.attr_timeout = _getTimeout( path );
+                e.entry_timeout = e.attr_timeout;
+            } else if ( e.attr.st_ino == 0 ) {
+                e.attr.st_ino = 0xffffffff;
             }
         }
 
-        return 0;
+        size_t entsize = plus ? fuse_add_direntry_plus( req, NULL, 0, name, &e, i + 1 )
+                              : fuse_add_direntry( req, NULL, 0, name, &e.attr, i + 1 );
+        char *entry = DirentBuf_append( direntBuf, entsize, e.ino );
+        if ( entry == NULL ) {
+            DirentBuf_free( direntBuf );
+            return NULL;
+        }
+        if ( plus ) {
+            fuse_add_direntry_plus( req, entry, entsize, name, &e, i + 1 );
+        } else {
+            fuse_add_direntry( req, entry, entsize, name, &e.attr, i + 1 );
+        }
     }
 
-    /** Handle /search */
-    if ( strcmp( path, "/search" ) == 0 ) {
-        printf( "readdir: in /search\n" );
-        
-        st.st_mode = S_IFDIR | 0755;
-        st.st_nlink = 2;
-        st.st_ino = 0xffffffff; /** Needs to be set otherwise these directories won't add in plus mode. This value corresponds to FUSE_UNKNOWN_INO in fuse.c */
+    return direntBuf;
+}
+
+/**
+ * Answers a listing request with the slice of an encoded listing that
+ * fits, counting the lookup of each entry handed out in plus mode
+ * Returns:
+ *   0: Replied
+ *   1: An entry is already numbered differently, so nothing was
+ *      counted or replied
+ */
+static int _readdirFromDirentBuf( fuse_req_t req, const char *dirpath, DirHandle_t *dirHandle,
+                                  DirentBuf_t *direntBuf, size_t size, off_t offset ) {
+
+    int first = offset > 0 ? offset : 0;
+    int nentries = 0;
+    size_t len = 0;
+    const char *window = DirentBuf_getwindow( direntBuf, first, size, &nentries, &len );
+
+    for ( int i = first ; i < first + nentries ; i++ ) {
+        uint64_t entryino = DirentBuf_getino( direntBuf, i );
+        if ( entryino == 0 ) {
+            continue;
+        }
 
-        /** Return any search results */
-        return _readdirFSCache( path, buf, filler, offset, fi, flags, nfileinfo );
+        char path[1024];
+        snprintf( path, sizeof( path ), "%s/%s",
+                  strcmp( dirpath, "/" ) == 0 ? "" : dirpath, DirHandle_getname( dirHandle, i ) );
+        uint64_t lookupino = InodeTable_lookup( inodes, path, entryino );
+        if ( lookupino != entryino ) {
+            /** Take back what has been counted so far */
+            if ( lookupino != 0 ) {
+                InodeTable_forget( inodes, lookupino, 1 );
+            }
+            for ( int j = first ; j < i ; j++ ) {
+                if ( DirentBuf_getino( direntBuf, j ) != 0 ) {
+                    InodeTable_forget( inodes, DirentBuf_getino( direntBuf, j ), 1 );
+                }
+            }
+            return 1;
+        }
     }
 
-    /** Handle /status -- contains three magic files */
-    if ( strcmp( path, "/status" ) == 0 ) {
-        printf( "readdir: in /status\n" );
+    fuse_reply_buf( req, window, len );
 
-        if ( offset > 0 ) {
-            return 0;
-        }
+    return 0;
+}
+
+/**
+ * Lists an open directory from its snapshot. Entry i goes out with
+ * cookie i + 1, so a continuation resumes straight after offset. In plus
+ * mode every entry but . and .. carries full attributes and counts as a
+ * lookup, sparing the kernel a lookup per entry.
+ *
+ * Snapshots of fscache directories are encoded once per generation and
+ * kept in the dirent cache, so a large listing is answered slice by
+ * slice without encoding each entry again
+ */
+static void _readdir( fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset,
+                      struct fuse_file_info *fi, int plus )
+{
+    DirHandle_t *dirHandle = (DirHandle_t *)(uintptr_t)fi->fh;
 
-        st.st_mode = S_IFREG | 0644;
-        st.st_nlink = 1;
-        st.st_size = 1024;
+    printf( "zxdb_fuse_readdir: %lu\toffset: %ld\tplus: %d\n", ino, offset, plus );
 
-        if ( filler( buf, "text", &st, nfileinfo++, FUSE_FILL_DIR_PLUS ) ) {
-            printf( "failed to inject /status/text\n" );
+    if ( dirHandle == NULL ) {
+        fuse_reply_err( req, EBADF );
+        return;
+    }
+
+    const char *dirpath = InodeTable_getpath( inodes, ino );
+    if ( dirpath == NULL ) {
+        fuse_reply_err( req, ESTALE );
+        return;
+    }
+
+    uint64_t generation = DirHandle_getgeneration( dirHandle );
+    if ( generation != 0 ) {
+        DirentBuf_t *direntBuf = DirentCache_get( direntcache, ino, generation, plus );
+        if ( direntBuf == NULL ) {
+            direntBuf = _encodeDirents( req, ino, dirpath, dirHandle, plus );
+            DirentCache_add( direntcache, direntBuf );
         }
-        if ( filler( buf, "json", &st, nfileinfo++, FUSE_FILL_DIR_PLUS ) ) {
-            printf( "failed to inject /status/json\n" );
+        int rv = 1;
+        if ( direntBuf != NULL ) {
+            rv = _readdirFromDirentBuf( req, dirpath, dirHandle, direntBuf, size, offset );
         }
-        if ( filler( buf, "summary", &st, nfileinfo++, FUSE_FILL_DIR_PLUS ) ) {
-            printf( "failed to inject /status/summary\n" );
+        DirentBuf_free( direntBuf );
+        if ( rv == 0 ) {
+            StringPool_release( dirpath );
+            return;
         }
+    }
 
-        return 0;
+    char *buf = (char *)malloc( size );
+    if ( buf == NULL ) {
+        StringPool_release( dirpath );
+        fuse_reply_err( req, ENOMEM );
+        return;
     }
 
-    /**
-     * Which magic directory type are we in that calls into ZXDB?
-     *
-    /** Top-level /by-letter/[A-Z]? */
-    printf( "readdir: after top-level dir processing: nfileinfo = %d, offset = %ld\n", nfileinfo, offset );
-    if ( strncmp( path, "/by-letter", 10 ) == 0 ) {
-        if ( strlen( path ) == 12 ) {
-            return _readdirByLetterAZ( path, buf, filler, offset, fi, flags, nfileinfo );
+    size_t used = 0;
+    for ( int i = offset > 0 ? offset : 0 ; i < DirHandle_getnentries( dirHandle ) ; i++ ) {
+        const char *name = DirHandle_getname( dirHandle, i );
+        struct fuse_entry_param e;
+        memset( &e, 0, sizeof( e ) );
+
+        if ( _getattrFromDirHandle( dirHandle, i, &e.attr ) != 0 ) {
+            continue;
+        }
+
+        char path[1024];
+        snprintf( path, sizeof( path ), "%s/%s",
+                  strcmp( dirpath, "/" ) == 0 ? "" : dirpath, name );
+
+        size_t entsize;
+        if ( strcmp( name, "." ) == 0 ) {
+            e.attr.st_ino = ino;
+        } else if ( strcmp( name, ".." ) == 0 ) {
+            e.attr.st_ino = 0xffffffff; /** FUSE_UNKNOWN_INO in fuse.c */
+        } else if ( plus ) {
+            if ( _lookupPath( path, &e ) != 0 ) {
+                break;
+            }
         } else {
-            /** Probably a game subdirectory */
-            if ( strlen( path ) > 12 ) {
-                return _readdirFSCache( path, buf, filler, offset, fi, flags, nfileinfo );
+            e.attr.st_ino = _getStableIno( path );
+            if ( e.attr.st_ino == 0 ) {
+                e.attr.st_ino = 0xffffffff;
             }
         }
-    }
 
-    if ( strncmp( path, "/search", 7 ) == 0 ) {
-        /** Search results subdir */
-        printf( "search results subdir\n" );
-        return _readdirFSCache( path, buf, filler, offset, fi, flags, nfileinfo );
+        if ( plus ) {
+            entsize = fuse_add_direntry_plus( req, buf + used, size - used, name, &e, i + 1 );
+        } else {
+            entsize = fuse_add_direntry( req, buf + used, size - used, name, &e.attr, i + 1 );
+        }
+        if ( entsize > size - used ) {
+            /** Didn't fit, so the kernel never sees this lookup */
+            if ( e.ino != 0 ) {
+                InodeTable_forget( inodes, e.ino, 1 );
+            }
+            break;
+        }
+        used += entsize;
     }
 
-readdir_cleanup:
-	return rv;
+    fuse_reply_buf( req, buf, used );
+    free( buf );
+    StringPool_release( dirpath );
+}
+
+static void zxdb_fuse_readdir( fuse_req_t req, fuse_ino_t ino, size_t size,
+                               off_t offset, struct fuse_file_info *fi )
+{
+    _readdir( req, ino, size, offset, fi, 0 );
 }
 
-static int zxdb_fuse_open(const char *path, struct fuse_file_info *fi)
+static void zxdb_fuse_readdirplus( fuse_req_t req, fuse_ino_t ino, size_t size,
+                                   off_t offset, struct fuse_file_info *fi )
+{
+    _readdir( req, ino, size, offset, fi, 1 );
+}
+
+static void zxdb_fuse_releasedir( fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi )
+{
+    DirHandle_free( (DirHandle_t *)(uintptr_t)fi->fh );
+    fi->fh = 0;
+
+    fuse_reply_err( req, 0 );
+}
+/**
+ * Open a file. A file already in the content cache is read from there.
+ * Otherwise, if its size is known, nothing is fetched until it is read,
+ * and then only the blocks read. Failing that, its contents are fetched
+ * into memory, hung off the file handle
+ * Returns:
+ *   0: Success
+ *   -errno: Failure
+ */
+static int _openPath( const char *path, struct fuse_file_info *fi )
 {
     int res;
     int i;
@@ -796,13 +1787,19 @@ static int zxdb_fuse_open(const char *path, struct fuse_file_info *fi)
         }
 
         FSCacheEntryType fsctype = FSCacheEntry_gettype( fsCacheEntry );
-        fscurl = (char *)FSCacheEntry_geturl( fsCacheEntry );
-        if ( fsctype != FSCACHEENTRY_FILE || fscurl == NULL ) {
-            printf( "Malformed fscache object: %d, %s\n", fsctype, fscurl );
-            dumpJSON( fsCacheEntry );
+        const char *url = FSCacheEntry_geturl( fsCacheEntry );
+        if ( fsctype != FSCACHEENTRY_FILE || url == NULL ) {
+            printf( "Malformed fscache object: %d, %s\n", fsctype, url );
+            dumpFSCacheEntry( fsCacheEntry );
+            FSCacheEntry_free( fsCacheEntry );
             return 0;
         }
 
+        /** The entry may be evicted once our reference is dropped */
+        fscurl = strdup( url );
+        fscsize = FSCacheEntry_getsize( fsCacheEntry );
+        FSCacheEntry_free( fsCacheEntry );
+
         printf( "URL: %s\n", fscurl );
 
         /** Figure out where the actual file is... */
@@ -811,10 +1808,9 @@ static int zxdb_fuse_open(const char *path, struct fuse_file_info *fi)
             printf( "actual URL: %s%s\n", rooturl, fscurl );
         } else {
             printf( "cannot determine root url\n" );
+            free( fscurl );
             return -ENOENT;
         }
-
-        fscsize = FSCacheEntry_getsize( fsCacheEntry );
     } else {
         /** Magic status directory */
         rooturl = strdup( "file://" );
@@ -830,76 +1826,293 @@ static int zxdb_fuse_open(const char *path, struct fuse_file_info *fi)
         fscurl = strdup( "/tmp/zxdbfsstatus.txt" );
     }
 
-    /** Retrieve the URL via cURL */
-    struct MemoryStruct *chunk = getURLViacURL( rooturl, fscurl, options.useragent );
-    if ( chunk != NULL ) {
-        if ( fscsize != 0 ) {
-            if ( fscsize != chunk->size ) {
-                printf( "chunk/metadata mismatch: %ld != %d\n", chunk->size, fscsize );
+    FileHandle_t *fh = (FileHandle_t *)calloc( 1, sizeof( FileHandle_t ) );
+    if ( fh == NULL ) {
+        free( rooturl );
+        free( fscurl );
+        return -ENOMEM;
+    }
+    fh->fd = -1;
+
+    /** Status files change on every open so are never cached */
+    char url[1024] = { 0 };
+    if ( strncmp( path, "/status", 7 ) != 0 ) {
+        snprintf( url, sizeof( url ), "%s%s", rooturl, fscurl );
+        fh->fd = ContentCache_open( contentcache, url, &fh->size );
+    }
+
+    /** Fetch only what is read, with Range requests */
+    if ( fh->fd < 0 && url[0] != '\0' && fscsize > 0 ) {
+        fh->blocks = BlockCache_create( rooturl, fscurl, options.useragent, fscsize, 0 );
+        fh->url = strdup( url );
+        if ( fh->blocks != NULL && fh->url != NULL ) {
+            fh->size = fscsize;
+        } else {
+            BlockCache_free( fh->blocks );
+            fh->blocks = NULL;
+            free( fh->url );
+            fh->url = NULL;
+        }
+    }
+
+    /**
+     * Otherwise download the whole file, but in the background so reads
+     * of whatever has arrived needn't wait for the rest
+     */
+    if ( fh->fd < 0 && fh->blocks == NULL && url[0] != '\0' && fetcher != NULL ) {
+        fh->download = Fetcher_submitstream( fetcher, url, options.useragent );
+        if ( fh->download != NULL ) {
+            fh->url = strdup( url );
+            fh->size = fscsize;
+
+            /** With no size to go on, the kernel must ask us where the end is */
+            if ( fscsize == 0 ) {
+                fi->direct_io = 1;
             }
         }
-        fi->fh = (unsigned long)chunk;
-    } else {
+    }
+
+    if ( fh->fd < 0 && fh->blocks == NULL && fh->download == NULL ) {
+        /** Retrieve the URL via cURL */
+        struct MemoryStruct *chunk = getURLViacURL( rooturl, fscurl, options.useragent );
+
+        /** Never serve, or keep, an error page as the file */
+        if ( chunk != NULL && chunk->code != 200 && chunk->code != 0 ) {
+            printf( "fuse_open: %s returned %ld\n", fscurl, chunk->code );
+            HTTP_freechunk( chunk );
+            free( rooturl );
+            free( fscurl );
+            free( fh );
+            return -EIO;
+        }
+        if ( chunk != NULL ) {
+            if ( fscsize != 0 ) {
+                if ( fscsize != chunk->size ) {
+                    printf( "chunk/metadata mismatch: %ld != %d\n", chunk->size, fscsize );
+                }
+            }
+
+            /** Serve from disk if it can be kept there, so it can be passed through */
+            if ( url[0] != '\0' &&
+                 ContentCache_add( contentcache, url, chunk->memory, chunk->size ) == 0 ) {
+                fh->fd = ContentCache_open( contentcache, url, &fh->size );
+            }
+            if ( fh->fd < 0 ) {
+                fh->chunk = chunk;
+                fh->size = chunk->size;
+            } else {
+                free( chunk->memory );
+                free( chunk );
+            }
+        }
+    }
+    free( rooturl );
+    free( fscurl );
+
+    if ( fh->fd < 0 && fh->chunk == NULL && fh->blocks == NULL && fh->download == NULL ) {
+        free( fh );
         fi->fh = 0;
+    } else {
+        fi->fh = (uint64_t)(uintptr_t)fh;
     }
     
     return 0;
 }
 
-static int zxdb_fuse_release( const char *path, struct fuse_file_info *fi)
+static void zxdb_fuse_open( fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi )
 {
+    const char *path = InodeTable_getpath( inodes, ino );
+    if ( path == NULL ) {
+        fuse_reply_err( req, ESTALE );
+        return;
+    }
 
-    /** Free data in fi->fh */
+    int rv = _openPath( path, fi );
+    StringPool_release( path );
+    if ( rv != 0 ) {
+        fuse_reply_err( req, -rv );
+        return;
+    }
 
-    struct MemoryStruct *fp = (struct MemoryStruct *)fi->fh;
-    if ( fp == NULL ) {
-        printf( "release: fp is NULL\n" );
-        return -ENOENT;
+#ifdef FUSE_CAP_PASSTHROUGH
+    /** Hand the kernel the cached file so reads never reach us */
+    FileHandle_t *fh = (FileHandle_t *)(uintptr_t)fi->fh;
+    if ( passthrough && fh != NULL && fh->fd >= 0 ) {
+        int backingid = fuse_passthrough_open( req, fh->fd );
+        if ( backingid > 0 ) {
+            fh->backingid = backingid;
+            fi->backing_id = backingid;
+        } else {
+            printf( "passthrough failed for: %lu\n", ino );
+        }
     }
+#endif
 
-    free( fp );
+    fuse_reply_open( req, fi );
+}
+
+static void zxdb_fuse_release( fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi )
+{
+    FileHandle_t *fh = (FileHandle_t *)(uintptr_t)fi->fh;
+    if ( fh == NULL ) {
+        printf( "release: fh is NULL\n" );
+        fuse_reply_err( req, 0 );
+        return;
+    }
+
+#ifdef FUSE_CAP_PASSTHROUGH
+    if ( fh->backingid > 0 ) {
+        fuse_passthrough_close( req, fh->backingid );
+    }
+#endif
+    if ( fh->fd >= 0 ) {
+        close( fh->fd );
+    }
+    if ( fh->chunk != NULL ) {
+        free( fh->chunk->memory );
+        free( fh->chunk );
+    }
+    BlockCache_free( fh->blocks );
+
+    /** Keep a finished download. One still running is stopped */
+    if ( fh->download != NULL ) {
+        if ( Fetch_isdone( fh->download ) ) {
+            struct MemoryStruct *chunk = Fetch_wait( fh->download, NULL, NULL );
+            if ( chunk != NULL && fh->url != NULL && ( chunk->code == 200 || chunk->code == 0 ) ) {
+                ContentCache_add( contentcache, fh->url, chunk->memory, chunk->size );
+            }
+            HTTP_freechunk( chunk );
+        } else {
+            Fetch_free( fh->download );
+        }
+    }
+    free( fh->url );
+    free( fh );
     fi->fh = 0;
 
-    return 0;
+    fuse_reply_err( req, 0 );
 }
 
-static int zxdb_fuse_read(const char *path, char *buf, size_t size, off_t offset,
-		      struct fuse_file_info *fi)
+/**
+ * Read from a file fetched a block at a time. Once every block has been
+ * read, the file goes into the content cache so later opens use it
+ */
+static void _readBlocks( fuse_req_t req, FileHandle_t *fh, size_t size, off_t offset )
 {
-	(void) fi;
-    int res;
+    char *buf = (char *)malloc( size > 0 ? size : 1 );
+    if ( buf == NULL ) {
+        fuse_reply_err( req, ENOMEM );
+        return;
+    }
 
-    printf( "fuse_read: %s -> %ld bytes (%ld offset)\n", path, size, offset );
+    ssize_t nread = BlockCache_pread( fh->blocks, offset, size, buf );
+    if ( nread < 0 ) {
+        free( buf );
+        fuse_reply_err( req, EIO );
+        return;
+    }
+    fuse_reply_buf( req, nread > 0 ? buf : NULL, nread );
+    free( buf );
+
+    if ( BlockCache_iscomplete( fh->blocks ) ) {
+        char *url = __atomic_exchange_n( &fh->url, NULL, __ATOMIC_ACQ_REL );
+        if ( url != NULL ) {
+            char *data = BlockCache_getdata( fh->blocks );
+            if ( data != NULL ) {
+                ContentCache_add( contentcache, url, data, fh->blocks->size );
+                free( data );
+            }
+            free( url );
+        }
+    }
+}
 
-    struct MemoryStruct *fp = (struct MemoryStruct *)fi->fh;
-    if ( fp == NULL ) {
-        printf( "read: fp is NULL\n" );
-        return -ENOENT;
+/**
+ * Read from a file still downloading, waiting only for the part wanted
+ */
+static void _readDownload( fuse_req_t req, FileHandle_t *fh, size_t size, off_t offset )
+{
+    char *buf = (char *)malloc( size > 0 ? size : 1 );
+    if ( buf == NULL ) {
+        fuse_reply_err( req, ENOMEM );
+        return;
+    }
+
+    ssize_t nread = Fetch_read( fh->download, offset, size, buf );
+    if ( nread < 0 ) {
+        free( buf );
+        fuse_reply_err( req, EIO );
+        return;
+    }
+    fuse_reply_buf( req, nread > 0 ? buf : NULL, nread );
+    free( buf );
+}
+
+static void zxdb_fuse_read( fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset,
+                            struct fuse_file_info *fi )
+{
+    printf( "fuse_read: %lu -> %ld bytes (%ld offset)\n", ino, size, offset );
+
+    FileHandle_t *fh = (FileHandle_t *)(uintptr_t)fi->fh;
+    if ( fh == NULL ) {
+        printf( "read: fh is NULL\n" );
+        fuse_reply_err( req, ENOENT );
+        return;
     }
 
     /** 
-     * Compute how much data to copy
+     * Compute how much data to send
      */
-    int ntocopy = size;
-    if ( (offset + size) > fp->size ) {
-        printf( "offset + size > fpsize\n" );
-        ntocopy = fp->size - offset;
-    } else {
-        ntocopy = size;
+    size_t ntocopy = 0;
+    if ( offset < fh->size ) {
+        ntocopy = fh->size - offset;
+        if ( ntocopy > size ) {
+            ntocopy = size;
+        }
     }
 
-    memcpy( buf, &fp->memory[offset], ntocopy );
+    if ( fh->chunk != NULL ) {
+        fuse_reply_buf( req, ntocopy > 0 ? &fh->chunk->memory[offset] : NULL, ntocopy );
+        return;
+    }
 
-	return ntocopy;
+    if ( fh->blocks != NULL ) {
+        _readBlocks( req, fh, ntocopy, offset );
+        return;
+    }
+
+    /** The size may not be known until the download finishes */
+    if ( fh->download != NULL ) {
+        _readDownload( req, fh, fh->size > 0 ? ntocopy : size, offset );
+        return;
+    }
+
+    /**
+     * Cached on disk but not passed through. Hand libfuse the fd rather
+     * than the data so it can splice straight from the page cache
+     */
+    struct fuse_bufvec buf = FUSE_BUFVEC_INIT( ntocopy );
+    buf.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+    buf.buf[0].fd = fh->fd;
+    buf.buf[0].pos = offset;
+
+    fuse_reply_data( req, &buf, FUSE_BUF_SPLICE_MOVE );
 }
 
-static const struct fuse_operations zxdb_fuse_oper = {
-	.init       = zxdb_fuse_init,
-	.getattr	= zxdb_fuse_getattr,
-	.readdir	= zxdb_fuse_readdir,
-	.open		= zxdb_fuse_open,
-	.read		= zxdb_fuse_read,
-    .release    = zxdb_fuse_release
+static const struct fuse_lowlevel_ops zxdb_fuse_oper = {
+	.init           = zxdb_fuse_init,
+	.destroy        = zxdb_fuse_destroy,
+	.lookup         = zxdb_fuse_lookup,
+	.forget         = zxdb_fuse_forget,
+	.forget_multi   = zxdb_fuse_forget_multi,
+	.getattr        = zxdb_fuse_getattr,
+	.opendir        = zxdb_fuse_opendir,
+	.readdir        = zxdb_fuse_readdir,
+	.readdirplus    = zxdb_fuse_readdirplus,
+	.releasedir     = zxdb_fuse_releasedir,
+	.open           = zxdb_fuse_open,
+	.read           = zxdb_fuse_read,
+	.release        = zxdb_fuse_release
 };
 
 static void show_help(const char *progname)
@@ -922,23 +2135,72 @@ int main(int argc, char *argv[])
     options.cacherooturl = strdup( lcacherooturl );
     options.localroot = 0;  /** Set to 1 to disable .. at top-level */
     options.useragent = strdup("zxdbfs");
+    options.fscachemaxbytes = FSCACHE_DEFAULT_MAX_BYTES;
+    options.urlcachemaxbytes = URLCACHE_DEFAULT_MAX_BYTES;
+    options.direntcachemaxbytes = DIRENTCACHE_DEFAULT_MAX_BYTES;
+    options.contentcachemaxbytes = CONTENTCACHE_DEFAULT_MAX_BYTES;
+    options.maxhostconnections = FETCHER_DEFAULT_MAX_HOST_CONNECTIONS;
+    options.maxhoststreams = FETCHER_DEFAULT_MAX_STREAMS;
+    options.ttlbyletter = FSCACHE_DEFAULT_TTL_BYLETTER;
+    options.ttlgame = FSCACHE_DEFAULT_TTL_GAME;
+    options.ttlsearch = FSCACHE_DEFAULT_TTL_SEARCH;
+    options.ttlnegative = NEGCACHE_DEFAULT_TTL;
+    options.preload = strdup("none");
 
 	/* Parse options */
 	if (fuse_opt_parse(&args, &options, option_spec, NULL) == -1)
 		return 1;
 
 	/* When --help is specified, first print our own file-system
-	   specific help text, then signal fuse_main to show
-	   additional help (by adding `--help` to the options again)
-	   without usage: line (by setting argv[0] to the empty
-	   string) */
+	   specific help text, then libfuse's */
 	if (options.show_help) {
 		show_help(argv[0]);
-		assert(fuse_opt_add_arg(&args, "--help") == 0);
-		args.argv[0][0] = '\0';
+		fuse_cmdline_help();
+		fuse_lowlevel_help();
+		fuse_opt_free_args(&args);
+		return 0;
+	}
+
+	struct fuse_cmdline_opts opts;
+	if (fuse_parse_cmdline(&args, &opts) != 0)
+		return 1;
+	if (opts.show_version) {
+		printf("FUSE library version %s\n", fuse_pkgversion());
+		fuse_lowlevel_version();
+		ret = 0;
+		goto err_out1;
+	}
+	if (opts.mountpoint == NULL) {
+		show_help(argv[0]);
+		ret = 1;
+		goto err_out1;
 	}
 
-	ret = fuse_main(args.argc, args.argv, &zxdb_fuse_oper, NULL);
+	ret = 1;
+	struct fuse_session *se =
+		fuse_session_new(&args, &zxdb_fuse_oper, sizeof(zxdb_fuse_oper), NULL);
+	if (se == NULL)
+		goto err_out1;
+	session = se;
+	if (fuse_set_signal_handlers(se) != 0)
+		goto err_out2;
+	if (fuse_session_mount(se, opts.mountpoint) != 0)
+		goto err_out3;
+
+	fuse_daemonize(opts.foreground);
+
+	if (opts.singlethread)
+		ret = fuse_session_loop(se);
+	else
+		ret = fuse_session_loop_mt(se, opts.clone_fd);
+
+	fuse_session_unmount(se);
+err_out3:
+	fuse_remove_signal_handlers(se);
+err_out2:
+	fuse_session_destroy(se);
+err_out1:
+	free(opts.mountpoint);
 	fuse_opt_free_args(&args);
-	return ret;
+	return ret ? 1 : 0;
 }
@@ -0,0 +1,175 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+extern "C" {
+#include <zxdbfs_blockcache.h>
+}
+
+#include "zxdbfs_tests_utils.h"
+
+/**
+ * Writes a file of the given size whose bytes are easy to check
+ */
+static void _createFile( const char *path, size_t size ) {
+
+    FILE *f = fopen( path, "wb" );
+    ASSERT_TRUE( NULL != f );
+    for ( size_t i = 0 ; i < size ; i++ ) {
+        fputc( (int)( i % 251 ), f );
+    }
+    fclose( f );
+}
+
+static int _isExpected( const char *buf, off_t offset, size_t len ) {
+
+    for ( size_t i = 0 ; i < len ; i++ ) {
+        if ( (unsigned char)buf[i] != ( offset + i ) % 251 ) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+TEST(zxdbfs_blockcache_tests, test_BlockCache_create) {
+
+    ASSERT_TRUE( NULL == BlockCache_create( NULL, "/a", NULL, 100, 0 ) );
+    ASSERT_TRUE( NULL == BlockCache_create( "file://", NULL, NULL, 100, 0 ) );
+    ASSERT_TRUE( NULL == BlockCache_create( "file://", "/a", NULL, 0, 0 ) );
+
+    BlockCache_t *cache = BlockCache_create( "file://", "/a", NULL, 100000, 0 );
+    ASSERT_TRUE( NULL != cache );
+    ASSERT_EQ( BLOCKCACHE_DEFAULT_BLOCK_SIZE, cache->blocksize );
+    ASSERT_EQ( ( 100000 + BLOCKCACHE_DEFAULT_BLOCK_SIZE - 1 ) / BLOCKCACHE_DEFAULT_BLOCK_SIZE, cache->nblocks );
+    ASSERT_EQ( 0, BlockCache_iscomplete( cache ) );
+
+    ASSERT_EQ( 1, BlockCache_free( NULL ) );
+    ASSERT_EQ( 0, BlockCache_free( cache ) );
+}
+
+TEST(zxdbfs_blockcache_tests, test_BlockCache_put) {
+
+    char data[100];
+    for ( int i = 0 ; i < 100 ; i++ ) {
+        data[i] = (char)( i % 251 );
+    }
+    char buf[100];
+
+    BlockCache_t *cache = BlockCache_create( "file://", "/a", NULL, 100, 16 );
+
+    /** Only block aligned data is taken */
+    ASSERT_EQ( 1, BlockCache_put( cache, 8, data + 8, 16 ) );
+    ASSERT_EQ( 0, BlockCache_read( cache, 0, 100, buf ) );
+
+    /** Partial blocks are dropped */
+    ASSERT_EQ( 0, BlockCache_put( cache, 0, data, 40 ) );
+    ASSERT_EQ( 2, cache->npresent );
+    ASSERT_EQ( 32, BlockCache_read( cache, 0, 100, buf ) );
+    ASSERT_TRUE( _isExpected( buf, 0, 32 ) );
+    ASSERT_EQ( 12, BlockCache_read( cache, 20, 100, buf ) );
+    ASSERT_TRUE( _isExpected( buf, 20, 12 ) );
+
+    /** Except the last, which is short */
+    ASSERT_EQ( 0, BlockCache_put( cache, 96, data + 96, 4 ) );
+    ASSERT_EQ( 4, BlockCache_read( cache, 96, 100, buf ) );
+    ASSERT_EQ( 0, BlockCache_read( cache, 100, 100, buf ) );
+    ASSERT_TRUE( NULL == BlockCache_getdata( cache ) );
+
+    /** The whole file fills every block */
+    ASSERT_EQ( 0, BlockCache_put( cache, 0, data, 100 ) );
+    ASSERT_EQ( 1, BlockCache_iscomplete( cache ) );
+    char *all = BlockCache_getdata( cache );
+    ASSERT_TRUE( NULL != all );
+    ASSERT_EQ( 0, memcmp( data, all, 100 ) );
+    free( all );
+
+    BlockCache_free( cache );
+}
+
+TEST(zxdbfs_blockcache_tests, test_BlockCache_pread) {
+
+    char fname[128];
+    sprintf( fname, "/tmp/%d.blocks", getpid() );
+    _createFile( fname, 100000 );
+
+    BlockCache_t *cache = BlockCache_create( "file://", fname, NULL, 100000, 4096 );
+    char *buf = (char *)malloc( 100000 );
+
+    /** A header read fetches one block */
+    ASSERT_EQ( 128, BlockCache_pread( cache, 0, 128, buf ) );
+    ASSERT_TRUE( _isExpected( buf, 0, 128 ) );
+    ASSERT_EQ( 1, cache->nranges );
+    ASSERT_EQ( 1, cache->npresent );
+    ASSERT_EQ( 1, cache->nmisses );
+
+    /** Read again, it is already there */
+    ASSERT_EQ( 128, BlockCache_pread( cache, 0, 128, buf ) );
+    ASSERT_EQ( 1, cache->nranges );
+    ASSERT_EQ( 1, cache->nhits );
+
+    /** A read elsewhere fetches just the blocks it spans */
+    ASSERT_EQ( 5000, BlockCache_pread( cache, 50000, 5000, buf ) );
+    ASSERT_TRUE( _isExpected( buf, 50000, 5000 ) );
+    ASSERT_EQ( 2, cache->nranges );
+    ASSERT_EQ( 3, cache->npresent );
+
+    /** Holes either side of a fetched block take a request each */
+    ASSERT_EQ( 20480, BlockCache_pread( cache, 40960, 20480, buf ) );
+    ASSERT_TRUE( _isExpected( buf, 40960, 20480 ) );
+    ASSERT_EQ( 4, cache->nranges );
+    ASSERT_EQ( 6, cache->npresent );
+
+    /** Reading on from there, requests reach further ahead each time */
+    unsigned long nranges = cache->nranges;
+    for ( off_t offset = 0 ; offset < 100000 ; offset += 4096 ) {
+        size_t len = 100000 - offset < 4096 ? 100000 - offset : 4096;
+        ASSERT_EQ( (ssize_t)len, BlockCache_pread( cache, offset, 4096, buf ) );
+        ASSERT_TRUE( _isExpected( buf, offset, len ) );
+    }
+    ASSERT_TRUE( cache->nranges - nranges < 10 );
+    ASSERT_EQ( 1, BlockCache_iscomplete( cache ) );
+
+    char *all = BlockCache_getdata( cache );
+    ASSERT_TRUE( _isExpected( all, 0, 100000 ) );
+    free( all );
+
+    /** Past the end */
+    ASSERT_EQ( 0, BlockCache_pread( cache, 100000, 10, buf ) );
+
+    BlockCache_free( cache );
+
+    /** A file shorter than it claims gives short reads */
+    cache = BlockCache_create( "file://", fname, NULL, 100100, 4096 );
+    ASSERT_EQ( 100000 - 98304, BlockCache_pread( cache, 98304, 4000, buf ) );
+    ASSERT_EQ( 100000, cache->size );
+    BlockCache_free( cache );
+
+    /** A missing file fails */
+    ASSERT_EQ( 0, unlinkTestFile( fname ) );
+    cache = BlockCache_create( "file://", fname, NULL, 100000, 4096 );
+    ASSERT_EQ( -1, BlockCache_pread( cache, 0, 128, buf ) );
+    BlockCache_free( cache );
+
+    free( buf );
+}
@@ -0,0 +1,80 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include <zxdbfs_bloom.h>
+}
+
+TEST(zxdbfs_bloom_tests, test_Bloom_create) {
+
+    ASSERT_TRUE( NULL == Bloom_create( 0, -1 ) );
+
+    Bloom_t *bloom = Bloom_create( 0, 0 );
+    ASSERT_TRUE( NULL != bloom );
+    ASSERT_EQ( BLOOM_DEFAULT_NBITS, bloom->nbits );
+    ASSERT_EQ( BLOOM_DEFAULT_NHASHES, bloom->nhashes );
+    ASSERT_EQ( 0, Bloom_test( bloom, "0005795" ) );
+    ASSERT_EQ( 0, Bloom_free( bloom ) );
+
+    /** Rounded up to whole words */
+    bloom = Bloom_create( 100, 3 );
+    ASSERT_TRUE( NULL != bloom );
+    ASSERT_EQ( 0, bloom->nbits % 64 );
+    ASSERT_TRUE( bloom->nbits >= 100 );
+    ASSERT_EQ( 0, Bloom_free( bloom ) );
+
+    ASSERT_EQ( 1, Bloom_free( NULL ) );
+}
+
+TEST(zxdbfs_bloom_tests, test_Bloom_add) {
+
+    Bloom_t *bloom = Bloom_create( 0, 0 );
+    ASSERT_TRUE( NULL != bloom );
+
+    ASSERT_EQ( 1, Bloom_add( NULL, "0005795" ) );
+    ASSERT_EQ( 1, Bloom_add( bloom, NULL ) );
+    ASSERT_EQ( 2, Bloom_test( NULL, "0005795" ) );
+    ASSERT_EQ( 2, Bloom_test( bloom, NULL ) );
+
+    /** No false negatives across a ZXDB-sized set of IDs */
+    char id[16];
+    for ( int i = 0 ; i < 50000 ; i += 2 ) {
+        sprintf( id, "%07d", i );
+        ASSERT_EQ( 0, Bloom_add( bloom, id ) );
+    }
+    ASSERT_EQ( 25000, bloom->nkeys );
+
+    int nfalse = 0;
+    for ( int i = 0 ; i < 50000 ; i++ ) {
+        sprintf( id, "%07d", i );
+        if ( i % 2 == 0 ) {
+            ASSERT_EQ( 1, Bloom_test( bloom, id ) );
+        } else {
+            nfalse += Bloom_test( bloom, id );
+        }
+    }
+
+    /** Well under 0.1% of the 25000 absent IDs get through */
+    ASSERT_LT( nfalse, 25 );
+
+    ASSERT_EQ( 0, Bloom_free( bloom ) );
+}
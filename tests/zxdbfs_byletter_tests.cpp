@@ -43,3 +43,30 @@ TEST(zxdbfs_byletter_tests, test_FSCacheEntry_createFromByLetter) {
     json_object_put( jsonObject );
     FSCacheEntry_free( byLetter );
 }
+
+TEST(zxdbfs_byletter_tests, test_parseByLetterRange) {
+
+    unsigned int letters = 12345;
+
+    ASSERT_EQ( 0, parseByLetterRange( "all", &letters ) );
+    ASSERT_EQ( 0x3ffffffU, letters );
+    ASSERT_EQ( 0, parseByLetterRange( "none", &letters ) );
+    ASSERT_EQ( 0U, letters );
+    ASSERT_EQ( 0, parseByLetterRange( "S", &letters ) );
+    ASSERT_EQ( 1U << ( 'S' - 'A' ), letters );
+    ASSERT_EQ( 0, parseByLetterRange( "a-f", &letters ) );
+    ASSERT_EQ( 0x3fU, letters );
+    ASSERT_EQ( 0, parseByLetterRange( "A-C,X,Z-Z", &letters ) );
+    ASSERT_EQ( 0x7U | ( 1U << 23 ) | ( 1U << 25 ), letters );
+
+    /** Bad sets leave letters untouched */
+    letters = 12345;
+    ASSERT_EQ( 1, parseByLetterRange( NULL, &letters ) );
+    ASSERT_EQ( 1, parseByLetterRange( "", &letters ) );
+    ASSERT_EQ( 1, parseByLetterRange( "F-A", &letters ) );
+    ASSERT_EQ( 1, parseByLetterRange( "A-", &letters ) );
+    ASSERT_EQ( 1, parseByLetterRange( "A,", &letters ) );
+    ASSERT_EQ( 1, parseByLetterRange( "AB", &letters ) );
+    ASSERT_EQ( 1, parseByLetterRange( "1", &letters ) );
+    ASSERT_EQ( 12345U, letters );
+}
@@ -0,0 +1,107 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+
+extern "C" {
+#include <zxdbfs_byletter.h>
+#include <zxdbfs_byletterindex.h>
+}
+
+#define INDEX_PATH "/tmp/zxdbfs_byletterindex_tests.idx"
+
+TEST(zxdbfs_byletterindex_tests, test_ByLetterIndex_write) {
+
+#include <testdata/by-letter-X.h>
+
+    json_object *jsonObject = json_tokener_parse( jsonData );
+    ASSERT_TRUE( NULL != jsonObject );
+
+    ASSERT_EQ( 1, ByLetterIndex_write( NULL, INDEX_PATH ) );
+    ASSERT_EQ( 1, ByLetterIndex_write( jsonObject, NULL ) );
+    ASSERT_EQ( 0, ByLetterIndex_write( jsonObject, INDEX_PATH ) );
+
+    ASSERT_TRUE( NULL == ByLetterIndex_open( NULL ) );
+    ASSERT_TRUE( NULL == ByLetterIndex_open( "/tmp/zxdbfs_byletterindex_tests.missing" ) );
+    ByLetterIndex_t *index = ByLetterIndex_open( INDEX_PATH );
+    ASSERT_TRUE( NULL != index );
+    ASSERT_EQ( 115, ByLetterIndex_getnentries( index ) );
+    ASSERT_TRUE( NULL == ByLetterIndex_getname( index, -1 ) );
+    ASSERT_TRUE( NULL == ByLetterIndex_getname( index, 115 ) );
+    ASSERT_EQ( -1, ByLetterIndex_getid( index, 115 ) );
+
+    /** Same listing as the JSON gives */
+    FSCacheEntry_t *fromJSON = FSCacheEntry_createFromByLetter( "/by-letter/X", jsonObject );
+    FSCacheEntry_t *fromIndex = FSCacheEntry_createFromByLetterIndex( "/by-letter/X", index );
+    ASSERT_TRUE( NULL != fromIndex );
+    ASSERT_EQ( FSCacheEntry_getnfiles( fromJSON ), FSCacheEntry_getnfiles( fromIndex ) );
+    for ( int i = 0 ; i < FSCacheEntry_getnfiles( fromJSON ) ; i++ ) {
+        FSCacheEntry_t *a = FSCacheEntry_getfile( fromJSON, i );
+        FSCacheEntry_t *b = FSCacheEntry_getfile( fromIndex, i );
+        ASSERT_STREQ( FSCacheEntry_getfname( a ), FSCacheEntry_getfname( b ) );
+        ASSERT_EQ( FSCACHEENTRY_DIR_STUB, FSCacheEntry_gettype( b ) );
+    }
+    FSCacheEntry_free( fromIndex );
+    FSCacheEntry_free( fromJSON );
+    json_object_put( jsonObject );
+
+    /** Games can be found by ID */
+    int i = ByLetterIndex_findid( index, 5795 );
+    ASSERT_TRUE( i >= 0 );
+    ASSERT_STREQ( "Xevious_0005795", ByLetterIndex_getname( index, i ) );
+    ASSERT_EQ( 5795, ByLetterIndex_getid( index, i ) );
+    ASSERT_EQ( -1, ByLetterIndex_findid( index, 5796 ) );
+    ASSERT_EQ( -1, ByLetterIndex_findid( index, -1 ) );
+    for ( int j = 0 ; j < ByLetterIndex_getnentries( index ) ; j++ ) {
+        ASSERT_EQ( ByLetterIndex_getid( index, j ),
+                   ByLetterIndex_getid( index, ByLetterIndex_findid( index, ByLetterIndex_getid( index, j ) ) ) );
+    }
+
+    ASSERT_EQ( 1, ByLetterIndex_close( NULL ) );
+    ASSERT_EQ( 0, ByLetterIndex_close( index ) );
+    unlink( INDEX_PATH );
+}
+
+TEST(zxdbfs_byletterindex_tests, test_ByLetterIndex_invalid) {
+
+#include <testdata/by-letter-X.h>
+
+    json_object *jsonObject = json_tokener_parse( jsonData );
+    ASSERT_EQ( 0, ByLetterIndex_write( jsonObject, INDEX_PATH ) );
+    json_object_put( jsonObject );
+
+    FILE *f = fopen( INDEX_PATH, "r+b" );
+    ASSERT_TRUE( NULL != f );
+    fseek( f, 0, SEEK_END );
+    long size = ftell( f );
+    ASSERT_EQ( 0, ftruncate( fileno( f ), size - 1 ) );
+    fclose( f );
+    ASSERT_TRUE( NULL == ByLetterIndex_open( INDEX_PATH ) );
+
+    /** Not an index at all */
+    f = fopen( INDEX_PATH, "wb" );
+    fwrite( jsonData, 1, 256, f );
+    fclose( f );
+    ASSERT_TRUE( NULL == ByLetterIndex_open( INDEX_PATH ) );
+
+    unlink( INDEX_PATH );
+}
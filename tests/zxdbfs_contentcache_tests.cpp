@@ -0,0 +1,156 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern "C" {
+#include <zxdbfs_contentcache.h>
+}
+
+#define CACHE_ROOT "/tmp"
+#define URL "https://spectrumcomputing.co.uk/zxdb/sinclair/entries/0002258/ManicMiner.tzx.zip"
+
+TEST(zxdbfs_contentcache_tests, test_ContentCache_create) {
+
+    ASSERT_TRUE( NULL == ContentCache_create( NULL, 0 ) );
+    ASSERT_TRUE( NULL == ContentCache_create( "/tmp/zxdbfs_contentcache_tests.missing/deeper", 0 ) );
+
+    ContentCache_t *cache = ContentCache_create( CACHE_ROOT, 0 );
+    ASSERT_TRUE( NULL != cache );
+    ASSERT_STREQ( CACHE_ROOT "/" CONTENTCACHE_DIRNAME, cache->dir );
+    ASSERT_EQ( CONTENTCACHE_DEFAULT_MAX_BYTES, cache->maxbytes );
+
+    struct stat st;
+    ASSERT_EQ( 0, stat( cache->dir, &st ) );
+    ASSERT_TRUE( S_ISDIR( st.st_mode ) );
+
+    char path[1024];
+    char path2[1024];
+    ASSERT_EQ( 0, ContentCache_getpath( cache, URL, path, sizeof( path ) ) );
+    ASSERT_EQ( 0, strncmp( path, cache->dir, strlen( cache->dir ) ) );
+    ASSERT_EQ( 0, ContentCache_getpath( cache, URL "2", path2, sizeof( path2 ) ) );
+    ASSERT_STRNE( path, path2 );
+    ASSERT_EQ( 1, ContentCache_getpath( cache, URL, path, 8 ) );
+    ASSERT_EQ( 1, ContentCache_getpath( NULL, URL, path, sizeof( path ) ) );
+
+    ASSERT_EQ( 1, ContentCache_free( NULL ) );
+    ASSERT_EQ( 0, ContentCache_free( cache ) );
+}
+
+TEST(zxdbfs_contentcache_tests, test_ContentCache_add) {
+
+    ContentCache_t *cache = ContentCache_create( CACHE_ROOT, 0 );
+    ASSERT_TRUE( NULL != cache );
+
+    char path[1024];
+    ASSERT_EQ( 0, ContentCache_getpath( cache, URL, path, sizeof( path ) ) );
+    unlink( path );
+
+    size_t size = 12345;
+    ASSERT_EQ( -1, ContentCache_open( cache, URL, &size ) );
+    ASSERT_EQ( 12345, size );
+
+    ASSERT_EQ( 1, ContentCache_add( NULL, URL, "data", 4 ) );
+    ASSERT_EQ( 1, ContentCache_add( cache, URL, NULL, 4 ) );
+    ASSERT_EQ( 0, ContentCache_add( cache, URL, "first", 5 ) );
+    ASSERT_EQ( 0, ContentCache_add( cache, URL, "second!", 7 ) );
+
+    int fd = ContentCache_open( cache, URL, &size );
+    ASSERT_TRUE( fd >= 0 );
+    ASSERT_EQ( 7, size );
+    char buf[16] = { 0 };
+    ASSERT_EQ( 7, pread( fd, buf, sizeof( buf ), 0 ) );
+    ASSERT_STREQ( "second!", buf );
+    close( fd );
+
+    unlink( path );
+    ContentCache_free( cache );
+}
+
+TEST(zxdbfs_contentcache_tests, test_ContentCache_evict) {
+
+    char root[128];
+    sprintf( root, "/tmp/%d.contentcache", getpid() );
+    ASSERT_EQ( 0, mkdir( root, 0755 ) );
+
+    ContentCache_t *cache = ContentCache_create( root, 10 );
+    ASSERT_TRUE( NULL != cache );
+    ASSERT_EQ( 0, ContentCache_getnbytes( cache ) );
+
+    /** Too big to ever fit */
+    ASSERT_EQ( 1, ContentCache_add( cache, URL "0", "0123456789a", 11 ) );
+    ASSERT_EQ( 0, ContentCache_getnfiles( cache ) );
+
+    char path[1024];
+    ASSERT_EQ( 0, ContentCache_add( cache, URL "1", "1111", 4 ) );
+    ASSERT_EQ( 0, ContentCache_getpath( cache, URL "1", path, sizeof( path ) ) );
+    struct timespec old[2] = { { 1000, 0 }, { 1000, 0 } };
+    ASSERT_EQ( 0, utimensat( AT_FDCWD, path, old, 0 ) );
+    ASSERT_EQ( 0, ContentCache_add( cache, URL "2", "2222", 4 ) );
+    ASSERT_EQ( 0, ContentCache_getpath( cache, URL "2", path, sizeof( path ) ) );
+    struct timespec older[2] = { { 500, 0 }, { 500, 0 } };
+    ASSERT_EQ( 0, utimensat( AT_FDCWD, path, older, 0 ) );
+    ASSERT_EQ( 8, ContentCache_getnbytes( cache ) );
+    ASSERT_EQ( 2, ContentCache_getnfiles( cache ) );
+
+    /** Replacing a file only charges the difference */
+    ASSERT_EQ( 0, ContentCache_add( cache, URL "1", "11", 2 ) );
+    ASSERT_EQ( 0, ContentCache_getpath( cache, URL "1", path, sizeof( path ) ) );
+    ASSERT_EQ( 0, utimensat( AT_FDCWD, path, old, 0 ) );
+    ASSERT_EQ( 6, ContentCache_getnbytes( cache ) );
+
+    /** Opening a file makes it the most recently used */
+    int fd = ContentCache_open( cache, URL "2", NULL );
+    ASSERT_TRUE( fd >= 0 );
+
+    /** Over budget, so the least recently opened goes first */
+    ASSERT_EQ( 0, ContentCache_add( cache, URL "3", "33333", 5 ) );
+    ASSERT_EQ( 9, ContentCache_getnbytes( cache ) );
+    ASSERT_EQ( 1, cache->nevictions );
+    ASSERT_EQ( -1, ContentCache_open( cache, URL "1", NULL ) );
+
+    /** An evicted file stays readable while open */
+    ASSERT_EQ( 0, ContentCache_add( cache, URL "4", "4444444444", 10 ) );
+    ASSERT_EQ( 1, ContentCache_getnfiles( cache ) );
+    ASSERT_EQ( 3, cache->nevictions );
+    char buf[8] = { 0 };
+    ASSERT_EQ( 4, pread( fd, buf, sizeof( buf ), 0 ) );
+    ASSERT_STREQ( "2222", buf );
+    close( fd );
+
+    /** Files left behind count against the budget next time */
+    ASSERT_EQ( 0, ContentCache_free( cache ) );
+    cache = ContentCache_create( root, 10 );
+    ASSERT_EQ( 10, ContentCache_getnbytes( cache ) );
+
+    ASSERT_EQ( 1, ContentCache_flush( NULL ) );
+    ASSERT_EQ( 0, ContentCache_flush( cache ) );
+    ASSERT_EQ( 0, ContentCache_getnbytes( cache ) );
+    ASSERT_EQ( 0, ContentCache_getnfiles( cache ) );
+    ASSERT_EQ( -1, ContentCache_open( cache, URL "4", NULL ) );
+
+    ASSERT_EQ( 0, rmdir( cache->dir ) );
+    ContentCache_free( cache );
+    ASSERT_EQ( 0, rmdir( root ) );
+}
@@ -0,0 +1,200 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include <zxdbfs_direntcache.h>
+}
+
+static DirentBuf_t *_createBuf( uint64_t ino, uint64_t generation, int plus,
+                                int nentries, size_t len ) {
+
+    DirentBuf_t *buf = DirentBuf_create( ino, generation, plus );
+    for ( int i = 0 ; i < nentries ; i++ ) {
+        char *entry = DirentBuf_append( buf, len, 100 + i );
+        if ( entry == NULL ) {
+            DirentBuf_free( buf );
+            return NULL;
+        }
+        memset( entry, 'a' + ( i % 26 ), len );
+    }
+
+    return buf;
+}
+
+TEST(zxdbfs_direntcache_tests, test_DirentBuf_append) {
+
+    ASSERT_TRUE( NULL == DirentBuf_append( NULL, 8, 0 ) );
+
+    DirentBuf_t *buf = DirentBuf_create( 2, 1, 0 );
+    ASSERT_TRUE( NULL != buf );
+    ASSERT_TRUE( NULL == DirentBuf_append( buf, 0, 0 ) );
+    ASSERT_EQ( 0, DirentBuf_getnentries( buf ) );
+
+    /** Grows past the initial sizes */
+    for ( int i = 0 ; i < 1000 ; i++ ) {
+        char *entry = DirentBuf_append( buf, 24 + ( i % 3 ) * 8, i );
+        ASSERT_TRUE( NULL != entry );
+        memset( entry, 'a' + ( i % 26 ), 24 + ( i % 3 ) * 8 );
+    }
+    ASSERT_EQ( 1000, DirentBuf_getnentries( buf ) );
+    ASSERT_EQ( 999, DirentBuf_getino( buf, 999 ) );
+    ASSERT_EQ( 0, DirentBuf_getino( buf, 1000 ) );
+    ASSERT_EQ( 0, DirentBuf_getino( buf, -1 ) );
+
+    int nentries = 0;
+    size_t len = 0;
+    const char *window = DirentBuf_getwindow( buf, 999, 4096, &nentries, &len );
+    ASSERT_EQ( 1, nentries );
+    ASSERT_EQ( 24, len );
+    ASSERT_EQ( 'a' + ( 999 % 26 ), window[0] );
+
+    DirentBuf_free( buf );
+}
+
+TEST(zxdbfs_direntcache_tests, test_DirentBuf_getwindow) {
+
+    int nentries = 0;
+    size_t len = 0;
+    ASSERT_TRUE( NULL == DirentBuf_getwindow( NULL, 0, 4096, &nentries, &len ) );
+
+    DirentBuf_t *buf = _createBuf( 2, 1, 0, 10, 32 );
+    ASSERT_TRUE( NULL != buf );
+
+    /** Only whole entries */
+    const char *window = DirentBuf_getwindow( buf, 0, 100, &nentries, &len );
+    ASSERT_EQ( 3, nentries );
+    ASSERT_EQ( 96, len );
+    ASSERT_EQ( 'a', window[0] );
+
+    window = DirentBuf_getwindow( buf, 3, 96, &nentries, &len );
+    ASSERT_EQ( 3, nentries );
+    ASSERT_EQ( 96, len );
+    ASSERT_EQ( 'd', window[0] );
+
+    window = DirentBuf_getwindow( buf, 8, 4096, &nentries, &len );
+    ASSERT_EQ( 2, nentries );
+    ASSERT_EQ( 64, len );
+    ASSERT_EQ( 'i', window[0] );
+
+    /** Too small for anything */
+    DirentBuf_getwindow( buf, 0, 31, &nentries, &len );
+    ASSERT_EQ( 0, nentries );
+    ASSERT_EQ( 0, len );
+
+    /** Past the end */
+    ASSERT_TRUE( NULL != DirentBuf_getwindow( buf, 10, 4096, &nentries, &len ) );
+    ASSERT_EQ( 0, nentries );
+    ASSERT_EQ( 0, len );
+
+    DirentBuf_free( buf );
+}
+
+TEST(zxdbfs_direntcache_tests, test_DirentCache_get) {
+
+    DirentCache_t *cache = DirentCache_create( 0 );
+    ASSERT_TRUE( NULL != cache );
+
+    DirentBuf_t *buf = _createBuf( 2, 7, 0, 10, 32 );
+    DirentBuf_t *plusbuf = _createBuf( 2, 7, 1, 10, 64 );
+    ASSERT_EQ( 1, DirentCache_add( NULL, buf ) );
+    ASSERT_EQ( 1, DirentCache_add( cache, NULL ) );
+    ASSERT_EQ( 0, DirentCache_add( cache, buf ) );
+    ASSERT_EQ( 0, DirentCache_add( cache, buf ) );
+    ASSERT_EQ( 0, DirentCache_add( cache, plusbuf ) );
+    ASSERT_EQ( 2, DirentCache_getnentries( cache ) );
+    ASSERT_EQ( DirentBuf_getnbytes( buf ) + DirentBuf_getnbytes( plusbuf ),
+               DirentCache_getnbytes( cache ) );
+
+    /** Held by the cache as well as here */
+    DirentBuf_free( buf );
+    DirentBuf_free( plusbuf );
+
+    ASSERT_TRUE( NULL == DirentCache_get( NULL, 2, 7, 0 ) );
+    ASSERT_TRUE( NULL == DirentCache_get( cache, 3, 7, 0 ) );
+
+    DirentBuf_t *got = DirentCache_get( cache, 2, 7, 0 );
+    ASSERT_TRUE( buf == got );
+    DirentBuf_free( got );
+    got = DirentCache_get( cache, 2, 7, 1 );
+    ASSERT_TRUE( plusbuf == got );
+    DirentBuf_free( got );
+
+    /** Another generation discards it */
+    ASSERT_TRUE( NULL == DirentCache_get( cache, 2, 8, 0 ) );
+    ASSERT_EQ( 1, DirentCache_getnentries( cache ) );
+    ASSERT_TRUE( NULL == DirentCache_get( cache, 2, 7, 0 ) );
+
+    /** Replacing */
+    buf = _createBuf( 2, 9, 1, 5, 64 );
+    ASSERT_EQ( 0, DirentCache_add( cache, buf ) );
+    ASSERT_EQ( 1, DirentCache_getnentries( cache ) );
+    got = DirentCache_get( cache, 2, 9, 1 );
+    ASSERT_TRUE( buf == got );
+    ASSERT_EQ( 5, DirentBuf_getnentries( got ) );
+    DirentBuf_free( got );
+    DirentBuf_free( buf );
+
+    ASSERT_EQ( 3, cache->nhits );
+    ASSERT_EQ( 3, cache->nmisses );
+    ASSERT_EQ( 0, DirentCache_flush( cache ) );
+    ASSERT_EQ( 0, DirentCache_getnentries( cache ) );
+    ASSERT_EQ( 0, DirentCache_getnbytes( cache ) );
+
+    ASSERT_EQ( 1, DirentCache_free( NULL ) );
+    ASSERT_EQ( 0, DirentCache_free( cache ) );
+}
+
+TEST(zxdbfs_direntcache_tests, test_DirentCache_evict) {
+
+    DirentBuf_t *buf = _createBuf( 2, 1, 0, 10, 1000 );
+    size_t nbytes = DirentBuf_getnbytes( buf );
+    DirentCache_t *cache = DirentCache_create( nbytes * 2 + nbytes / 2 );
+    ASSERT_TRUE( NULL != cache );
+
+    ASSERT_EQ( 0, DirentCache_add( cache, buf ) );
+    DirentBuf_free( buf );
+    buf = _createBuf( 3, 1, 0, 10, 1000 );
+    ASSERT_EQ( 0, DirentCache_add( cache, buf ) );
+    DirentBuf_free( buf );
+
+    /** Using 2 makes 3 the least recently used */
+    DirentBuf_free( DirentCache_get( cache, 2, 1, 0 ) );
+
+    buf = _createBuf( 4, 1, 0, 10, 1000 );
+    ASSERT_EQ( 0, DirentCache_add( cache, buf ) );
+    DirentBuf_free( buf );
+
+    ASSERT_EQ( 2, DirentCache_getnentries( cache ) );
+    ASSERT_EQ( 1, cache->nevictions );
+    ASSERT_TRUE( NULL == DirentCache_get( cache, 3, 1, 0 ) );
+    DirentBuf_t *got = DirentCache_get( cache, 2, 1, 0 );
+    ASSERT_TRUE( NULL != got );
+    DirentBuf_free( got );
+
+    /** Never larger than the whole budget */
+    buf = _createBuf( 5, 1, 0, 100, 1000 );
+    ASSERT_EQ( 1, DirentCache_add( cache, buf ) );
+    DirentBuf_free( buf );
+    ASSERT_EQ( 2, DirentCache_getnentries( cache ) );
+
+    ASSERT_EQ( 0, DirentCache_free( cache ) );
+}
@@ -0,0 +1,94 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include <zxdbfs_dirhandle.h>
+#include <zxdbfs_epoch.h>
+#include <zxdbfs_fscacheentry.h>
+}
+
+TEST(zxdbfs_dirhandle_tests, test_DirHandle_add) {
+
+    DirHandle_t *dirHandle = DirHandle_create();
+    ASSERT_TRUE( NULL != dirHandle );
+    ASSERT_EQ( 0, DirHandle_getnentries( dirHandle ) );
+
+    ASSERT_EQ( 1, DirHandle_add( NULL, "by-letter", FSCACHEENTRY_DIR, 0 ) );
+    ASSERT_EQ( 1, DirHandle_add( dirHandle, NULL, FSCACHEENTRY_DIR, 0 ) );
+
+    /** Enough to grow both arrays several times */
+    for ( int i = 0 ; i < 1000 ; i++ ) {
+        char name[64];
+        sprintf( name, "a reasonably long file name %d.tap", i );
+        ASSERT_EQ( 0, DirHandle_add( dirHandle, name, FSCACHEENTRY_FILE, i ) );
+    }
+
+    ASSERT_EQ( 1000, DirHandle_getnentries( dirHandle ) );
+    ASSERT_STREQ( "a reasonably long file name 0.tap", DirHandle_getname( dirHandle, 0 ) );
+    ASSERT_STREQ( "a reasonably long file name 999.tap", DirHandle_getname( dirHandle, 999 ) );
+    ASSERT_EQ( FSCACHEENTRY_FILE, DirHandle_gettype( dirHandle, 573 ) );
+    ASSERT_EQ( 573, DirHandle_getsize( dirHandle, 573 ) );
+
+    ASSERT_TRUE( NULL == DirHandle_getname( dirHandle, 1000 ) );
+    ASSERT_TRUE( NULL == DirHandle_getname( dirHandle, -1 ) );
+    ASSERT_EQ( FSCACHEENTRY_UNKNOWN, DirHandle_gettype( dirHandle, 1000 ) );
+    ASSERT_EQ( 0, DirHandle_getsize( dirHandle, 1000 ) );
+    ASSERT_EQ( 0, DirHandle_getnentries( NULL ) );
+
+    DirHandle_free( dirHandle );
+    DirHandle_free( NULL );
+}
+
+TEST(zxdbfs_dirhandle_tests, test_DirHandle_addFromFSCacheEntry) {
+
+    FSCacheEntry_t *dirEntry = FSCacheEntry_create( "/dirhandle/dir", FSCACHEENTRY_DIR, NULL, 0 );
+    ASSERT_TRUE( NULL != dirEntry );
+    ASSERT_EQ( 0, FSCacheEntry_addFile( dirEntry, FSCacheEntry_create( "/dirhandle/dir/file.tap", FSCACHEENTRY_FILE, "https://testhost/testpath", 1234 ) ) );
+    ASSERT_EQ( 0, FSCacheEntry_addFile( dirEntry, FSCacheEntry_create( "/dirhandle/dir/stub", FSCACHEENTRY_DIR_STUB, NULL, 0 ) ) );
+
+    DirHandle_t *dirHandle = DirHandle_create();
+    ASSERT_TRUE( NULL != dirHandle );
+    ASSERT_EQ( 1, DirHandle_addFromFSCacheEntry( NULL, dirEntry ) );
+    ASSERT_EQ( 1, DirHandle_addFromFSCacheEntry( dirHandle, NULL ) );
+
+    ASSERT_EQ( 0, DirHandle_add( dirHandle, ".", FSCACHEENTRY_DIR, 0 ) );
+    ASSERT_EQ( 0, DirHandle_getgeneration( dirHandle ) );
+    ASSERT_EQ( 0, DirHandle_addFromFSCacheEntry( dirHandle, dirEntry ) );
+    ASSERT_EQ( FSCacheEntry_getgeneration( dirEntry ), DirHandle_getgeneration( dirHandle ) );
+
+    /** The snapshot doesn't see later changes */
+    uint64_t generation = DirHandle_getgeneration( dirHandle );
+    ASSERT_EQ( 0, FSCacheEntry_addFile( dirEntry, FSCacheEntry_create( "/dirhandle/dir/later.tap", FSCACHEENTRY_FILE, NULL, 1 ) ) );
+    FSCacheEntry_free( dirEntry );
+    Epoch_synchronize();
+
+    ASSERT_EQ( generation, DirHandle_getgeneration( dirHandle ) );
+    ASSERT_EQ( 3, DirHandle_getnentries( dirHandle ) );
+    ASSERT_STREQ( ".", DirHandle_getname( dirHandle, 0 ) );
+    ASSERT_STREQ( "file.tap", DirHandle_getname( dirHandle, 1 ) );
+    ASSERT_EQ( FSCACHEENTRY_FILE, DirHandle_gettype( dirHandle, 1 ) );
+    ASSERT_EQ( 1234, DirHandle_getsize( dirHandle, 1 ) );
+    ASSERT_STREQ( "stub", DirHandle_getname( dirHandle, 2 ) );
+    ASSERT_EQ( FSCACHEENTRY_DIR_STUB, DirHandle_gettype( dirHandle, 2 ) );
+
+    DirHandle_free( dirHandle );
+}
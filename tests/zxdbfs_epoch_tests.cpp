@@ -0,0 +1,126 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <pthread.h>
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include <zxdbfs_epoch.h>
+}
+
+static int nfreed = 0;
+
+static void _countFree( void *ptr ) {
+    __atomic_add_fetch( &nfreed, 1, __ATOMIC_RELAXED );
+    free( ptr );
+}
+
+TEST(zxdbfs_epoch_tests, test_Epoch_retire) {
+
+    Epoch_synchronize();
+    nfreed = 0;
+
+    /** Ignored */
+    void *ptr = malloc( 16 );
+    Epoch_retire( NULL, _countFree );
+    Epoch_retire( ptr, NULL );
+    ASSERT_EQ( 0, Epoch_getnretired() );
+    free( ptr );
+
+    Epoch_retire( malloc( 16 ), _countFree );
+    ASSERT_EQ( 0, nfreed );
+    ASSERT_EQ( 1, Epoch_getnretired() );
+
+    Epoch_synchronize();
+    ASSERT_EQ( 1, nfreed );
+    ASSERT_EQ( 0, Epoch_getnretired() );
+}
+
+static int readerEntered = 0;
+static int readerRelease = 0;
+
+static void *_reader( void *arg ) {
+
+    int **shared = (int **)arg;
+
+    Epoch_enter();
+    int *value = __atomic_load_n( shared, __ATOMIC_ACQUIRE );
+    __atomic_store_n( &readerEntered, 1, __ATOMIC_RELEASE );
+    while ( !__atomic_load_n( &readerRelease, __ATOMIC_ACQUIRE ) ) {
+        sched_yield();
+    }
+    /** Still readable despite having been retired */
+    int v = *value;
+    Epoch_exit();
+
+    return (void *)(long)v;
+}
+
+TEST(zxdbfs_epoch_tests, test_Epoch_grace_period) {
+
+    Epoch_synchronize();
+    nfreed = 0;
+
+    int *value = (int *)malloc( sizeof( int ) );
+    *value = 42;
+    int *shared = value;
+
+    pthread_t reader;
+    ASSERT_EQ( 0, pthread_create( &reader, NULL, _reader, &shared ) );
+    while ( !__atomic_load_n( &readerEntered, __ATOMIC_ACQUIRE ) ) {
+        sched_yield();
+    }
+
+    /** Unpublish and retire. Reclamation can't pass the reader */
+    __atomic_store_n( &shared, (int *)NULL, __ATOMIC_RELEASE );
+    Epoch_retire( value, _countFree );
+    for ( int i = 0 ; i < EPOCH_DEFAULT_RECLAIM_THRESHOLD * 2 ; i++ ) {
+        Epoch_retire( malloc( 16 ), free );
+    }
+    ASSERT_EQ( 0, nfreed );
+
+    __atomic_store_n( &readerRelease, 1, __ATOMIC_RELEASE );
+    void *rv;
+    pthread_join( reader, &rv );
+    ASSERT_EQ( 42, (int)(long)rv );
+
+    Epoch_synchronize();
+    ASSERT_EQ( 1, nfreed );
+}
+
+TEST(zxdbfs_epoch_tests, test_Epoch_nesting) {
+
+    Epoch_synchronize();
+    nfreed = 0;
+
+    Epoch_enter();
+    Epoch_enter();
+    Epoch_exit();
+    /** Still inside the outer critical section */
+    Epoch_exit();
+
+    /** Unbalanced exits are ignored */
+    Epoch_exit();
+
+    Epoch_retire( malloc( 16 ), _countFree );
+    Epoch_synchronize();
+    ASSERT_EQ( 1, nfreed );
+}
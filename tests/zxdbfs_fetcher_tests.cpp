@@ -0,0 +1,299 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+extern "C" {
+#include <zxdbfs_fetcher.h>
+#include <zxdbfs_http.h>
+#include <zxdbfs_json.h>
+}
+
+#include "zxdbfs_tests_utils.h"
+
+TEST(zxdbfs_fetcher_tests, test_Fetcher_create) {
+
+    Fetcher_t *fetcher = Fetcher_create( 0, 0 );
+    ASSERT_TRUE( NULL != fetcher );
+    ASSERT_EQ( 0, Fetcher_getninflight( fetcher ) );
+    ASSERT_EQ( 0, Fetcher_free( fetcher ) );
+
+    ASSERT_EQ( 1, Fetcher_free( NULL ) );
+}
+
+TEST(zxdbfs_fetcher_tests, test_Fetcher_submit) {
+
+    const char *jsonData = "{\"id\":\"0005795\"}";
+
+    Fetcher_t *fetcher = Fetcher_create( 0, 0 );
+
+    char fname[128];
+    sprintf( fname, "/tmp/%d.fetch.json", getpid() );
+    ASSERT_EQ( 0, createTestFile( fname, jsonData ) );
+    char url[256];
+    sprintf( url, "file://%s", fname );
+
+    /** Bad parameters */
+    ASSERT_TRUE( NULL == Fetcher_submit( NULL, url, NULL, NULL, 0 ) );
+    ASSERT_TRUE( NULL == Fetcher_submit( fetcher, NULL, NULL, NULL, 0 ) );
+    ASSERT_TRUE( NULL == Fetch_wait( NULL, NULL, NULL ) );
+
+    Fetch_t *fetch = Fetcher_submit( fetcher, url, NULL, NULL, 0 );
+    ASSERT_TRUE( NULL != fetch );
+    struct MemoryStruct *chunk = Fetch_wait( fetch, NULL, NULL );
+    ASSERT_TRUE( NULL != chunk );
+    ASSERT_EQ( strlen( jsonData ), chunk->size );
+    ASSERT_EQ( 0, memcmp( jsonData, chunk->memory, chunk->size ) );
+    free( chunk->memory );
+    free( chunk );
+
+    /** Failures complete with no body */
+    ASSERT_EQ( 0, unlinkTestFile( fname ) );
+    fetch = Fetcher_submit( fetcher, url, NULL, NULL, 0 );
+    ASSERT_TRUE( NULL != fetch );
+    ASSERT_TRUE( NULL == Fetch_wait( fetch, NULL, NULL ) );
+    ASSERT_EQ( 2, fetcher->nfetches );
+    ASSERT_EQ( 1, fetcher->nfailures );
+    ASSERT_EQ( 0, Fetcher_getninflight( fetcher ) );
+
+    Fetcher_free( fetcher );
+}
+
+TEST(zxdbfs_fetcher_tests, test_Fetcher_parse) {
+
+#include <testdata/zxdb-games-0005795.h>
+
+    Fetcher_t *fetcher = Fetcher_create( 0, 0 );
+
+    char fname[128];
+    sprintf( fname, "/tmp/%d.fetch.json", getpid() );
+    ASSERT_EQ( 0, createTestFile( fname, jsonData ) );
+    char url[256];
+    sprintf( url, "file://%s", fname );
+
+    /** The body is parsed as it arrives rather than kept */
+    struct MemoryStruct *chunk = Fetch_wait( Fetcher_submit( fetcher, url, NULL, NULL, 1 ),
+                                             NULL, NULL );
+    ASSERT_TRUE( NULL != chunk );
+    ASSERT_TRUE( NULL != chunk->obj );
+    ASSERT_EQ( json_type_object, json_object_get_type( chunk->obj ) );
+    ASSERT_EQ( strlen( jsonData ), chunk->size );
+    ASSERT_STREQ( "", chunk->memory );
+    HTTP_freechunk( chunk );
+
+    /** Abandoned part way, the parse is thrown away */
+    Fetch_free( Fetcher_submit( fetcher, url, NULL, NULL, 1 ) );
+
+    ASSERT_EQ( 0, unlinkTestFile( fname ) );
+    Fetcher_free( fetcher );
+}
+
+TEST(zxdbfs_fetcher_tests, test_Fetcher_submitrange) {
+
+    Fetcher_t *fetcher = Fetcher_create( 0, 0 );
+
+    char fname[128];
+    sprintf( fname, "/tmp/%d.fetch.json", getpid() );
+    ASSERT_EQ( 0, createTestFile( fname, "0123456789" ) );
+    char url[256];
+    sprintf( url, "file://%s", fname );
+
+    ASSERT_TRUE( NULL == Fetcher_submitrange( fetcher, url, NULL, 0, 0 ) );
+
+    struct MemoryStruct *chunk = Fetch_wait( Fetcher_submitrange( fetcher, url, NULL, 6, 3 ),
+                                             NULL, NULL );
+    ASSERT_TRUE( NULL != chunk );
+    ASSERT_EQ( 3, chunk->size );
+    ASSERT_EQ( 0, memcmp( "678", chunk->memory, 3 ) );
+    HTTP_freechunk( chunk );
+
+    ASSERT_EQ( 0, unlinkTestFile( fname ) );
+    Fetcher_free( fetcher );
+}
+
+TEST(zxdbfs_fetcher_tests, test_Fetcher_submitstream) {
+
+    Fetcher_t *fetcher = Fetcher_create( 0, 0 );
+
+    char fname[128];
+    sprintf( fname, "/tmp/%d.fetch.json", getpid() );
+    ASSERT_EQ( 0, createTestFile( fname, "0123456789" ) );
+    char url[256];
+    sprintf( url, "file://%s", fname );
+
+    char buf[16];
+    ASSERT_EQ( -1, Fetch_read( NULL, 0, 4, buf ) );
+
+    Fetch_t *fetch = Fetcher_submitstream( fetcher, url, NULL );
+    ASSERT_TRUE( NULL != fetch );
+    ASSERT_EQ( 3, Fetch_read( fetch, 6, 3, buf ) );
+    ASSERT_EQ( 0, memcmp( "678", buf, 3 ) );
+
+    /** Reads past the end stop short once the body is complete */
+    ASSERT_EQ( 2, Fetch_read( fetch, 8, 8, buf ) );
+    ASSERT_EQ( 0, memcmp( "89", buf, 2 ) );
+    ASSERT_EQ( 0, Fetch_read( fetch, 10, 8, buf ) );
+    ASSERT_EQ( 1, Fetch_isdone( fetch ) );
+
+    struct MemoryStruct *chunk = Fetch_wait( fetch, NULL, NULL );
+    ASSERT_TRUE( NULL != chunk );
+    ASSERT_EQ( 10, chunk->size );
+    HTTP_freechunk( chunk );
+
+    ASSERT_EQ( 0, unlinkTestFile( fname ) );
+
+    /** A missing file fails its reads */
+    fetch = Fetcher_submitstream( fetcher, url, NULL );
+    ASSERT_EQ( -1, Fetch_read( fetch, 0, 4, buf ) );
+    Fetch_free( fetch );
+
+    /** And is told apart from a failed request */
+    long code = 0;
+    ASSERT_TRUE( NULL == Fetch_waitcode( Fetcher_submit( fetcher, url, NULL, NULL, 0 ),
+                                         NULL, NULL, &code ) );
+    ASSERT_EQ( 404, code );
+    ASSERT_TRUE( NULL == Fetch_waitcode( Fetcher_submit( fetcher, "http://127.0.0.1:1/", NULL, NULL, 0 ),
+                                         NULL, NULL, &code ) );
+    ASSERT_EQ( -1, code );
+
+    Fetcher_free( fetcher );
+}
+
+TEST(zxdbfs_fetcher_tests, test_Fetcher_concurrent) {
+
+    const int NFETCHES = 64;
+    const char *jsonData = "{\"id\":\"0005795\"}";
+
+    Fetcher_t *fetcher = Fetcher_create( 4, 0 );
+
+    char fname[128];
+    sprintf( fname, "/tmp/%d.fetch.json", getpid() );
+    ASSERT_EQ( 0, createTestFile( fname, jsonData ) );
+    char url[256];
+    sprintf( url, "file://%s", fname );
+
+    /** Everything is submitted before anything is waited on */
+    Fetch_t *fetches[NFETCHES];
+    for ( int i = 0 ; i < NFETCHES ; i++ ) {
+        fetches[i] = Fetcher_submit( fetcher, url, NULL, NULL, 0 );
+        ASSERT_TRUE( NULL != fetches[i] );
+    }
+    for ( int i = NFETCHES - 1 ; i >= 0 ; i-- ) {
+        struct MemoryStruct *chunk = Fetch_wait( fetches[i], NULL, NULL );
+        ASSERT_TRUE( NULL != chunk );
+        ASSERT_EQ( strlen( jsonData ), chunk->size );
+        free( chunk->memory );
+        free( chunk );
+    }
+    ASSERT_EQ( NFETCHES, fetcher->nfetches );
+    ASSERT_EQ( 0, fetcher->nfailures );
+
+    ASSERT_EQ( 0, unlinkTestFile( fname ) );
+    Fetcher_free( fetcher );
+}
+
+TEST(zxdbfs_fetcher_tests, test_Fetch_free) {
+
+    const char *jsonData = "{\"id\":\"0005795\"}";
+
+    Fetcher_t *fetcher = Fetcher_create( 0, 0 );
+
+    char fname[128];
+    sprintf( fname, "/tmp/%d.fetch.json", getpid() );
+    ASSERT_EQ( 0, createTestFile( fname, jsonData ) );
+    char url[256];
+    sprintf( url, "file://%s", fname );
+
+    /** Abandoned fetches finish in the background */
+    for ( int i = 0 ; i < 8 ; i++ ) {
+        Fetch_free( Fetcher_submit( fetcher, url, NULL, NULL, 0 ) );
+    }
+
+    /** A completed fetch can be abandoned too */
+    Fetch_t *fetch = Fetcher_submit( fetcher, url, NULL, NULL, 0 );
+    while ( !Fetch_isdone( fetch ) ) {
+        usleep( 1000 );
+    }
+    Fetch_free( fetch );
+
+    ASSERT_EQ( 0, unlinkTestFile( fname ) );
+
+    /** Freeing the fetcher fails anything left, and refuses more */
+    Fetcher_free( fetcher );
+}
+
+TEST(zxdbfs_fetcher_tests, test_Fetcher_conditional) {
+
+    const char *jsonData = "{\"id\":\"0005795\"}";
+
+    Fetcher_t *fetcher = Fetcher_create( 0, 0 );
+
+    char fname[128];
+    sprintf( fname, "/tmp/%d.fetch.json", getpid() );
+    ASSERT_EQ( 0, createTestFile( fname, jsonData ) );
+    char url[256];
+    sprintf( url, "file://%s", fname );
+
+    HTTPValidators_t validators = { { 0 }, 0 };
+    int notmodified = -1;
+    struct MemoryStruct *chunk = Fetch_wait( Fetcher_submit( fetcher, url, NULL, NULL, 0 ),
+                                             &validators, &notmodified );
+    ASSERT_TRUE( NULL != chunk );
+    ASSERT_EQ( 0, notmodified );
+    ASSERT_TRUE( validators.lastmodified > 0 );
+    free( chunk->memory );
+    free( chunk );
+
+    /** Unchanged since, so nothing comes back */
+    chunk = Fetch_wait( Fetcher_submit( fetcher, url, NULL, &validators, 0 ), NULL, &notmodified );
+    ASSERT_TRUE( NULL == chunk );
+    ASSERT_EQ( 1, notmodified );
+    ASSERT_EQ( 0, fetcher->nfailures );
+
+    ASSERT_EQ( 0, unlinkTestFile( fname ) );
+    Fetcher_free( fetcher );
+}
+
+TEST(zxdbfs_fetcher_tests, test_getURL_fetcher) {
+
+#include <testdata/zxdb-games-0005795.h>
+
+    Fetcher_t *fetcher = Fetcher_create( 0, 0 );
+    HTTP_setfetcher( fetcher );
+
+    char fname[128];
+    sprintf( fname, "/tmp/%d.fetch.json", getpid() );
+    ASSERT_EQ( 0, createTestFile( fname, jsonData ) );
+
+    json_object *rv0 = getURL( NULL, "file://", fname, NULL, 0 );
+    ASSERT_TRUE( NULL != rv0 );
+    json_object_put( rv0 );
+    ASSERT_EQ( 1, fetcher->nfetches );
+
+    ASSERT_EQ( 0, unlinkTestFile( fname ) );
+    ASSERT_TRUE( NULL == getURL( NULL, "file://", fname, NULL, 0 ) );
+    ASSERT_EQ( 1, fetcher->nfailures );
+
+    HTTP_setfetcher( NULL );
+    Fetcher_free( fetcher );
+}
@@ -20,9 +20,13 @@
 
 #include <gtest/gtest.h>
 
+#include <pthread.h>
+
 extern "C" {
 #include <zxdbfs_byletter.h>
+#include <zxdbfs_epoch.h>
 #include <zxdbfs_fscache.h>
+#include <zxdbfs_urlcache.h>
 #include <zxdbfs_gameid.h>
 #include <zxdbfs_json.h>
 }
@@ -50,10 +54,10 @@ TEST(zxdbfs_fscache_tests, test_FSCache_flush) {
 
     ASSERT_EQ( 0, FSCache_add( cache, "key", fsCacheEntry ) );
 
-    ASSERT_EQ( 1, json_object_object_length( cache->cache ) );
+    ASSERT_EQ( 1, FSCache_getnentries( cache ) );
 
     ASSERT_EQ( 0, FSCache_flush( cache ) );
-    ASSERT_EQ( 0, json_object_object_length( cache->cache ) );
+    ASSERT_EQ( 0, FSCache_getnentries( cache ) );
 
     ASSERT_EQ( 0, FSCache_free( cache ) );
 }
@@ -69,7 +73,7 @@ TEST(zxdbfs_fscache_tests, test_FSCache_add) {
     ASSERT_EQ( 1, FSCache_add( NULL, "key", NULL ) );
     ASSERT_EQ( 1, FSCache_add( cache, "key", NULL ) );
 
-    dumpJSON( cache->cache );
+    dumpFSCache( cache );
 
     FSCacheEntry_t *fsCacheEntry = FSCacheEntry_create( "/path0/path1", FSCACHEENTRY_DIR, NULL, 0 );
     ASSERT_TRUE( NULL != fsCacheEntry );
@@ -97,6 +101,7 @@ TEST(zxdbfs_fscache_tests, test_FSCache_get_dir) {
     const char *url = FSCacheEntry_geturl( newFSCacheEntry );
     ASSERT_TRUE( NULL == url );
     ASSERT_EQ( 0, FSCacheEntry_getnfiles( newFSCacheEntry ) );
+    FSCacheEntry_free( newFSCacheEntry );
 
     ASSERT_EQ( 0, FSCache_free( cache ) );
 }
@@ -138,6 +143,7 @@ TEST(zxdbfs_fscache_tests, test_FSCache_get_file) {
     ASSERT_STREQ( "https://testhost/testpath", FSCacheEntry_geturl( newFSCacheEntry)  );
     ASSERT_EQ( 0, FSCacheEntry_getnfiles( newFSCacheEntry ) );
     //ASSERT_TRUE( NULL == newFSCacheEntry->files );
+    FSCacheEntry_free( newFSCacheEntry );
 
     ASSERT_EQ( 0, FSCache_free( cache ) );
 }
@@ -170,7 +176,7 @@ TEST(zxdbfs_fscache_tests, test_FSCache_get_dir_with_files_and_dirs) {
     ASSERT_EQ( 2, FSCacheEntry_getnfiles( newFSCacheEntry ) );
     //ASSERT_TRUE( NULL != newFSCacheEntry->files );
 
-    //dumpJSON( cache->cache );
+    //dumpFSCache( cache );
 
     /** Test the subfile */
     FSCacheEntry_t *file0 = FSCacheEntry_getfile( newFSCacheEntry, 0 );
@@ -195,6 +201,7 @@ TEST(zxdbfs_fscache_tests, test_FSCache_get_dir_with_files_and_dirs) {
     ASSERT_EQ( FSCACHEENTRY_FILE, FSCacheEntry_gettype( file1file0 ) );
     ASSERT_EQ( 5678, FSCacheEntry_getsize( file1file0 ) );
     ASSERT_STREQ( "https://testhost2/testpath2", FSCacheEntry_geturl( file1file0 ) );
+    FSCacheEntry_free( newFSCacheEntry );
 
     ASSERT_EQ( 0, FSCache_free( cache ) );
 }
@@ -228,6 +235,7 @@ TEST(zxdbfs_fscache_tests, test_FSCache_get_dir_with_files) {
     ASSERT_STREQ( "/path0/path1/path2", FSCacheEntry_getfname( file0 ) );
     ASSERT_EQ( 1234, FSCacheEntry_getsize( file0 ) );
     ASSERT_STREQ( "https://testhost/testpath", FSCacheEntry_geturl( file0 ) );
+    FSCacheEntry_free( newFSCacheEntry );
 
     ASSERT_EQ( 0, FSCache_free( cache ) );
 }
@@ -249,10 +257,11 @@ TEST(zxdbfs_fscache_tests, test_FSCache_addAll_AZ) {
     ASSERT_EQ( 115, FSCacheEntry_getnfiles( byLetter ) );
 
     ASSERT_EQ( 0, FSCache_addAll( cache, "root", byLetter ) );
-    ASSERT_EQ( 116, json_object_object_length( cache->cache ) );
+    ASSERT_EQ( 116, FSCache_getnentries( cache ) );
     FSCacheEntry_t *cachedAZ = FSCache_get( cache, "root" );
     ASSERT_TRUE( NULL != cachedAZ );
     ASSERT_EQ( 115, FSCacheEntry_getnfiles( cachedAZ ) );
+    FSCacheEntry_free( cachedAZ );
 
     ASSERT_EQ( 0, FSCache_free( cache ) );
 }
@@ -274,7 +283,604 @@ TEST(zxdbfs_fscache_tests, test_FSCache_addAll_Xevious) {
     ASSERT_EQ( 7, FSCacheEntry_getnfiles( gameRoot ) );
 
     ASSERT_EQ( 0, FSCache_addAll( cache, "/by-letter/X/Xevious_0005795", gameRoot ) );
-    ASSERT_EQ( 11, json_object_object_length( cache->cache ) );
+    ASSERT_EQ( 11, FSCache_getnentries( cache ) );
+
+    ASSERT_EQ( 0, FSCache_free( cache ) );
+}
+
+TEST(zxdbfs_fscache_tests, test_FSCache_addAll_shares_entries) {
+
+#include <testdata/by-letter-X.h>
+
+    FSCache_t *cache = FSCache_create();
+    ASSERT_TRUE( NULL != cache );
+
+    json_object *jsonObject = json_tokener_parse( jsonData );
+    ASSERT_TRUE( NULL != jsonObject );
+
+    FSCacheEntry_t *byLetter =
+        FSCacheEntry_createFromByLetter( "/by-letter/X", jsonObject );
+    json_object_put( jsonObject );
+    ASSERT_TRUE( NULL != byLetter );
+
+    ASSERT_EQ( 0, FSCache_addAll( cache, "/by-letter/X", byLetter ) );
+
+    /** The path index and the directory's file list hold the same entries */
+    for ( int i = 0 ; i < FSCacheEntry_getnfiles( byLetter ) ; i++ ) {
+        FSCacheEntry_t *file = FSCacheEntry_getfile( byLetter, i );
+        FSCacheEntry_t *cached = FSCache_get( cache, FSCacheEntry_getfname( file ) );
+        ASSERT_EQ( file, cached );
+        ASSERT_EQ( 3, file->refcount );
+        FSCacheEntry_free( cached );
+        ASSERT_EQ( 2, file->refcount );
+    }
+
+    /** Deleting the index entry leaves the directory listing intact */
+    FSCacheEntry_t *file0 = FSCacheEntry_getfile( byLetter, 0 );
+    ASSERT_EQ( 0, FSCache_delete( cache, FSCacheEntry_getfname( file0 ) ) );
+    ASSERT_EQ( 1, file0->refcount );
+    ASSERT_TRUE( NULL != FSCacheEntry_getfname( file0 ) );
 
     ASSERT_EQ( 0, FSCache_free( cache ) );
 }
+
+TEST(zxdbfs_fscache_tests, test_FSCache_addAll_unstubs_in_place) {
+
+    FSCache_t *cache = FSCache_create();
+    ASSERT_TRUE( NULL != cache );
+
+    {
+#include <testdata/by-letter-X.h>
+        json_object *jsonObject = json_tokener_parse( jsonData );
+        FSCacheEntry_t *byLetter =
+            FSCacheEntry_createFromByLetter( "/by-letter/X", jsonObject );
+        json_object_put( jsonObject );
+        ASSERT_EQ( 0, FSCache_addAll( cache, "/by-letter/X", byLetter ) );
+    }
+
+    FSCacheEntry_t *stub = FSCache_get( cache, "/by-letter/X/Xevious_0005795" );
+    ASSERT_TRUE( NULL != stub );
+    ASSERT_EQ( FSCACHEENTRY_DIR_STUB, FSCacheEntry_gettype( stub ) );
+
+    {
+#include <testdata/zxdb-games-0005795.h>
+        json_object *jsonObject = json_tokener_parse( jsonData );
+        FSCacheEntry_t *gameRoot =
+            FSCacheEntry_createFromGame( "/by-letter/X/Xevious_0005795", jsonObject );
+        json_object_put( jsonObject );
+        ASSERT_EQ( 0, FSCache_addAll( cache, "/by-letter/X/Xevious_0005795", gameRoot ) );
+    }
+
+    /** The stub that the by-letter directory lists is now the full game */
+    FSCacheEntry_t *game = FSCache_get( cache, "/by-letter/X/Xevious_0005795" );
+    ASSERT_EQ( stub, game );
+    ASSERT_EQ( FSCACHEENTRY_DIR, FSCacheEntry_gettype( game ) );
+    ASSERT_EQ( 7, FSCacheEntry_getnfiles( game ) );
+    ASSERT_EQ( 116 + 10, FSCache_getnentries( cache ) );
+
+    FSCacheEntry_t *file0 = FSCacheEntry_getfile( game, 0 );
+    FSCacheEntry_t *cached = FSCache_get( cache, FSCacheEntry_getfname( file0 ) );
+    ASSERT_EQ( file0, cached );
+    FSCacheEntry_free( cached );
+    FSCacheEntry_free( game );
+    FSCacheEntry_free( stub );
+
+    ASSERT_EQ( 0, FSCache_free( cache ) );
+}
+
+/**
+ * Looks up the type of a cached entry, FSCACHEENTRY_UNKNOWN if not present
+ */
+static FSCacheEntryType _gettype( FSCache_t *cache, const char *key ) {
+
+    FSCacheEntry_t *fsCacheEntry = FSCache_get( cache, key );
+    FSCacheEntryType type = FSCacheEntry_gettype( fsCacheEntry );
+    FSCacheEntry_free( fsCacheEntry );
+
+    return type;
+}
+
+static FSCacheEntry_t *_createXevious( const char *path ) {
+
+#include <testdata/zxdb-games-0005795.h>
+
+    json_object *jsonObject = json_tokener_parse( jsonData );
+    FSCacheEntry_t *gameRoot = FSCacheEntry_createFromGame( path, jsonObject );
+    json_object_put( jsonObject );
+
+    return gameRoot;
+}
+
+TEST(zxdbfs_fscache_tests, test_FSCache_nbytes) {
+
+    FSCache_t *cache = FSCache_create();
+    ASSERT_TRUE( NULL != cache );
+    ASSERT_EQ( 0, FSCache_getnbytes( cache ) );
+
+    ASSERT_EQ( 0, FSCache_addAll( cache, "/g1", _createXevious( "/g1" ) ) );
+    size_t nbytes = FSCache_getnbytes( cache );
+    ASSERT_TRUE( nbytes > 0 );
+
+    /** Overwriting the same key with the same data costs the same */
+    ASSERT_EQ( 0, FSCache_addAll( cache, "/g1", _createXevious( "/g1" ) ) );
+    ASSERT_EQ( nbytes, FSCache_getnbytes( cache ) );
+
+    /** Deleting a game directory takes its contents with it */
+    ASSERT_EQ( 0, FSCache_delete( cache, "/g1" ) );
+    ASSERT_EQ( 0, FSCache_getnentries( cache ) );
+    ASSERT_EQ( 0, FSCache_getnbytes( cache ) );
+
+    ASSERT_EQ( 0, FSCache_addAll( cache, "/g1", _createXevious( "/g1" ) ) );
+    ASSERT_EQ( 0, FSCache_flush( cache ) );
+    ASSERT_EQ( 0, FSCache_getnbytes( cache ) );
+    ASSERT_EQ( 0, cache->nunits );
+
+    ASSERT_EQ( 0, FSCache_free( cache ) );
+}
+
+TEST(zxdbfs_fscache_tests, test_FSCache_evict) {
+
+    FSCache_t *cache = FSCache_create();
+    ASSERT_TRUE( NULL != cache );
+
+    ASSERT_EQ( 1, FSCache_evict( NULL, "/g1" ) );
+    ASSERT_EQ( 2, FSCache_evict( cache, "/g1" ) );
+
+    ASSERT_EQ( 0, FSCache_addAll( cache, "/g1", _createXevious( "/g1" ) ) );
+    ASSERT_EQ( 11, FSCache_getnentries( cache ) );
+    FSCacheEntry_t *game = FSCache_get( cache, "/g1" );
+    FSCacheEntry_t *file0 = FSCacheEntry_getfile( game, 0 );
+    ASSERT_EQ( 2, FSCache_evict( cache, FSCacheEntry_getfname( file0 ) ) );
+    FSCacheEntry_free( game );
+
+    ASSERT_EQ( 0, FSCache_evict( cache, "/g1" ) );
+    ASSERT_EQ( 1, FSCache_getnentries( cache ) );
+    FSCacheEntry_t *stub = FSCache_get( cache, "/g1" );
+    ASSERT_EQ( FSCACHEENTRY_DIR_STUB, FSCacheEntry_gettype( stub ) );
+    ASSERT_EQ( 0, FSCacheEntry_getnfiles( stub ) );
+    ASSERT_EQ( 1, cache->nevictions );
+
+    /** Stubs aren't evictable */
+    ASSERT_EQ( 2, FSCache_evict( cache, "/g1" ) );
+
+    /** ...but can be unstubbed again */
+    ASSERT_EQ( 0, FSCache_addAll( cache, "/g1", _createXevious( "/g1" ) ) );
+    game = FSCache_get( cache, "/g1" );
+    ASSERT_EQ( stub, game );
+    ASSERT_EQ( FSCACHEENTRY_DIR, FSCacheEntry_gettype( stub ) );
+    ASSERT_EQ( 11, FSCache_getnentries( cache ) );
+    FSCacheEntry_free( game );
+    FSCacheEntry_free( stub );
+
+    ASSERT_EQ( 0, FSCache_free( cache ) );
+}
+
+TEST(zxdbfs_fscache_tests, test_FSCache_maxbytes) {
+
+    FSCache_t *cache = FSCache_create();
+    ASSERT_TRUE( NULL != cache );
+
+    /** Measure a single game */
+    ASSERT_EQ( 0, FSCache_addAll( cache, "/g1", _createXevious( "/g1" ) ) );
+    size_t nbytes = FSCache_getnbytes( cache );
+    ASSERT_EQ( 0, FSCache_flush( cache ) );
+
+    /** Room for two games */
+    ASSERT_EQ( 0, FSCache_setmaxbytes( cache, nbytes * 2 + nbytes / 2 ) );
+
+    ASSERT_EQ( 0, FSCache_addAll( cache, "/g1", _createXevious( "/g1" ) ) );
+    ASSERT_EQ( 0, FSCache_addAll( cache, "/g2", _createXevious( "/g2" ) ) );
+    ASSERT_EQ( 22, FSCache_getnentries( cache ) );
+    ASSERT_EQ( 0, cache->nevictions );
+
+    /** /g1 was used more recently than /g2, so /g2 makes way for /g3 */
+    ASSERT_EQ( FSCACHEENTRY_DIR, _gettype( cache, "/g1/SCRSHOT" ) );
+    ASSERT_EQ( 0, FSCache_addAll( cache, "/g3", _createXevious( "/g3" ) ) );
+    ASSERT_EQ( 1, cache->nevictions );
+    ASSERT_TRUE( FSCache_getnbytes( cache ) <= cache->maxbytes );
+
+    ASSERT_EQ( FSCACHEENTRY_DIR, _gettype( cache, "/g1" ) );
+    ASSERT_EQ( FSCACHEENTRY_DIR_STUB, _gettype( cache, "/g2" ) );
+    ASSERT_EQ( FSCACHEENTRY_UNKNOWN, _gettype( cache, "/g2/SCRSHOT" ) );
+    ASSERT_EQ( FSCACHEENTRY_DIR, _gettype( cache, "/g3" ) );
+
+    /** Shrinking the budget evicts immediately */
+    ASSERT_EQ( 0, FSCache_setmaxbytes( cache, nbytes ) );
+    ASSERT_TRUE( FSCache_getnbytes( cache ) <= nbytes );
+    ASSERT_TRUE( cache->nunits <= 1 );
+
+    ASSERT_EQ( 0, FSCache_free( cache ) );
+}
+
+TEST(zxdbfs_fscache_tests, test_FSCache_getfiles) {
+
+    FSCache_t *cache = FSCache_create();
+    ASSERT_TRUE( NULL != cache );
+
+    FSCacheEntry_t **files = NULL;
+    int nfiles = 0;
+    ASSERT_EQ( 1, FSCache_getfiles( NULL, "/g1", &files, &nfiles ) );
+    ASSERT_EQ( 2, FSCache_getfiles( cache, "/g1", &files, &nfiles ) );
+
+    ASSERT_EQ( 0, FSCache_addAll( cache, "/g1", _createXevious( "/g1" ) ) );
+    ASSERT_EQ( 0, FSCache_getfiles( cache, "/g1", &files, &nfiles ) );
+    ASSERT_EQ( 7, nfiles );
+
+    /** The snapshot outlives an eviction of the directory */
+    ASSERT_EQ( 0, FSCache_evict( cache, "/g1" ) );
+    for ( int i = 0 ; i < nfiles ; i++ ) {
+        ASSERT_EQ( 1, files[i]->refcount );
+        ASSERT_TRUE( NULL != FSCacheEntry_getfname( files[i] ) );
+    }
+    FSCache_releasefiles( files, nfiles );
+
+    ASSERT_EQ( 0, FSCache_getfiles( cache, "/g1", &files, &nfiles ) );
+    ASSERT_EQ( 0, nfiles );
+    ASSERT_TRUE( NULL == files );
+
+    ASSERT_EQ( 0, FSCache_free( cache ) );
+}
+
+TEST(zxdbfs_fscache_tests, test_FSCache_addFile) {
+
+    FSCache_t *cache = FSCache_create();
+    ASSERT_TRUE( NULL != cache );
+
+    FSCacheEntry_t *term = FSCacheEntry_create( "/search/xevious", FSCACHEENTRY_DIR, NULL, 0 );
+    ASSERT_EQ( 2, FSCache_addFile( cache, "/search", term ) );
+
+    ASSERT_EQ( 0, FSCache_add( cache, "/search", FSCacheEntry_create( "/search", FSCACHEENTRY_DIR, NULL, 0 ) ) );
+    ASSERT_EQ( 0, FSCache_addFile( cache, "/search", term ) );
+
+    FSCacheEntry_t **files = NULL;
+    int nfiles = 0;
+    ASSERT_EQ( 0, FSCache_getfiles( cache, "/search", &files, &nfiles ) );
+    ASSERT_EQ( 1, nfiles );
+    ASSERT_EQ( term, files[0] );
+    FSCache_releasefiles( files, nfiles );
+
+    /** The appended entry isn't indexed */
+    ASSERT_EQ( 1, FSCache_getnentries( cache ) );
+
+    ASSERT_EQ( 0, FSCache_free( cache ) );
+}
+
+TEST(zxdbfs_fscache_tests, test_FSCache_lookup) {
+
+    FSCache_t *cache = FSCache_create();
+    ASSERT_TRUE( NULL != cache );
+
+    ASSERT_TRUE( NULL == FSCache_lookup( NULL, "/g1" ) );
+    ASSERT_TRUE( NULL == FSCache_lookup( cache, NULL ) );
+
+    ASSERT_EQ( 0, FSCache_addAll( cache, "/g1", _createXevious( "/g1" ) ) );
+
+    Epoch_enter();
+    FSCacheEntry_t *fsCacheEntry = FSCache_lookup( cache, "/g1" );
+    ASSERT_TRUE( NULL != fsCacheEntry );
+    ASSERT_EQ( 1, fsCacheEntry->refcount );
+    int nfiles = 0;
+    FSCacheEntry_t **files = FSCacheEntry_getfilelist( fsCacheEntry, &nfiles );
+    ASSERT_EQ( 7, nfiles );
+
+    /** Deleting leaves the entry and its file list readable until the epoch ends */
+    ASSERT_EQ( 0, FSCache_delete( cache, "/g1" ) );
+    ASSERT_TRUE( NULL == FSCache_lookup( cache, "/g1" ) );
+    ASSERT_STREQ( "/g1", FSCacheEntry_getfname( fsCacheEntry ) );
+    for ( int i = 0 ; i < nfiles ; i++ ) {
+        ASSERT_TRUE( NULL != FSCacheEntry_getfname( files[i] ) );
+    }
+    Epoch_exit();
+
+    ASSERT_EQ( 0, FSCache_free( cache ) );
+    ASSERT_EQ( 0, Epoch_getnretired() );
+}
+
+TEST(zxdbfs_fscache_tests, test_FSCache_grow) {
+
+    FSCache_t *cache = FSCache_create();
+    ASSERT_TRUE( NULL != cache );
+
+    char key[32];
+    for ( int i = 0 ; i < FSCACHE_DEFAULT_HASH_SIZE * 16 ; i++ ) {
+        sprintf( key, "/search/term%d", i );
+        ASSERT_EQ( 0, FSCache_add( cache, key, FSCacheEntry_create( key, FSCACHEENTRY_DIR, NULL, 0 ) ) );
+    }
+    ASSERT_EQ( FSCACHE_DEFAULT_HASH_SIZE * 16, FSCache_getnentries( cache ) );
+    ASSERT_TRUE( cache->table->size >= FSCACHE_DEFAULT_HASH_SIZE * 16 );
+
+    for ( int i = 0 ; i < FSCACHE_DEFAULT_HASH_SIZE * 16 ; i++ ) {
+        sprintf( key, "/search/term%d", i );
+        FSCacheEntry_t *fsCacheEntry = FSCache_get( cache, key );
+        ASSERT_TRUE( NULL != fsCacheEntry );
+        ASSERT_STREQ( key, FSCacheEntry_getfname( fsCacheEntry ) );
+        FSCacheEntry_free( fsCacheEntry );
+    }
+
+    ASSERT_EQ( 0, FSCache_free( cache ) );
+}
+
+TEST(zxdbfs_fscache_tests, test_FSCache_getttlclass) {
+
+    ASSERT_EQ( FSCACHE_TTL_MAX, FSCache_getttlclass( NULL ) );
+    ASSERT_EQ( FSCACHE_TTL_MAX, FSCache_getttlclass( "/" ) );
+    ASSERT_EQ( FSCACHE_TTL_MAX, FSCache_getttlclass( "/by-letter" ) );
+    ASSERT_EQ( FSCACHE_TTL_MAX, FSCache_getttlclass( "/search" ) );
+    ASSERT_EQ( FSCACHE_TTL_MAX, FSCache_getttlclass( "/g1" ) );
+    ASSERT_EQ( FSCACHE_TTL_BYLETTER, FSCache_getttlclass( "/by-letter/X" ) );
+    ASSERT_EQ( FSCACHE_TTL_BYLETTER, FSCache_getttlclass( "/by-letter/X/" ) );
+    ASSERT_EQ( FSCACHE_TTL_SEARCH, FSCache_getttlclass( "/search/xevious" ) );
+    ASSERT_EQ( FSCACHE_TTL_GAME, FSCache_getttlclass( "/by-letter/X/Xevious_0005795" ) );
+    ASSERT_EQ( FSCACHE_TTL_GAME, FSCache_getttlclass( "/search/xevious/Xevious_0005795" ) );
+}
+
+TEST(zxdbfs_fscache_tests, test_FSCache_ttl) {
+
+    FSCache_t *cache = FSCache_create();
+    ASSERT_TRUE( NULL != cache );
+
+    ASSERT_EQ( FSCACHE_DEFAULT_TTL_GAME, FSCache_getttl( cache, FSCACHE_TTL_GAME ) );
+    ASSERT_EQ( 1, FSCache_setttl( cache, FSCACHE_TTL_MAX, 10 ) );
+    ASSERT_EQ( 1, FSCache_setttl( cache, FSCACHE_TTL_GAME, -1 ) );
+    ASSERT_EQ( 0, FSCache_setttl( cache, FSCACHE_TTL_GAME, 10 ) );
+    ASSERT_EQ( 10, FSCache_getttl( cache, FSCACHE_TTL_GAME ) );
+
+    /** Added directories are stamped with the TTL of their class */
+    const char *key = "/by-letter/X/Xevious_0005795";
+    time_t now = time( NULL );
+    ASSERT_EQ( 0, FSCache_addAll( cache, key, _createXevious( key ) ) );
+    FSCacheEntry_t *game = FSCache_get( cache, key );
+    ASSERT_EQ( 10, game->ttl );
+    ASSERT_TRUE( game->fetched >= now );
+    ASSERT_EQ( 0, FSCacheEntry_isstale( game, now ) );
+    ASSERT_EQ( 1, FSCacheEntry_isstale( game, now + 10 ) );
+
+    /** Only one caller gets to refresh */
+    ASSERT_EQ( 0, FSCacheEntry_claimrefresh( game, now ) );
+    ASSERT_EQ( 1, FSCacheEntry_claimrefresh( game, now + 10 ) );
+    ASSERT_EQ( 0, FSCacheEntry_claimrefresh( game, now + 11 ) );
+
+    /** Refreshing replaces the contents in place */
+    FSCacheEntry_t *file0 = FSCacheEntry_getfile( game, 0 );
+    int nentries = FSCache_getnentries( cache );
+    size_t nbytes = cache->nbytes;
+    ASSERT_EQ( 0, FSCache_addAll( cache, key, _createXevious( key ) ) );
+    FSCacheEntry_t *refreshed = FSCache_get( cache, key );
+    ASSERT_EQ( game, refreshed );
+    ASSERT_EQ( 1, cache->nrefreshes );
+    ASSERT_NE( file0, FSCacheEntry_getfile( game, 0 ) );
+    ASSERT_EQ( 0, game->refreshed );
+    ASSERT_EQ( 1, cache->nunits );
+    ASSERT_EQ( nentries, FSCache_getnentries( cache ) );
+    ASSERT_EQ( nbytes, cache->nbytes );
+    FSCacheEntry_free( refreshed );
+    FSCacheEntry_free( game );
+
+    ASSERT_EQ( 0, FSCache_free( cache ) );
+}
+
+TEST(zxdbfs_fscache_tests, test_FSCache_refresh_keeps_loaded) {
+
+#include <testdata/by-letter-X.h>
+
+    FSCache_t *cache = FSCache_create();
+    ASSERT_TRUE( NULL != cache );
+
+    json_object *jsonObject = json_tokener_parse( jsonData );
+    ASSERT_EQ( 0, FSCache_addAll( cache, "/by-letter/X",
+                                  FSCacheEntry_createFromByLetter( "/by-letter/X", jsonObject ) ) );
+    const char *key = "/by-letter/X/Xevious_0005795";
+    ASSERT_EQ( 0, FSCache_addAll( cache, key, _createXevious( key ) ) );
+    int nentries = FSCache_getnentries( cache );
+
+    /** Refresh the listing. The loaded game survives */
+    FSCacheEntry_t *byLetter = FSCache_get( cache, "/by-letter/X" );
+    FSCacheEntry_t *game = FSCache_get( cache, key );
+    ASSERT_EQ( 0, FSCache_addAll( cache, "/by-letter/X",
+                                  FSCacheEntry_createFromByLetter( "/by-letter/X", jsonObject ) ) );
+    json_object_put( jsonObject );
+
+    FSCacheEntry_t *refreshed = FSCache_get( cache, "/by-letter/X" );
+    ASSERT_EQ( byLetter, refreshed );
+    ASSERT_EQ( nentries, FSCache_getnentries( cache ) );
+    ASSERT_EQ( FSCACHEENTRY_DIR, _gettype( cache, key ) );
+
+    int found = 0;
+    for ( int i = 0 ; i < FSCacheEntry_getnfiles( refreshed ) ; i++ ) {
+        found |= FSCacheEntry_getfile( refreshed, i ) == game;
+    }
+    ASSERT_EQ( 1, found );
+
+    FSCacheEntry_free( refreshed );
+    FSCacheEntry_free( game );
+    FSCacheEntry_free( byLetter );
+
+    ASSERT_EQ( 0, FSCache_free( cache ) );
+}
+
+#define STRESS_NTHREADS     8
+#define STRESS_NITERATIONS  400
+#define STRESS_NGAMES       8
+
+static void *_stressThread( void *arg ) {
+
+    FSCache_t *cache = (FSCache_t *)arg;
+    unsigned int seed = (unsigned int)pthread_self();
+    char key[32];
+    char childkey[64];
+
+    for ( int i = 0 ; i < STRESS_NITERATIONS ; i++ ) {
+        sprintf( key, "/by-letter/X/g%d", rand_r( &seed ) % STRESS_NGAMES );
+        sprintf( childkey, "%s/SCRSHOT", key );
+
+        switch ( rand_r( &seed ) % 7 ) {
+            case 0: {
+                FSCache_addAll( cache, key, _createXevious( key ) );
+                break;
+            }
+            case 1: {
+                FSCache_delete( cache, key );
+                break;
+            }
+            case 2: {
+                FSCache_evict( cache, key );
+                break;
+            }
+            case 3: {
+                FSCacheEntry_t **files = NULL;
+                int nfiles = 0;
+                if ( FSCache_getfiles( cache, key, &files, &nfiles ) == 0 ) {
+                    for ( int j = 0 ; j < nfiles ; j++ ) {
+                        if ( strncmp( FSCacheEntry_getfname( files[j] ), key, strlen( key ) ) != 0 ) {
+                            return (void *)1;
+                        }
+                    }
+                    FSCache_releasefiles( files, nfiles );
+                }
+                break;
+            }
+            case 4: {
+                /** Lock-free walk, as readdir does */
+                Epoch_enter();
+                FSCacheEntry_t *fsCacheEntry = FSCache_lookup( cache, key );
+                int nfiles = 0;
+                FSCacheEntry_t **files = FSCacheEntry_getfilelist( fsCacheEntry, &nfiles );
+                for ( int j = 0 ; j < nfiles ; j++ ) {
+                    if ( strncmp( FSCacheEntry_getfname( files[j] ), key, strlen( key ) ) != 0 ) {
+                        Epoch_exit();
+                        return (void *)1;
+                    }
+                }
+                Epoch_exit();
+                break;
+            }
+            default: {
+                FSCacheEntry_t *fsCacheEntry = FSCache_get( cache, i & 1 ? key : childkey );
+                if ( fsCacheEntry != NULL ) {
+                    if ( FSCacheEntry_gettype( fsCacheEntry ) == FSCACHEENTRY_UNKNOWN ||
+                         FSCacheEntry_getfname( fsCacheEntry ) == NULL ) {
+                        return (void *)1;
+                    }
+                    FSCacheEntry_free( fsCacheEntry );
+                }
+                break;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+TEST(zxdbfs_fscache_tests, test_FSCache_stress) {
+
+    FSCache_t *cache = FSCache_create();
+    ASSERT_TRUE( NULL != cache );
+
+    /** Enough room for a few games so the CLOCK hand keeps evicting */
+    ASSERT_EQ( 0, FSCache_addAll( cache, "/g", _createXevious( "/g" ) ) );
+    size_t nbytes = FSCache_getnbytes( cache );
+    ASSERT_EQ( 0, FSCache_flush( cache ) );
+    ASSERT_EQ( 0, FSCache_setmaxbytes( cache, nbytes * 3 ) );
+
+    pthread_t threads[STRESS_NTHREADS];
+    for ( int i = 0 ; i < STRESS_NTHREADS ; i++ ) {
+        ASSERT_EQ( 0, pthread_create( &threads[i], NULL, _stressThread, cache ) );
+    }
+    for ( int i = 0 ; i < STRESS_NTHREADS ; i++ ) {
+        void *rv = NULL;
+        ASSERT_EQ( 0, pthread_join( threads[i], &rv ) );
+        ASSERT_TRUE( NULL == rv );
+    }
+
+    ASSERT_TRUE( FSCache_getnbytes( cache ) <= nbytes * 3 );
+
+    /** Accounting must balance once everything is deleted */
+    char key[32];
+    for ( int i = 0 ; i < STRESS_NGAMES ; i++ ) {
+        sprintf( key, "/by-letter/X/g%d", i );
+        FSCache_delete( cache, key );
+    }
+    ASSERT_EQ( 0, FSCache_getnentries( cache ) );
+    ASSERT_EQ( 0, FSCache_getnbytes( cache ) );
+    ASSERT_EQ( 0, cache->nunits );
+
+    ASSERT_EQ( 0, FSCache_free( cache ) );
+}
+
+#define STRESS_NURLS        32
+
+static void *_stressURLCacheThread( void *arg ) {
+
+    URLCache_t *cache = (URLCache_t *)arg;
+    unsigned int seed = (unsigned int)pthread_self();
+    char key[64];
+
+    for ( int i = 0 ; i < STRESS_NITERATIONS * 4 ; i++ ) {
+        int n = rand_r( &seed ) % STRESS_NURLS;
+        sprintf( key, "https://api.zxinfo.dk/v3/games/%07d", n );
+
+        switch ( rand_r( &seed ) % 16 ) {
+            case 0: {
+                URLCache_flush( cache );
+                break;
+            }
+            case 1: {
+                URLCache_delete( cache, key );
+                break;
+            }
+            case 2:
+            case 3:
+            case 4:
+            case 5: {
+                json_object *obj = json_object_new_int( n );
+                URLCache_add( cache, key, obj, 64 + n, 0 );
+                json_object_put( obj );
+                break;
+            }
+            default: {
+                json_object *obj = URLCache_get( cache, key, NULL );
+                if ( obj != NULL ) {
+                    if ( json_object_get_int( obj ) != n ) {
+                        return (void *)1;
+                    }
+                    json_object_put( obj );
+                }
+                break;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+TEST(zxdbfs_fscache_tests, test_URLCache_stress) {
+
+    /** Room for about a third of the responses, so 2Q keeps evicting */
+    URLCache_t *cache = URLCache_create( STRESS_NURLS * 32 );
+    ASSERT_TRUE( NULL != cache );
+
+    pthread_t threads[STRESS_NTHREADS];
+    for ( int i = 0 ; i < STRESS_NTHREADS ; i++ ) {
+        ASSERT_EQ( 0, pthread_create( &threads[i], NULL, _stressURLCacheThread, cache ) );
+    }
+    for ( int i = 0 ; i < STRESS_NTHREADS ; i++ ) {
+        void *rv = NULL;
+        ASSERT_EQ( 0, pthread_join( threads[i], &rv ) );
+        ASSERT_TRUE( NULL == rv );
+    }
+
+    ASSERT_TRUE( URLCache_getnbytes( cache ) <= cache->maxbytes );
+    ASSERT_TRUE( cache->nhits > 0 );
+    ASSERT_TRUE( cache->nevictions > 0 );
+
+    /** Accounting must balance once everything is deleted */
+    char key[64];
+    for ( int i = 0 ; i < STRESS_NURLS ; i++ ) {
+        sprintf( key, "https://api.zxinfo.dk/v3/games/%07d", i );
+        URLCache_delete( cache, key );
+    }
+    ASSERT_EQ( 0, URLCache_getnentries( cache ) );
+    ASSERT_EQ( 0, URLCache_getnbytes( cache ) );
+
+    ASSERT_EQ( 0, URLCache_free( cache ) );
+}
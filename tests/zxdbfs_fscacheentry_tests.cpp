@@ -21,7 +21,9 @@
 #include <gtest/gtest.h>
 
 extern "C" {
+#include <zxdbfs_epoch.h>
 #include <zxdbfs_fscacheentry.h>
+#include <zxdbfs_json.h>
 }
 
 TEST(zxdbfs_fscacheentry_tests, test_FSCacheEntry_create) {
@@ -86,3 +88,207 @@ TEST(zxdbfs_fscacheentry_tests, test_FSCacheEntry_isValidType) {
     ASSERT_EQ( 1, FSCacheEntry_isValidType( (FSCacheEntryType)10 ) );
 }
 
+TEST(zxdbfs_fscacheentry_tests, test_FSCacheEntry_addFile_file) {
+
+    FSCacheEntry_t *fileEntry = FSCacheEntry_create( "filename", FSCACHEENTRY_FILE, "https://testhost/testpath", 1234 );
+    ASSERT_TRUE( NULL != fileEntry );
+    FSCacheEntry_t *fileEntry2 = FSCacheEntry_create( "filename2", FSCACHEENTRY_FILE, "https://testhost/testpath2", 5678 );
+    ASSERT_TRUE( NULL != fileEntry2 );
+
+    /** Files can't contain files */
+    ASSERT_EQ( 1, FSCacheEntry_addFile( fileEntry, fileEntry2 ) );
+    ASSERT_EQ( 0, FSCacheEntry_getnfiles( fileEntry ) );
+    ASSERT_TRUE( NULL == FSCacheEntry_getfile( fileEntry, 0 ) );
+
+    FSCacheEntry_free( fileEntry );
+    FSCacheEntry_free( fileEntry2 );
+}
+
+TEST(zxdbfs_fscacheentry_tests, test_FSCacheEntry_addFile_many) {
+
+    FSCacheEntry_t *dirEntry = FSCacheEntry_create( "dirname", FSCACHEENTRY_DIR, NULL, 0 );
+    ASSERT_TRUE( NULL != dirEntry ); 
+
+    for ( int i = 0 ; i < 100 ; i++ ) {
+        char fname[64];
+        sprintf( fname, "dirname/file%d", i );
+        FSCacheEntry_t *fileEntry = FSCacheEntry_create( fname, FSCACHEENTRY_FILE, "https://testhost/testpath", i );
+        ASSERT_EQ( 0, FSCacheEntry_addFile( dirEntry, fileEntry ) );
+    }
+
+    ASSERT_EQ( 100, FSCacheEntry_getnfiles( dirEntry ) );
+    ASSERT_STREQ( "dirname/file57", FSCacheEntry_getfname( FSCacheEntry_getfile( dirEntry, 57 ) ) );
+    ASSERT_EQ( 57, FSCacheEntry_getsize( FSCacheEntry_getfile( dirEntry, 57 ) ) );
+    ASSERT_TRUE( NULL == FSCacheEntry_getfile( dirEntry, 100 ) );
+    ASSERT_TRUE( NULL == FSCacheEntry_getfile( dirEntry, -1 ) );
+
+    FSCacheEntry_free( dirEntry );
+}
+
+TEST(zxdbfs_fscacheentry_tests, test_FSCacheEntry_clone) {
+
+    ASSERT_TRUE( NULL == FSCacheEntry_clone( NULL ) );
+
+    FSCacheEntry_t *dirEntry = FSCacheEntry_create( "dirname", FSCACHEENTRY_DIR, NULL, 0 );
+    FSCacheEntry_t *fileEntry = FSCacheEntry_create( "dirname/filename", FSCACHEENTRY_FILE, "https://testhost/testpath", 1234 );
+    ASSERT_EQ( 0, FSCacheEntry_addFile( dirEntry, fileEntry ) );
+
+    FSCacheEntry_t *clone = FSCacheEntry_clone( dirEntry );
+    ASSERT_TRUE( NULL != clone );
+    ASSERT_TRUE( clone != dirEntry );
+    ASSERT_EQ( FSCACHEENTRY_DIR, FSCacheEntry_gettype( clone ) );
+    ASSERT_STREQ( "dirname", FSCacheEntry_getfname( clone ) );
+    ASSERT_EQ( 1, FSCacheEntry_getnfiles( clone ) );
+
+    FSCacheEntry_t *clonefile = FSCacheEntry_getfile( clone, 0 );
+    ASSERT_TRUE( clonefile != fileEntry );
+    ASSERT_STREQ( "https://testhost/testpath", FSCacheEntry_geturl( clonefile ) );
+    ASSERT_EQ( 1234, FSCacheEntry_getsize( clonefile ) );
+
+    /** The clone must survive the original going away */
+    FSCacheEntry_free( dirEntry );
+    ASSERT_STREQ( "dirname/filename", FSCacheEntry_getfname( clonefile ) );
+
+    FSCacheEntry_free( clone );
+}
+
+TEST(zxdbfs_fscacheentry_tests, test_FSCacheEntry_convertJSON) {
+
+    FSCacheEntry_t *dirEntry = FSCacheEntry_create( "dirname", FSCACHEENTRY_DIR, NULL, 0 );
+    ASSERT_EQ( 0, FSCacheEntry_addFile( dirEntry, FSCacheEntry_create( "dirname/filename", FSCACHEENTRY_FILE, "https://testhost/testpath", 1234 ) ) );
+    ASSERT_EQ( 0, FSCacheEntry_addFile( dirEntry, FSCacheEntry_create( "dirname/stub", FSCACHEENTRY_DIR_STUB, NULL, 0 ) ) );
+
+    json_object *obj = FSCacheEntry_convertToJSON( dirEntry );
+    ASSERT_TRUE( NULL != obj );
+    ASSERT_STREQ( "dir", json_object_get_string( json_object_object_get( obj, "type" ) ) );
+    ASSERT_EQ( 2, json_object_array_length( json_object_object_get( obj, "files" ) ) );
+
+    FSCacheEntry_t *newEntry = FSCacheEntry_convertFromJSON( obj );
+    json_object_put( obj );
+    ASSERT_TRUE( NULL != newEntry );
+    ASSERT_EQ( FSCACHEENTRY_DIR, FSCacheEntry_gettype( newEntry ) );
+    ASSERT_EQ( 2, FSCacheEntry_getnfiles( newEntry ) );
+    ASSERT_EQ( FSCACHEENTRY_FILE, FSCacheEntry_gettype( FSCacheEntry_getfile( newEntry, 0 ) ) );
+    ASSERT_EQ( 1234, FSCacheEntry_getsize( FSCacheEntry_getfile( newEntry, 0 ) ) );
+    ASSERT_EQ( FSCACHEENTRY_DIR_STUB, FSCacheEntry_gettype( FSCacheEntry_getfile( newEntry, 1 ) ) );
+
+    FSCacheEntry_free( newEntry );
+    FSCacheEntry_free( dirEntry );
+}
+
+TEST(zxdbfs_fscacheentry_tests, test_FSCacheEntry_ref) {
+
+    ASSERT_TRUE( NULL == FSCacheEntry_ref( NULL ) );
+
+    FSCacheEntry_t *dirEntry = FSCacheEntry_create( "dirname", FSCACHEENTRY_DIR, NULL, 0 );
+    FSCacheEntry_t *fileEntry = FSCacheEntry_create( "dirname/filename", FSCACHEENTRY_FILE, "https://testhost/testpath", 1234 );
+    ASSERT_EQ( 0, FSCacheEntry_addFile( dirEntry, FSCacheEntry_ref( fileEntry ) ) );
+    ASSERT_EQ( 2, fileEntry->refcount );
+
+    /** Dropping the directory leaves our reference on the file alive */
+    FSCacheEntry_free( dirEntry );
+    Epoch_synchronize();
+    ASSERT_EQ( 1, fileEntry->refcount );
+    ASSERT_STREQ( "dirname/filename", FSCacheEntry_getfname( fileEntry ) );
+
+    FSCacheEntry_free( fileEntry );
+}
+
+TEST(zxdbfs_fscacheentry_tests, test_FSCacheEntry_unstub) {
+
+    FSCacheEntry_t *stubEntry = FSCacheEntry_create( "dirname", FSCACHEENTRY_DIR_STUB, NULL, 0 );
+    FSCacheEntry_t *dirEntry = FSCacheEntry_create( "dirname", FSCACHEENTRY_DIR, NULL, 0 );
+    ASSERT_EQ( 0, FSCacheEntry_addFile( dirEntry, FSCacheEntry_create( "dirname/filename", FSCACHEENTRY_FILE, "https://testhost/testpath", 1234 ) ) );
+
+    ASSERT_EQ( 1, FSCacheEntry_unstub( NULL, dirEntry ) );
+    ASSERT_EQ( 1, FSCacheEntry_unstub( stubEntry, NULL ) );
+    ASSERT_EQ( 1, FSCacheEntry_unstub( dirEntry, stubEntry ) );
+
+    ASSERT_EQ( 0, FSCacheEntry_unstub( stubEntry, dirEntry ) );
+    ASSERT_EQ( FSCACHEENTRY_DIR, FSCacheEntry_gettype( stubEntry ) );
+    ASSERT_EQ( 1, FSCacheEntry_getnfiles( stubEntry ) );
+    ASSERT_EQ( 0, FSCacheEntry_getnfiles( dirEntry ) );
+
+    /** Can't unstub twice */
+    ASSERT_EQ( 1, FSCacheEntry_unstub( stubEntry, dirEntry ) );
+
+    FSCacheEntry_free( dirEntry );
+    FSCacheEntry_free( stubEntry );
+}
+
+TEST(zxdbfs_fscacheentry_tests, test_FSCacheEntry_refresh) {
+
+    FSCacheEntry_t *stubEntry = FSCacheEntry_create( "dirname", FSCACHEENTRY_DIR_STUB, NULL, 0 );
+    FSCacheEntry_t *dirEntry = FSCacheEntry_create( "dirname", FSCACHEENTRY_DIR, NULL, 0 );
+    ASSERT_EQ( 0, FSCacheEntry_addFile( dirEntry, FSCacheEntry_create( "dirname/filename", FSCACHEENTRY_FILE, "https://testhost/testpath", 1234 ) ) );
+    FSCacheEntry_setfetched( dirEntry, 1000, 60 );
+
+    FSCacheEntry_t *freshEntry = FSCacheEntry_create( "dirname", FSCACHEENTRY_DIR, NULL, 0 );
+    ASSERT_EQ( 0, FSCacheEntry_addFile( freshEntry, FSCacheEntry_create( "dirname/filename", FSCACHEENTRY_FILE, "https://testhost/testpath", 1234 ) ) );
+    ASSERT_EQ( 0, FSCacheEntry_addFile( freshEntry, FSCacheEntry_create( "dirname/filename2", FSCACHEENTRY_FILE, "https://testhost/testpath2", 5678 ) ) );
+    FSCacheEntry_setfetched( freshEntry, 2000, 60 );
+
+    ASSERT_EQ( 1, FSCacheEntry_refresh( NULL, freshEntry ) );
+    ASSERT_EQ( 1, FSCacheEntry_refresh( dirEntry, NULL ) );
+    ASSERT_EQ( 1, FSCacheEntry_refresh( stubEntry, freshEntry ) );
+
+    /** Never fetched entries are never stale */
+    ASSERT_EQ( 0, FSCacheEntry_isstale( stubEntry, 1000000 ) );
+    ASSERT_EQ( 0, FSCacheEntry_isstale( dirEntry, 1059 ) );
+    ASSERT_EQ( 1, FSCacheEntry_isstale( dirEntry, 1060 ) );
+    ASSERT_EQ( 1, FSCacheEntry_claimrefresh( dirEntry, 1060 ) );
+
+    /** A failed refresh is retried after a back off */
+    ASSERT_EQ( 0, FSCacheEntry_claimrefresh( dirEntry, 1060 + FSCACHEENTRY_REFRESH_RETRY - 1 ) );
+    ASSERT_EQ( 1, FSCacheEntry_claimrefresh( dirEntry, 1060 + FSCACHEENTRY_REFRESH_RETRY ) );
+
+    ASSERT_EQ( 0, FSCacheEntry_refresh( dirEntry, freshEntry ) );
+    ASSERT_EQ( 2, FSCacheEntry_getnfiles( dirEntry ) );
+    ASSERT_EQ( 0, FSCacheEntry_getnfiles( freshEntry ) );
+    ASSERT_EQ( 2000, dirEntry->fetched );
+    ASSERT_EQ( 0, FSCacheEntry_isstale( dirEntry, 2059 ) );
+    ASSERT_EQ( 1, FSCacheEntry_claimrefresh( dirEntry, 2060 ) );
+
+    FSCacheEntry_free( freshEntry );
+    FSCacheEntry_free( dirEntry );
+    FSCacheEntry_free( stubEntry );
+}
+
+TEST(zxdbfs_fscacheentry_tests, test_FSCacheEntry_getgeneration) {
+
+    ASSERT_EQ( 0, FSCacheEntry_getgeneration( NULL ) );
+
+    FSCacheEntry_t *stubEntry = FSCacheEntry_create( "dirname", FSCACHEENTRY_DIR_STUB, NULL, 0 );
+    FSCacheEntry_t *dirEntry = FSCacheEntry_create( "dirname", FSCACHEENTRY_DIR, NULL, 0 );
+    FSCacheEntry_t *freshEntry = FSCacheEntry_create( "dirname", FSCACHEENTRY_DIR, NULL, 0 );
+
+    /** Never shared, even between entries for the same path */
+    uint64_t generation = FSCacheEntry_getgeneration( stubEntry );
+    ASSERT_NE( 0, generation );
+    ASSERT_NE( generation, FSCacheEntry_getgeneration( dirEntry ) );
+    ASSERT_NE( FSCacheEntry_getgeneration( dirEntry ), FSCacheEntry_getgeneration( freshEntry ) );
+
+    generation = FSCacheEntry_getgeneration( dirEntry );
+    ASSERT_EQ( 0, FSCacheEntry_addFile( dirEntry, FSCacheEntry_create( "dirname/filename", FSCACHEENTRY_FILE, "https://testhost/testpath", 1234 ) ) );
+    ASSERT_NE( generation, FSCacheEntry_getgeneration( dirEntry ) );
+
+    generation = FSCacheEntry_getgeneration( stubEntry );
+    ASSERT_EQ( 0, FSCacheEntry_unstub( stubEntry, dirEntry ) );
+    ASSERT_NE( generation, FSCacheEntry_getgeneration( stubEntry ) );
+
+    generation = FSCacheEntry_getgeneration( stubEntry );
+    ASSERT_EQ( 0, FSCacheEntry_refresh( stubEntry, freshEntry ) );
+    ASSERT_NE( generation, FSCacheEntry_getgeneration( stubEntry ) );
+
+    /** Failures leave it alone */
+    generation = FSCacheEntry_getgeneration( stubEntry );
+    ASSERT_EQ( 1, FSCacheEntry_unstub( stubEntry, dirEntry ) );
+    ASSERT_EQ( generation, FSCacheEntry_getgeneration( stubEntry ) );
+
+    ASSERT_EQ( 0, FSCacheEntry_restub( stubEntry ) );
+    ASSERT_NE( generation, FSCacheEntry_getgeneration( stubEntry ) );
+
+    FSCacheEntry_free( freshEntry );
+    FSCacheEntry_free( dirEntry );
+    FSCacheEntry_free( stubEntry );
+}
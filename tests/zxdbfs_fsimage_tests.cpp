@@ -0,0 +1,187 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+
+extern "C" {
+#include <zxdbfs_byletter.h>
+#include <zxdbfs_epoch.h>
+#include <zxdbfs_fsimage.h>
+#include <zxdbfs_gameid.h>
+#include <zxdbfs_strpool.h>
+}
+
+#define IMAGE_PATH "/tmp/zxdbfs_fsimage_tests.img"
+
+/**
+ * Images pool their strings for good, so these tests use paths that no
+ * other test counts in the string pool
+ */
+static FSCache_t *_createCache() {
+
+    FSCache_t *cache = FSCache_create();
+
+    {
+#include <testdata/by-letter-X.h>
+        json_object *jsonObject = json_tokener_parse( jsonData );
+        FSCache_addAll( cache, "/image/X",
+                        FSCacheEntry_createFromByLetter( "/image/X", jsonObject ) );
+        json_object_put( jsonObject );
+    }
+    {
+#include <testdata/zxdb-games-0005795.h>
+        json_object *jsonObject = json_tokener_parse( jsonData );
+        FSCache_addAll( cache, "/image/X/Xevious_0005795",
+                        FSCacheEntry_createFromGame( "/image/X/Xevious_0005795", jsonObject ) );
+        json_object_put( jsonObject );
+    }
+
+    return cache;
+}
+
+static int _isStatic( const char *str ) {
+
+    const StringPoolEntry_t *entry = (const StringPoolEntry_t *)
+        ( str - offsetof( StringPoolEntry_t, str ) );
+
+    return entry->refcount == STRPOOL_REFCOUNT_STATIC;
+}
+
+TEST(zxdbfs_fsimage_tests, test_FSImage_roundtrip) {
+
+    FSCache_t *cache = _createCache();
+    ASSERT_TRUE( NULL != cache );
+    ASSERT_EQ( 1, FSImage_save( NULL, IMAGE_PATH ) );
+    ASSERT_EQ( 1, FSImage_save( cache, NULL ) );
+    ASSERT_EQ( 0, FSImage_save( cache, IMAGE_PATH ) );
+
+    int nentries = FSCache_getnentries( cache );
+    FSCacheEntry_t *original = FSCache_get( cache, "/image/X/Xevious_0005795" );
+    time_t fetched = original->fetched;
+    int ttl = original->ttl;
+    unsigned int flags = original->flags;
+    FSCacheEntry_free( original );
+
+    /** Drop the originals so that the image's names aren't already pooled */
+    ASSERT_EQ( 0, FSCache_free( cache ) );
+    Epoch_synchronize();
+
+    FSCache_t *loaded = FSCache_create();
+    ASSERT_EQ( 1, FSImage_load( NULL, IMAGE_PATH ) );
+    ASSERT_EQ( 0, FSImage_load( loaded, IMAGE_PATH ) );
+
+    ASSERT_EQ( nentries, FSCache_getnentries( loaded ) );
+    ASSERT_EQ( 1, loaded->nunits );
+
+    /** The listing and the index share the loaded game */
+    FSCacheEntry_t *byLetter = FSCache_get( loaded, "/image/X" );
+    FSCacheEntry_t *game = FSCache_get( loaded, "/image/X/Xevious_0005795" );
+    ASSERT_TRUE( NULL != byLetter );
+    ASSERT_TRUE( NULL != game );
+    ASSERT_EQ( FSCACHEENTRY_DIR, FSCacheEntry_gettype( game ) );
+    int found = 0;
+    for ( int i = 0 ; i < FSCacheEntry_getnfiles( byLetter ) ; i++ ) {
+        found |= FSCacheEntry_getfile( byLetter, i ) == game;
+    }
+    ASSERT_EQ( 1, found );
+
+    /** Names come straight from the mapped image */
+    ASSERT_TRUE( _isStatic( FSCacheEntry_getfname( game ) ) );
+
+    /** Contents and timestamps survive */
+    ASSERT_EQ( fetched, game->fetched );
+    ASSERT_EQ( ttl, game->ttl );
+    ASSERT_EQ( flags, game->flags );
+    cache = _createCache();
+    original = FSCache_get( cache, "/image/X/Xevious_0005795" );
+    ASSERT_EQ( FSCacheEntry_getnfiles( original ), FSCacheEntry_getnfiles( game ) );
+    for ( int i = 0 ; i < FSCacheEntry_getnfiles( game ) ; i++ ) {
+        FSCacheEntry_t *a = FSCacheEntry_getfile( original, i );
+        FSCacheEntry_t *b = FSCacheEntry_getfile( game, i );
+        ASSERT_STREQ( FSCacheEntry_getfname( a ), FSCacheEntry_getfname( b ) );
+        ASSERT_EQ( FSCacheEntry_gettype( a ), FSCacheEntry_gettype( b ) );
+        ASSERT_EQ( FSCacheEntry_getsize( a ), FSCacheEntry_getsize( b ) );
+        if ( FSCacheEntry_geturl( a ) != NULL ) {
+            ASSERT_STREQ( FSCacheEntry_geturl( a ), FSCacheEntry_geturl( b ) );
+        }
+    }
+    FSCacheEntry_free( original );
+
+    /** Loaded entries can be changed like any other */
+    ASSERT_EQ( 0, FSCache_evict( loaded, "/image/X/Xevious_0005795" ) );
+    ASSERT_EQ( FSCACHEENTRY_DIR_STUB, FSCacheEntry_gettype( game ) );
+    ASSERT_EQ( 0, loaded->nunits );
+
+    FSCacheEntry_free( game );
+    FSCacheEntry_free( byLetter );
+
+    ASSERT_EQ( 0, FSCache_free( loaded ) );
+    ASSERT_EQ( 0, FSCache_free( cache ) );
+    unlink( IMAGE_PATH );
+}
+
+TEST(zxdbfs_fsimage_tests, test_FSImage_invalid) {
+
+    FSCache_t *cache = _createCache();
+    ASSERT_EQ( 0, FSImage_save( cache, IMAGE_PATH ) );
+    ASSERT_EQ( 0, FSCache_free( cache ) );
+
+    FILE *f = fopen( IMAGE_PATH, "rb" );
+    ASSERT_TRUE( NULL != f );
+    fseek( f, 0, SEEK_END );
+    long size = ftell( f );
+    fseek( f, 0, SEEK_SET );
+    char *image = (char *)malloc( size );
+    ASSERT_EQ( size, (long)fread( image, 1, size, f ) );
+    fclose( f );
+
+    cache = FSCache_create();
+    ASSERT_EQ( 2, FSImage_load( cache, "/tmp/zxdbfs_fsimage_tests.missing" ) );
+
+    /** Truncated */
+    f = fopen( IMAGE_PATH, "wb" );
+    fwrite( image, 1, size - 1, f );
+    fclose( f );
+    ASSERT_EQ( 1, FSImage_load( cache, IMAGE_PATH ) );
+
+    /** Another version */
+    FSImageHeader_t *header = (FSImageHeader_t *)image;
+    header->version++;
+    f = fopen( IMAGE_PATH, "wb" );
+    fwrite( image, 1, size, f );
+    fclose( f );
+    ASSERT_EQ( 1, FSImage_load( cache, IMAGE_PATH ) );
+    header->version--;
+
+    /** A child pointing back at its parent */
+    uint32_t *children = (uint32_t *)( image + header->children );
+    children[0] = 0;
+    f = fopen( IMAGE_PATH, "wb" );
+    fwrite( image, 1, size, f );
+    fclose( f );
+    ASSERT_EQ( 1, FSImage_load( cache, IMAGE_PATH ) );
+
+    ASSERT_EQ( 0, FSCache_getnentries( cache ) );
+    ASSERT_EQ( 0, FSCache_free( cache ) );
+    free( image );
+    unlink( IMAGE_PATH );
+}
@@ -20,6 +20,8 @@
 
 #include <gtest/gtest.h>
 
+#include <utime.h>
+
 extern "C" {
 #include <zxdbfs_fscache.h>
 #include <zxdbfs_http.h>
@@ -31,19 +33,49 @@ extern "C" {
 TEST(zxdbfs_http_tests, test_getURL_error) {
 
     /** Bad parameters */
-    json_object *rv0 = getURL( NULL, NULL, NULL, NULL );
+    json_object *rv0 = getURL( NULL, NULL, NULL, NULL, 0 );
     ASSERT_TRUE( NULL == rv0 );
 
-    json_object *rv1 = getURL( NULL, "file://", NULL, NULL );
+    json_object *rv1 = getURL( NULL, "file://", NULL, NULL, 0 );
     ASSERT_TRUE( NULL == rv1 );
 
-    json_object *rv2 = getURL( NULL, NULL, "/path", NULL );
+    json_object *rv2 = getURL( NULL, NULL, "/path", NULL, 0 );
     ASSERT_TRUE( NULL == rv2 );
 
     /** File not found */
-    json_object *rv3 = getURL( NULL, "file://", "/tmp/doesnotexist.json", NULL );
+    json_object *rv3 = getURL( NULL, "file://", "/tmp/doesnotexist.json", NULL, 0 );
     ASSERT_TRUE( NULL == rv3 );
+    ASSERT_EQ( 404, HTTP_getlastcode() );
 
+    /** Nothing listening, which is a failure rather than a missing URL */
+    json_object *rv4 = getURL( NULL, "http://127.0.0.1:1", "/game.json", NULL, 0 );
+    ASSERT_TRUE( NULL == rv4 );
+    ASSERT_EQ( -1, HTTP_getlastcode() );
+}
+
+TEST(zxdbfs_http_tests, test_getURL_parse) {
+
+    int pid = getpid();
+    char fname[128];
+    sprintf( fname, "/tmp/%d.json", pid );
+
+    /** A body cut short fails rather than giving a partial object */
+    ASSERT_EQ( 0, createTestFile( fname, "{\"id\":\"0005" ) );
+    ASSERT_TRUE( NULL == getURL( NULL, "file://", fname, NULL, 0 ) );
+
+    /** As does anything that isn't JSON */
+    ASSERT_EQ( 0, createTestFile( fname, "<html></html>" ) );
+    ASSERT_TRUE( NULL == getURL( NULL, "file://", fname, NULL, 0 ) );
+
+    /** The end of the body ends a bare value */
+    ASSERT_EQ( 0, createTestFile( fname, "5795" ) );
+    json_object *rv0 = getURL( NULL, "file://", fname, NULL, 0 );
+    ASSERT_TRUE( NULL != rv0 );
+    ASSERT_EQ( 5795, json_object_get_int( rv0 ) );
+    ASSERT_EQ( 0, HTTP_getlastcode() );
+    json_object_put( rv0 );
+
+    ASSERT_EQ( 0, unlinkTestFile( fname ) );
 }
 
 TEST(zxdbfs_http_tests, test_getURL_uncached) {
@@ -57,7 +89,7 @@ TEST(zxdbfs_http_tests, test_getURL_uncached) {
     int rv = createTestFile( fname, jsonData ); 
     ASSERT_EQ( 0, rv );
 
-    json_object *rv0 = getURL( NULL, "file://", fname, NULL );
+    json_object *rv0 = getURL( NULL, "file://", fname, NULL, 0 );
     ASSERT_TRUE( NULL != rv0 );
 
     ASSERT_EQ( 0, unlinkTestFile( fname ) );
@@ -69,8 +101,8 @@ TEST(zxdbfs_http_tests, test_getURL_cached) {
 
 #include <testdata/zxdb-games-0005795.h>
 
-    json_object *urlcache = json_object_new_object();
-    ASSERT_EQ( 0, json_object_object_length( urlcache ) );
+    URLCache_t *urlcache = URLCache_create( 0 );
+    ASSERT_EQ( 0, URLCache_getnentries( urlcache ) );
 
     int pid = getpid();
     char fname[128];
@@ -79,19 +111,160 @@ TEST(zxdbfs_http_tests, test_getURL_cached) {
     int rv = createTestFile( fname, jsonData ); 
     ASSERT_EQ( 0, rv );
 
-    json_object *rv0 = getURL( urlcache, "file://", fname, NULL );
+    json_object *rv0 = getURL( urlcache, "file://", fname, NULL, 0 );
     ASSERT_TRUE( NULL != rv0 );
     json_object_put( rv0 );
 
     ASSERT_EQ( 0, unlinkTestFile( fname ) );
 
     /** Should have one entry in the URL cache... */
-    ASSERT_EQ( 1, json_object_object_length( urlcache ) );
+    ASSERT_EQ( 1, URLCache_getnentries( urlcache ) );
 
     /** Refetch from the cache */
-    json_object *cachedata = getURL( urlcache, "file://", fname, NULL );
+    json_object *cachedata = getURL( urlcache, "file://", fname, NULL, 0 );
     ASSERT_TRUE( NULL != cachedata );
     json_object_put( cachedata );
+    ASSERT_EQ( 1, urlcache->nhits );
+
+    URLCache_free( urlcache );
+}
+
+TEST(zxdbfs_http_tests, test_getURL_stale) {
+
+#include <testdata/zxdb-games-0005795.h>
+
+    URLCache_t *urlcache = URLCache_create( 0 );
+
+    int pid = getpid();
+    char fname[128];
+    sprintf( fname, "/tmp/%d.json", pid );
+    char cachekey[256];
+    sprintf( cachekey, "file://%s", fname );
+
+    ASSERT_EQ( 0, createTestFile( fname, jsonData ) );
+    struct utimbuf times = { time( NULL ) - 3600, time( NULL ) - 3600 };
+    ASSERT_EQ( 0, utime( fname, &times ) );
+    json_object *rv0 = getURL( urlcache, "file://", fname, NULL, 60 );
+    ASSERT_TRUE( NULL != rv0 );
+    ASSERT_EQ( 0, unlinkTestFile( fname ) );
+
+    /** Expire the response. With the source gone, it is served stale */
+    URLCacheEntry_t *entry =
+        (URLCacheEntry_t *)lh_entry_v( lh_table_lookup_entry( urlcache->cache, cachekey ) );
+    entry->fetched -= 61;
+
+    json_object *rv1 = getURL( urlcache, "file://", fname, NULL, 60 );
+    ASSERT_EQ( rv0, rv1 );
+    ASSERT_EQ( 1, urlcache->nstale );
+    json_object_put( rv1 );
+
+    /** Once the source is back, changed, the response is refetched */
+    ASSERT_EQ( 0, createTestFile( fname, jsonData ) );
+    json_object *rv2 = getURL( urlcache, "file://", fname, NULL, 60 );
+    ASSERT_TRUE( NULL != rv2 );
+    ASSERT_NE( rv0, rv2 );
+    ASSERT_EQ( 0, unlinkTestFile( fname ) );
+    json_object_put( rv2 );
+
+    int stale = -1;
+    json_object *rv3 = URLCache_get( urlcache, cachekey, &stale );
+    ASSERT_EQ( 0, stale );
+    json_object_put( rv3 );
+
+    json_object_put( rv0 );
+    URLCache_free( urlcache );
+}
+
+TEST(zxdbfs_http_tests, test_getURL_revalidate) {
+
+#include <testdata/zxdb-games-0005795.h>
+
+    URLCache_t *urlcache = URLCache_create( 0 );
+
+    int pid = getpid();
+    char fname[128];
+    sprintf( fname, "/tmp/%d.json", pid );
+    char cachekey[256];
+    sprintf( cachekey, "file://%s", fname );
+
+    /** Backdate the source so its modification time is settled */
+    ASSERT_EQ( 0, createTestFile( fname, jsonData ) );
+    struct utimbuf times = { time( NULL ) - 3600, time( NULL ) - 3600 };
+    ASSERT_EQ( 0, utime( fname, &times ) );
+
+    json_object *rv0 = getURL( urlcache, "file://", fname, NULL, 60 );
+    ASSERT_TRUE( NULL != rv0 );
+
+    char etag[HTTP_ETAG_SIZE];
+    time_t lastmodified = 0;
+    ASSERT_EQ( 0, URLCache_getvalidators( urlcache, cachekey, etag, sizeof( etag ), &lastmodified ) );
+    ASSERT_EQ( times.modtime, lastmodified );
+
+    /** Once expired, an unchanged source is revalidated rather than refetched */
+    URLCacheEntry_t *entry =
+        (URLCacheEntry_t *)lh_entry_v( lh_table_lookup_entry( urlcache->cache, cachekey ) );
+    entry->fetched -= 61;
+
+    unsigned long nmodified0, nnotmodified0;
+    HTTP_getstats( &nmodified0, &nnotmodified0 );
+
+    json_object *rv1 = getURL( urlcache, "file://", fname, NULL, 60 );
+    ASSERT_EQ( rv0, rv1 );
+    ASSERT_EQ( 1, urlcache->nrevalidated );
+    json_object_put( rv1 );
+
+    unsigned long nmodified1, nnotmodified1;
+    HTTP_getstats( &nmodified1, &nnotmodified1 );
+    ASSERT_EQ( nmodified0, nmodified1 );
+    ASSERT_EQ( nnotmodified0 + 1, nnotmodified1 );
 
-    json_object_put( urlcache );
+    int stale = -1;
+    rv1 = URLCache_get( urlcache, cachekey, &stale );
+    ASSERT_EQ( 0, stale );
+    json_object_put( rv1 );
+
+    /** A changed source is fetched again */
+    times.modtime += 60;
+    ASSERT_EQ( 0, utime( fname, &times ) );
+    entry->fetched -= 61;
+    json_object *rv2 = getURL( urlcache, "file://", fname, NULL, 60 );
+    ASSERT_TRUE( NULL != rv2 );
+    ASSERT_NE( rv0, rv2 );
+    ASSERT_EQ( 1, urlcache->nrevalidated );
+    json_object_put( rv2 );
+
+    HTTP_getstats( &nmodified1, NULL );
+    ASSERT_EQ( nmodified0 + 1, nmodified1 );
+
+    ASSERT_EQ( 0, unlinkTestFile( fname ) );
+    json_object_put( rv0 );
+    URLCache_free( urlcache );
+}
+
+TEST(zxdbfs_http_tests, test_getURLRange) {
+
+    /** Bad parameters */
+    ASSERT_TRUE( NULL == getURLRangeViacURL( NULL, "/path", NULL, 0, 10 ) );
+    ASSERT_TRUE( NULL == getURLRangeViacURL( "file://", "/path", NULL, -1, 10 ) );
+    ASSERT_TRUE( NULL == getURLRangeViacURL( "file://", "/path", NULL, 0, 0 ) );
+
+    int pid = getpid();
+    char fname[128];
+    sprintf( fname, "/tmp/%d.json", pid );
+    ASSERT_EQ( 0, createTestFile( fname, "0123456789" ) );
+
+    struct MemoryStruct *chunk = getURLRangeViacURL( "file://", fname, NULL, 2, 4 );
+    ASSERT_TRUE( NULL != chunk );
+    ASSERT_EQ( 4, chunk->size );
+    ASSERT_EQ( 0, memcmp( "2345", chunk->memory, 4 ) );
+    HTTP_freechunk( chunk );
+
+    /** Short at the end of the file */
+    chunk = getURLRangeViacURL( "file://", fname, NULL, 8, 4 );
+    ASSERT_TRUE( NULL != chunk );
+    ASSERT_EQ( 2, chunk->size );
+    HTTP_freechunk( chunk );
+
+    ASSERT_EQ( 0, unlinkTestFile( fname ) );
+    ASSERT_TRUE( NULL == getURLRangeViacURL( "file://", fname, NULL, 0, 4 ) );
 }
@@ -0,0 +1,167 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <zxdbfs_inode.h>
+#include <zxdbfs_strpool.h>
+}
+
+TEST(zxdbfs_inode_tests, test_Inode_fromGameID) {
+
+    ASSERT_EQ( ( 2258ULL << INODE_GAME_SHIFT ), Inode_fromGameID( "0002258", 0 ) );
+    ASSERT_EQ( ( 2258ULL << INODE_GAME_SHIFT ) | 0x0102, Inode_fromGameID( "0002258", 0x0102 ) );
+
+    ASSERT_EQ( 0, Inode_fromGameID( NULL, 0 ) );
+    ASSERT_EQ( 0, Inode_fromGameID( "", 0 ) );
+    ASSERT_EQ( 0, Inode_fromGameID( "0000000", 0 ) );
+    ASSERT_EQ( 0, Inode_fromGameID( "00a2258", 0 ) );
+    ASSERT_EQ( 0, Inode_fromGameID( "0002258", INODE_GAME_MAX_SLOT + 1 ) );
+}
+
+TEST(zxdbfs_inode_tests, test_InodeTable_lookup) {
+
+    InodeTable_t *table = InodeTable_create();
+    ASSERT_TRUE( NULL != table );
+    ASSERT_EQ( 1, InodeTable_getnentries( table ) );
+
+    const char *path = InodeTable_getpath( table, INODE_ROOT );
+    ASSERT_STREQ( "/", path );
+    StringPool_release( path );
+
+    ASSERT_EQ( 0, InodeTable_lookup( NULL, "/by-letter", 2 ) );
+    ASSERT_EQ( 0, InodeTable_lookup( table, NULL, 2 ) );
+
+    /** Stable numbers are used when free, dynamic ones otherwise */
+    uint64_t game = Inode_fromGameID( "0002258", 0 );
+    ASSERT_EQ( game, InodeTable_lookup( table, "/by-letter/M/Manic Miner_0002258", game ) );
+    ASSERT_EQ( game, InodeTable_lookup( table, "/by-letter/M/Manic Miner_0002258", 0 ) );
+    ASSERT_EQ( INODE_DYNAMIC_BASE, InodeTable_lookup( table, "/search/manic/Manic Miner_0002258", game ) );
+    ASSERT_EQ( INODE_DYNAMIC_BASE + 1, InodeTable_lookup( table, "/search/manic", 0 ) );
+    ASSERT_EQ( 4, InodeTable_getnentries( table ) );
+
+    path = InodeTable_getpath( table, INODE_DYNAMIC_BASE );
+    ASSERT_STREQ( "/search/manic/Manic Miner_0002258", path );
+    StringPool_release( path );
+    ASSERT_TRUE( NULL == InodeTable_getpath( table, 12345 ) );
+    ASSERT_TRUE( NULL == InodeTable_getpath( table, 0 ) );
+
+    ASSERT_EQ( 1, InodeTable_free( NULL ) );
+    ASSERT_EQ( 0, InodeTable_free( table ) );
+}
+
+TEST(zxdbfs_inode_tests, test_InodeTable_forget) {
+
+    InodeTable_t *table = InodeTable_create();
+    ASSERT_TRUE( NULL != table );
+
+    uint64_t game = Inode_fromGameID( "0002258", 0 );
+    ASSERT_EQ( game, InodeTable_lookup( table, "/by-letter/M/Manic Miner_0002258", game ) );
+    ASSERT_EQ( game, InodeTable_lookup( table, "/by-letter/M/Manic Miner_0002258", game ) );
+    ASSERT_EQ( game, InodeTable_lookup( table, "/by-letter/M/Manic Miner_0002258", game ) );
+
+    ASSERT_EQ( 1, InodeTable_forget( NULL, game, 1 ) );
+    ASSERT_EQ( 2, InodeTable_forget( table, 12345, 1 ) );
+
+    /** Still there until every lookup is forgotten */
+    ASSERT_EQ( 0, InodeTable_forget( table, game, 2 ) );
+    ASSERT_EQ( 2, InodeTable_getnentries( table ) );
+    ASSERT_EQ( 0, InodeTable_forget( table, game, 1 ) );
+    ASSERT_EQ( 1, InodeTable_getnentries( table ) );
+    ASSERT_TRUE( NULL == InodeTable_getpath( table, game ) );
+    ASSERT_EQ( 2, InodeTable_forget( table, game, 1 ) );
+
+    /** The root stays */
+    ASSERT_EQ( 0, InodeTable_forget( table, INODE_ROOT, 1 ) );
+    ASSERT_EQ( 1, InodeTable_getnentries( table ) );
+
+    /** A forgotten number can be handed out again */
+    ASSERT_EQ( game, InodeTable_lookup( table, "/by-letter/M/Manic Miner_0002258", game ) );
+
+    ASSERT_EQ( 0, InodeTable_free( table ) );
+}
+
+TEST(zxdbfs_inode_tests, test_InodeTable_setgeneration) {
+
+    InodeTable_t *table = InodeTable_create();
+    ASSERT_TRUE( NULL != table );
+
+    uint64_t ino = InodeTable_lookup( table, "/by-letter/M", 0 );
+    ASSERT_NE( 0, ino );
+
+    ASSERT_EQ( 0, InodeTable_setgeneration( NULL, ino, 5 ) );
+    ASSERT_EQ( 0, InodeTable_setgeneration( table, 12345, 5 ) );
+
+    ASSERT_EQ( 0, InodeTable_setgeneration( table, ino, 5 ) );
+    ASSERT_EQ( 5, InodeTable_setgeneration( table, ino, 5 ) );
+    ASSERT_EQ( 5, InodeTable_setgeneration( table, ino, 7 ) );
+
+    /** Forgotten along with the inode */
+    ASSERT_EQ( 0, InodeTable_forget( table, ino, 1 ) );
+    ASSERT_EQ( ino, InodeTable_lookup( table, "/by-letter/M", ino ) );
+    ASSERT_EQ( 0, InodeTable_setgeneration( table, ino, 7 ) );
+
+    ASSERT_EQ( 0, InodeTable_free( table ) );
+}
+
+static void _collect( uint64_t ino, const char *path, void *arg ) {
+
+    std::vector<std::string> *paths = (std::vector<std::string> *)arg;
+    paths->push_back( path );
+}
+
+TEST(zxdbfs_inode_tests, test_InodeTable_foreach) {
+
+    InodeTable_t *table = InodeTable_create();
+    ASSERT_TRUE( NULL != table );
+
+    ASSERT_NE( 0, InodeTable_lookup( table, "/by-letter", 2 ) );
+    ASSERT_NE( 0, InodeTable_lookup( table, "/by-letter/M", 0 ) );
+    ASSERT_NE( 0, InodeTable_lookup( table, "/by-letter/M/Manic Miner_0003012", 0 ) );
+    ASSERT_NE( 0, InodeTable_lookup( table, "/by-letter/M/Manic Miner_0003012/POKES", 0 ) );
+    ASSERT_NE( 0, InodeTable_lookup( table, "/by-letter/MX", 0 ) );
+
+    ASSERT_EQ( 2, InodeTable_getino( table, "/by-letter" ) );
+    ASSERT_EQ( 0, InodeTable_getino( table, "/search" ) );
+    ASSERT_EQ( 0, InodeTable_getino( NULL, "/by-letter" ) );
+
+    std::vector<std::string> paths;
+    ASSERT_EQ( 1, InodeTable_foreach( NULL, "/", _collect, &paths ) );
+    ASSERT_EQ( 1, InodeTable_foreach( table, NULL, _collect, &paths ) );
+    ASSERT_EQ( 1, InodeTable_foreach( table, "/", NULL, &paths ) );
+
+    ASSERT_EQ( 0, InodeTable_foreach( table, "/by-letter/M", _collect, &paths ) );
+    std::sort( paths.begin(), paths.end() );
+    ASSERT_EQ( 3, paths.size() );
+    ASSERT_EQ( "/by-letter/M", paths[0] );
+    ASSERT_EQ( "/by-letter/M/Manic Miner_0003012", paths[1] );
+    ASSERT_EQ( "/by-letter/M/Manic Miner_0003012/POKES", paths[2] );
+
+    paths.clear();
+    ASSERT_EQ( 0, InodeTable_foreach( table, "/", _collect, &paths ) );
+    ASSERT_EQ( 6, paths.size() );
+
+    ASSERT_EQ( 0, InodeTable_free( table ) );
+}
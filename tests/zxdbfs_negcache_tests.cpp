@@ -0,0 +1,108 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include <zxdbfs_negcache.h>
+#include <zxdbfs_strpool.h>
+}
+
+TEST(zxdbfs_negcache_tests, test_NegCache_create) {
+
+    ASSERT_TRUE( NULL == NegCache_create( -1, 0 ) );
+    ASSERT_TRUE( NULL == NegCache_create( 0, -1 ) );
+
+    NegCache_t *cache = NegCache_create( 0, 0 );
+    ASSERT_TRUE( NULL != cache );
+    ASSERT_EQ( NEGCACHE_DEFAULT_MAX_ENTRIES, cache->maxentries );
+    ASSERT_EQ( NEGCACHE_DEFAULT_TTL, cache->ttl );
+    ASSERT_EQ( 0, NegCache_getnentries( cache ) );
+
+    ASSERT_EQ( 1, NegCache_setttl( cache, 0 ) );
+    ASSERT_EQ( 0, NegCache_setttl( cache, 10 ) );
+    ASSERT_EQ( 10, cache->ttl );
+
+    ASSERT_EQ( 1, NegCache_free( NULL ) );
+    ASSERT_EQ( 0, NegCache_free( cache ) );
+}
+
+TEST(zxdbfs_negcache_tests, test_NegCache_add) {
+
+    NegCache_t *cache = NegCache_create( 0, 10 );
+    ASSERT_TRUE( NULL != cache );
+
+    ASSERT_EQ( 1, NegCache_add( NULL, "/by-letter/X/.git", 1000 ) );
+    ASSERT_EQ( 1, NegCache_add( cache, NULL, 1000 ) );
+    ASSERT_EQ( 0, NegCache_contains( cache, NULL, 1000 ) );
+
+    ASSERT_EQ( 0, NegCache_contains( cache, "/by-letter/X/.git", 1000 ) );
+    ASSERT_EQ( 0, NegCache_add( cache, "/by-letter/X/.git", 1000 ) );
+    ASSERT_EQ( 1, NegCache_contains( cache, "/by-letter/X/.git", 1009 ) );
+    ASSERT_EQ( 0, NegCache_contains( cache, "/by-letter/X/autorun.inf", 1009 ) );
+    ASSERT_EQ( 1, cache->nhits );
+    ASSERT_EQ( 2, cache->nmisses );
+
+    /** Re-adding extends the lifetime */
+    ASSERT_EQ( 0, NegCache_add( cache, "/by-letter/X/.git", 1005 ) );
+    ASSERT_EQ( 1, NegCache_getnentries( cache ) );
+    ASSERT_EQ( 1, NegCache_contains( cache, "/by-letter/X/.git", 1014 ) );
+
+    /** Expired paths are forgotten */
+    ASSERT_EQ( 0, NegCache_contains( cache, "/by-letter/X/.git", 1015 ) );
+    ASSERT_EQ( 0, NegCache_getnentries( cache ) );
+
+    ASSERT_EQ( 0, NegCache_add( cache, "/by-letter/X/.git", 1000 ) );
+    ASSERT_EQ( 2, NegCache_delete( cache, "/by-letter/X/.hidden" ) );
+    ASSERT_EQ( 0, NegCache_delete( cache, "/by-letter/X/.git" ) );
+    ASSERT_EQ( 0, NegCache_contains( cache, "/by-letter/X/.git", 1000 ) );
+
+    ASSERT_EQ( 0, NegCache_free( cache ) );
+}
+
+TEST(zxdbfs_negcache_tests, test_NegCache_bounded) {
+
+    int nentries = StringPool_getnentries();
+
+    NegCache_t *cache = NegCache_create( 4, 10 );
+    ASSERT_TRUE( NULL != cache );
+
+    char path[64];
+    for ( int i = 0 ; i < 8 ; i++ ) {
+        sprintf( path, "/by-letter/X/Missing_%07d", i );
+        ASSERT_EQ( 0, NegCache_add( cache, path, 1000 ) );
+    }
+    ASSERT_EQ( 4, NegCache_getnentries( cache ) );
+
+    /** Oldest go first */
+    ASSERT_EQ( 0, NegCache_contains( cache, "/by-letter/X/Missing_0000003", 1000 ) );
+    ASSERT_EQ( 1, NegCache_contains( cache, "/by-letter/X/Missing_0000004", 1000 ) );
+
+    /** Expired entries make room before live ones are dropped */
+    ASSERT_EQ( 0, NegCache_add( cache, "/by-letter/X/.git", 1010 ) );
+    ASSERT_EQ( 1, NegCache_getnentries( cache ) );
+
+    ASSERT_EQ( 0, NegCache_flush( cache ) );
+    ASSERT_EQ( 0, NegCache_getnentries( cache ) );
+    ASSERT_EQ( 0, NegCache_contains( cache, "/by-letter/X/.git", 1010 ) );
+
+    ASSERT_EQ( 0, NegCache_free( cache ) );
+    ASSERT_EQ( nentries, StringPool_getnentries() );
+}
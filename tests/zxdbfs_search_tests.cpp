@@ -282,7 +282,7 @@ TEST(zxdbfs_gameid_tests, test_getAndCreateGame) {
 #include <testdata/zxdb-games-0005795.h>
 
     const char *path0 = "";
-    FSCacheEntry_t *rv0 = FSCacheEntry_getAndCreateGame( NULL, "/path0", "file://", path0, 0 );
+    FSCacheEntry_t *rv0 = FSCacheEntry_getAndCreateGame( NULL, "/path0", "file://", path0, 0, 0 );
     ASSERT_TRUE( NULL == rv0 );
 
     /** Copy the JSON data to /tmp */
@@ -295,14 +295,14 @@ TEST(zxdbfs_gameid_tests, test_getAndCreateGame) {
 
     /** Test with the direct path */
     const char *path1 = "/by-letter/X/Xevious_0005795";
-    FSCacheEntry_t *rv1 = FSCacheEntry_getAndCreateGame( NULL, path1, "file://", fname, 0 );
+    FSCacheEntry_t *rv1 = FSCacheEntry_getAndCreateGame( NULL, path1, "file://", fname, 0, 0 );
     ASSERT_TRUE( NULL != rv1 );
     ASSERT_STREQ( path1, rv1->fname );
     FSCacheEntry_free( rv1 );
 
     /** Test with a subdir path -- should equal the direct path */
     const char *path2 = "/by-letter/X/Xevious_0005795/POKES/poke1.pok";
-    FSCacheEntry_t *rv2 = FSCacheEntry_getAndCreateGame( NULL, path2, "file://", fname, 0 );
+    FSCacheEntry_t *rv2 = FSCacheEntry_getAndCreateGame( NULL, path2, "file://", fname, 0, 0 );
     ASSERT_TRUE( NULL != rv2 );
     ASSERT_STREQ( path1, rv2->fname );
     FSCacheEntry_free( rv2 );
@@ -0,0 +1,119 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include <zxdbfs_epoch.h>
+#include <zxdbfs_strpool.h>
+}
+
+TEST(zxdbfs_strpool_tests, test_StringPool_intern) {
+
+    /** Let names retired by earlier tests drain from the pool */
+    Epoch_synchronize();
+
+    ASSERT_TRUE( NULL == StringPool_intern( NULL ) );
+
+    int nentries = StringPool_getnentries();
+
+    const char *s0 = StringPool_intern( "/by-letter/X/Xevious_0005795" );
+    ASSERT_TRUE( NULL != s0 );
+    ASSERT_STREQ( "/by-letter/X/Xevious_0005795", s0 );
+    ASSERT_EQ( nentries + 1, StringPool_getnentries() );
+
+    /** Same string should hand back the same pooled copy */
+    char buf[64];
+    strcpy( buf, "/by-letter/X/Xevious_0005795" );
+    const char *s1 = StringPool_intern( buf );
+    ASSERT_EQ( s0, s1 );
+    ASSERT_EQ( nentries + 1, StringPool_getnentries() );
+
+    const char *s2 = StringPool_intern( "/by-letter/X/Xenon_0005782" );
+    ASSERT_NE( s0, s2 );
+    ASSERT_EQ( nentries + 2, StringPool_getnentries() );
+
+    StringPool_release( s2 );
+    ASSERT_EQ( nentries + 1, StringPool_getnentries() );
+    StringPool_release( s1 );
+    ASSERT_EQ( nentries + 1, StringPool_getnentries() );
+    StringPool_release( s0 );
+    ASSERT_EQ( nentries, StringPool_getnentries() );
+}
+
+TEST(zxdbfs_strpool_tests, test_StringPool_ref) {
+
+    Epoch_synchronize();
+
+    ASSERT_TRUE( NULL == StringPool_ref( NULL ) );
+
+    int nentries = StringPool_getnentries();
+
+    const char *s0 = StringPool_intern( "/search/Hewson" );
+    ASSERT_EQ( s0, StringPool_ref( s0 ) );
+
+    StringPool_release( s0 );
+    ASSERT_EQ( nentries + 1, StringPool_getnentries() );
+    StringPool_release( s0 );
+    ASSERT_EQ( nentries, StringPool_getnentries() );
+}
+
+TEST(zxdbfs_strpool_tests, test_StringPool_adopt) {
+
+    /** Adopted storage must outlive the pool */
+    static union {
+        StringPoolEntry_t entry;
+        char buf[64];
+    } storage;
+
+    ASSERT_TRUE( NULL == StringPool_adopt( NULL ) );
+    strcpy( storage.entry.str, "/search/Adopted" );
+    storage.entry.refcount = 1;
+    ASSERT_TRUE( NULL == StringPool_adopt( &storage.entry ) );
+    storage.entry.refcount = STRPOOL_REFCOUNT_STATIC;
+
+    int nentries = StringPool_getnentries();
+
+    const char *s0 = StringPool_adopt( &storage.entry );
+    ASSERT_EQ( storage.entry.str, s0 );
+    ASSERT_EQ( nentries + 1, StringPool_getnentries() );
+
+    /** Used in place and never counted */
+    ASSERT_EQ( s0, StringPool_intern( "/search/Adopted" ) );
+    ASSERT_EQ( s0, StringPool_ref( s0 ) );
+    StringPool_release( s0 );
+    StringPool_release( s0 );
+    StringPool_release( s0 );
+    ASSERT_EQ( STRPOOL_REFCOUNT_STATIC, storage.entry.refcount );
+    ASSERT_EQ( nentries + 1, StringPool_getnentries() );
+
+    /** Strings already pooled are shared rather than adopted */
+    const char *s1 = StringPool_intern( "/search/Pooled" );
+    static union {
+        StringPoolEntry_t entry;
+        char buf[64];
+    } duplicate;
+    strcpy( duplicate.entry.str, "/search/Pooled" );
+    duplicate.entry.refcount = STRPOOL_REFCOUNT_STATIC;
+    ASSERT_EQ( s1, StringPool_adopt( &duplicate.entry ) );
+    StringPool_release( s1 );
+    StringPool_release( s1 );
+    ASSERT_EQ( nentries + 1, StringPool_getnentries() );
+}
@@ -0,0 +1,256 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include <zxdbfs_urlcache.h>
+}
+
+static void _addKey( URLCache_t *cache, const char *key, size_t nbytes ) {
+
+    json_object *obj = json_object_new_string( key );
+    ASSERT_EQ( 0, URLCache_add( cache, key, obj, nbytes, 0 ) );
+    json_object_put( obj );
+}
+
+static int _isResident( URLCache_t *cache, const char *key ) {
+
+    json_object *obj = URLCache_get( cache, key, NULL );
+    if ( obj == NULL ) {
+        return 0;
+    }
+    json_object_put( obj );
+    return 1;
+}
+
+TEST(zxdbfs_urlcache_tests, test_URLCache_create) {
+
+    URLCache_t *cache = URLCache_create( 0 );
+    ASSERT_TRUE( NULL != cache );
+    ASSERT_EQ( URLCACHE_DEFAULT_MAX_BYTES, cache->maxbytes );
+    ASSERT_EQ( 0, URLCache_getnentries( cache ) );
+    ASSERT_EQ( 0, URLCache_getnbytes( cache ) );
+
+    ASSERT_EQ( 1, URLCache_free( NULL ) );
+    ASSERT_EQ( 0, URLCache_free( cache ) );
+}
+
+TEST(zxdbfs_urlcache_tests, test_URLCache_get) {
+
+    URLCache_t *cache = URLCache_create( 1024 );
+
+    ASSERT_TRUE( NULL == URLCache_get( cache, NULL, NULL ) );
+    ASSERT_EQ( 1, URLCache_add( cache, NULL, NULL, 0, 0 ) );
+
+    ASSERT_TRUE( NULL == URLCache_get( cache, "file:///tmp/a.json", NULL ) );
+    ASSERT_EQ( 1, cache->nmisses );
+
+    _addKey( cache, "file:///tmp/a.json", 100 );
+    ASSERT_EQ( 1, URLCache_getnentries( cache ) );
+    ASSERT_EQ( 100, URLCache_getnbytes( cache ) );
+
+    json_object *obj = URLCache_get( cache, "file:///tmp/a.json", NULL );
+    ASSERT_TRUE( NULL != obj );
+    ASSERT_STREQ( "file:///tmp/a.json", json_object_get_string( obj ) );
+    ASSERT_EQ( 1, cache->nhits );
+
+    /** Caller's reference survives a flush */
+    ASSERT_EQ( 0, URLCache_flush( cache ) );
+    ASSERT_EQ( 0, URLCache_getnentries( cache ) );
+    ASSERT_EQ( 0, URLCache_getnbytes( cache ) );
+    ASSERT_STREQ( "file:///tmp/a.json", json_object_get_string( obj ) );
+    json_object_put( obj );
+
+    /** Oversized responses are not admitted */
+    json_object *big = json_object_new_string( "big" );
+    ASSERT_EQ( 1, URLCache_add( cache, "file:///tmp/big.json", big, 2048, 0 ) );
+    json_object_put( big );
+    ASSERT_EQ( 0, URLCache_getnentries( cache ) );
+
+    ASSERT_EQ( 2, URLCache_delete( cache, "file:///tmp/a.json" ) );
+    _addKey( cache, "file:///tmp/a.json", 100 );
+    ASSERT_EQ( 0, URLCache_delete( cache, "file:///tmp/a.json" ) );
+    ASSERT_EQ( 0, URLCache_getnentries( cache ) );
+
+    URLCache_free( cache );
+}
+
+TEST(zxdbfs_urlcache_tests, test_URLCache_stale) {
+
+    URLCache_t *cache = URLCache_create( 1024 );
+    int stale = -1;
+
+    json_object *obj = json_object_new_string( "a" );
+    ASSERT_EQ( 0, URLCache_add( cache, "file:///tmp/a.json", obj, 100, 60 ) );
+    ASSERT_EQ( 0, URLCache_add( cache, "file:///tmp/b.json", obj, 100, 0 ) );
+    json_object_put( obj );
+
+    obj = URLCache_get( cache, "file:///tmp/a.json", &stale );
+    ASSERT_TRUE( NULL != obj );
+    ASSERT_EQ( 0, stale );
+    json_object_put( obj );
+
+    /** Age both responses past the TTL */
+    URLCacheEntry_t *a = (URLCacheEntry_t *)lh_entry_v( lh_table_lookup_entry( cache->cache, "file:///tmp/a.json" ) );
+    URLCacheEntry_t *b = (URLCacheEntry_t *)lh_entry_v( lh_table_lookup_entry( cache->cache, "file:///tmp/b.json" ) );
+    a->fetched -= 61;
+    b->fetched -= 61;
+
+    /** Stale responses are still handed back */
+    obj = URLCache_get( cache, "file:///tmp/a.json", &stale );
+    ASSERT_TRUE( NULL != obj );
+    ASSERT_EQ( 1, stale );
+    ASSERT_EQ( 1, cache->nstale );
+    json_object_put( obj );
+
+    /** A TTL of 0 never expires */
+    obj = URLCache_get( cache, "file:///tmp/b.json", &stale );
+    ASSERT_EQ( 0, stale );
+    json_object_put( obj );
+
+    /** Replacing a response makes it fresh again */
+    obj = json_object_new_string( "a2" );
+    ASSERT_EQ( 0, URLCache_add( cache, "file:///tmp/a.json", obj, 100, 60 ) );
+    json_object_put( obj );
+    obj = URLCache_get( cache, "file:///tmp/a.json", &stale );
+    ASSERT_EQ( 0, stale );
+    ASSERT_STREQ( "a2", json_object_get_string( obj ) );
+    json_object_put( obj );
+    ASSERT_EQ( 2, URLCache_getnentries( cache ) );
+
+    URLCache_free( cache );
+}
+
+TEST(zxdbfs_urlcache_tests, test_URLCache_validators) {
+
+    URLCache_t *cache = URLCache_create( 1024 );
+    char etag[32];
+    time_t lastmodified = -1;
+    int stale = -1;
+
+    /** Bad parameters */
+    ASSERT_EQ( 1, URLCache_setvalidators( NULL, "file:///tmp/a.json", "\"1\"", 1 ) );
+    ASSERT_EQ( 1, URLCache_getvalidators( cache, "file:///tmp/a.json", NULL, 0, &lastmodified ) );
+    ASSERT_EQ( 1, URLCache_revalidate( cache, NULL ) );
+
+    /** Not resident */
+    ASSERT_EQ( 2, URLCache_setvalidators( cache, "file:///tmp/a.json", "\"1\"", 1 ) );
+    ASSERT_EQ( 2, URLCache_getvalidators( cache, "file:///tmp/a.json", etag, sizeof( etag ), &lastmodified ) );
+    ASSERT_EQ( 2, URLCache_revalidate( cache, "file:///tmp/a.json" ) );
+
+    json_object *obj = json_object_new_string( "a" );
+    ASSERT_EQ( 0, URLCache_add( cache, "file:///tmp/a.json", obj, 100, 60 ) );
+    json_object_put( obj );
+
+    /** None recorded yet */
+    ASSERT_EQ( 0, URLCache_getvalidators( cache, "file:///tmp/a.json", etag, sizeof( etag ), &lastmodified ) );
+    ASSERT_STREQ( "", etag );
+    ASSERT_EQ( 0, lastmodified );
+
+    ASSERT_EQ( 0, URLCache_setvalidators( cache, "file:///tmp/a.json", "\"abc\"", 1000 ) );
+    ASSERT_EQ( 0, URLCache_getvalidators( cache, "file:///tmp/a.json", etag, sizeof( etag ), &lastmodified ) );
+    ASSERT_STREQ( "\"abc\"", etag );
+    ASSERT_EQ( 1000, lastmodified );
+
+    /** ETags that don't fit are left out rather than truncated */
+    char small[4];
+    ASSERT_EQ( 0, URLCache_getvalidators( cache, "file:///tmp/a.json", small, sizeof( small ), &lastmodified ) );
+    ASSERT_STREQ( "", small );
+    ASSERT_EQ( 1000, lastmodified );
+
+    /** Revalidating makes an expired response fresh again */
+    URLCacheEntry_t *a = (URLCacheEntry_t *)lh_entry_v( lh_table_lookup_entry( cache->cache, "file:///tmp/a.json" ) );
+    a->fetched -= 61;
+    ASSERT_EQ( 0, URLCache_revalidate( cache, "file:///tmp/a.json" ) );
+    ASSERT_EQ( 1, cache->nrevalidated );
+    obj = URLCache_get( cache, "file:///tmp/a.json", &stale );
+    ASSERT_EQ( 0, stale );
+    json_object_put( obj );
+
+    /** A new response forgets the old validators */
+    obj = json_object_new_string( "a2" );
+    ASSERT_EQ( 0, URLCache_add( cache, "file:///tmp/a.json", obj, 100, 60 ) );
+    json_object_put( obj );
+    ASSERT_EQ( 0, URLCache_getvalidators( cache, "file:///tmp/a.json", etag, sizeof( etag ), &lastmodified ) );
+    ASSERT_STREQ( "", etag );
+    ASSERT_EQ( 0, lastmodified );
+
+    URLCache_free( cache );
+}
+
+TEST(zxdbfs_urlcache_tests, test_URLCache_budget) {
+
+    URLCache_t *cache = URLCache_create( 1000 );
+    char key[64];
+
+    for ( int i = 0 ; i < 50 ; i++ ) {
+        sprintf( key, "file:///tmp/%d.json", i );
+        _addKey( cache, key, 100 );
+        ASSERT_TRUE( URLCache_getnbytes( cache ) <= 1000 );
+    }
+    ASSERT_EQ( 10, URLCache_getnentries( cache ) );
+    ASSERT_EQ( 40, cache->nevictions );
+
+    ASSERT_EQ( 0, URLCache_setmaxbytes( cache, 500 ) );
+    ASSERT_EQ( 5, URLCache_getnentries( cache ) );
+    ASSERT_EQ( 1, URLCache_setmaxbytes( cache, 0 ) );
+
+    URLCache_free( cache );
+}
+
+TEST(zxdbfs_urlcache_tests, test_URLCache_scan_resistant) {
+
+    URLCache_t *cache = URLCache_create( 1000 );
+    char key[64];
+
+    /** Two passes over a small working set promotes it into Am */
+    for ( int pass = 0 ; pass < 2 ; pass++ ) {
+        for ( int i = 0 ; i < 6 ; i++ ) {
+            sprintf( key, "file:///tmp/hot%d.json", i );
+            if ( !_isResident( cache, key ) ) {
+                _addKey( cache, key, 100 );
+            }
+        }
+        /** Push the hot set out of A1in so it is remembered as ghosts */
+        for ( int i = 0 ; i < 10 && pass == 0 ; i++ ) {
+            sprintf( key, "file:///tmp/warm%d.json", i );
+            _addKey( cache, key, 100 );
+        }
+    }
+    ASSERT_EQ( 6, cache->queues[URLCACHEQUEUE_AM].nentries );
+
+    /** A long one-pass scan must not displace the hot set */
+    for ( int i = 0 ; i < 500 ; i++ ) {
+        sprintf( key, "file:///tmp/scan%d.json", i );
+        _addKey( cache, key, 100 );
+    }
+
+    for ( int i = 0 ; i < 6 ; i++ ) {
+        sprintf( key, "file:///tmp/hot%d.json", i );
+        ASSERT_EQ( 1, _isResident( cache, key ) );
+    }
+    ASSERT_TRUE( URLCache_getnbytes( cache ) <= 1000 );
+
+    /** Ghosts are bounded */
+    ASSERT_TRUE( cache->queues[URLCACHEQUEUE_A1OUT].nentries <= cache->maxghosts );
+
+    URLCache_free( cache );
+}
@@ -0,0 +1,79 @@
+/*
+  Copyright (C) 2021  Alligator Descartes <alligator.descartes@hermitretro.com>
+
+ This file is part of zxdbfs.
+
+     zxdbfs is free software: you can redistribute it and/or modify
+     it under the terms of the GNU General Public License as published by
+     the Free Software Foundation, either version 3 of the License, or
+     (at your option) any later version.
+
+     zxdbfs is distributed in the hope that it will be useful,
+     but WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+     GNU General Public License for more details.
+
+     You should have received a copy of the GNU General Public License
+     along with zxdbfs.  If not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include <zxdbfs_workqueue.h>
+}
+
+static void _increment( void *arg ) {
+
+    __atomic_add_fetch( (int *)arg, 1, __ATOMIC_RELAXED );
+}
+
+TEST(zxdbfs_workqueue_tests, test_WorkQueue_create) {
+
+    ASSERT_TRUE( NULL == WorkQueue_create( -1 ) );
+
+    WorkQueue_t *workqueue = WorkQueue_create( 0 );
+    ASSERT_TRUE( NULL != workqueue );
+    ASSERT_EQ( WORKQUEUE_DEFAULT_NTHREADS, workqueue->nthreads );
+    ASSERT_EQ( 0, WorkQueue_getnpending( workqueue ) );
+
+    ASSERT_EQ( 1, WorkQueue_free( NULL ) );
+    ASSERT_EQ( 0, WorkQueue_free( workqueue ) );
+}
+
+TEST(zxdbfs_workqueue_tests, test_WorkQueue_add) {
+
+    int count = 0;
+
+    WorkQueue_t *workqueue = WorkQueue_create( 4 );
+    ASSERT_TRUE( NULL != workqueue );
+
+    ASSERT_EQ( 1, WorkQueue_add( NULL, _increment, &count ) );
+    ASSERT_EQ( 1, WorkQueue_add( workqueue, NULL, &count ) );
+
+    for ( int i = 0 ; i < 1000 ; i++ ) {
+        ASSERT_EQ( 0, WorkQueue_add( workqueue, _increment, &count ) );
+    }
+    ASSERT_EQ( 0, WorkQueue_wait( workqueue ) );
+    ASSERT_EQ( 1000, count );
+    ASSERT_EQ( 0, WorkQueue_getnpending( workqueue ) );
+
+    ASSERT_EQ( 0, WorkQueue_free( workqueue ) );
+}
+
+TEST(zxdbfs_workqueue_tests, test_WorkQueue_free_drains) {
+
+    int count = 0;
+
+    WorkQueue_t *workqueue = WorkQueue_create( 1 );
+    ASSERT_TRUE( NULL != workqueue );
+
+    for ( int i = 0 ; i < 100 ; i++ ) {
+        ASSERT_EQ( 0, WorkQueue_add( workqueue, _increment, &count ) );
+    }
+
+    /** Queued jobs still run on shutdown */
+    ASSERT_EQ( 0, WorkQueue_free( workqueue ) );
+    ASSERT_EQ( 100, count );
+}